@@ -23,10 +23,34 @@ struct ShadowPayload{
 struct PrimMesh {
     uint64_t indexBuffer;
     uint64_t vertexBuffer;
+    uint64_t attributeBuffer;
     uint32_t materialIndex;
-    //memory alignment 4+8byte
     int32_t useShadow;
-    int64_t padding1;
+    uint32_t useQuantizedVertex;
+    //byte strides of the position and attribute streams
+    uint32_t positionStride;
+    uint32_t attributeStride;
+    //memory alignment 4byte
+    uint32_t padding0;
+    //GeometryParam of the mesh, indexed by gl_GeometryIndexEXT
+    uint64_t geometryBuffer;
+    //memory alignment 4+4byte
+    uint32_t padding1;
+    uint32_t padding2;
+    //pos = snorm * positionScale + positionOffset
+    vec4 positionScale;
+    vec4 positionOffset;
+};
+
+//materialIndex OBJECT_MATERIAL : the geometry uses PrimMesh.materialIndex
+#define OBJECT_MATERIAL     (0xFFFFFFFFu)
+struct GeometryParam {
+    //first index of the geometry in the shared index buffer, in indices of its own type
+    uint32_t firstIndex;
+    uint32_t materialIndex;
+    //added to the stored indices
+    uint32_t baseVertex;
+    uint32_t useShortIndex;
 };
 
 struct Material {
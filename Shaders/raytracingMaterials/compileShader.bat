@@ -2,4 +2,5 @@ C:\VulkanSDK\1.2.189.2\Bin/glslc.exe closesthit.rchit -o closesthit.rchit.spv --
 C:\VulkanSDK\1.2.189.2\Bin/glslc.exe raygen.rgen -o raygen.rgen.spv --target-env=vulkan1.2
 C:\VulkanSDK\1.2.189.2\Bin/glslc.exe miss.rmiss -o miss.rmiss.spv --target-env=vulkan1.2
 C:\VulkanSDK\1.2.189.2\Bin/glslc.exe shadowMiss.rmiss -o shadowMiss.rmiss.spv --target-env=vulkan1.2
+C:\VulkanSDK\1.2.189.2\Bin/glslc.exe instances.comp -o instances.comp.spv --target-env=vulkan1.2
 pause
\ No newline at end of file
@@ -6,18 +6,87 @@ struct Vertex {
 };
 
 layout(buffer_reference, scalar)readonly buffer Indices {uvec3 i[];};
-layout(buffer_reference, buffer_reference_align = 4, scalar)readonly buffer Vertices {Vertex v[];};
+//16bit indices, two per word (the index buffer is padded to 4 bytes)
+layout(buffer_reference, scalar)readonly buffer ShortIndices {uint i[];};
+//position and attribute streams are read as 32bit words
+//float      : pos(3) / normal(3), uv(2), color(4)
+//quantized  : snorm16 pos.xy, pos.z / oct normal, half uv, unorm8 color
+layout(buffer_reference, buffer_reference_align = 4, scalar)readonly buffer Words {uint w[];};
+layout(buffer_reference, scalar)readonly buffer Geometries {GeometryParam g[];};
 
+GeometryParam GetGeometry(PrimMesh primMesh) {
+    Geometries geometries = Geometries(primMesh.geometryBuffer);
+    return geometries.g[gl_GeometryIndexEXT];
+}
 
-Vertex GetVertex(vec3 barycentricCoords, uint64_t indexBuffer, uint64_t vertexBuffer) {
-    
-    Indices indices = Indices(indexBuffer);
-    Vertices vertices = Vertices(vertexBuffer);
 
-    const uvec3 index = indices.i[gl_PrimitiveID];
-    Vertex v0 = vertices.v[index.x];
-    Vertex v1 = vertices.v[index.y];
-    Vertex v2 = vertices.v[index.z];
+//firstIndex is a multiple of 3, gl_PrimitiveID is relative to the geometry
+uvec3 GetIndex(uint64_t indexBuffer, GeometryParam geometry) {
+
+    if (geometry.useShortIndex == 0) {
+        Indices indices = Indices(indexBuffer);
+        return indices.i[geometry.firstIndex / 3 + gl_PrimitiveID] + geometry.baseVertex;
+    }
+
+    ShortIndices indices = ShortIndices(indexBuffer);
+    uvec3 index;
+    for (uint k = 0; k < 3; k++) {
+        uint i = geometry.firstIndex + uint(gl_PrimitiveID) * 3 + k;
+        index[k] = ((indices.i[i >> 1] >> ((i & 1) * 16)) & 0xFFFF) + geometry.baseVertex;
+    }
+    return index;
+}
+
+vec3 OctDecode(vec2 e) {
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+vec3 GetPosition(PrimMesh primMesh, uint index) {
+
+    Words words = Words(primMesh.vertexBuffer);
+    const uint base = index * (primMesh.positionStride >> 2);
+    if (primMesh.useQuantizedVertex == 0) {
+        return uintBitsToFloat(uvec3(words.w[base], words.w[base + 1], words.w[base + 2]));
+    }
+    vec3 pos = vec3(unpackSnorm2x16(words.w[base]), unpackSnorm2x16(words.w[base + 1]).x);
+    return pos * primMesh.positionScale.xyz + primMesh.positionOffset.xyz;
+}
+
+//uv is only fetched for textured materials
+Vertex GetAttributes(PrimMesh primMesh, uint index, bool fetchUV) {
+
+    Words words = Words(primMesh.attributeBuffer);
+    const uint base = index * (primMesh.attributeStride >> 2);
+    Vertex v = Vertex(vec3(0), vec3(0), vec2(0), vec4(0));
+    if (primMesh.useQuantizedVertex == 0) {
+        v.normal = uintBitsToFloat(uvec3(words.w[base], words.w[base + 1], words.w[base + 2]));
+        if (fetchUV) {
+            v.uv = uintBitsToFloat(uvec2(words.w[base + 3], words.w[base + 4]));
+        }
+        v.color = uintBitsToFloat(uvec4(words.w[base + 5], words.w[base + 6], words.w[base + 7], words.w[base + 8]));
+        return v;
+    }
+    v.normal = OctDecode(unpackSnorm2x16(words.w[base]));
+    if (fetchUV) {
+        v.uv = unpackHalf2x16(words.w[base + 1]);
+    }
+    v.color = unpackUnorm4x8(words.w[base + 2]);
+    return v;
+}
+
+Vertex GetVertex(vec3 barycentricCoords, PrimMesh primMesh, GeometryParam geometry, bool fetchUV) {
+    
+    const uvec3 index = GetIndex(primMesh.indexBuffer, geometry);
+    Vertex v0 = GetAttributes(primMesh, index.x, fetchUV);
+    Vertex v1 = GetAttributes(primMesh, index.y, fetchUV);
+    Vertex v2 = GetAttributes(primMesh, index.z, fetchUV);
+    v0.pos = GetPosition(primMesh, index.x);
+    v1.pos = GetPosition(primMesh, index.y);
+    v2.pos = GetPosition(primMesh, index.z);
 
     Vertex v = Vertex(vec3(0), vec3(0), vec2(0), vec4(0));
 
@@ -0,0 +1,152 @@
+#include "accelerationStructureCache.h"
+
+#include <cstring>
+#include <iostream>
+
+#include <extensions_vk.hpp>
+
+#include "cacheFileWriter.h"
+
+namespace {
+
+    uint64_t AlignUp(uint64_t offset) {
+        return (offset + 15) & ~uint64_t(15);
+    }
+
+    //driver UUID, compatibility UUID, serialized size, deserialized size, handle count
+    constexpr size_t SERIALIZED_HEADER_SIZE = 2 * VK_UUID_SIZE + 3 * sizeof(uint64_t);
+}
+
+void AccelerationStructureCache::Open(const std::string& filename, VkPhysicalDevice physicalDevice, VkDevice device) {
+
+    Close();
+    _filename = filename;
+    _device = device;
+
+    VkPhysicalDeviceIDProperties idProperties{};
+    idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+    VkPhysicalDeviceProperties2 deviceProperties{};
+    deviceProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    deviceProperties.pNext = &idProperties;
+    vkGetPhysicalDeviceProperties2(physicalDevice, &deviceProperties);
+    memcpy(_driverUUID, idProperties.driverUUID, VK_UUID_SIZE);
+
+    if (!_file.Open(filename) || _file.GetSize() < sizeof(Header)) {
+        _file.Close();
+        return;
+    }
+    const unsigned char* data = _file.GetData();
+    const size_t fileSize = _file.GetSize();
+
+    Header header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, "VKRTBLS", 8) != 0 ||
+        header.version != VERSION ||
+        memcmp(header.driverUUID, _driverUUID, VK_UUID_SIZE) != 0 ||
+        header.entryCount > (fileSize - sizeof(Header)) / sizeof(Entry)) {
+        _file.Close();
+        return;
+    }
+
+    const Entry* entries = reinterpret_cast<const Entry*>(data + sizeof(Header));
+    for (uint32_t i = 0; i < header.entryCount; i++) {
+        const Entry& entry = entries[i];
+        if (entry.offset > fileSize || entry.size > fileSize - entry.offset || entry.size < SERIALIZED_HEADER_SIZE) {
+            continue;
+        }
+        _entries[entry.key] = entry;
+    }
+}
+
+const unsigned char* AccelerationStructureCache::Find(uint64_t key, size_t& size) {
+
+    auto entry = _entries.find(key);
+    if (entry == _entries.end()) {
+        return nullptr;
+    }
+    const unsigned char* data = _file.GetData() + entry->second.offset;
+
+    //the deserialize copy reads as many bytes as the data claims, a truncated entry must not get that far
+    uint64_t serializedSize = 0;
+    memcpy(&serializedSize, data + 2 * VK_UUID_SIZE, sizeof(uint64_t));
+    if (serializedSize != entry->second.size) {
+        return nullptr;
+    }
+
+    //the same driver can still change its format between versions
+    VkAccelerationStructureVersionInfoKHR versionInfo{};
+    versionInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_VERSION_INFO_KHR;
+    versionInfo.pVersionData = data;
+    VkAccelerationStructureCompatibilityKHR compatibility = VK_ACCELERATION_STRUCTURE_COMPATIBILITY_INCOMPATIBLE_KHR;
+    vkGetDeviceAccelerationStructureCompatibilityKHR(_device, &versionInfo, &compatibility);
+    if (compatibility != VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR) {
+        return nullptr;
+    }
+
+    _used.insert(key);
+    size = static_cast<size_t>(entry->second.size);
+    return data;
+}
+
+void AccelerationStructureCache::Add(uint64_t key, std::vector<unsigned char> data) {
+    _added[key] = std::move(data);
+}
+
+void AccelerationStructureCache::Write() {
+
+    if (_added.empty()) {
+        return;
+    }
+
+    //kept entries are read from the mapping, so it is closed only after the new file is written
+    std::vector<Entry> entries;
+    std::vector<const unsigned char*> sources;
+    uint64_t offset = AlignUp(sizeof(Header) + (_used.size() + _added.size()) * sizeof(Entry));
+    for (uint64_t key : _used) {
+        if (_added.count(key)) {
+            continue;
+        }
+        const Entry& used = _entries[key];
+        entries.push_back({ key, offset, used.size });
+        sources.push_back(_file.GetData() + used.offset);
+        offset = AlignUp(offset + used.size);
+    }
+    for (const auto& added : _added) {
+        entries.push_back({ added.first, offset, added.second.size() });
+        sources.push_back(added.second.data());
+        offset = AlignUp(offset + added.second.size());
+    }
+
+    Header header{};
+    memcpy(header.magic, "VKRTBLS", 8);
+    header.version = VERSION;
+    header.entryCount = static_cast<uint32_t>(entries.size());
+    memcpy(header.driverUUID, _driverUUID, VK_UUID_SIZE);
+
+    //write to a temporary file first so that a broken cache is never picked up
+    CacheFileWriter file(_filename);
+    file.WriteSection(0, &header, sizeof(header));
+    file.WriteSection(sizeof(Header), entries.data(), entries.size() * sizeof(Entry));
+    for (size_t i = 0; i < entries.size(); i++) {
+        file.WriteSection(entries[i].offset, sources[i], static_cast<size_t>(entries[i].size));
+    }
+    if (!file.Finish()) {
+        //the old file and its mapping stay usable
+        std::cerr << "failed to write acceleration structure cache " << _filename << std::endl;
+        return;
+    }
+
+    const std::string filename = _filename;
+    Close();
+    if (!file.Commit()) {
+        std::cerr << "failed to write acceleration structure cache " << filename << std::endl;
+    }
+}
+
+void AccelerationStructureCache::Close() {
+
+    _file.Close();
+    _entries.clear();
+    _used.clear();
+    _added.clear();
+}
\ No newline at end of file
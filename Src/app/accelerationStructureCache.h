@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "mappedFile.h"
+
+/**
+* @brief    シリアライズした加速構造のディスクキャッシュ
+*           キー（メッシュの内容とビルドフラグのハッシュ）ごとにvkCmdCopyAccelerationStructureToMemoryKHRの出力を持つ
+*           ドライバのUUIDが違うファイルは読み込まず、エントリごとにvkGetDeviceAccelerationStructureCompatibilityKHRで確認する
+*/
+class AccelerationStructureCache {
+
+public:
+
+    static constexpr uint32_t VERSION = 1;
+
+    AccelerationStructureCache() = default;
+
+    /**
+    * @brief    コピーコンストラクタの禁止
+    */
+    AccelerationStructureCache(const AccelerationStructureCache&) = delete;
+    AccelerationStructureCache& operator=(const AccelerationStructureCache&) = delete;
+
+    /**
+    * @brief    キャッシュファイルを開く（ファイルがないか無効なら空のキャッシュ）
+    */
+    void Open(const std::string& filename, VkPhysicalDevice physicalDevice, VkDevice device);
+
+    /**
+    * @brief    このデバイスで読み込めるシリアライズデータを探す（なければnullptr）
+    *           データ中のシリアライズサイズがエントリのサイズと違うものは無効として扱う
+    *           Writeまで、またはCloseまで有効
+    */
+    const unsigned char* Find(uint64_t key, size_t& size);
+
+    /**
+    * @brief    シリアライズデータを追加する（Writeで書き出す）
+    */
+    void Add(uint64_t key, std::vector<unsigned char> data);
+
+    /**
+    * @brief    見つかったエントリと追加したエントリでファイルを書き直す
+    */
+    void Write();
+
+    /**
+    * @brief    ファイルを閉じる
+    */
+    void Close();
+
+private:
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t entryCount;
+        uint8_t driverUUID[VK_UUID_SIZE];
+    };
+
+    //the table follows the header, the data of each entry is aligned to 16 bytes
+    struct Entry {
+        uint64_t key;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    std::string _filename;
+    VkDevice _device = VK_NULL_HANDLE;
+    uint8_t _driverUUID[VK_UUID_SIZE] = {};
+    MappedFile _file;
+    std::unordered_map<uint64_t, Entry> _entries;
+    //entries of _file that were found, the others are dropped by Write
+    std::unordered_set<uint64_t> _used;
+    std::unordered_map<uint64_t, std::vector<unsigned char>> _added;
+};
\ No newline at end of file
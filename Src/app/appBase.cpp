@@ -31,37 +31,42 @@ namespace glTF {
         VkQueue queue;
 
         /**
-        * @brief    C[W̍쐬
+        * @brief    イメージの作成
         */
-        void CreateImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
+        void CreateImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, vk::Image& image);
 
         /**
-        * @brief    obt@C[WɃRs[
+        * @brief    バッファをイメージにコピーする
         */
-        void CopyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
+        void CopyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize bufferOffset, VkImage image, uint32_t width, uint32_t height);
 
         /**
-        * @brief    C[W̏
+        * @brief    イメージの準備
         */
         void PrepareImage(void* buffer, VkDeviceSize bufferSize, VkFormat format, uint32_t texWidth, uint32_t texHeight);
 
         /**
-        * @brief    C[Wr[쐬
+        * @brief    イメージビューを作成する
         */
         void CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels);
 
         /**
-        * @brief    C[W̓ǂݍ
+        * @brief    イメージの読み込み
         */
         void LoadglTFImages(tinygltf::Image& gltfImage);
 
         /**
-        * @brief    
+        * @brief    RGBAピクセルからイメージを作成する
+        */
+        void LoadFromPixels(void* buffer, VkDeviceSize bufferSize, uint32_t width, uint32_t height);
+
+        /**
+        * @brief    初期化
         */
         void Connect(VulkanDevice* device, VkQueue transQueue);
 
         /**
-        * @brief    \[X̔j
+        * @brief    リソースの破棄
         */
         void Destroy();
     };
@@ -115,7 +120,84 @@ namespace glTF {
         PreTransformVertices = 0x00000001,
         PreMultiplyVertexColors = 0x00000002,
         FlipY = 0x00000004,
-        DontLoadImages = 0x00000008
+        DontLoadImages = 0x00000008,
+        DeferImageDecoding = 0x00000010,
+        PreferShortIndices = 0x00000020,
+        UseSceneCache = 0x00000040,
+        OptimizeMeshes = 0x00000080,
+        QuantizeVertices = 0x00000100,
+        SplitPositionStream = 0x00000200,
+        InstanceMeshes = 0x00000400,
+        KeepHostGeometry = 0x00000800
+    };
+
+    /*
+    * binary scene cache (<glTF file>.cache)
+    * header, vertices, attributes, indices, nodes, primitives, materials, encoded images, each section aligned to 16 bytes
+    */
+    const uint32_t SCENE_CACHE_VERSION = 6;
+    const uint32_t SCENE_CACHE_FLAG_MASK = FileLoadingFlags::PreTransformVertices | FileLoadingFlags::PreMultiplyVertexColors | FileLoadingFlags::FlipY | FileLoadingFlags::DontLoadImages | FileLoadingFlags::PreferShortIndices | FileLoadingFlags::OptimizeMeshes | FileLoadingFlags::QuantizeVertices | FileLoadingFlags::SplitPositionStream | FileLoadingFlags::InstanceMeshes;
+
+    struct SceneCacheHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t fileLoadingFlags;
+        uint64_t sourceHash;
+        uint32_t vertexStride;
+        uint32_t attributeStride;
+        uint32_t vertexCount;
+        uint32_t indexCount;
+        uint32_t nodeCount;
+        uint32_t primitiveCount;
+        uint32_t materialCount;
+        uint32_t imageCount;
+        float positionScale[3];
+        float positionOffset[3];
+        uint64_t vertexOffset;
+        uint64_t vertexSize;
+        uint64_t attributeOffset;
+        uint64_t attributeSize;
+        uint64_t indexOffset;
+        uint64_t indexSize;
+        uint64_t nodeOffset;
+        uint64_t primitiveOffset;
+        uint64_t materialOffset;
+        uint64_t imageOffset;
+    };
+
+    struct SceneCacheNode {
+        float matrix[16];
+        float translation[3];
+        float scale[3];
+        float rotation[4];
+        int32_t parent;
+        int32_t hasMesh;
+        int32_t meshIndex;
+        uint32_t firstPrimitive;
+        uint32_t primitiveCount;
+    };
+
+    struct SceneCachePrimitive {
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        uint32_t firstVertex;
+        uint32_t vertexCount;
+        uint32_t material;
+    };
+
+    struct SceneCacheMaterial {
+        float baseColorFactor[4];
+        float roughnessFactor;
+        float metallicFactor;
+        float alphaCutoff;
+        int32_t alphaMode;
+        //baseColor, metallicRoughness, normal, occlusion, emissive (-1 : none)
+        int32_t textures[5];
+    };
+
+    struct SceneCacheImage {
+        uint64_t offset;
+        uint64_t size;
     };
 
     struct Material {
@@ -144,6 +226,10 @@ namespace glTF {
         uint32_t indexCount = 0;
         uint32_t firstVertex = 0;
         uint32_t vertexCount = 0;
+        //layout in the uploaded index buffer, set by UploadGeometry (the indices are stored relative to baseVertex)
+        VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+        VkDeviceSize indexOffset = 0;
+        uint32_t baseVertex = 0;
         Material& material;
 
         Primitive(uint32_t firstIndex, uint32_t indexCount, Material& material);
@@ -152,6 +238,8 @@ namespace glTF {
     struct Mesh {
         std::vector<Primitive*> primitives;
         std::string name;
+        //index of the source tinygltf mesh, InstanceMeshes shares the primitives between nodes with the same index
+        int32_t index = -1;
 
         vk::Buffer uniformBuffer;
         struct UniformBlock {
@@ -178,17 +266,17 @@ namespace glTF {
         glm::quat rotation{};
         
         /**
-        * @brief   [JW̎擾
+        * @brief   ローカル座標の取得
         */
         glm::mat4 localMatrix();
 
         /**
-        * @brief   W̎擾
+        * @brief   座標の取得
         */
         glm::mat4 getMatrix();
         
         /**
-        * @brief    jtH[obt@̍XV
+        * @brief    ユニフォームバッファの更新
         */
         void UpdateUniformBuffer(glm::mat4 projection, glm::mat4 view);
 
@@ -207,101 +295,224 @@ namespace glTF {
         ~Model() {};
 
         /**
-        * @brief    Rs[RXgN^̋֎~
+        * @brief    コピーコンストラクタの禁止
         */
         Model(const Model&);
         Model& operator=(const Model&);
 
+        struct BufferSource {
+            const unsigned char* data = nullptr;
+            size_t size = 0;
+        };
+
+        //LoadImagesDeferred timings in milliseconds
+        struct ImageLoadStats {
+            struct Image {
+                double decodeTime = 0.0;
+                double uploadTime = 0.0;
+            };
+            std::vector<Image> images;
+            //decode times run in parallel, so their sum is more than the wall clock time
+            double decodeTime = 0.0;
+            double uploadTime = 0.0;
+            double totalTime = 0.0;
+        };
+
+        //OptimizeMeshes totals over all primitives
+        struct MeshOptimizationStats {
+            meshOptimizer::MeshStats before;
+            meshOptimizer::MeshStats after;
+        };
 
         void LoadImages(tinygltf::Model& gltfModel);
 
         /**
-        * @brief    eNX`擾
+        * @brief    ワーカースレッドでデコードしながらイメージをアップロードする
+        */
+        void LoadImagesDeferred(const std::vector<BufferSource>& encodedImages);
+
+        /**
+        * @brief    tinygltfのイメージ読み込みコールバック（デコードせずに保持する）
+        */
+        static bool LoadImageDataCallback(tinygltf::Image* image, const int imageIndex, std::string* error, std::string* warning, int reqWidth, int reqHeight, const unsigned char* bytes, int size, void* userData);
+
+        /**
+        * @brief    テクスチャを取得する
         */
         Texture* GetTexture(uint32_t index);
         
         /**
-        * @brief    }eA[h
+        * @brief    マテリアルをロードする
         */
         void LoadMaterials(tinygltf::Model& input);
 
 
         void LoadNode(const tinygltf::Node& inputNode, const tinygltf::Model& input, Node* parent, std::vector<uint32_t>& indexBuffer, std::vector<Vertex>& vertexBuffer);
+
+        /**
+        * @brief    アクセサが指すデータの先頭アドレスを取得する
+        *           bufferViewを持たないアクセサや、要素がbufferView・バッファの範囲外にはみ出すアクセサは例外を投げる
+        */
+        const unsigned char* GetAccessorData(const tinygltf::Model& input, const tinygltf::Accessor& accessor) const;
+
+        /**
+        * @brief    アクセサをストライド付きの入力アトリビュートに変換する
+        */
+        vertexConverter::AttributeStream GetAttributeStream(const tinygltf::Model& input, const tinygltf::Accessor& accessor) const;
+
+        /**
+        * @brief    glTF/GLBファイルをメモリマップして解析する
+        */
+        bool ParseFile(tinygltf::TinyGLTF& context, tinygltf::Model& model, const std::string& filename, std::string* error, std::string* warning);
         
         /**
-        * @brief    obt@쐬̃tOw肷
+        * @brief    バッファ作成時のメモリフラグを指定する
         */
         void SetMemoryPropertyFlags(VkMemoryPropertyFlags memoryFlags);
 
         /**
-        * @brief    fBXNv^v[̍쐬
+        * @brief    ディスクリプタプールの作成
         */
         void CreateDescriptorPool();
 
         /**
-        * @brief    fBXNv^CAEg̍쐬
+        * @brief    ディスクリプタレイアウトの作成
         */
         void CreateDescriptorSetLayout();
 
         /**
-        * @brief    m[h̃fBXNv^CAEg̍쐬
+        * @brief    ノードのディスクリプタレイアウトの作成
         */
         void CreateNodeDescriptorSets(Node* node);
 
         /**
-        * @brief    fBXNv^Zbg쐬
+        * @brief    ディスクリプタセットを作成する
         */
         void CreateDescriptorSets();
 
         /**
-        * @brief    fBXNv^֘A̍쐬
+        * @brief    ディスクリプタ関連の作成
         */
         void CreateDescriptors();
 
         /**
-        * @brief    glTFt@Cǂݍ
+        * @brief    glTFファイルを読み込む
         */
         void LoadFromFile(std::string filename, uint32_t fileLoadingFlags);
 
         /**
-        * @brief    
+        * @brief    glTFファイルと、参照している外部バッファ・画像ファイルのハッシュを求める（シーンキャッシュの検証用）
+        *           外部ファイルは読み込まず、サイズと更新日時で判定する
+        */
+        uint64_t HashSourceFiles(const std::string& filename) const;
+
+        /**
+        * @brief    シーンキャッシュから読み込む（キャッシュが無効ならfalse）
+        */
+        bool LoadFromCache(const std::string& cacheFilename, uint64_t sourceHash);
+
+        /**
+        * @brief    シーンキャッシュを書き出す（インデックスは32bitのまま保存する）
+        */
+        void WriteCache(const std::string& cacheFilename, uint64_t sourceHash, const void* vertexData, uint32_t vertexCount, const void* attributeData, const uint32_t* indices, uint32_t indexCount);
+
+        /**
+        * @brief    プリミティブごとに頂点の結合、三角形と頂点の並べ替えを行う
+        */
+        void OptimizeMeshes(std::vector<Vertex>& vertexBuffer, std::vector<uint32_t>& indexBuffer);
+
+        /**
+        * @brief    読み込みフラグから頂点バッファのレイアウトを決める
+        */
+        void SetVertexLayout(uint32_t fileLoadingFlags);
+
+        /**
+        * @brief    頂点、アトリビュート、インデックスバッファをデバイスに転送する
+        *           インデックスはプリミティブごとに自身の先頭頂点からの相対値にして、頂点数が16bitに収まるものはステージング領域へ直接詰めて書き込む
+        */
+        void UploadGeometry(const void* vertexData, uint32_t vertexCount, const void* attributeData, const uint32_t* indices, uint32_t indexCount);
+
+        /**
+        * @brief    初期化
         */
         void Connect(VulkanDevice* device);
 
         /**
-        * @brief    m[h`
+        * @brief    ノード描画
         */
         void DrawNode(VkCommandBuffer& commandBuffer, VkPipelineLayout& pipelineLayout, Node* node, uint32_t renderFlags, uint32_t bindImageSet = 1);
 
         /**
-        * @brief    f`
+        * @brief    モデル描画
         */
         void Draw(VkCommandBuffer& commandBuffer, VkPipelineLayout& pipelineLayout, uint32_t renderFlags, uint32_t bindImageSet);
 
         /**
-        * @brief    č\
+        * @brief    再構成
         */
         void Recreate();
 
         /**
-        * @brief    Xbv`F[č쐬
+        * @brief    スワップチェーン再作成時
         */
         void Cleanup();
 
         /**
-        * @brief    j
+        * @brief    破棄
         */
         void Destroy();
 
         /**
-        * @brief    CX^X̎擾
+        * @brief    自インスタンスの取得
         */
         static Model* GetglTF();
 
+        /**
+        * @brief    親より先に子が並んだノードの一覧を取得する
+        */
+        const std::vector<Node*>& GetLinearNodes() const {
+            return _linearNodes;
+        }
+
+        /**
+        * @brief    マテリアルの一覧を取得する
+        */
+        const std::vector<Material>& GetMaterials() const {
+            return _materials;
+        }
+
+        /**
+        * @brief    イメージごとのデコードとアップロードにかかった時間を取得する（DeferImageDecoding時のみ）
+        */
+        const ImageLoadStats& GetImageLoadStats() const {
+            return _imageLoadStats;
+        }
+
+        /**
+        * @brief    最適化前後のメッシュの統計情報を取得する（OptimizeMeshesでキャッシュを使わなかった時のみ）
+        */
+        const MeshOptimizationStats& GetMeshOptimizationStats() const {
+            return _meshOptimizationStats;
+        }
+
 
         VkMemoryPropertyFlags memoryPropertyFlags;
         vk::Buffer _vertices;
+        //index type and offset vary per primitive, see Primitive::indexType
         vk::Buffer _indices;
+        //QuantizeVertices : vertexConverter::QuantizedVertex, VK_FORMAT_R16G16B16A16_SNORM
+        uint32_t _vertexStride = sizeof(Vertex);
+        VkFormat _vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+        vertexConverter::PositionQuantization _positionQuantization;
+        //SplitPositionStream : _vertices only holds the positions, normal/uv/color are in _attributes
+        vk::Buffer _attributes;
+        uint32_t _attributeStride = 0;
+        //hash of the data in _vertices and _indices
+        uint64_t _geometryHash = 0;
+        //KeepHostGeometry : copies of the data in _vertices, _indices and _attributes
+        std::shared_ptr<const std::vector<unsigned char>> _hostVertices;
+        std::shared_ptr<const std::vector<unsigned char>> _hostIndices;
+        std::shared_ptr<const std::vector<unsigned char>> _hostAttributes;
 
     private:
         std::vector<Node*> _nodes;
@@ -314,20 +525,67 @@ namespace glTF {
         uint32_t _mipLevel;
         VkDescriptorPool _descriptorPool;
 
+        uint32_t _fileLoadingFlags = FileLoadingFlags::None;
+        //encoded image files kept for DeferImageDecoding
+        std::vector<std::vector<unsigned char>> _encodedImages;
+        ImageLoadStats _imageLoadStats;
+        MeshOptimizationStats _meshOptimizationStats;
+
+        //.glb/.bin files stay mapped while the model is being loaded
+        std::vector<std::unique_ptr<MappedFile>> _mappedFiles;
+        std::vector<BufferSource> _bufferSources;
+        std::vector<BufferSource> _imageSources;
+
+        //InstanceMeshes : first mesh loaded for each tinygltf mesh index
+        std::unordered_map<int, Mesh*> _loadedMeshes;
+
     };
 
 }
 
 namespace {
-    //VOg
+    //シングルトン
     glTF::Model* s_model = nullptr;
 
+    //decodes the same file as Create2DTexture for the CPU ray tracer
+    cpuRayTracer::Image LoadHostImage(const wchar_t* fileName, bool srgb) {
+
+        std::vector<char> binImage;
+        std::ifstream infile(fileName, std::ios::binary);
+        if (!infile) {
+            throw std::runtime_error("failed to find images!");
+        }
+
+        binImage.resize(infile.seekg(0, std::ifstream::end).tellg());
+        infile.seekg(0, std::ifstream::beg).read(binImage.data(), binImage.size());
+
+        int width, height;
+        stbi_uc* pixels = stbi_load_from_memory(
+            reinterpret_cast<const stbi_uc*>(binImage.data()),
+            int(binImage.size()),
+            &width,
+            &height,
+            nullptr,
+            4
+        );
+        if (!pixels) {
+            throw std::runtime_error("failed to decode images!");
+        }
+
+        cpuRayTracer::Image image;
+        image.width = uint32_t(width);
+        image.height = uint32_t(height);
+        image.srgb = srgb;
+        image.pixels.assign(pixels, pixels + size_t(width) * height * 4);
+        stbi_image_free(pixels);
+        return image;
+    }
 }
 
 /*******************************************************************************************************************
 *                                             glTF Texture
 ********************************************************************************************************************/
-void glTF::Texture::CreateImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) {
+void glTF::Texture::CreateImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, vk::Image& image) {
     VkImageCreateInfo imageInfo{};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
     imageInfo.imageType = VK_IMAGE_TYPE_2D;
@@ -346,28 +604,16 @@ void glTF::Texture::CreateImage(uint32_t width, uint32_t height, uint32_t mipLev
         imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
     }
 
-    if (vkCreateImage(vulkanDevice->_device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
+    if (vkCreateImage(vulkanDevice->_device, &imageInfo, nullptr, &image.image) != VK_SUCCESS) {
         throw std::runtime_error("failed to create image!");
     }
 
-    VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(vulkanDevice->_device, image, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = vulkanDevice->FindMemoryType(memRequirements.memoryTypeBits, properties);
-
-    if (vkAllocateMemory(vulkanDevice->_device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate image memory!");
-    }
-
-    vkBindImageMemory(vulkanDevice->_device, image, imageMemory, 0);
+    vulkanDevice->AllocateImageMemory(image, properties, vk::MemoryCategory::Texture);
 }
 
-void glTF::Texture::CopyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
+void glTF::Texture::CopyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkDeviceSize bufferOffset, VkImage image, uint32_t width, uint32_t height) {
     VkBufferImageCopy region{};
-    region.bufferOffset = 0;
+    region.bufferOffset = bufferOffset;
     region.bufferRowLength = 0;
     region.bufferImageHeight = 0;
     region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -388,24 +634,16 @@ void glTF::Texture::PrepareImage(void* buffer, VkDeviceSize bufferSize, VkFormat
 
     mipLevel = 1;
 
-    vk::Buffer stagingBuffer;
-    stagingBuffer = vulkanDevice->CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-    void* data;
-    vkMapMemory(vulkanDevice->_device, stagingBuffer.memory, 0, VK_WHOLE_SIZE, 0, &data);
-    memcpy(data, buffer, bufferSize);
-    vkUnmapMemory(vulkanDevice->_device, stagingBuffer.memory);
+    StagingRing::Region staging = vulkanDevice->_uploadQueue.Allocate(bufferSize);
+    memcpy(staging.data, buffer, bufferSize);
     
-    CreateImage(texWidth, texHeight, mipLevel, format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage.image, textureImage.memory);
+    CreateImage(texWidth, texHeight, mipLevel, format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage);
 
-    auto commandBuffer = vulkanDevice->BeginCommand();  
+    //recorded into the upload batch, submitted together with the other uploads
+    auto commandBuffer = vulkanDevice->_uploadQueue.GetCommandBuffer();
     textureImage.SetImageLayout(commandBuffer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevel);
-    CopyBufferToImage(commandBuffer, stagingBuffer.buffer, textureImage.image, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-    textureImage.SetImageLayout(commandBuffer, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevel);
-    vulkanDevice->FlushCommandBuffer(commandBuffer, queue);
-
-    vkDestroyBuffer(vulkanDevice->_device, stagingBuffer.buffer, nullptr);
-    vkFreeMemory(vulkanDevice->_device, stagingBuffer.memory, nullptr);
+    CopyBufferToImage(commandBuffer, staging.buffer, staging.offset, textureImage.image, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+    vulkanDevice->_uploadQueue.ReleaseImage(textureImage, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevel);
 }
 
 void glTF::Texture::CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels) {
@@ -431,7 +669,7 @@ void glTF::Texture::LoadglTFImages(tinygltf::Image& gltfImage) {
     VkDeviceSize bufferSize = 0;
     bool deleteBuffer = false;
 
-    //RGB̏ꍇARGBAɂĂ
+    //RGBの場合、RGBAにしておく
     if (gltfImage.component == 3) {
         bufferSize = gltfImage.width * gltfImage.height * 4;
         buffer = new unsigned char[bufferSize];
@@ -450,15 +688,20 @@ void glTF::Texture::LoadglTFImages(tinygltf::Image& gltfImage) {
     }
 
 
-    PrepareImage(buffer, bufferSize, IMAGE_FORMAT, gltfImage.width, gltfImage.height);
-    CreateImageView(textureImage.image, IMAGE_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, mipLevel);
-    textureImage.sampler = vulkanDevice->CreateSampler();
+    LoadFromPixels(buffer, bufferSize, gltfImage.width, gltfImage.height);
 
     if (deleteBuffer) {
         delete[] buffer;
     }
 }
 
+void glTF::Texture::LoadFromPixels(void* buffer, VkDeviceSize bufferSize, uint32_t width, uint32_t height) {
+
+    PrepareImage(buffer, bufferSize, IMAGE_FORMAT, width, height);
+    CreateImageView(textureImage.image, IMAGE_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, mipLevel);
+    textureImage.sampler = vulkanDevice->CreateSampler();
+}
+
 void glTF::Texture::Connect(VulkanDevice* device, VkQueue transQueue) {
 
     vulkanDevice = device;
@@ -545,14 +788,14 @@ glTF::Mesh::Mesh(VulkanDevice* device, glm::mat4 matrix) {
     uniformBuffer = vulkanDevice->CreateBuffer(
         sizeof(uniformBlock),
         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        vk::MemoryCategory::Uniform
     );
-    vkMapMemory(vulkanDevice->_device, uniformBuffer.memory, 0, sizeof(uniformBlock), 0, &uniformBuffer.mapped);
+    uniformBuffer.mapped = uniformBuffer.Map(vulkanDevice->_device);
 }
 
 glTF::Mesh::~Mesh() {
-    vkDestroyBuffer(vulkanDevice->_device, uniformBuffer.buffer, nullptr);
-    vkFreeMemory(vulkanDevice->_device, uniformBuffer.memory, nullptr);
+    uniformBuffer.Destroy(vulkanDevice->_device);
 }
 
 /*******************************************************************************************************************
@@ -601,6 +844,19 @@ glTF::Model::Model() {
 }
 
 void glTF::Model::LoadImages(tinygltf::Model& input) {
+
+    if (_fileLoadingFlags & FileLoadingFlags::DontLoadImages) {
+        return;
+    }
+    if (_fileLoadingFlags & FileLoadingFlags::DeferImageDecoding) {
+        std::vector<BufferSource> encodedImages(input.images.size());
+        for (size_t i = 0; i < encodedImages.size() && i < _encodedImages.size(); i++) {
+            encodedImages[i] = { _encodedImages[i].data(), _encodedImages[i].size() };
+        }
+        LoadImagesDeferred(encodedImages);
+        return;
+    }
+
     for (tinygltf::Image& image : input.images) {
         Texture texture;
         texture.Connect(_vulkanDevice, _vulkanDevice->_queue);
@@ -609,6 +865,96 @@ void glTF::Model::LoadImages(tinygltf::Model& input) {
     }
 }
 
+void glTF::Model::LoadImagesDeferred(const std::vector<BufferSource>& encodedImages) {
+
+    struct DecodedImage {
+        stbi_uc* pixels = nullptr;
+        int width = 0;
+        int height = 0;
+        double decodeTime = 0.0;
+    };
+
+    auto tStart = std::chrono::high_resolution_clock::now();
+    const size_t imageCount = encodedImages.size();
+    _imageLoadStats = ImageLoadStats();
+    _imageLoadStats.images.resize(imageCount);
+
+    //decode on worker threads, always expanded to RGBA
+    ThreadPool threadPool;
+    std::vector<std::future<DecodedImage>> decodedImages;
+    decodedImages.reserve(imageCount);
+    for (size_t i = 0; i < imageCount; i++) {
+        decodedImages.push_back(threadPool.Submit([&encodedImages, i]() {
+            DecodedImage decoded;
+            const BufferSource& encoded = encodedImages[i];
+            if (encoded.size > 0) {
+                auto tDecodeStart = std::chrono::high_resolution_clock::now();
+                decoded.pixels = stbi_load_from_memory(encoded.data, static_cast<int>(encoded.size), &decoded.width, &decoded.height, nullptr, 4);
+                auto tDecodeEnd = std::chrono::high_resolution_clock::now();
+                decoded.decodeTime = std::chrono::duration<double, std::milli>(tDecodeEnd - tDecodeStart).count();
+            }
+            return decoded;
+        }));
+    }
+
+    //upload in order while the remaining images are still decoding
+    for (size_t i = 0; i < imageCount; i++) {
+        DecodedImage decoded = decodedImages[i].get();
+        if (decoded.pixels == nullptr) {
+            throw std::runtime_error("failed to decode glTF image!");
+        }
+
+        Texture texture;
+        texture.Connect(_vulkanDevice, _vulkanDevice->_queue);
+        VkDeviceSize bufferSize = VkDeviceSize(decoded.width) * decoded.height * 4;
+        auto tUploadStart = std::chrono::high_resolution_clock::now();
+        texture.LoadFromPixels(decoded.pixels, bufferSize, decoded.width, decoded.height);
+        auto tUploadEnd = std::chrono::high_resolution_clock::now();
+        _textures.push_back(texture);
+        stbi_image_free(decoded.pixels);
+
+        ImageLoadStats::Image& stats = _imageLoadStats.images[i];
+        stats.decodeTime = decoded.decodeTime;
+        stats.uploadTime = std::chrono::duration<double, std::milli>(tUploadEnd - tUploadStart).count();
+        _imageLoadStats.decodeTime += stats.decodeTime;
+        _imageLoadStats.uploadTime += stats.uploadTime;
+    }
+
+    auto tEnd = std::chrono::high_resolution_clock::now();
+    _imageLoadStats.totalTime = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+}
+
+bool glTF::Model::LoadImageDataCallback(tinygltf::Image* image, const int imageIndex, std::string* error, std::string* warning, int reqWidth, int reqHeight, const unsigned char* bytes, int size, void* userData) {
+
+    Model* model = static_cast<Model*>(userData);
+    if (model->_fileLoadingFlags & FileLoadingFlags::DontLoadImages) {
+        return true;
+    }
+
+    //image stored in a mapped bufferView
+    if (size_t(imageIndex) < model->_imageSources.size() && model->_imageSources[imageIndex].data) {
+        bytes = model->_imageSources[imageIndex].data;
+        size = static_cast<int>(model->_imageSources[imageIndex].size);
+    }
+
+    if (!(model->_fileLoadingFlags & FileLoadingFlags::DeferImageDecoding)) {
+        return tinygltf::LoadImageData(image, imageIndex, error, warning, reqWidth, reqHeight, bytes, size, nullptr);
+    }
+
+    //keep the encoded file, decoding happens in LoadImagesDeferred
+    if (model->_encodedImages.size() <= size_t(imageIndex)) {
+        model->_encodedImages.resize(size_t(imageIndex) + 1);
+    }
+    model->_encodedImages[imageIndex].assign(bytes, bytes + size);
+
+    int component = 0;
+    stbi_info_from_memory(bytes, size, &image->width, &image->height, &component);
+    image->component = 4;
+    image->bits = 8;
+    image->pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+    return true;
+}
+
 glTF::Texture* glTF::Model::GetTexture(uint32_t index) {
     if (index < _textures.size()) {
         return &_textures[index];
@@ -669,7 +1015,7 @@ void glTF::Model::LoadNode(const tinygltf::Node& inputNode, const tinygltf::Mode
     newNode->matrix = glm::mat4(1.0f);
     newNode->name = newNode->name;
 
-    //4~4 matrix
+    //4×4 matrix
     if (inputNode.matrix.size() == 16) {
         newNode->matrix = glm::make_mat4x4(inputNode.matrix.data());
     }
@@ -693,119 +1039,80 @@ void glTF::Model::LoadNode(const tinygltf::Node& inputNode, const tinygltf::Mode
         const tinygltf::Mesh mesh = input.meshes[inputNode.mesh];
         Mesh* newMesh = new Mesh(_vulkanDevice, newNode->matrix);
         newMesh->name = mesh.name;
+        newMesh->index = inputNode.mesh;
 
-        for (size_t i = 0; i < mesh.primitives.size(); i++) {
-            const tinygltf::Primitive& primitive = mesh.primitives[i];
-
-            if (primitive.indices < 0) {
-                continue;
-            }
-            uint32_t vertexStart = static_cast<uint32_t>(vertexBuffer.size());
-            uint32_t indexStart = static_cast<uint32_t> (indexBuffer.size());
-            uint32_t indexCount = 0;
-            uint32_t vertexCount = 0;
-            
-            //vertices
-            {    
-                const float* positionBuffer = nullptr;
-                const float* normalsBuffer = nullptr;
-                const float* texCoordsBuffer = nullptr;
-                const float* colorBuffer = nullptr;
-                uint32_t numColorComponent;
-
-                if (primitive.attributes.find("POSITION") != primitive.attributes.end()) {
-                    const tinygltf::Accessor& accessor = input.accessors[primitive.attributes.find("POSITION")->second];
-                    const tinygltf::BufferView& view = input.bufferViews[accessor.bufferView];
-                    positionBuffer = reinterpret_cast<const float*> (&(input.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]));
-                    vertexCount = static_cast<uint32_t>(accessor.count);
-                }
-
-                if (primitive.attributes.find("NORMAL") != primitive.attributes.end()) {
-                    const tinygltf::Accessor& accessor = input.accessors[primitive.attributes.find("NORMAL")->second];
-                    const tinygltf::BufferView& view = input.bufferViews[accessor.bufferView];
-                    normalsBuffer = reinterpret_cast<const float*>(&(input.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]));
-                }
-
-                if (primitive.attributes.find("TEXCOORD_0") != primitive.attributes.end()) {
-                    const tinygltf::Accessor& accessor = input.accessors[primitive.attributes.find("TEXCOORD_0")->second];
-                    const tinygltf::BufferView& view = input.bufferViews[accessor.bufferView];
-                    texCoordsBuffer = reinterpret_cast<const float*> (&(input.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]));
-                }
+        //nodes that place an already loaded mesh only reference its primitives
+        auto loaded = _loadedMeshes.find(inputNode.mesh);
+        if ((_fileLoadingFlags & FileLoadingFlags::InstanceMeshes) && loaded != _loadedMeshes.end()) {
+            newMesh->primitives = loaded->second->primitives;
+        }
+        else {
+            for (size_t i = 0; i < mesh.primitives.size(); i++) {
+                const tinygltf::Primitive& primitive = mesh.primitives[i];
 
-                if (primitive.attributes.find("COLOR_0") != primitive.attributes.end()) {
-                    const tinygltf::Accessor& accessor = input.accessors[primitive.attributes.find("COLOR_0")->second];
-                    const tinygltf::BufferView& view = input.bufferViews[accessor.bufferView];
-                    colorBuffer = reinterpret_cast<const float*> (&(input.buffers[view.buffer].data[accessor.byteOffset + view.byteOffset]));
-                    numColorComponent = accessor.type == TINYGLTF_PARAMETER_TYPE_FLOAT_VEC3 ? 3 : 4;
+                if (primitive.indices < 0) {
+                    continue;
                 }
-
-                for (size_t v = 0; v < vertexCount; v++) {
-                    Vertex vert{};
-                    vert.pos = glm::vec4(glm::make_vec3(&positionBuffer[v * 3]), 1.0f);
-                    vert.normal = glm::normalize(glm::vec3(normalsBuffer ? glm::make_vec3(&normalsBuffer[v * 3]) : glm::vec3(0.0f)));
-                    vert.uv = texCoordsBuffer ? glm::make_vec2(&texCoordsBuffer[v * 2]) : glm::vec3(0.0f);
-                    if (colorBuffer) {
-                        switch (numColorComponent) {
-                        case 3:
-                            vert.color = glm::vec4(glm::make_vec3(&colorBuffer[v * 3]), 1.0f);
-                        case 4:
-                            vert.color = glm::make_vec4(&colorBuffer[v * 4]);
+                uint32_t vertexStart = static_cast<uint32_t>(vertexBuffer.size());
+                uint32_t indexStart = static_cast<uint32_t> (indexBuffer.size());
+                uint32_t indexCount = 0;
+                uint32_t vertexCount = 0;
+            
+                //vertices
+                {
+                    const char* attributeNames[4] = { "POSITION", "NORMAL", "TEXCOORD_0", "COLOR_0" };
+                    vertexConverter::AttributeBinding bindings[4];
+
+                    bindings[0].dstOffset = offsetof(Vertex, pos);
+                    bindings[0].dstComponentCount = 3;
+
+                    bindings[1].dstOffset = offsetof(Vertex, normal);
+                    bindings[1].dstComponentCount = 3;
+                    bindings[1].normalizeVec3 = true;
+
+                    bindings[2].dstOffset = offsetof(Vertex, uv);
+                    bindings[2].dstComponentCount = 2;
+
+                    //vec3 colors get alpha 1.0, missing colors become white
+                    bindings[3].dstOffset = offsetof(Vertex, color);
+                    bindings[3].dstComponentCount = 4;
+                    std::fill(std::begin(bindings[3].fillValue), std::end(bindings[3].fillValue), 1.0f);
+
+                    for (uint32_t attributeIndex = 0; attributeIndex < 4; attributeIndex++) {
+                        auto attribute = primitive.attributes.find(attributeNames[attributeIndex]);
+                        if (attribute == primitive.attributes.end()) {
+                            continue;
+                        }
+                        const tinygltf::Accessor& accessor = input.accessors[attribute->second];
+                        bindings[attributeIndex].stream = GetAttributeStream(input, accessor);
+                        if (attributeIndex == 0) {
+                            vertexCount = static_cast<uint32_t>(accessor.count);
                         }
                     }
-                    else {
-                        vert.color = glm::vec4(1.0f);
-                    }
-                    vertexBuffer.push_back(vert);
+
+                    vertexBuffer.resize(vertexStart + vertexCount);
+                    vertexConverter::ConvertVertices(bindings, 4, vertexCount, vertexBuffer.data() + vertexStart, sizeof(Vertex));
                 }
-            }
-            
 
-            //indices
-            {
-                const tinygltf::Accessor& accessor = input.accessors[primitive.indices];
-                const tinygltf::BufferView& bufferView = input.bufferViews[accessor.bufferView];
-                const tinygltf::Buffer& buffer = input.buffers[bufferView.buffer];
+                //indices
+                {
+                    const tinygltf::Accessor& accessor = input.accessors[primitive.indices];
+                    const unsigned char* indexData = GetAccessorData(input, accessor);
 
-                indexCount = static_cast<uint32_t>(accessor.count);
+                    indexCount = static_cast<uint32_t>(accessor.count);
 
-                switch (accessor.componentType) {
-                case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT: {
-                    uint32_t* buf = new uint32_t[accessor.count];
-                    memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(uint32_t));
-                    for (size_t index = 0; index < accessor.count; index++) {
-                        indexBuffer.push_back(buf[index] + vertexStart);
-                    }
-                    break;
-                }
-                case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT: {
-                    uint16_t* buf = new uint16_t[accessor.count];
-                    memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(uint16_t));
-                    for (size_t index = 0; index < accessor.count; index++) {
-                        indexBuffer.push_back(buf[index] + vertexStart);
-                    }
-                    break;
-                }
-                case TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE: {
-                    uint8_t* buf = new uint8_t[accessor.count];
-                    memcpy(buf, &buffer.data[accessor.byteOffset + bufferView.byteOffset], accessor.count * sizeof(uint8_t));
-                    for (size_t index = 0; index < accessor.count; index++) {
-                        indexBuffer.push_back(buf[index] + vertexStart);
-                    }
-                    break;
-                }
-                default:
-                    std::cerr << "Index conponent type" << accessor.componentType << "not supported!" << std::endl;
-                    return;
+                    indexBuffer.resize(indexStart + indexCount);
+                    vertexConverter::ConvertIndices(indexData, accessor.componentType, indexCount, vertexStart, indexBuffer.data() + indexStart);
                 }
+
+                Primitive* newPrimitive = new Primitive(indexStart, indexCount, primitive.material > -1 ? _materials[primitive.material] : _materials.back());
+                newPrimitive->firstVertex = vertexStart;
+                newPrimitive->vertexCount = vertexCount;
+                newPrimitive->firstIndex = indexStart;
+                newPrimitive->indexCount = indexCount;
+                newMesh->primitives.push_back(newPrimitive);
             }
-            
-            
-            Primitive* newPrimitive = new Primitive(indexStart, indexCount, primitive.material > -1 ? _materials[primitive.material] : _materials.back());
-            newPrimitive->firstVertex = vertexStart;
-            newPrimitive->vertexCount = vertexCount;
-            newPrimitive->firstIndex = indexStart;
-            newPrimitive->indexCount = indexCount;
-            newMesh->primitives.push_back(newPrimitive);
+            _loadedMeshes.emplace(inputNode.mesh, newMesh);
         }
         newNode->mesh = newMesh;
     }
@@ -818,6 +1125,200 @@ void glTF::Model::LoadNode(const tinygltf::Node& inputNode, const tinygltf::Mode
     _linearNodes.push_back(newNode);
 }
 
+const unsigned char* glTF::Model::GetAccessorData(const tinygltf::Model& input, const tinygltf::Accessor& accessor) const {
+
+    //accessors without a bufferView (zero filled / sparse only) are not supported
+    if (accessor.bufferView < 0 || size_t(accessor.bufferView) >= input.bufferViews.size()) {
+        throw std::runtime_error("glTF accessor has no bufferView!");
+    }
+    const tinygltf::BufferView& view = input.bufferViews[accessor.bufferView];
+    if (view.buffer < 0 || size_t(view.buffer) >= _bufferSources.size()) {
+        throw std::runtime_error("glTF bufferView has no buffer!");
+    }
+    const BufferSource& source = _bufferSources[view.buffer];
+
+    const int byteStride = accessor.ByteStride(view);
+    const int componentSize = tinygltf::GetComponentSizeInBytes(static_cast<uint32_t>(accessor.componentType));
+    const int componentCount = tinygltf::GetNumComponentsInType(static_cast<uint32_t>(accessor.type));
+    if (byteStride <= 0 || componentSize <= 0 || componentCount <= 0) {
+        throw std::runtime_error("invalid glTF accessor type!");
+    }
+
+    //the last element ends at byteOffset + (count - 1) * stride + elementSize
+    const size_t elementSize = size_t(componentSize) * size_t(componentCount);
+    const size_t extent = accessor.count > 0 ? (accessor.count - 1) * size_t(byteStride) + elementSize : 0;
+    if (accessor.byteOffset + extent > view.byteLength || view.byteOffset + view.byteLength > source.size) {
+        throw std::runtime_error("glTF accessor is out of buffer range!");
+    }
+    return source.data + view.byteOffset + accessor.byteOffset;
+}
+
+vertexConverter::AttributeStream glTF::Model::GetAttributeStream(const tinygltf::Model& input, const tinygltf::Accessor& accessor) const {
+
+    vertexConverter::AttributeStream stream;
+    if (accessor.bufferView < 0) {
+        return stream;
+    }
+
+    int byteStride = accessor.ByteStride(input.bufferViews[accessor.bufferView]);
+    if (byteStride <= 0) {
+        throw std::runtime_error("invalid glTF accessor stride!");
+    }
+    stream.data = GetAccessorData(input, accessor);
+    stream.byteStride = static_cast<size_t>(byteStride);
+    stream.componentType = accessor.componentType;
+    stream.componentCount = static_cast<uint32_t>(tinygltf::GetNumComponentsInType(static_cast<uint32_t>(accessor.type)));
+    stream.normalized = accessor.normalized;
+    return stream;
+}
+
+namespace {
+
+    std::string DecodeURI(const std::string& uri) {
+        std::string decoded;
+        for (size_t i = 0; i < uri.size(); i++) {
+            if (uri[i] == '%' && i + 2 < uri.size()) {
+                decoded += static_cast<char>(std::stoi(uri.substr(i + 1, 2), nullptr, 16));
+                i += 2;
+            }
+            else {
+                decoded += uri[i];
+            }
+        }
+        return decoded;
+    }
+}
+
+bool glTF::Model::ParseFile(tinygltf::TinyGLTF& context, tinygltf::Model& model, const std::string& filename, std::string* error, std::string* warning) {
+
+    auto mapFile = [this](const std::string& path) -> MappedFile* {
+        std::unique_ptr<MappedFile> file = std::make_unique<MappedFile>();
+        if (!file->Open(path)) {
+            return nullptr;
+        }
+        _mappedFiles.push_back(std::move(file));
+        return _mappedFiles.back().get();
+    };
+
+    MappedFile* file = mapFile(filename);
+    if (file == nullptr) {
+        return false;
+    }
+
+    std::string baseDir;
+    size_t separator = filename.find_last_of("/\\");
+    if (separator != std::string::npos) {
+        baseDir = filename.substr(0, separator + 1);
+    }
+
+    //GLB: 12 byte header, then a JSON chunk and an optional BIN chunk
+    const unsigned char* jsonData = file->GetData();
+    size_t jsonSize = file->GetSize();
+    BufferSource binChunk;
+    if (file->GetSize() >= 20 && memcmp(file->GetData(), "glTF", 4) == 0) {
+        const unsigned char* data = file->GetData();
+        uint32_t chunkLength, chunkType;
+        memcpy(&chunkLength, data + 12, sizeof(uint32_t));
+        memcpy(&chunkType, data + 16, sizeof(uint32_t));
+        if (chunkType != 0x4E4F534A || 20 + size_t(chunkLength) > file->GetSize()) {
+            if (error) {
+                (*error) += "invalid GLB JSON chunk\n";
+            }
+            return false;
+        }
+        jsonData = data + 20;
+        jsonSize = chunkLength;
+
+        size_t binOffset = 20 + size_t(chunkLength);
+        if (binOffset + 8 <= file->GetSize()) {
+            memcpy(&chunkLength, data + binOffset, sizeof(uint32_t));
+            memcpy(&chunkType, data + binOffset + 4, sizeof(uint32_t));
+            if (chunkType == 0x004E4942 && binOffset + 8 + chunkLength <= file->GetSize()) {
+                binChunk.data = data + binOffset + 8;
+                binChunk.size = chunkLength;
+            }
+        }
+    }
+
+    nlohmann::json document = nlohmann::json::parse(jsonData, jsonData + jsonSize, nullptr, false);
+    if (document.is_discarded()) {
+        if (error) {
+            (*error) += "failed to parse glTF JSON\n";
+        }
+        return false;
+    }
+
+    //mapped buffers are replaced with a 1 byte placeholder, so tinygltf never copies them
+    const std::string placeholderURI = "data:application/octet-stream;base64,AA==";
+    nlohmann::json& buffers = document["buffers"];
+    _bufferSources.assign(buffers.is_array() ? buffers.size() : 0, BufferSource{});
+    for (size_t i = 0; i < _bufferSources.size(); i++) {
+        nlohmann::json& buffer = buffers[i];
+        if (buffer.find("uri") != buffer.end()) {
+            const std::string uri = buffer["uri"].get<std::string>();
+            if (tinygltf::IsDataURI(uri)) {
+                continue;
+            }
+            MappedFile* binFile = mapFile(baseDir + DecodeURI(uri));
+            if (binFile == nullptr) {
+                if (error) {
+                    (*error) += "failed to map glTF buffer: " + uri + "\n";
+                }
+                return false;
+            }
+            _bufferSources[i] = { binFile->GetData(), binFile->GetSize() };
+        }
+        else {
+            _bufferSources[i] = binChunk;
+        }
+        if (buffer.value("byteLength", size_t(0)) > _bufferSources[i].size) {
+            if (error) {
+                (*error) += "glTF buffer is smaller than byteLength\n";
+            }
+            return false;
+        }
+        buffer["uri"] = placeholderURI;
+        buffer["byteLength"] = 1;
+    }
+
+    //images stored in a mapped bufferView are passed to the image loader directly
+    nlohmann::json& images = document["images"];
+    _imageSources.assign(images.is_array() ? images.size() : 0, BufferSource{});
+    for (size_t i = 0; i < _imageSources.size(); i++) {
+        nlohmann::json& image = images[i];
+        if (image.find("bufferView") == image.end()) {
+            continue;
+        }
+        const nlohmann::json& view = document["bufferViews"][image["bufferView"].get<size_t>()];
+        const BufferSource& source = _bufferSources[view["buffer"].get<size_t>()];
+        if (source.data == nullptr) {
+            continue;
+        }
+        size_t offset = view.value("byteOffset", size_t(0));
+        size_t length = view["byteLength"].get<size_t>();
+        if (offset + length > source.size) {
+            continue;
+        }
+        _imageSources[i] = { source.data + offset, length };
+        image.erase("bufferView");
+        image["uri"] = placeholderURI;
+    }
+
+    const std::string json = document.dump();
+    document = nlohmann::json();
+    if (!context.LoadASCIIFromString(&model, error, warning, json.c_str(), static_cast<unsigned int>(json.size()), baseDir)) {
+        return false;
+    }
+
+    //embedded base64 buffers are decoded by tinygltf
+    for (size_t i = 0; i < _bufferSources.size(); i++) {
+        if (_bufferSources[i].data == nullptr) {
+            _bufferSources[i] = { model.buffers[i].data.data(), model.buffers[i].data.size() };
+        }
+    }
+    return true;
+}
+
 void glTF::Model::SetMemoryPropertyFlags(VkMemoryPropertyFlags memoryFlags) {
     memoryPropertyFlags = memoryFlags;
 }
@@ -972,7 +1473,24 @@ void glTF::Model::LoadFromFile(std::string filename, uint32_t fileLoadingFlags)
     tinygltf::TinyGLTF gltfContext;
     std::string error, warning;
 
-    bool fileLoaded = gltfContext.LoadASCIIFromFile(&glTFInput, &error, &warning, filename);
+    _fileLoadingFlags = fileLoadingFlags;
+    SetVertexLayout(fileLoadingFlags);
+
+    const std::string cacheFilename = filename + ".cache";
+    uint64_t sourceHash = 0;
+    if (fileLoadingFlags & FileLoadingFlags::UseSceneCache) {
+        sourceHash = HashSourceFiles(filename);
+        if (LoadFromCache(cacheFilename, sourceHash)) {
+            CreateDescriptors();
+            return;
+        }
+        //keep the encoded images so that they can be written to the cache
+        _fileLoadingFlags |= FileLoadingFlags::DeferImageDecoding;
+    }
+
+    gltfContext.SetImageLoader(LoadImageDataCallback, this);
+
+    bool fileLoaded = ParseFile(gltfContext, glTFInput, filename, &error, &warning);
 
     std::vector<uint32_t> indexBuffer;
     std::vector<Vertex> vertexBuffer;
@@ -982,12 +1500,46 @@ void glTF::Model::LoadFromFile(std::string filename, uint32_t fileLoadingFlags)
         LoadMaterials(glTFInput);
 
         const tinygltf::Scene& scene = glTFInput.scenes[0];
+
+        //reserve once for every node that LoadNode will visit
+        size_t vertexTotal = 0;
+        size_t indexTotal = 0;
+        std::vector<bool> meshCounted(glTFInput.meshes.size(), false);
+        std::function<void(int)> countNode = [&](int nodeIndex) {
+            const tinygltf::Node& node = glTFInput.nodes[nodeIndex];
+            for (int child : node.children) {
+                countNode(child);
+            }
+            if (node.mesh < 0) {
+                return;
+            }
+            if (fileLoadingFlags & FileLoadingFlags::InstanceMeshes) {
+                if (meshCounted[node.mesh]) {
+                    return;
+                }
+                meshCounted[node.mesh] = true;
+            }
+            for (const tinygltf::Primitive& primitive : glTFInput.meshes[node.mesh].primitives) {
+                auto position = primitive.attributes.find("POSITION");
+                if (primitive.indices < 0 || position == primitive.attributes.end()) {
+                    continue;
+                }
+                vertexTotal += glTFInput.accessors[position->second].count;
+                indexTotal += glTFInput.accessors[primitive.indices].count;
+            }
+        };
+        for (int nodeIndex : scene.nodes) {
+            countNode(nodeIndex);
+        }
+        vertexBuffer.reserve(vertexTotal);
+        indexBuffer.reserve(indexTotal);
+
         for (size_t i = 0; i < scene.nodes.size(); i++) {
             const tinygltf::Node node = glTFInput.nodes[scene.nodes[i]];
             LoadNode(node, glTFInput, nullptr, indexBuffer, vertexBuffer);
         }
         if (glTFInput.animations.size() > 0) {
-            //ŃAj[Vǂݍ
+            //ここでアニメーションを読み込む
         }
     }
     else {
@@ -995,15 +1547,21 @@ void glTF::Model::LoadFromFile(std::string filename, uint32_t fileLoadingFlags)
     }
 
     
-    if (fileLoadingFlags & FileLoadingFlags::PreTransformVertices || fileLoadingFlags & FileLoadingFlags::PreMultiplyVertexColors || fileLoadingFlags & FileLoadingFlags::FlipY) {
+    //instanced meshes stay in mesh space, the node matrices become instance transforms
+    const bool preTransform = (fileLoadingFlags & FileLoadingFlags::PreTransformVertices) && !(fileLoadingFlags & FileLoadingFlags::InstanceMeshes);
+    if (preTransform || fileLoadingFlags & FileLoadingFlags::PreMultiplyVertexColors || fileLoadingFlags & FileLoadingFlags::FlipY) {
+        std::unordered_set<const Primitive*> visited;
         for (Node* node : _linearNodes) {
             if (node->mesh) {
                 const glm::mat4 localMatrix = node->getMatrix();
                 for (Primitive* primitive : node->mesh->primitives) {
+                    if (!visited.insert(primitive).second) {
+                        continue;
+                    }
                     for (uint32_t i = 0; i < primitive->vertexCount; i++) {
                         Vertex& vertex = vertexBuffer[primitive->firstVertex + i];
 
-                        if (fileLoadingFlags & FileLoadingFlags::PreTransformVertices) {
+                        if (preTransform) {
                             vertex.pos = glm::vec3(localMatrix * glm::vec4(vertex.pos, 1.0f));
                             vertex.normal = glm::normalize(glm::mat3(localMatrix) * vertex.normal);
                         }
@@ -1022,60 +1580,597 @@ void glTF::Model::LoadFromFile(std::string filename, uint32_t fileLoadingFlags)
 
 
 
-    //vertex buffer
-    VkDeviceSize vertexBufferSize = vertexBuffer.size() * sizeof(Vertex);
+    if (fileLoadingFlags & FileLoadingFlags::OptimizeMeshes) {
+        OptimizeMeshes(vertexBuffer, indexBuffer);
+    }
+
+    //vertex buffer
+    const void* vertexData = vertexBuffer.data();
+    size_t interleavedStride = sizeof(Vertex);
+    std::vector<vertexConverter::QuantizedVertex> quantizedVertexBuffer;
+    _positionQuantization = vertexConverter::PositionQuantization();
+    if (fileLoadingFlags & FileLoadingFlags::QuantizeVertices) {
+        //one dequantization transform for the whole model, it becomes the BLAS geometry transform
+        _positionQuantization = vertexConverter::ComputePositionQuantization(vertexBuffer.data(), vertexBuffer.size(), sizeof(Vertex));
+        quantizedVertexBuffer.resize(vertexBuffer.size());
+        vertexConverter::QuantizeVertices(vertexBuffer.data(), vertexBuffer.size(), sizeof(Vertex), _positionQuantization, quantizedVertexBuffer.data());
+        vertexData = quantizedVertexBuffer.data();
+        interleavedStride = sizeof(vertexConverter::QuantizedVertex);
+    }
+
+    //positions and shading attributes in separate streams
+    const void* attributeData = nullptr;
+    std::vector<unsigned char> positionStream;
+    std::vector<unsigned char> attributeStream;
+    if (fileLoadingFlags & FileLoadingFlags::SplitPositionStream) {
+        positionStream.resize(vertexBuffer.size() * _vertexStride);
+        attributeStream.resize(vertexBuffer.size() * _attributeStride);
+        vertexConverter::SplitVertices(vertexData, vertexBuffer.size(), interleavedStride, _vertexStride, positionStream.data(), attributeStream.data());
+        vertexData = positionStream.data();
+        attributeData = attributeStream.data();
+    }
+
+    UploadGeometry(vertexData, static_cast<uint32_t>(vertexBuffer.size()), attributeData, indexBuffer.data(), static_cast<uint32_t>(indexBuffer.size()));
+
+    if (fileLoadingFlags & FileLoadingFlags::UseSceneCache) {
+        WriteCache(cacheFilename, sourceHash, vertexData, static_cast<uint32_t>(vertexBuffer.size()), attributeData, indexBuffer.data(), static_cast<uint32_t>(indexBuffer.size()));
+    }
+
+    //everything is on the GPU now, release the mapped files
+    _loadedMeshes.clear();
+    _bufferSources.clear();
+    _imageSources.clear();
+    _mappedFiles.clear();
+    _encodedImages.clear();
+
+    CreateDescriptors();
+}
+
+void glTF::Model::OptimizeMeshes(std::vector<Vertex>& vertexBuffer, std::vector<uint32_t>& indexBuffer) {
+
+    struct OptimizedPrimitive {
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+        MeshOptimizationStats stats;
+    };
+
+    //instanced meshes share their primitives, each one is optimized once
+    std::vector<Primitive*> primitives;
+    std::unordered_set<const Primitive*> visited;
+    for (Node* node : _linearNodes) {
+        if (node->mesh) {
+            for (Primitive* primitive : node->mesh->primitives) {
+                if (visited.insert(primitive).second) {
+                    primitives.push_back(primitive);
+                }
+            }
+        }
+    }
+
+    ThreadPool threadPool;
+    std::vector<std::future<OptimizedPrimitive>> results;
+    results.reserve(primitives.size());
+    for (Primitive* primitive : primitives) {
+        results.push_back(threadPool.Submit([primitive, &vertexBuffer, &indexBuffer]() {
+            OptimizedPrimitive result;
+            const Vertex* vertices = vertexBuffer.data() + primitive->firstVertex;
+            result.indices.assign(indexBuffer.begin() + primitive->firstIndex, indexBuffer.begin() + primitive->firstIndex + primitive->indexCount);
+
+            for (uint32_t& index : result.indices) {
+                index -= primitive->firstVertex;
+                if (index >= primitive->vertexCount) {
+                    //index outside of the primitive's own vertices, leave it untouched
+                    const uint32_t* original = indexBuffer.data() + primitive->firstIndex;
+                    result.stats.before = meshOptimizer::AnalyzeMesh(original, primitive->indexCount, vertexBuffer.size(), sizeof(Vertex));
+                    result.stats.before.vertexCount = primitive->vertexCount;
+                    result.stats.before.vertexBytes = size_t(primitive->vertexCount) * sizeof(Vertex);
+                    result.stats.after = result.stats.before;
+                    result.vertices.assign(vertices, vertices + primitive->vertexCount);
+                    result.indices.assign(original, original + primitive->indexCount);
+                    for (uint32_t& rebased : result.indices) {
+                        rebased -= primitive->firstVertex;
+                    }
+                    return result;
+                }
+            }
+            result.stats.before = meshOptimizer::AnalyzeMesh(result.indices.data(), result.indices.size(), primitive->vertexCount, sizeof(Vertex));
+
+            //weld bit-identical vertices
+            std::vector<uint32_t> remap;
+            size_t uniqueCount = meshOptimizer::WeldVertices(vertices, primitive->vertexCount, sizeof(Vertex), remap);
+            std::vector<Vertex> welded(uniqueCount);
+            meshOptimizer::RemapVertices(welded.data(), vertices, primitive->vertexCount, sizeof(Vertex), remap);
+            meshOptimizer::RemapIndices(result.indices.data(), result.indices.size(), remap);
+
+            //triangle order for the post-transform cache, then vertex order for fetch locality
+            meshOptimizer::OptimizeTriangleOrder(result.indices.data(), result.indices.size(), uniqueCount);
+            size_t usedCount = meshOptimizer::BuildFetchRemap(result.indices.data(), result.indices.size(), uniqueCount, remap);
+            result.vertices.resize(usedCount);
+            meshOptimizer::RemapVertices(result.vertices.data(), welded.data(), uniqueCount, sizeof(Vertex), remap);
+            meshOptimizer::RemapIndices(result.indices.data(), result.indices.size(), remap);
+            result.stats.after = meshOptimizer::AnalyzeMesh(result.indices.data(), result.indices.size(), usedCount, sizeof(Vertex));
+            return result;
+        }));
+    }
+
+    std::vector<Vertex> optimizedVertices;
+    std::vector<uint32_t> optimizedIndices;
+    optimizedVertices.reserve(vertexBuffer.size());
+    optimizedIndices.reserve(indexBuffer.size());
+    _meshOptimizationStats = MeshOptimizationStats();
+    for (size_t i = 0; i < primitives.size(); i++) {
+        OptimizedPrimitive result = results[i].get();
+        meshOptimizer::AccumulateMeshStats(_meshOptimizationStats.before, result.stats.before);
+        meshOptimizer::AccumulateMeshStats(_meshOptimizationStats.after, result.stats.after);
+        Primitive* primitive = primitives[i];
+        primitive->firstVertex = static_cast<uint32_t>(optimizedVertices.size());
+        primitive->vertexCount = static_cast<uint32_t>(result.vertices.size());
+        primitive->firstIndex = static_cast<uint32_t>(optimizedIndices.size());
+        primitive->indexCount = static_cast<uint32_t>(result.indices.size());
+
+        optimizedVertices.insert(optimizedVertices.end(), result.vertices.begin(), result.vertices.end());
+        for (uint32_t index : result.indices) {
+            optimizedIndices.push_back(index + primitive->firstVertex);
+        }
+    }
+    vertexBuffer.swap(optimizedVertices);
+    indexBuffer.swap(optimizedIndices);
+}
+
+void glTF::Model::SetVertexLayout(uint32_t fileLoadingFlags) {
+
+    const bool quantize = (fileLoadingFlags & FileLoadingFlags::QuantizeVertices) != 0;
+    const uint32_t interleavedStride = quantize ? sizeof(vertexConverter::QuantizedVertex) : sizeof(Vertex);
+    const uint32_t positionSize = quantize ? sizeof(vertexConverter::QuantizedVertex::pos) : sizeof(Vertex::pos);
+
+    _vertexFormat = quantize ? VK_FORMAT_R16G16B16A16_SNORM : VK_FORMAT_R32G32B32_SFLOAT;
+    if (fileLoadingFlags & FileLoadingFlags::SplitPositionStream) {
+        _vertexStride = positionSize;
+        _attributeStride = interleavedStride - positionSize;
+    }
+    else {
+        _vertexStride = interleavedStride;
+        _attributeStride = 0;
+    }
+}
+
+void glTF::Model::UploadGeometry(const void* vertexData, uint32_t vertexCount, const void* attributeData, const uint32_t* indices, uint32_t indexCount) {
+
+    auto createBuffer = [this](VkDeviceSize size, VkBufferUsageFlags usage) {
+        return _vulkanDevice->CreateBuffer(
+            size,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage | memoryPropertyFlags,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            vk::MemoryCategory::Geometry
+        );
+    };
+    auto upload = [this, &createBuffer](const void* src, VkDeviceSize size, VkBufferUsageFlags usage) {
+        vk::Buffer buffer = createBuffer(size, usage);
+        _vulkanDevice->_uploadQueue.CopyBuffer(buffer.buffer, src, size);
+        return buffer;
+    };
+
+    //one range of the index buffer per primitive, primitives sharing their indices share the range
+    struct IndexRange {
+        uint64_t offset;
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        uint32_t baseVertex;
+        uint32_t indexType;
+    };
+    std::vector<IndexRange> indexRanges;
+    std::unordered_map<uint32_t, size_t> rangeIndices;
+    VkDeviceSize indexBufferSize = 0;
+    for (Node* node : _linearNodes) {
+        if (!node->mesh) {
+            continue;
+        }
+        for (Primitive* primitive : node->mesh->primitives) {
+            auto found = rangeIndices.find(primitive->firstIndex);
+            if (found == rangeIndices.end()) {
+                IndexRange range{};
+                range.offset = indexBufferSize;
+                range.firstIndex = primitive->firstIndex;
+                range.indexCount = primitive->indexCount;
+
+                //indices outside of the primitive's own vertices stay absolute and 32 bit
+                bool local = primitive->indexCount > 0;
+                for (uint32_t i = 0; i < primitive->indexCount && local; i++) {
+                    const uint32_t index = indices[primitive->firstIndex + i];
+                    local = index >= primitive->firstVertex && index - primitive->firstVertex < primitive->vertexCount;
+                }
+                range.baseVertex = local ? primitive->firstVertex : 0;
+                const bool shortIndices = local && (_fileLoadingFlags & FileLoadingFlags::PreferShortIndices) && primitive->vertexCount <= std::numeric_limits<uint16_t>::max();
+                range.indexType = static_cast<uint32_t>(shortIndices ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32);
+
+                //ranges start on 4 bytes, shaders read the indices as 32 bit words
+                const VkDeviceSize indexSize = shortIndices ? sizeof(uint16_t) : sizeof(uint32_t);
+                indexBufferSize = (indexBufferSize + VkDeviceSize(range.indexCount) * indexSize + 3) & ~VkDeviceSize(3);
+                found = rangeIndices.emplace(primitive->firstIndex, indexRanges.size()).first;
+                indexRanges.push_back(range);
+            }
+            const IndexRange& range = indexRanges[found->second];
+            primitive->indexType = static_cast<VkIndexType>(range.indexType);
+            primitive->indexOffset = range.offset;
+            primitive->baseVertex = range.baseVertex;
+        }
+    }
+
+    //writes any 4 byte aligned part of the index buffer, 16 bit ranges are narrowed on the way
+    auto writeIndices = [&indexRanges, indices](void* dst, VkDeviceSize offset, VkDeviceSize size) {
+        unsigned char* bytes = static_cast<unsigned char*>(dst);
+        const VkDeviceSize end = offset + size;
+        VkDeviceSize written = offset;
+        auto range = std::upper_bound(indexRanges.begin(), indexRanges.end(), offset, [](VkDeviceSize value, const IndexRange& r) {
+            return value < r.offset;
+        });
+        if (range != indexRanges.begin()) {
+            --range;
+        }
+        for (; range != indexRanges.end() && range->offset < end; ++range) {
+            const bool shortIndices = range->indexType == VK_INDEX_TYPE_UINT16;
+            const VkDeviceSize indexSize = shortIndices ? sizeof(uint16_t) : sizeof(uint32_t);
+            const VkDeviceSize first = std::max(offset, range->offset);
+            const VkDeviceSize last = std::min(end, range->offset + VkDeviceSize(range->indexCount) * indexSize);
+            if (first >= last) {
+                continue;
+            }
+            memset(bytes + (written - offset), 0, static_cast<size_t>(first - written));
+            const uint32_t* src = indices + range->firstIndex + static_cast<size_t>((first - range->offset) / indexSize);
+            const size_t count = static_cast<size_t>((last - first) / indexSize);
+            if (shortIndices) {
+                vertexConverter::NarrowIndices(src, count, range->baseVertex, reinterpret_cast<uint16_t*>(bytes + (first - offset)));
+            }
+            else {
+                uint32_t* rebased = reinterpret_cast<uint32_t*>(bytes + (first - offset));
+                for (size_t i = 0; i < count; i++) {
+                    rebased[i] = src[i] - range->baseVertex;
+                }
+            }
+            written = last;
+        }
+        memset(bytes + (written - offset), 0, static_cast<size_t>(end - written));
+    };
+
+    //the attributes do not affect the BLAS, the index layout does
+    _geometryHash = utils::HashBytes(vertexData, size_t(vertexCount) * _vertexStride);
+    _geometryHash = utils::HashBytes(indices, size_t(indexCount) * sizeof(uint32_t), _geometryHash);
+    _geometryHash = utils::HashBytes(indexRanges.data(), indexRanges.size() * sizeof(IndexRange), _geometryHash);
+
+    //vertex buffer
+    _vertices = upload(vertexData, VkDeviceSize(vertexCount) * _vertexStride, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+    _vertices.count = vertexCount;
+
+    //attribute buffer
+    if (_attributeStride > 0) {
+        _attributes = upload(attributeData, VkDeviceSize(vertexCount) * _attributeStride, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+        _attributes.count = vertexCount;
+    }
+
+    //index buffer, the indices are rebased and narrowed straight into the staging memory
+    _indices = createBuffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+    _vulkanDevice->_uploadQueue.WriteBuffer(_indices.buffer, indexBufferSize, writeIndices);
+    _indices.count = indexCount;
+
+    if (_fileLoadingFlags & FileLoadingFlags::KeepHostGeometry) {
+        const unsigned char* vertexBytes = static_cast<const unsigned char*>(vertexData);
+        _hostVertices = std::make_shared<std::vector<unsigned char>>(vertexBytes, vertexBytes + size_t(vertexCount) * _vertexStride);
+        auto hostIndices = std::make_shared<std::vector<unsigned char>>(static_cast<size_t>(indexBufferSize));
+        writeIndices(hostIndices->data(), 0, indexBufferSize);
+        _hostIndices = hostIndices;
+        if (_attributeStride > 0) {
+            const unsigned char* attributeBytes = static_cast<const unsigned char*>(attributeData);
+            _hostAttributes = std::make_shared<std::vector<unsigned char>>(attributeBytes, attributeBytes + size_t(vertexCount) * _attributeStride);
+        }
+    }
+}
+
+uint64_t glTF::Model::HashSourceFiles(const std::string& filename) const {
+
+    MappedFile source;
+    if (!source.Open(filename)) {
+        throw std::runtime_error("failed to find glTF file!");
+    }
+    uint64_t hash = utils::HashBytes(source.GetData(), source.GetSize(), SCENE_CACHE_VERSION);
+
+    //GLB: the JSON chunk follows the 12 byte header
+    const unsigned char* jsonData = source.GetData();
+    size_t jsonSize = source.GetSize();
+    if (jsonSize >= 20 && memcmp(jsonData, "glTF", 4) == 0) {
+        uint32_t chunkLength;
+        memcpy(&chunkLength, jsonData + 12, sizeof(uint32_t));
+        jsonSize = std::min(size_t(chunkLength), jsonSize - 20);
+        jsonData += 20;
+    }
+    nlohmann::json document = nlohmann::json::parse(jsonData, jsonData + jsonSize, nullptr, false);
+    if (document.is_discarded()) {
+        return hash;
+    }
 
-    vk::Buffer vertexStaging;
-    vertexStaging = _vulkanDevice->CreateBuffer(
-        vertexBufferSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-    );
+    std::string baseDir;
+    size_t separator = filename.find_last_of("/\\");
+    if (separator != std::string::npos) {
+        baseDir = filename.substr(0, separator + 1);
+    }
 
-    void* data;
-    vkMapMemory(_vulkanDevice->_device, vertexStaging.memory, 0, VK_WHOLE_SIZE, 0, &data);
-    memcpy(data, vertexBuffer.data(), (size_t)vertexBufferSize);
-    vkUnmapMemory(_vulkanDevice->_device, vertexStaging.memory);
+    //external buffers and images, hashing their contents would cost as much as loading them
+    for (const char* key : { "buffers", "images" }) {
+        auto entries = document.find(key);
+        if (entries == document.end() || !entries->is_array()) {
+            continue;
+        }
+        for (const nlohmann::json& entry : *entries) {
+            auto uri = entry.find("uri");
+            if (uri == entry.end() || !uri->is_string() || tinygltf::IsDataURI(uri->get<std::string>())) {
+                continue;
+            }
+            const std::string path = baseDir + DecodeURI(uri->get<std::string>());
+            std::error_code errorCode;
+            uint64_t stamp[2] = {};
+            stamp[0] = static_cast<uint64_t>(std::filesystem::file_size(path, errorCode));
+            const std::filesystem::file_time_type writeTime = std::filesystem::last_write_time(path, errorCode);
+            stamp[1] = errorCode ? 0 : static_cast<uint64_t>(writeTime.time_since_epoch().count());
+            hash = utils::HashBytes(path.data(), path.size(), hash);
+            hash = utils::HashBytes(stamp, sizeof(stamp), hash);
+        }
+    }
+    return hash;
+}
 
-    _vertices = _vulkanDevice->CreateBuffer(
-        vertexBufferSize,
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | memoryPropertyFlags,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-    );
-    _vertices.count = static_cast<uint32_t>(vertexBuffer.size());
+bool glTF::Model::LoadFromCache(const std::string& cacheFilename, uint64_t sourceHash) {
 
-    _vulkanDevice->CopyBuffer(vertexStaging.buffer, _vertices.buffer, vertexBufferSize);
+    MappedFile cache;
+    if (!cache.Open(cacheFilename) || cache.GetSize() < sizeof(SceneCacheHeader)) {
+        return false;
+    }
+    const unsigned char* data = cache.GetData();
+    const size_t fileSize = cache.GetSize();
 
-    vkDestroyBuffer(_vulkanDevice->_device, vertexStaging.buffer, nullptr);
-    vkFreeMemory(_vulkanDevice->_device, vertexStaging.memory, nullptr);
+    SceneCacheHeader header;
+    memcpy(&header, data, sizeof(header));
+    auto inRange = [fileSize](uint64_t offset, uint64_t size) {
+        return offset <= fileSize && size <= fileSize - offset;
+    };
+    if (memcmp(header.magic, "VKRTSCN", 8) != 0 ||
+        header.version != SCENE_CACHE_VERSION ||
+        header.fileLoadingFlags != (_fileLoadingFlags & SCENE_CACHE_FLAG_MASK) ||
+        header.sourceHash != sourceHash ||
+        header.vertexStride != _vertexStride ||
+        header.attributeStride != _attributeStride ||
+        !inRange(header.vertexOffset, header.vertexSize) ||
+        !inRange(header.attributeOffset, header.attributeSize) ||
+        !inRange(header.indexOffset, header.indexSize) ||
+        !inRange(header.nodeOffset, uint64_t(header.nodeCount) * sizeof(SceneCacheNode)) ||
+        !inRange(header.primitiveOffset, uint64_t(header.primitiveCount) * sizeof(SceneCachePrimitive)) ||
+        !inRange(header.materialOffset, uint64_t(header.materialCount) * sizeof(SceneCacheMaterial)) ||
+        !inRange(header.imageOffset, uint64_t(header.imageCount) * sizeof(SceneCacheImage)) ||
+        header.vertexSize != uint64_t(header.vertexCount) * _vertexStride ||
+        header.attributeSize != uint64_t(header.vertexCount) * _attributeStride ||
+        header.indexSize != uint64_t(header.indexCount) * sizeof(uint32_t)) {
+        return false;
+    }
+
+    const SceneCacheNode* cachedNodes = reinterpret_cast<const SceneCacheNode*>(data + header.nodeOffset);
+    const SceneCachePrimitive* cachedPrimitives = reinterpret_cast<const SceneCachePrimitive*>(data + header.primitiveOffset);
+    const SceneCacheMaterial* cachedMaterials = reinterpret_cast<const SceneCacheMaterial*>(data + header.materialOffset);
+    const SceneCacheImage* cachedImages = reinterpret_cast<const SceneCacheImage*>(data + header.imageOffset);
+
+    //references must be valid before anything is created
+    for (uint32_t i = 0; i < header.imageCount; i++) {
+        if (!inRange(cachedImages[i].offset, cachedImages[i].size)) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header.primitiveCount; i++) {
+        const SceneCachePrimitive& primitive = cachedPrimitives[i];
+        if (primitive.material >= header.materialCount ||
+            uint64_t(primitive.firstIndex) + primitive.indexCount > header.indexCount ||
+            uint64_t(primitive.firstVertex) + primitive.vertexCount > header.vertexCount) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header.nodeCount; i++) {
+        const SceneCacheNode& node = cachedNodes[i];
+        if (node.parent >= int32_t(header.nodeCount) || uint64_t(node.firstPrimitive) + node.primitiveCount > header.primitiveCount) {
+            return false;
+        }
+    }
 
-    //index buffer
-    VkDeviceSize indexBufferSize = indexBuffer.size() * sizeof(uint32_t);
+    //images
+    if (!(_fileLoadingFlags & FileLoadingFlags::DontLoadImages)) {
+        std::vector<BufferSource> encodedImages(header.imageCount);
+        for (uint32_t i = 0; i < header.imageCount; i++) {
+            encodedImages[i] = { data + cachedImages[i].offset, static_cast<size_t>(cachedImages[i].size) };
+        }
+        LoadImagesDeferred(encodedImages);
+    }
 
-    vk::Buffer indexStaging;
-    indexStaging = _vulkanDevice->CreateBuffer(
-        indexBufferSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-    );
+    //materials
+    _materials.resize(header.materialCount);
+    for (uint32_t i = 0; i < header.materialCount; i++) {
+        const SceneCacheMaterial& cached = cachedMaterials[i];
+        Material& material = _materials[i];
+        glTF::Texture** textures[5] = { &material.baseColorTexture, &material.metallicRoughnessTexture, &material.normalTexture, &material.occlusionTexture, &material.emissiveTexture };
+        for (uint32_t t = 0; t < 5; t++) {
+            *textures[t] = cached.textures[t] < 0 ? nullptr : GetTexture(static_cast<uint32_t>(cached.textures[t]));
+        }
+        material.baseColorFactor = glm::make_vec4(cached.baseColorFactor);
+        material.roughnessFactor = cached.roughnessFactor;
+        material.metallicFactor = cached.metallicFactor;
+        material.alphaCutoff = cached.alphaCutoff;
+        material.alphaMode = cached.alphaMode;
+    }
+
+    //nodes are stored in _linearNodes order, children always come before their parent
+    std::vector<Node*> nodes(header.nodeCount);
+    std::unordered_map<uint32_t, Mesh*> sharedPrimitives;
+    for (uint32_t i = 0; i < header.nodeCount; i++) {
+        const SceneCacheNode& cached = cachedNodes[i];
+        Node* newNode = new Node{};
+        newNode->matrix = glm::make_mat4x4(cached.matrix);
+        newNode->translation = glm::make_vec3(cached.translation);
+        newNode->scale = glm::make_vec3(cached.scale);
+        memcpy(&newNode->rotation, cached.rotation, sizeof(cached.rotation));
+
+        if (cached.hasMesh) {
+            Mesh* newMesh = new Mesh(_vulkanDevice, newNode->matrix);
+            newMesh->index = cached.meshIndex;
+            //nodes sharing a primitive range share the primitives as well
+            auto shared = sharedPrimitives.find(cached.firstPrimitive);
+            if (cached.primitiveCount > 0 && shared != sharedPrimitives.end()) {
+                newMesh->primitives = shared->second->primitives;
+                newNode->mesh = newMesh;
+                nodes[i] = newNode;
+                continue;
+            }
+            if (cached.primitiveCount > 0) {
+                sharedPrimitives[cached.firstPrimitive] = newMesh;
+            }
+            for (uint32_t p = 0; p < cached.primitiveCount; p++) {
+                const SceneCachePrimitive& primitive = cachedPrimitives[cached.firstPrimitive + p];
+                Primitive* newPrimitive = new Primitive(primitive.firstIndex, primitive.indexCount, _materials[primitive.material]);
+                newPrimitive->firstVertex = primitive.firstVertex;
+                newPrimitive->vertexCount = primitive.vertexCount;
+                newMesh->primitives.push_back(newPrimitive);
+            }
+            newNode->mesh = newMesh;
+        }
+        nodes[i] = newNode;
+    }
+    for (uint32_t i = 0; i < header.nodeCount; i++) {
+        Node* node = nodes[i];
+        if (cachedNodes[i].parent >= 0) {
+            node->parent = nodes[cachedNodes[i].parent];
+            node->parent->children.push_back(node);
+        }
+        else {
+            _nodes.push_back(node);
+        }
+        _linearNodes.push_back(node);
+    }
 
-    vkMapMemory(_vulkanDevice->_device, indexStaging.memory, 0, VK_WHOLE_SIZE, 0, &data);
-    memcpy(data, indexBuffer.data(), (size_t)indexBufferSize);
-    vkUnmapMemory(_vulkanDevice->_device, indexStaging.memory);
+    //vertices and indices go from the mapping straight into the staging buffers
+    memcpy(_positionQuantization.scale, header.positionScale, sizeof(header.positionScale));
+    memcpy(_positionQuantization.offset, header.positionOffset, sizeof(header.positionOffset));
+    UploadGeometry(data + header.vertexOffset, header.vertexCount, data + header.attributeOffset, reinterpret_cast<const uint32_t*>(data + header.indexOffset), header.indexCount);
+    return true;
+}
 
-    _indices = _vulkanDevice->CreateBuffer(
-        indexBufferSize,
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | memoryPropertyFlags,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-    );
-    _indices.count = static_cast<uint32_t>(indexBuffer.size());
+void glTF::Model::WriteCache(const std::string& cacheFilename, uint64_t sourceHash, const void* vertexData, uint32_t vertexCount, const void* attributeData, const uint32_t* indices, uint32_t indexCount) {
 
-    _vulkanDevice->CopyBuffer(indexStaging.buffer, _indices.buffer, indexBufferSize);
+    auto align = [](uint64_t offset) {
+        return (offset + 15) & ~uint64_t(15);
+    };
 
-    vkDestroyBuffer(_vulkanDevice->_device, indexStaging.buffer, nullptr);
-    vkFreeMemory(_vulkanDevice->_device, indexStaging.memory, nullptr);
+    std::vector<SceneCacheNode> cachedNodes;
+    std::vector<SceneCachePrimitive> cachedPrimitives;
+    std::vector<SceneCacheMaterial> cachedMaterials;
+    std::vector<SceneCacheImage> cachedImages;
+
+    std::unordered_map<const Node*, int32_t> nodeIndices;
+    std::unordered_map<const Primitive*, uint32_t> writtenPrimitives;
+    for (size_t i = 0; i < _linearNodes.size(); i++) {
+        nodeIndices[_linearNodes[i]] = static_cast<int32_t>(i);
+    }
+    for (const Node* node : _linearNodes) {
+        SceneCacheNode cached{};
+        memcpy(cached.matrix, glm::value_ptr(node->matrix), sizeof(cached.matrix));
+        memcpy(cached.translation, glm::value_ptr(node->translation), sizeof(cached.translation));
+        memcpy(cached.scale, glm::value_ptr(node->scale), sizeof(cached.scale));
+        memcpy(cached.rotation, &node->rotation, sizeof(cached.rotation));
+        cached.parent = node->parent ? nodeIndices[node->parent] : -1;
+        cached.hasMesh = node->mesh ? 1 : 0;
+        cached.meshIndex = node->mesh ? node->mesh->index : -1;
+        cached.firstPrimitive = static_cast<uint32_t>(cachedPrimitives.size());
+        if (node->mesh) {
+            //instanced meshes write their primitives once and share the range
+            auto written = writtenPrimitives.find(node->mesh->primitives.empty() ? nullptr : node->mesh->primitives.front());
+            if (written != writtenPrimitives.end()) {
+                cached.firstPrimitive = written->second;
+                cached.primitiveCount = static_cast<uint32_t>(node->mesh->primitives.size());
+                cachedNodes.push_back(cached);
+                continue;
+            }
+            if (!node->mesh->primitives.empty()) {
+                writtenPrimitives[node->mesh->primitives.front()] = cached.firstPrimitive;
+            }
+            for (const Primitive* primitive : node->mesh->primitives) {
+                SceneCachePrimitive cachedPrimitive{};
+                cachedPrimitive.firstIndex = primitive->firstIndex;
+                cachedPrimitive.indexCount = primitive->indexCount;
+                cachedPrimitive.firstVertex = primitive->firstVertex;
+                cachedPrimitive.vertexCount = primitive->vertexCount;
+                cachedPrimitive.material = static_cast<uint32_t>(&primitive->material - _materials.data());
+                cachedPrimitives.push_back(cachedPrimitive);
+            }
+            cached.primitiveCount = static_cast<uint32_t>(node->mesh->primitives.size());
+        }
+        cachedNodes.push_back(cached);
+    }
 
-    CreateDescriptors();
+    for (const Material& material : _materials) {
+        SceneCacheMaterial cached{};
+        const glTF::Texture* textures[5] = { material.baseColorTexture, material.metallicRoughnessTexture, material.normalTexture, material.occlusionTexture, material.emissiveTexture };
+        for (uint32_t t = 0; t < 5; t++) {
+            cached.textures[t] = textures[t] ? static_cast<int32_t>(textures[t] - _textures.data()) : -1;
+        }
+        memcpy(cached.baseColorFactor, glm::value_ptr(material.baseColorFactor), sizeof(cached.baseColorFactor));
+        cached.roughnessFactor = material.roughnessFactor;
+        cached.metallicFactor = material.metallicFactor;
+        cached.alphaCutoff = material.alphaCutoff;
+        cached.alphaMode = material.alphaMode;
+        cachedMaterials.push_back(cached);
+    }
+
+    SceneCacheHeader header{};
+    memcpy(header.magic, "VKRTSCN", 8);
+    header.version = SCENE_CACHE_VERSION;
+    header.fileLoadingFlags = _fileLoadingFlags & SCENE_CACHE_FLAG_MASK;
+    header.sourceHash = sourceHash;
+    header.vertexStride = _vertexStride;
+    header.attributeStride = _attributeStride;
+    header.vertexCount = vertexCount;
+    header.indexCount = indexCount;
+    header.nodeCount = static_cast<uint32_t>(cachedNodes.size());
+    header.primitiveCount = static_cast<uint32_t>(cachedPrimitives.size());
+    header.materialCount = static_cast<uint32_t>(cachedMaterials.size());
+    header.imageCount = static_cast<uint32_t>(_encodedImages.size());
+    memcpy(header.positionScale, _positionQuantization.scale, sizeof(header.positionScale));
+    memcpy(header.positionOffset, _positionQuantization.offset, sizeof(header.positionOffset));
+
+    header.vertexOffset = align(sizeof(SceneCacheHeader));
+    header.vertexSize = uint64_t(vertexCount) * _vertexStride;
+    header.attributeOffset = align(header.vertexOffset + header.vertexSize);
+    header.attributeSize = uint64_t(vertexCount) * _attributeStride;
+    header.indexOffset = align(header.attributeOffset + header.attributeSize);
+    header.indexSize = uint64_t(indexCount) * sizeof(uint32_t);
+    header.nodeOffset = align(header.indexOffset + header.indexSize);
+    header.primitiveOffset = align(header.nodeOffset + cachedNodes.size() * sizeof(SceneCacheNode));
+    header.materialOffset = align(header.primitiveOffset + cachedPrimitives.size() * sizeof(SceneCachePrimitive));
+    header.imageOffset = align(header.materialOffset + cachedMaterials.size() * sizeof(SceneCacheMaterial));
+
+    uint64_t offset = align(header.imageOffset + _encodedImages.size() * sizeof(SceneCacheImage));
+    for (const std::vector<unsigned char>& encoded : _encodedImages) {
+        cachedImages.push_back({ offset, encoded.size() });
+        offset = align(offset + encoded.size());
+    }
+
+    //write to a temporary file first so that a broken cache is never picked up
+    CacheFileWriter file(cacheFilename);
+    file.WriteSection(0, &header, sizeof(header));
+    file.WriteSection(header.vertexOffset, vertexData, static_cast<size_t>(header.vertexSize));
+    file.WriteSection(header.attributeOffset, attributeData, static_cast<size_t>(header.attributeSize));
+    file.WriteSection(header.indexOffset, indices, static_cast<size_t>(header.indexSize));
+    file.WriteSection(header.nodeOffset, cachedNodes.data(), cachedNodes.size() * sizeof(SceneCacheNode));
+    file.WriteSection(header.primitiveOffset, cachedPrimitives.data(), cachedPrimitives.size() * sizeof(SceneCachePrimitive));
+    file.WriteSection(header.materialOffset, cachedMaterials.data(), cachedMaterials.size() * sizeof(SceneCacheMaterial));
+    file.WriteSection(header.imageOffset, cachedImages.data(), cachedImages.size() * sizeof(SceneCacheImage));
+    for (size_t i = 0; i < _encodedImages.size(); i++) {
+        file.WriteSection(cachedImages[i].offset, _encodedImages[i].data(), _encodedImages[i].size());
+    }
+    if (!file.Finish() || !file.Commit()) {
+        std::cerr << "failed to write scene cache " << cacheFilename << std::endl;
+    }
 }
 
 void glTF::Model::Connect(VulkanDevice* device) {
@@ -1101,7 +2196,9 @@ void glTF::Model::DrawNode(VkCommandBuffer& commandBuffer, VkPipelineLayout& pip
                 if (renderFlags & RenderFlags::BindImages) {
                     vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, bindImageSet, 1, &material.descriptorSet, 0, nullptr);
                 }
-                vkCmdDrawIndexed(commandBuffer, primitive->indexCount, 1, primitive->firstIndex, 0, 0);
+                //the index type can change from one primitive to the next
+                vkCmdBindIndexBuffer(commandBuffer, _indices.buffer, primitive->indexOffset, primitive->indexType);
+                vkCmdDrawIndexed(commandBuffer, primitive->indexCount, 1, 0, static_cast<int32_t>(primitive->baseVertex), 0);
             }
         }
     }
@@ -1112,10 +2209,9 @@ void glTF::Model::DrawNode(VkCommandBuffer& commandBuffer, VkPipelineLayout& pip
 }
 
 void glTF::Model::Draw(VkCommandBuffer& commandBuffer, VkPipelineLayout& pipelineLayout, uint32_t renderFlags, uint32_t bindImageSet) {
-    //f`
+    //モデル描画
     VkDeviceSize offsets[] = { 0 };
     vkCmdBindVertexBuffers(commandBuffer, 0, 1, &_vertices.buffer, offsets);
-    vkCmdBindIndexBuffer(commandBuffer, _indices.buffer, 0, VK_INDEX_TYPE_UINT32);
 
     for (auto& node : _nodes) {
         DrawNode(commandBuffer, pipelineLayout, node, renderFlags, bindImageSet);
@@ -1137,6 +2233,9 @@ void glTF::Model::Destroy() {
     for (auto node : _nodes) {
         delete node;
     }
+    _vertices.Destroy(_vulkanDevice->_device);
+    _attributes.Destroy(_vulkanDevice->_device);
+    _indices.Destroy(_vulkanDevice->_device);
     vkDestroyDescriptorSetLayout(_vulkanDevice->_device, _descriptorSetLayout.ubo, nullptr);
     vkDestroyDescriptorSetLayout(_vulkanDevice->_device, _descriptorSetLayout.image, nullptr);
 
@@ -1160,7 +2259,7 @@ AppBase::AppBase()
 }
 
 /*******************************************************************************************************************
-*                                             R[obN
+*                                             コールバック
 ********************************************************************************************************************/
 
 static void FramebufferResizeCallback(GLFWwindow* window, int width, int height) {
@@ -1180,7 +2279,7 @@ static void mouseButton(GLFWwindow* window, int button, int action, int modsy) {
     if (instance != NULL) {
 
         if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) {
-            //Ƃ肠
+            //とりあえず左だけ
             instance->_mouseButtons.left = true;
         }
         else if (action == GLFW_RELEASE) {
@@ -1213,7 +2312,7 @@ void AppBase::MouseMove(double x, double y) {
         _camera->translate(glm::vec3(-dx * 0.01f, -dy * 0.01f, 0.0f));
         viewUpdated = true;
     }
-    //}EXʒuۑ
+    //マウス位置保存
     _mousePos = glm::vec2((float)x, (float)y);
 }
 
@@ -1221,7 +2320,7 @@ static void cursor(GLFWwindow* window, double xpos, double ypos) {
 
     AppBase* const instance(static_cast<AppBase*>(glfwGetWindowUserPointer(window)));
     if (instance != NULL) {
-        //[hWnɑ΂foCXWn̊g嗦XV
+        //ワールド座標系に対するデバイス座標系の拡大率を更新する
         instance->MouseMove(xpos, ypos);
     }
 }
@@ -1280,7 +2379,7 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(VkDebugUtilsMessageSeverityF
 
 
 /*******************************************************************************************************************
-*                                             
+*                                             初期化
 ********************************************************************************************************************/
 
 void AppBase::InitializeWindow() {
@@ -1295,15 +2394,15 @@ void AppBase::InitializeWindow() {
 
 void AppBase::SetupGlfwCallbacks() {
 
-    //R[obN֐̓o^
+    //コールバック関数の登録
     glfwSetFramebufferSizeCallback(_window, FramebufferResizeCallback);
 
     glfwSetMouseButtonCallback(_window, mouseButton);
 
-    //}EX
+    //マウス入力
     glfwSetCursorPosCallback(_window, cursor);
 
-    //}EXzC[쎞ɌĂяo̓o^
+    //マウスホイール操作時に呼び出す処理の登録
     glfwSetScrollCallback(_window, wheel);
 
     glfwSetWindowUserPointer(_window, this);
@@ -1362,7 +2461,7 @@ void AppBase::populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEX
 
 void AppBase::CreateInstance() {
 
-    //؃C[L̂ƂɎg邩mF
+    //検証レイヤーが有効のときに使えるか確認
     if (enableValidationLayers && !CheckValidationLayerSupport()) {
         throw std::runtime_error("validation layers requested, but not available!");
     }
@@ -1684,7 +2783,8 @@ void AppBase::CreateDepthResources() {
             depthFormat,
             VK_IMAGE_ASPECT_STENCIL_BIT,
             VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            vk::MemoryCategory::RenderTarget
         );
     }
     else {
@@ -1694,7 +2794,8 @@ void AppBase::CreateDepthResources() {
             depthFormat,
             VK_IMAGE_ASPECT_DEPTH_BIT,
             VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            vk::MemoryCategory::RenderTarget
         );
     }
 
@@ -1760,7 +2861,15 @@ void AppBase::BuildCommandBuffers(uint32_t index, bool renderImgui) {
     if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
         throw std::runtime_error("failed to begin recording command buffer!");
     }
-    UpdateTLAS(commandBuffer);
+
+    //the fence of this frame has signalled, so the scratch of the last recording can be reused
+    FrameCommandBuffer& frameCommandBuffer = _commandBuffers[index];
+    const VkDeviceSize tlasScratchSize = std::max(r_topLevelAS->buildScratchSize, r_topLevelAS->updateScratchSize);
+    if (frameCommandBuffer.tlasScratch.size < tlasScratchSize) {
+        _vulkanDevice->_scratchPool.Free(frameCommandBuffer.tlasScratch);
+        frameCommandBuffer.tlasScratch = _vulkanDevice->_scratchPool.Allocate(tlasScratchSize);
+    }
+    frameCommandBuffer.tlasState = UpdateTLAS(commandBuffer, frameCommandBuffer.tlasScratch.address, frameCommandBuffer.instanceBuffer);
 
     vkCmdSetCheckpointNV(commandBuffer, "Raytrace");
 
@@ -1892,36 +3001,47 @@ void AppBase::Initialize() {
 }
 
 /*******************************************************************************************************************
-*                                             Cg[VO
+*                                             レイトレーシング
 ********************************************************************************************************************/
 AccelerationStructure::AccelerationStructure(VulkanDevice* device)
 {
     vulkanDevice = device;
 }
 
-void AccelerationStructure::Update(VkCommandBuffer commandBuffer, VkAccelerationStructureTypeKHR type, VkAccelerationStructureGeometryKHR geometryInfo, uint32_t primitiveCount, VkBuildAccelerationStructureFlagsKHR flags) {
+void AccelerationStructure::Update(VkCommandBuffer commandBuffer, VkDeviceAddress scratchAddress, VkAccelerationStructureTypeKHR type, VkAccelerationStructureGeometryKHR geometryInfo, uint32_t primitiveCount, VkBuildAccelerationStructureFlagsKHR flags, VkBuildAccelerationStructureModeKHR mode) {
+    Update(commandBuffer, scratchAddress, type, std::vector<VkAccelerationStructureGeometryKHR>{ geometryInfo }, std::vector<uint32_t>{ primitiveCount }, flags, mode);
+}
+
+void AccelerationStructure::Update(VkCommandBuffer commandBuffer, VkDeviceAddress scratchAddress, VkAccelerationStructureTypeKHR type, const std::vector<VkAccelerationStructureGeometryKHR>& geometryInfos, const std::vector<uint32_t>& primitiveCounts, VkBuildAccelerationStructureFlagsKHR flags, VkBuildAccelerationStructureModeKHR mode) {
     
     //get sizeInfo
     VkAccelerationStructureBuildGeometryInfoKHR buildGeometryInfo{};
     buildGeometryInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
     buildGeometryInfo.type = type;
     buildGeometryInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | flags;
-    buildGeometryInfo.geometryCount = 1;
-    buildGeometryInfo.pGeometries = &geometryInfo;
-    buildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+    buildGeometryInfo.geometryCount = static_cast<uint32_t>(geometryInfos.size());
+    buildGeometryInfo.pGeometries = geometryInfos.data();
+    buildGeometryInfo.mode = mode;
+    //a refit reads the structure it writes, which is allowed for in-place updates
+    if (mode == VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR) {
+        buildGeometryInfo.srcAccelerationStructure = handle;
+    }
     buildGeometryInfo.dstAccelerationStructure = handle;
-    buildGeometryInfo.scratchData.deviceAddress = updateBuffer.GetBufferDeviceAddress(vulkanDevice->_device);
+    buildGeometryInfo.scratchData.deviceAddress = scratchAddress;
 
 
-    VkAccelerationStructureBuildRangeInfoKHR buildRangeInfo{};
-    buildRangeInfo.primitiveCount = primitiveCount;
-    buildRangeInfo.primitiveOffset = 0;
-    buildRangeInfo.firstVertex = 0;
-    buildRangeInfo.transformOffset = 0;
-    std::vector<VkAccelerationStructureBuildRangeInfoKHR*> buildRangeInfos = { &buildRangeInfo };
+    //one build range per geometry, the offsets are baked into the geometry addresses
+    std::vector<VkAccelerationStructureBuildRangeInfoKHR> buildRangeInfo(geometryInfos.size());
+    for (size_t i = 0; i < geometryInfos.size(); i++) {
+        buildRangeInfo[i].primitiveCount = primitiveCounts[i];
+        buildRangeInfo[i].primitiveOffset = 0;
+        buildRangeInfo[i].firstVertex = 0;
+        buildRangeInfo[i].transformOffset = 0;
+    }
+    const VkAccelerationStructureBuildRangeInfoKHR* buildRangeInfos = buildRangeInfo.data();
 
     //build
-    vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &buildGeometryInfo, buildRangeInfos.data());
+    vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &buildGeometryInfo, &buildRangeInfos);
 
     //memory barrier
     VkMemoryBarrier memoryBarrier{};
@@ -1938,14 +3058,18 @@ void AccelerationStructure::Update(VkCommandBuffer commandBuffer, VkAcceleration
 }
 
 void AccelerationStructure::CreateAccelerationStructureBuffer(VkAccelerationStructureTypeKHR type, VkAccelerationStructureGeometryKHR geometryInfo, uint32_t primitiveCount, VkBuildAccelerationStructureFlagsKHR flags) {
+    CreateAccelerationStructureBuffer(type, std::vector<VkAccelerationStructureGeometryKHR>{ geometryInfo }, std::vector<uint32_t>{ primitiveCount }, flags);
+}
+
+void AccelerationStructure::CreateAccelerationStructureBuffer(VkAccelerationStructureTypeKHR type, const std::vector<VkAccelerationStructureGeometryKHR>& geometryInfos, const std::vector<uint32_t>& primitiveCounts, VkBuildAccelerationStructureFlagsKHR flags) {
 
     //get sizeInfo
     VkAccelerationStructureBuildGeometryInfoKHR buildGeometryInfo{};
     buildGeometryInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
     buildGeometryInfo.type = type;
     buildGeometryInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | flags;
-    buildGeometryInfo.geometryCount = 1;
-    buildGeometryInfo.pGeometries = &geometryInfo;
+    buildGeometryInfo.geometryCount = static_cast<uint32_t>(geometryInfos.size());
+    buildGeometryInfo.pGeometries = geometryInfos.data();
 
     VkAccelerationStructureBuildSizesInfoKHR buildSizeInfo;
     buildSizeInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
@@ -1953,7 +3077,7 @@ void AccelerationStructure::CreateAccelerationStructureBuffer(VkAccelerationStru
         vulkanDevice->_device,
         VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
         &buildGeometryInfo,
-        &primitiveCount,
+        primitiveCounts.data(),
         &buildSizeInfo
     );
 
@@ -1961,7 +3085,8 @@ void AccelerationStructure::CreateAccelerationStructureBuffer(VkAccelerationStru
     asBuffer = vulkanDevice->CreateBuffer(
         buildSizeInfo.accelerationStructureSize,
         VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        type == VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR ? vk::MemoryCategory::BLAS : vk::MemoryCategory::TLAS
     );
 
     VkAccelerationStructureCreateInfoKHR createInfo{};
@@ -1976,39 +3101,28 @@ void AccelerationStructure::CreateAccelerationStructureBuffer(VkAccelerationStru
     deviceAddressInfo.accelerationStructure = handle;
     deviceAddress = vkGetAccelerationStructureDeviceAddressKHR(vulkanDevice->_device, &deviceAddressInfo);
 
-    //create scratch buffer
-    vk::Buffer scratchBuffer;
-    if (buildSizeInfo.buildScratchSize > 0) {
-        scratchBuffer = vulkanDevice->CreateBuffer(
-            buildSizeInfo.buildScratchSize,
-            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-        );
-    }
-
-    //create update buffer
-    if (buildSizeInfo.updateScratchSize > 0) {
-            updateBuffer = vulkanDevice->CreateBuffer(
-        buildSizeInfo.buildScratchSize,
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-    );
-    }
+    //later updates borrow their scratch from the pool as well
+    buildScratchSize = buildSizeInfo.buildScratchSize;
+    updateScratchSize = buildSizeInfo.updateScratchSize;
+    ScratchPool::Allocation scratch = vulkanDevice->_scratchPool.Allocate(buildScratchSize);
 
     buildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
     buildGeometryInfo.dstAccelerationStructure = handle;
-    buildGeometryInfo.scratchData.deviceAddress = scratchBuffer.address;
+    buildGeometryInfo.scratchData.deviceAddress = scratch.address;
 
-    VkAccelerationStructureBuildRangeInfoKHR buildRangeInfo{};
-    buildRangeInfo.primitiveCount = primitiveCount;
-    buildRangeInfo.primitiveOffset = 0;
-    buildRangeInfo.firstVertex = 0;
-    buildRangeInfo.transformOffset = 0;
-    std::vector<VkAccelerationStructureBuildRangeInfoKHR*> buildRangeInfos = { &buildRangeInfo };
+    //one build range per geometry, the offsets are baked into the geometry addresses
+    std::vector<VkAccelerationStructureBuildRangeInfoKHR> buildRangeInfo(geometryInfos.size());
+    for (size_t i = 0; i < geometryInfos.size(); i++) {
+        buildRangeInfo[i].primitiveCount = primitiveCounts[i];
+        buildRangeInfo[i].primitiveOffset = 0;
+        buildRangeInfo[i].firstVertex = 0;
+        buildRangeInfo[i].transformOffset = 0;
+    }
+    const VkAccelerationStructureBuildRangeInfoKHR* buildRangeInfos = buildRangeInfo.data();
 
     //build
     VkCommandBuffer commandBuffer = vulkanDevice->BeginCommand();
-    vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &buildGeometryInfo, buildRangeInfos.data());
+    vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &buildGeometryInfo, &buildRangeInfos);
 
     //memory barrier
     VkMemoryBarrier memoryBarrier{};
@@ -2024,53 +3138,636 @@ void AccelerationStructure::CreateAccelerationStructureBuffer(VkAccelerationStru
     );
     vulkanDevice->FlushCommandBuffer(commandBuffer, vulkanDevice->_queue);
 
-    vkDestroyBuffer(vulkanDevice->_device, scratchBuffer.buffer, nullptr);
-    vkFreeMemory(vulkanDevice->_device, scratchBuffer.memory, nullptr);
+    vulkanDevice->_scratchPool.Free(scratch);
+}
+
+vk::Buffer AccelerationStructure::BuildBatch(VulkanDevice* device, const std::vector<BuildInput>& inputs, VkBuildAccelerationStructureFlagsKHR flags, bool compact) {
+
+    vk::Buffer storageBuffer;
+    if (inputs.empty()) {
+        return storageBuffer;
+    }
+    if (compact) {
+        flags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
+    }
+
+    //query every size first to carve the storage out of one buffer
+    const VkDeviceSize scratchAlignment = device->_scratchPool.GetAlignment();
+    std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildGeometryInfos(inputs.size());
+    std::vector<VkDeviceSize> storageOffsets(inputs.size());
+    std::vector<VkDeviceSize> storageSizes(inputs.size());
+    VkDeviceSize storageSize = 0;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        VkAccelerationStructureBuildGeometryInfoKHR& buildGeometryInfo = buildGeometryInfos[i];
+        buildGeometryInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+        buildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+        buildGeometryInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | flags;
+        buildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+        buildGeometryInfo.geometryCount = static_cast<uint32_t>(inputs[i].geometryInfos.size());
+        buildGeometryInfo.pGeometries = inputs[i].geometryInfos.data();
+
+        VkAccelerationStructureBuildSizesInfoKHR buildSizeInfo{};
+        buildSizeInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+        vkGetAccelerationStructureBuildSizesKHR(
+            device->_device,
+            VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+            &buildGeometryInfo,
+            inputs[i].primitiveCounts.data(),
+            &buildSizeInfo
+        );
+
+        AccelerationStructure* accelerationStructure = inputs[i].accelerationStructure;
+        accelerationStructure->buildScratchSize = buildSizeInfo.buildScratchSize;
+        accelerationStructure->updateScratchSize = buildSizeInfo.updateScratchSize;
+        storageOffsets[i] = (storageSize + STORAGE_ALIGNMENT - 1) / STORAGE_ALIGNMENT * STORAGE_ALIGNMENT;
+        storageSizes[i] = buildSizeInfo.accelerationStructureSize;
+        storageSize = storageOffsets[i] + storageSizes[i];
+    }
+
+    storageBuffer = device->CreateBuffer(
+        storageSize,
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        vk::MemoryCategory::BLAS
+    );
+
+    for (size_t i = 0; i < inputs.size(); i++) {
+        AccelerationStructure* accelerationStructure = inputs[i].accelerationStructure;
+
+        VkAccelerationStructureCreateInfoKHR createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+        createInfo.buffer = storageBuffer.buffer;
+        createInfo.offset = storageOffsets[i];
+        createInfo.size = storageSizes[i];
+        createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+        vkCreateAccelerationStructureKHR(device->_device, &createInfo, nullptr, &accelerationStructure->handle);
+
+        VkAccelerationStructureDeviceAddressInfoKHR deviceAddressInfo{};
+        deviceAddressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+        deviceAddressInfo.accelerationStructure = accelerationStructure->handle;
+        accelerationStructure->deviceAddress = vkGetAccelerationStructureDeviceAddressKHR(device->_device, &deviceAddressInfo);
+
+        buildGeometryInfos[i].dstAccelerationStructure = accelerationStructure->handle;
+    }
+
+    std::vector<std::vector<VkAccelerationStructureBuildRangeInfoKHR>> buildRangeInfos(inputs.size());
+    std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> buildRangeInfoPointers(inputs.size());
+    for (size_t i = 0; i < inputs.size(); i++) {
+        buildRangeInfos[i].resize(inputs[i].primitiveCounts.size());
+        for (size_t j = 0; j < inputs[i].primitiveCounts.size(); j++) {
+            buildRangeInfos[i][j].primitiveCount = inputs[i].primitiveCounts[j];
+        }
+        buildRangeInfoPointers[i] = buildRangeInfos[i].data();
+    }
+
+    //split into builds whose scratch fits in MAX_BATCH_SCRATCH_SIZE, each reuses the same scratch
+    std::vector<size_t> batchBegins;
+    VkDeviceSize batchScratchSize = 0;
+    VkDeviceSize maxScratchSize = 0;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        const VkDeviceSize scratchSize = (inputs[i].accelerationStructure->buildScratchSize + scratchAlignment - 1) / scratchAlignment * scratchAlignment;
+        if (batchBegins.empty() || batchScratchSize + scratchSize > MAX_BATCH_SCRATCH_SIZE) {
+            batchBegins.push_back(i);
+            batchScratchSize = 0;
+        }
+        buildGeometryInfos[i].scratchData.deviceAddress = batchScratchSize;
+        batchScratchSize += scratchSize;
+        maxScratchSize = std::max(maxScratchSize, batchScratchSize);
+    }
+    batchBegins.push_back(inputs.size());
+
+    ScratchPool::Allocation scratch = device->_scratchPool.Allocate(maxScratchSize);
+    for (VkAccelerationStructureBuildGeometryInfoKHR& buildGeometryInfo : buildGeometryInfos) {
+        buildGeometryInfo.scratchData.deviceAddress += scratch.address;
+    }
+
+    //the compacted sizes are known once the builds have finished
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    if (compact) {
+        VkQueryPoolCreateInfo queryPoolInfo{};
+        queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolInfo.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR;
+        queryPoolInfo.queryCount = static_cast<uint32_t>(inputs.size());
+        if (vkCreateQueryPool(device->_device, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create query pool!");
+        }
+    }
+
+    VkCommandBuffer commandBuffer = device->BeginCommand();
+    if (compact) {
+        vkCmdResetQueryPool(commandBuffer, queryPool, 0, static_cast<uint32_t>(inputs.size()));
+    }
+    for (size_t b = 0; b + 1 < batchBegins.size(); b++) {
+        const size_t begin = batchBegins[b];
+        const uint32_t count = static_cast<uint32_t>(batchBegins[b + 1] - begin);
+        vkCmdBuildAccelerationStructuresKHR(commandBuffer, count, &buildGeometryInfos[begin], &buildRangeInfoPointers[begin]);
+
+        //the structures are ready to be read, and the next build may overwrite the scratch
+        VkMemoryBarrier memoryBarrier{};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+        memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+        vkCmdPipelineBarrier(
+            commandBuffer,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+            0, 1, &memoryBarrier, 0, nullptr, 0, nullptr
+        );
+    }
+    if (compact) {
+        std::vector<VkAccelerationStructureKHR> handles(inputs.size());
+        for (size_t i = 0; i < inputs.size(); i++) {
+            handles[i] = inputs[i].accelerationStructure->handle;
+        }
+        vkCmdWriteAccelerationStructuresPropertiesKHR(
+            commandBuffer,
+            static_cast<uint32_t>(handles.size()), handles.data(),
+            VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+            queryPool, 0
+        );
+    }
+    device->FlushCommandBuffer(commandBuffer, device->_queue);
+
+    device->_scratchPool.Free(scratch);
+
+    if (compact) {
+        vk::Buffer compactedBuffer = Compact(device, inputs, storageBuffer, queryPool);
+        vkDestroyQueryPool(device->_device, queryPool, nullptr);
+        return compactedBuffer;
+    }
+    return storageBuffer;
+}
+
+vk::Buffer AccelerationStructure::BuildBatchOnHost(VulkanDevice* device, const std::vector<BuildInput>& inputs, VkBuildAccelerationStructureFlagsKHR flags) {
+
+    vk::Buffer storageBuffer;
+    if (inputs.empty()) {
+        return storageBuffer;
+    }
+    if (!device->_accelerationStructureHostCommands) {
+        throw std::runtime_error("acceleration structure host commands are not supported!");
+    }
+
+    std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildGeometryInfos(inputs.size());
+    std::vector<VkDeviceSize> storageOffsets(inputs.size());
+    std::vector<VkDeviceSize> storageSizes(inputs.size());
+    std::vector<size_t> scratchOffsets(inputs.size());
+    VkDeviceSize storageSize = 0;
+    size_t scratchSize = 0;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        VkAccelerationStructureBuildGeometryInfoKHR& buildGeometryInfo = buildGeometryInfos[i];
+        buildGeometryInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR;
+        buildGeometryInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+        buildGeometryInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | flags;
+        buildGeometryInfo.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR;
+        buildGeometryInfo.geometryCount = static_cast<uint32_t>(inputs[i].geometryInfos.size());
+        buildGeometryInfo.pGeometries = inputs[i].geometryInfos.data();
+
+        VkAccelerationStructureBuildSizesInfoKHR buildSizeInfo{};
+        buildSizeInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+        vkGetAccelerationStructureBuildSizesKHR(
+            device->_device,
+            VK_ACCELERATION_STRUCTURE_BUILD_TYPE_HOST_KHR,
+            &buildGeometryInfo,
+            inputs[i].primitiveCounts.data(),
+            &buildSizeInfo
+        );
+
+        //host built structures are never rebuilt on the device
+        AccelerationStructure* accelerationStructure = inputs[i].accelerationStructure;
+        accelerationStructure->buildScratchSize = 0;
+        accelerationStructure->updateScratchSize = 0;
+        storageOffsets[i] = (storageSize + STORAGE_ALIGNMENT - 1) / STORAGE_ALIGNMENT * STORAGE_ALIGNMENT;
+        storageSizes[i] = buildSizeInfo.accelerationStructureSize;
+        storageSize = storageOffsets[i] + storageSizes[i];
+        scratchOffsets[i] = scratchSize;
+        scratchSize += (static_cast<size_t>(buildSizeInfo.buildScratchSize) + 15) & ~size_t(15);
+    }
+
+    //the host writes the structures, so their memory has to be mappable
+    storageBuffer = device->CreateBuffer(
+        storageSize,
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        vk::MemoryCategory::BLAS
+    );
+
+    std::vector<unsigned char> scratch(scratchSize);
+    std::vector<std::vector<VkAccelerationStructureBuildRangeInfoKHR>> buildRangeInfos(inputs.size());
+    std::vector<const VkAccelerationStructureBuildRangeInfoKHR*> buildRangeInfoPointers(inputs.size());
+    for (size_t i = 0; i < inputs.size(); i++) {
+        AccelerationStructure* accelerationStructure = inputs[i].accelerationStructure;
+
+        VkAccelerationStructureCreateInfoKHR createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+        createInfo.buffer = storageBuffer.buffer;
+        createInfo.offset = storageOffsets[i];
+        createInfo.size = storageSizes[i];
+        createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+        vkCreateAccelerationStructureKHR(device->_device, &createInfo, nullptr, &accelerationStructure->handle);
+
+        VkAccelerationStructureDeviceAddressInfoKHR deviceAddressInfo{};
+        deviceAddressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+        deviceAddressInfo.accelerationStructure = accelerationStructure->handle;
+        accelerationStructure->deviceAddress = vkGetAccelerationStructureDeviceAddressKHR(device->_device, &deviceAddressInfo);
+
+        buildGeometryInfos[i].dstAccelerationStructure = accelerationStructure->handle;
+        buildGeometryInfos[i].scratchData.hostAddress = scratch.data() + scratchOffsets[i];
+
+        buildRangeInfos[i].resize(inputs[i].primitiveCounts.size());
+        for (size_t j = 0; j < inputs[i].primitiveCounts.size(); j++) {
+            buildRangeInfos[i][j].primitiveCount = inputs[i].primitiveCounts[j];
+        }
+        buildRangeInfoPointers[i] = buildRangeInfos[i].data();
+    }
+
+    //without a deferred operation the call returns when every structure is built
+    if (vkBuildAccelerationStructuresKHR(device->_device, VK_NULL_HANDLE, static_cast<uint32_t>(inputs.size()), buildGeometryInfos.data(), buildRangeInfoPointers.data()) != VK_SUCCESS) {
+        throw std::runtime_error("failed to build acceleration structures on the host!");
+    }
+    return storageBuffer;
+}
+
+vk::Buffer AccelerationStructure::Compact(VulkanDevice* device, const std::vector<BuildInput>& inputs, vk::Buffer& storageBuffer, VkQueryPool queryPool) {
+
+    std::vector<VkDeviceSize> compactedSizes(inputs.size());
+    vkGetQueryPoolResults(
+        device->_device, queryPool,
+        0, static_cast<uint32_t>(inputs.size()),
+        compactedSizes.size() * sizeof(VkDeviceSize), compactedSizes.data(), sizeof(VkDeviceSize),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT
+    );
+
+    std::vector<VkDeviceSize> storageOffsets(inputs.size());
+    VkDeviceSize storageSize = 0;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        storageOffsets[i] = (storageSize + STORAGE_ALIGNMENT - 1) / STORAGE_ALIGNMENT * STORAGE_ALIGNMENT;
+        storageSize = storageOffsets[i] + compactedSizes[i];
+    }
+
+    vk::Buffer compactedBuffer = device->CreateBuffer(
+        storageSize,
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        vk::MemoryCategory::BLAS
+    );
+
+    std::vector<VkAccelerationStructureKHR> compactedHandles(inputs.size());
+    VkCommandBuffer commandBuffer = device->BeginCommand();
+    for (size_t i = 0; i < inputs.size(); i++) {
+        VkAccelerationStructureCreateInfoKHR createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+        createInfo.buffer = compactedBuffer.buffer;
+        createInfo.offset = storageOffsets[i];
+        createInfo.size = compactedSizes[i];
+        createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+        vkCreateAccelerationStructureKHR(device->_device, &createInfo, nullptr, &compactedHandles[i]);
+
+        VkCopyAccelerationStructureInfoKHR copyInfo{};
+        copyInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR;
+        copyInfo.src = inputs[i].accelerationStructure->handle;
+        copyInfo.dst = compactedHandles[i];
+        copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
+        vkCmdCopyAccelerationStructureKHR(commandBuffer, &copyInfo);
+    }
+
+    VkMemoryBarrier memoryBarrier{};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+        0, 1, &memoryBarrier, 0, nullptr, 0, nullptr
+    );
+    device->FlushCommandBuffer(commandBuffer, device->_queue);
+
+    //the TLAS instances read deviceAddress, so they pick up the compacted structures when they are written
+    for (size_t i = 0; i < inputs.size(); i++) {
+        AccelerationStructure* accelerationStructure = inputs[i].accelerationStructure;
+        vkDestroyAccelerationStructureKHR(device->_device, accelerationStructure->handle, nullptr);
+        accelerationStructure->handle = compactedHandles[i];
+
+        VkAccelerationStructureDeviceAddressInfoKHR deviceAddressInfo{};
+        deviceAddressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+        deviceAddressInfo.accelerationStructure = accelerationStructure->handle;
+        accelerationStructure->deviceAddress = vkGetAccelerationStructureDeviceAddressKHR(device->_device, &deviceAddressInfo);
+    }
+
+    device->_allocator.RecordCompaction(static_cast<uint32_t>(inputs.size()), storageBuffer.allocation.size, storageSize);
+    storageBuffer.Destroy(device->_device);
+    return compactedBuffer;
+}
+
+std::vector<std::vector<unsigned char>> AccelerationStructure::Serialize(VulkanDevice* device, const std::vector<AccelerationStructure*>& accelerationStructures) {
+
+    std::vector<std::vector<unsigned char>> serialized(accelerationStructures.size());
+    if (accelerationStructures.empty()) {
+        return serialized;
+    }
+
+    std::vector<VkAccelerationStructureKHR> handles(accelerationStructures.size());
+    for (size_t i = 0; i < accelerationStructures.size(); i++) {
+        handles[i] = accelerationStructures[i]->handle;
+    }
+
+    VkQueryPoolCreateInfo queryPoolInfo{};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR;
+    queryPoolInfo.queryCount = static_cast<uint32_t>(handles.size());
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    if (vkCreateQueryPool(device->_device, &queryPoolInfo, nullptr, &queryPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create query pool!");
+    }
+
+    VkCommandBuffer commandBuffer = device->BeginCommand();
+    vkCmdResetQueryPool(commandBuffer, queryPool, 0, static_cast<uint32_t>(handles.size()));
+    vkCmdWriteAccelerationStructuresPropertiesKHR(
+        commandBuffer,
+        static_cast<uint32_t>(handles.size()), handles.data(),
+        VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR,
+        queryPool, 0
+    );
+    device->FlushCommandBuffer(commandBuffer, device->_queue);
+
+    std::vector<VkDeviceSize> serializedSizes(handles.size());
+    vkGetQueryPoolResults(
+        device->_device, queryPool,
+        0, static_cast<uint32_t>(handles.size()),
+        serializedSizes.size() * sizeof(VkDeviceSize), serializedSizes.data(), sizeof(VkDeviceSize),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT
+    );
+    vkDestroyQueryPool(device->_device, queryPool, nullptr);
+
+    //the destination addresses have the same alignment as the structures
+    std::vector<VkDeviceSize> offsets(handles.size());
+    VkDeviceSize readbackSize = 0;
+    for (size_t i = 0; i < handles.size(); i++) {
+        offsets[i] = (readbackSize + STORAGE_ALIGNMENT - 1) / STORAGE_ALIGNMENT * STORAGE_ALIGNMENT;
+        readbackSize = offsets[i] + serializedSizes[i];
+    }
+    vk::Buffer readbackBuffer = device->CreateBuffer(
+        readbackSize + STORAGE_ALIGNMENT,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        vk::MemoryCategory::Staging
+    );
+    const VkDeviceSize skew = (readbackBuffer.address + STORAGE_ALIGNMENT - 1) / STORAGE_ALIGNMENT * STORAGE_ALIGNMENT - readbackBuffer.address;
+
+    commandBuffer = device->BeginCommand();
+    for (size_t i = 0; i < handles.size(); i++) {
+        VkCopyAccelerationStructureToMemoryInfoKHR copyInfo{};
+        copyInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR;
+        copyInfo.src = handles[i];
+        copyInfo.dst.deviceAddress = readbackBuffer.address + skew + offsets[i];
+        copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR;
+        vkCmdCopyAccelerationStructureToMemoryKHR(commandBuffer, &copyInfo);
+    }
+
+    VkMemoryBarrier memoryBarrier{};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        VK_PIPELINE_STAGE_HOST_BIT,
+        0, 1, &memoryBarrier, 0, nullptr, 0, nullptr
+    );
+    device->FlushCommandBuffer(commandBuffer, device->_queue);
+
+    const unsigned char* mapped = static_cast<const unsigned char*>(readbackBuffer.Map(device->_device)) + skew;
+    for (size_t i = 0; i < handles.size(); i++) {
+        serialized[i].assign(mapped + offsets[i], mapped + offsets[i] + serializedSizes[i]);
+    }
+    readbackBuffer.Unmap(device->_device);
+    readbackBuffer.Destroy(device->_device);
+    return serialized;
+}
+
+vk::Buffer AccelerationStructure::Deserialize(VulkanDevice* device, const std::vector<AccelerationStructure*>& accelerationStructures, const std::vector<const unsigned char*>& data, const std::vector<size_t>& sizes) {
+
+    vk::Buffer storageBuffer;
+    if (accelerationStructures.empty()) {
+        return storageBuffer;
+    }
+
+    //the serialized data starts with the driver UUID, the compatibility UUID, the serialized size and the deserialized size
+    std::vector<VkDeviceSize> serializedSizes(sizes.begin(), sizes.end());
+    std::vector<VkDeviceSize> storageSizes(accelerationStructures.size());
+    std::vector<VkDeviceSize> sourceOffsets(accelerationStructures.size());
+    std::vector<VkDeviceSize> storageOffsets(accelerationStructures.size());
+    VkDeviceSize sourceSize = 0;
+    VkDeviceSize storageSize = 0;
+    for (size_t i = 0; i < accelerationStructures.size(); i++) {
+        memcpy(&storageSizes[i], data[i] + 2 * VK_UUID_SIZE + sizeof(uint64_t), sizeof(uint64_t));
+        sourceOffsets[i] = (sourceSize + STORAGE_ALIGNMENT - 1) / STORAGE_ALIGNMENT * STORAGE_ALIGNMENT;
+        sourceSize = sourceOffsets[i] + serializedSizes[i];
+        storageOffsets[i] = (storageSize + STORAGE_ALIGNMENT - 1) / STORAGE_ALIGNMENT * STORAGE_ALIGNMENT;
+        storageSize = storageOffsets[i] + storageSizes[i];
+    }
+
+    vk::Buffer sourceBuffer = device->CreateBuffer(
+        sourceSize + STORAGE_ALIGNMENT,
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        vk::MemoryCategory::Staging
+    );
+    const VkDeviceSize skew = (sourceBuffer.address + STORAGE_ALIGNMENT - 1) / STORAGE_ALIGNMENT * STORAGE_ALIGNMENT - sourceBuffer.address;
+    unsigned char* mapped = static_cast<unsigned char*>(sourceBuffer.Map(device->_device)) + skew;
+    for (size_t i = 0; i < accelerationStructures.size(); i++) {
+        memcpy(mapped + sourceOffsets[i], data[i], static_cast<size_t>(serializedSizes[i]));
+    }
+    sourceBuffer.Unmap(device->_device);
+
+    storageBuffer = device->CreateBuffer(
+        storageSize,
+        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        vk::MemoryCategory::BLAS
+    );
+
+    VkCommandBuffer commandBuffer = device->BeginCommand();
+    for (size_t i = 0; i < accelerationStructures.size(); i++) {
+        AccelerationStructure* accelerationStructure = accelerationStructures[i];
+
+        VkAccelerationStructureCreateInfoKHR createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+        createInfo.buffer = storageBuffer.buffer;
+        createInfo.offset = storageOffsets[i];
+        createInfo.size = storageSizes[i];
+        createInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
+        vkCreateAccelerationStructureKHR(device->_device, &createInfo, nullptr, &accelerationStructure->handle);
+
+        VkAccelerationStructureDeviceAddressInfoKHR deviceAddressInfo{};
+        deviceAddressInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR;
+        deviceAddressInfo.accelerationStructure = accelerationStructure->handle;
+        accelerationStructure->deviceAddress = vkGetAccelerationStructureDeviceAddressKHR(device->_device, &deviceAddressInfo);
+        //loaded structures are never rebuilt
+        accelerationStructure->buildScratchSize = 0;
+        accelerationStructure->updateScratchSize = 0;
+
+        VkCopyMemoryToAccelerationStructureInfoKHR copyInfo{};
+        copyInfo.sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR;
+        copyInfo.src.deviceAddress = sourceBuffer.address + skew + sourceOffsets[i];
+        copyInfo.dst = accelerationStructure->handle;
+        copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR;
+        vkCmdCopyMemoryToAccelerationStructureKHR(commandBuffer, &copyInfo);
+    }
+
+    VkMemoryBarrier memoryBarrier{};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+        0, 1, &memoryBarrier, 0, nullptr, 0, nullptr
+    );
+    device->FlushCommandBuffer(commandBuffer, device->_queue);
+
+    sourceBuffer.Destroy(device->_device);
+    return storageBuffer;
 }
 
 void AccelerationStructure::Destroy() {
-    vkDestroyBuffer(vulkanDevice->_device, asBuffer.buffer, nullptr);
-    vkFreeMemory(vulkanDevice->_device, asBuffer.memory, nullptr);
-    vkDestroyBuffer(vulkanDevice->_device, updateBuffer.buffer, nullptr);
-    vkFreeMemory(vulkanDevice->_device, updateBuffer.memory, nullptr);
+    asBuffer.Destroy(vulkanDevice->_device);
     vkDestroyAccelerationStructureKHR(vulkanDevice->_device, handle, nullptr);
 }
 
-AppBase::PolygonMesh::PolygonMesh(VulkanDevice* vulkandevice, vk::Buffer& vertBuffer, vk::Buffer& idxBuffer, uint32_t stride) {
+AppBase::PolygonMesh::PolygonMesh(VulkanDevice* vulkandevice, vk::Buffer& vertBuffer, vk::Buffer& idxBuffer, uint32_t stride, VkIndexType idxType) {
     blas = new AccelerationStructure(vulkandevice);
     vertexBuffer = vertBuffer;
     indexBuffer = idxBuffer;
     vertexStride = stride;
+    indexType = idxType;
 }
 
 void AppBase::PolygonMesh::BuildBLAS(VulkanDevice* vulkanDevice, VkBuildAccelerationStructureFlagsKHR flags) {
 
-    VkDeviceOrHostAddressConstKHR vertexBufferDeviceAddress{};
-    VkDeviceOrHostAddressConstKHR indexBufferDeviceAddress{};
-    vertexBufferDeviceAddress.deviceAddress = vertexBuffer.GetBufferDeviceAddress(vulkanDevice->_device);
-    indexBufferDeviceAddress.deviceAddress = indexBuffer.GetBufferDeviceAddress(vulkanDevice->_device);
+    std::vector<VkAccelerationStructureGeometryKHR> geometryInfos;
+    std::vector<uint32_t> primitiveCounts;
+    GetBLASGeometries(vulkanDevice, geometryInfos, primitiveCounts);
+    blas->CreateAccelerationStructureBuffer(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, geometryInfos, primitiveCounts, flags);
+}
+
+void AppBase::PolygonMesh::GetBLASGeometries(VulkanDevice* vulkanDevice, std::vector<VkAccelerationStructureGeometryKHR>& geometryInfos, std::vector<uint32_t>& primitiveCounts, bool host) {
 
-    uint32_t numTriangles = static_cast<uint32_t>(indexBuffer.count) / 3;
-    uint32_t maxVertex = vertexBuffer.count;
+    if (geometries.empty()) {
+        Geometry geometry;
+        geometry.firstIndex = firstIndex;
+        geometry.indexCount = indexCount > 0 ? indexCount : static_cast<uint32_t>(indexBuffer.count) - firstIndex;
+        geometry.indexType = indexType;
+        geometries.push_back(geometry);
+    }
+
+    //each geometry offsets its index range and, for indices relative to baseVertex, its vertex data
+    VkDeviceAddress vertexBufferAddress = 0;
+    VkDeviceAddress indexBufferAddress = 0;
+    if (host) {
+        if (!hostVertices || !hostIndices) {
+            throw std::runtime_error("host BLAS build without host geometry!");
+        }
+    }
+    else {
+        vertexBufferAddress = vertexBuffer.GetBufferDeviceAddress(vulkanDevice->_device);
+        indexBufferAddress = indexBuffer.GetBufferDeviceAddress(vulkanDevice->_device);
+    }
 
     VkAccelerationStructureGeometryKHR geometryInfo{};
     geometryInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
     geometryInfo.flags = VK_GEOMETRY_OPAQUE_BIT_KHR;
     geometryInfo.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR;
     geometryInfo.geometry.triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
-    geometryInfo.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
-    geometryInfo.geometry.triangles.vertexData = vertexBufferDeviceAddress;
-    geometryInfo.geometry.triangles.maxVertex = maxVertex;
+    geometryInfo.geometry.triangles.vertexFormat = vertexFormat;
     geometryInfo.geometry.triangles.vertexStride = vertexStride;
-    geometryInfo.geometry.triangles.indexType = VK_INDEX_TYPE_UINT32;
-    geometryInfo.geometry.triangles.indexData = indexBufferDeviceAddress;
     geometryInfo.geometry.triangles.transformData.deviceAddress = 0;
     geometryInfo.geometry.triangles.transformData.hostAddress = nullptr;
 
-    blas->CreateAccelerationStructureBuffer(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, geometryInfo, numTriangles, flags);
+    //quantized positions are scaled back to object space while building
+    if (vertexFormat != VK_FORMAT_R32G32B32_SFLOAT) {
+        VkTransformMatrixKHR dequantize = {
+            positionScale.x, 0.0f, 0.0f, positionOffset.x,
+            0.0f, positionScale.y, 0.0f, positionOffset.y,
+            0.0f, 0.0f, positionScale.z, positionOffset.z
+        };
+        if (host) {
+            hostTransform = dequantize;
+            geometryInfo.geometry.triangles.transformData.hostAddress = &hostTransform;
+        }
+        else {
+            if (transformBuffer.buffer == VK_NULL_HANDLE) {
+                transformBuffer = vulkanDevice->CreateBuffer(
+                    sizeof(VkTransformMatrixKHR),
+                    VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    vk::MemoryCategory::Geometry
+                );
+            }
+            void* data;
+            data = transformBuffer.Map(vulkanDevice->_device);
+            memcpy(data, &dequantize, sizeof(VkTransformMatrixKHR));
+            transformBuffer.Unmap(vulkanDevice->_device);
+            geometryInfo.geometry.triangles.transformData.deviceAddress = transformBuffer.address;
+        }
+    }
+
+    //one geometry per primitive, they share the vertex buffer and the transform
+    geometryInfos.clear();
+    primitiveCounts.clear();
+    for (const Geometry& geometry : geometries) {
+        const VkDeviceSize indexSize = geometry.indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+        const VkDeviceSize vertexOffset = VkDeviceSize(geometry.baseVertex) * vertexStride;
+        geometryInfo.geometry.triangles.indexType = geometry.indexType;
+        geometryInfo.geometry.triangles.maxVertex = vertexBuffer.count - geometry.baseVertex;
+        if (host) {
+            geometryInfo.geometry.triangles.vertexData.hostAddress = hostVertices->data() + vertexOffset;
+            geometryInfo.geometry.triangles.indexData.hostAddress = hostIndices->data() + geometry.firstIndex * indexSize;
+        }
+        else {
+            geometryInfo.geometry.triangles.vertexData.deviceAddress = vertexBufferAddress + vertexOffset;
+            geometryInfo.geometry.triangles.indexData.deviceAddress = indexBufferAddress + geometry.firstIndex * indexSize;
+        }
+        geometryInfos.push_back(geometryInfo);
+        primitiveCounts.push_back(geometry.indexCount / 3);
+    }
+}
+
+uint64_t AppBase::PolygonMesh::GetBLASCacheKey(VkBuildAccelerationStructureFlagsKHR flags) const {
+
+    //everything GetBLASGeometries passes to the build besides the buffer addresses
+    struct {
+        uint64_t contentHash;
+        uint32_t vertexFormat, vertexStride, indexType, maxVertex, flags, reserved;
+        glm::vec3 positionScale, positionOffset;
+    } desc{};
+    desc.contentHash = contentHash;
+    desc.vertexFormat = static_cast<uint32_t>(vertexFormat);
+    desc.vertexStride = vertexStride;
+    desc.indexType = static_cast<uint32_t>(indexType);
+    desc.maxVertex = vertexBuffer.count;
+    desc.flags = static_cast<uint32_t>(flags);
+    desc.positionScale = positionScale;
+    desc.positionOffset = positionOffset;
+
+    uint64_t key = utils::HashBytes(&desc, sizeof(desc));
+    return utils::HashBytes(geometries.data(), geometries.size() * sizeof(Geometry), key);
+}
+
+void AppBase::PolygonMesh::Destroy(VkDevice device) {
+    if (ownsBuffers) {
+        vertexBuffer.Destroy(device);
+        attributeBuffer.Destroy(device);
+        indexBuffer.Destroy(device);
+    }
+    transformBuffer.Destroy(device);
+    blas->Destroy();
+    delete blas;
 }
 
-vk::Image AppBase::CreateTextureImageAndView(uint32_t width, uint32_t height, VkFormat format, VkImageAspectFlags aspectFlags, VkImageUsageFlags usage, VkMemoryPropertyFlags memProps) {
+vk::Image AppBase::CreateTextureImageAndView(uint32_t width, uint32_t height, VkFormat format, VkImageAspectFlags aspectFlags, VkImageUsageFlags usage, VkMemoryPropertyFlags memProps, vk::MemoryCategory category) {
     
     //create image
     VkImageCreateInfo imageInfo{};
@@ -2088,28 +3785,14 @@ vk::Image AppBase::CreateTextureImageAndView(uint32_t width, uint32_t height, Vk
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-    VkImage image;
-    vkCreateImage(_vulkanDevice->_device, &imageInfo, nullptr, &image);
-
-    VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(_vulkanDevice->_device, image, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = _vulkanDevice->FindMemoryType(memRequirements.memoryTypeBits, memProps);
-
-    VkDeviceMemory memory;
-    if (vkAllocateMemory(_vulkanDevice->_device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate image memory!");
-    }
-
-    vkBindImageMemory(_vulkanDevice->_device, image, memory, 0);
+    vk::Image imageResource;
+    vkCreateImage(_vulkanDevice->_device, &imageInfo, nullptr, &imageResource.image);
+    _vulkanDevice->AllocateImageMemory(imageResource, memProps, category);
 
     //create image view
     VkImageViewCreateInfo viewInfo{};
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    viewInfo.image = image;
+    viewInfo.image = imageResource.image;
     viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
     viewInfo.format = format;
     viewInfo.components = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A };
@@ -2124,9 +3807,6 @@ vk::Image AppBase::CreateTextureImageAndView(uint32_t width, uint32_t height, Vk
         throw std::runtime_error("failed to create texture image view!");
     }
 
-    vk::Image imageResource;
-    imageResource.image = image;
-    imageResource.memory = memory;
     imageResource.view = view;
     return imageResource;
 }
@@ -2157,30 +3837,23 @@ vk::Image AppBase::Create2DTexture(const wchar_t* fileNames, VkImageUsageFlags u
         IMAGE_FORMAT,
         VK_IMAGE_ASPECT_COLOR_BIT,
         usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
-        memProps
+        memProps,
+        vk::MemoryCategory::Texture
     );
 
 
     //staging buffer
     auto imageSize = width * height * sizeof(uint32_t);
 
-    auto bufferSrc = _vulkanDevice->CreateBuffer(
-        imageSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-    );
-
-    void* data;
-    vkMapMemory(_vulkanDevice->_device, bufferSrc.memory, 0, VK_WHOLE_SIZE, 0, &data);
-    memcpy(data, image, imageSize);
-    vkUnmapMemory(_vulkanDevice->_device, bufferSrc.memory);
+    StagingRing::Region staging = _vulkanDevice->_uploadQueue.Allocate(imageSize);
+    memcpy(staging.data, image, imageSize);
 
     //copy buffer to image
-    VkCommandBuffer commandBuffer = _vulkanDevice->BeginCommand();
+    VkCommandBuffer commandBuffer = _vulkanDevice->_uploadQueue.GetCommandBuffer();
     textureResource.SetImageLayout(commandBuffer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1);
 
     VkBufferImageCopy region{};
-    region.bufferOffset = 0;
+    region.bufferOffset = staging.offset;
     region.bufferRowLength = 0;
     region.bufferImageHeight = 0;
     region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -2194,14 +3867,10 @@ vk::Image AppBase::Create2DTexture(const wchar_t* fileNames, VkImageUsageFlags u
         1
     };
 
-    vkCmdCopyBufferToImage(commandBuffer, bufferSrc.buffer, textureResource.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    vkCmdCopyBufferToImage(commandBuffer, staging.buffer, textureResource.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 
     
-    textureResource.SetImageLayout(commandBuffer, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1);
-    _vulkanDevice->FlushCommandBuffer(commandBuffer, _vulkanDevice->_queue);
-
-    vkDestroyBuffer(_vulkanDevice->_device, bufferSrc.buffer, nullptr);
-    vkFreeMemory(_vulkanDevice->_device, bufferSrc.memory, nullptr);
+    _vulkanDevice->_uploadQueue.ReleaseImage(textureResource, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1);
 
     textureResource.sampler = _vulkanDevice->CreateSampler();
     return textureResource;
@@ -2255,19 +3924,7 @@ vk::Image AppBase::CreateTextureCube(const wchar_t* fileNames[6], VkImageUsageFl
     vk::Image cubeMap;
     vkCreateImage(_vulkanDevice->_device, &imageInfo, nullptr, &cubeMap.image);
 
-    VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(_vulkanDevice->_device, cubeMap.image, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = _vulkanDevice->FindMemoryType(memRequirements.memoryTypeBits, memProps);
-
-    if (vkAllocateMemory(_vulkanDevice->_device, &allocInfo, nullptr, &cubeMap.memory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate image memory!");
-    }
-
-    vkBindImageMemory(_vulkanDevice->_device, cubeMap.image, cubeMap.memory, 0);
+    _vulkanDevice->AllocateImageMemory(cubeMap, memProps, vk::MemoryCategory::Texture);
 
     //create imageview
     VkImageViewCreateInfo viewInfo{};
@@ -2286,31 +3943,21 @@ vk::Image AppBase::CreateTextureCube(const wchar_t* fileNames[6], VkImageUsageFl
         throw std::runtime_error("failed to create texture image view!");
     }
 
-    //staging buffer
-    vk::Buffer buffers[6];
+    //staging buffer (the six faces side by side)
     auto imageSize = width * height * sizeof(uint32_t);
+    StagingRing::Region staging = _vulkanDevice->_uploadQueue.Allocate(imageSize * 6);
     for (uint32_t i = 0; i < 6; i++) {
-        buffers[i] = _vulkanDevice->CreateBuffer(
-            imageSize,
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-        );
-
-        void* data;
-        vkMapMemory(_vulkanDevice->_device, buffers[i].memory, 0, VK_WHOLE_SIZE, 0, &data);
-        memcpy(data, images[i], imageSize);
-        vkUnmapMemory(_vulkanDevice->_device, buffers[i].memory);
-
+        memcpy(static_cast<char*>(staging.data) + imageSize * i, images[i], imageSize);
     }
 
     //copy buffer to image
-    auto commandBuffer = _vulkanDevice->BeginCommand();
+    auto commandBuffer = _vulkanDevice->_uploadQueue.GetCommandBuffer();
     cubeMap.layerCount = 6;
     cubeMap.SetImageLayout(commandBuffer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1);
     for (uint32_t i = 0; i < 6; i++) {
 
         VkBufferImageCopy region{};
-        region.bufferOffset = 0;
+        region.bufferOffset = staging.offset + imageSize * i;
         region.bufferRowLength = 0;
         region.bufferImageHeight = 0;
         region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -2324,158 +3971,155 @@ vk::Image AppBase::CreateTextureCube(const wchar_t* fileNames[6], VkImageUsageFl
             1
         };
 
-        vkCmdCopyBufferToImage(commandBuffer, buffers[i].buffer, cubeMap.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-    }
-    cubeMap.SetImageLayout(commandBuffer, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1);
-    _vulkanDevice->FlushCommandBuffer(commandBuffer, _vulkanDevice->_queue);
-
-    for (auto buffer : buffers) {
-        vkDestroyBuffer(_vulkanDevice->_device, buffer.buffer, nullptr);
-        vkFreeMemory(_vulkanDevice->_device, buffer.memory, nullptr);
-    }
-
-    cubeMap.sampler = _vulkanDevice->CreateSampler();
-
-    return cubeMap;
-}
-
-void AppBase::PrepareMesh() {
-
-    //load gltf model
-    {
-        glTF::Model::GetglTF();
-        s_model->Connect(_vulkanDevice);
-        s_model->SetMemoryPropertyFlags(VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-        const uint32_t glTFLoadingFlags = glTF::FileLoadingFlags::PreTransformVertices | glTF::FileLoadingFlags::PreMultiplyVertexColors | glTF::FileLoadingFlags::FlipY;
-        s_model->LoadFromFile("Assets/reflectionScene/reflectionScene.gltf", glTFLoadingFlags);
+        vkCmdCopyBufferToImage(commandBuffer, staging.buffer, cubeMap.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 
-        r_meshGlTF = new PolygonMesh(_vulkanDevice, s_model->_vertices, s_model->_indices, sizeof(glTF::Vertex));
     }
+    _vulkanDevice->_uploadQueue.ReleaseImage(cubeMap, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1);
 
-    
-    //plane
-    {
-        vk::Buffer planeVertexBuffer;
-        vk::Buffer planeIndexBuffer;
-        std::vector <PrimitiveMesh::Vertex> vertices;
-        std::vector<uint32_t> indices;
-        PrimitiveMesh::GetPlane(vertices, indices);
-        uint32_t vertexSize = static_cast<uint32_t>(vertices.size() * sizeof(PrimitiveMesh::Vertex));
-        uint32_t indexSize = static_cast<uint32_t>(indices.size() * sizeof(uint32_t));
-
-        //vertex
-        vk::Buffer vertexStaging;
-        vertexStaging = _vulkanDevice->CreateBuffer(
-            vertexSize,
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-        );
+    cubeMap.sampler = _vulkanDevice->CreateSampler();
 
-        void* data;
-        vkMapMemory(_vulkanDevice->_device, vertexStaging.memory, 0, VK_WHOLE_SIZE, 0, &data);
-        memcpy(data, vertices.data(), vertexSize);
-        vkUnmapMemory(_vulkanDevice->_device, vertexStaging.memory);
+    return cubeMap;
+}
 
-        planeVertexBuffer = _vulkanDevice->CreateBuffer(
-            vertexSize,
-            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-        );
-        planeVertexBuffer.count = uint32_t(vertices.size());
+void AppBase::PrepareMesh() {
 
-        _vulkanDevice->CopyBuffer(vertexStaging.buffer, planeVertexBuffer.buffer, vertexSize);
+    //load gltf model
+    {
+        glTF::Model::GetglTF();
+        s_model->Connect(_vulkanDevice);
+        s_model->SetMemoryPropertyFlags(VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        const uint32_t glTFLoadingFlags = glTF::FileLoadingFlags::InstanceMeshes | glTF::FileLoadingFlags::PreMultiplyVertexColors | glTF::FileLoadingFlags::FlipY | glTF::FileLoadingFlags::DeferImageDecoding | glTF::FileLoadingFlags::PreferShortIndices | glTF::FileLoadingFlags::UseSceneCache | glTF::FileLoadingFlags::OptimizeMeshes | glTF::FileLoadingFlags::QuantizeVertices | glTF::FileLoadingFlags::SplitPositionStream |
+            ((r_hostBLASBuild || r_cpuReference) ? glTF::FileLoadingFlags::KeepHostGeometry : 0u);
+        s_model->LoadFromFile("Assets/reflectionScene/reflectionScene.gltf", glTFLoadingFlags);
 
-        vkDestroyBuffer(_vulkanDevice->_device, vertexStaging.buffer, nullptr);
-        vkFreeMemory(_vulkanDevice->_device, vertexStaging.memory, nullptr);
+        //glTF materials go in front of the scene object materials
+        r_gltfMaterials.clear();
+        for (const glTF::Material& gltfMaterial : s_model->GetMaterials()) {
+            Material material;
+            material.diffuse = gltfMaterial.baseColorFactor;
+            r_gltfMaterials.push_back(material);
+        }
 
-        //index
-        vk::Buffer indexStaging;
-        indexStaging = _vulkanDevice->CreateBuffer(
-            indexSize,
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-        );
+        //one BLAS geometry per primitive, the primitives of a mesh are loaded back to back
+        auto createGlTFMesh = [this](const std::vector<const glTF::Primitive*>& primitives) {
+            PolygonMesh* mesh = new PolygonMesh(_vulkanDevice, s_model->_vertices, s_model->_indices, s_model->_vertexStride);
+            mesh->vertexFormat = s_model->_vertexFormat;
+            mesh->positionScale = glm::make_vec3(s_model->_positionQuantization.scale);
+            mesh->positionOffset = glm::make_vec3(s_model->_positionQuantization.offset);
+            mesh->attributeBuffer = s_model->_attributes;
+            mesh->attributeStride = s_model->_attributeStride;
+            mesh->ownsBuffers = false;
+            mesh->contentHash = s_model->_geometryHash;
+            mesh->hostVertices = s_model->_hostVertices;
+            mesh->hostIndices = s_model->_hostIndices;
+            mesh->hostAttributes = s_model->_hostAttributes;
+
+            //the index type, the index offset and the base vertex are chosen per primitive by the model
+            const glTF::Material* materials = s_model->GetMaterials().data();
+            for (const glTF::Primitive* primitive : primitives) {
+                if (primitive->indexCount == 0) {
+                    continue;
+                }
+                PolygonMesh::Geometry geometry;
+                geometry.indexType = primitive->indexType;
+                geometry.firstIndex = static_cast<uint32_t>(primitive->indexOffset / (primitive->indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t)));
+                geometry.indexCount = primitive->indexCount;
+                geometry.materialIndex = static_cast<uint32_t>(&primitive->material - materials);
+                geometry.baseVertex = primitive->baseVertex;
+                mesh->geometries.push_back(geometry);
+            }
+            r_meshes.push_back(mesh);
+            return mesh;
+        };
 
-        vkMapMemory(_vulkanDevice->_device, indexStaging.memory, 0, VK_WHOLE_SIZE, 0, &data);
-        memcpy(data, indices.data(), indexSize);
-        vkUnmapMemory(_vulkanDevice->_device, indexStaging.memory);
+        r_gltfInstances.clear();
+        if (glTFLoadingFlags & glTF::FileLoadingFlags::InstanceMeshes) {
+            //one BLAS per glTF mesh, one instance per node that places it
+            std::unordered_map<int32_t, PolygonMesh*> meshes;
+            for (glTF::Node* node : s_model->GetLinearNodes()) {
+                if (!node->mesh || node->mesh->primitives.empty()) {
+                    continue;
+                }
+                PolygonMesh*& mesh = meshes[node->mesh->index];
+                if (!mesh) {
+                    mesh = createGlTFMesh({ node->mesh->primitives.begin(), node->mesh->primitives.end() });
+                }
+                r_gltfInstances.push_back({ mesh, node->getMatrix() });
+            }
+        }
+        else {
+            //deduplicated primitives are shared between nodes, build them once
+            std::vector<const glTF::Primitive*> primitives;
+            std::unordered_set<uint32_t> visited;
+            for (glTF::Node* node : s_model->GetLinearNodes()) {
+                if (!node->mesh) {
+                    continue;
+                }
+                for (const glTF::Primitive* primitive : node->mesh->primitives) {
+                    if (visited.insert(primitive->firstIndex).second) {
+                        primitives.push_back(primitive);
+                    }
+                }
+            }
+            r_gltfInstances.push_back({ createGlTFMesh(primitives), glm::mat4(1.0f) });
+        }
+    }
 
-        planeIndexBuffer = _vulkanDevice->CreateBuffer(
-            indexSize,
-            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+    auto uploadBuffer = [this](const void* src, uint32_t size, uint32_t count, VkBufferUsageFlags usage) {
+        vk::Buffer buffer = _vulkanDevice->CreateBuffer(
+            size,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            vk::MemoryCategory::Geometry
         );
-        planeIndexBuffer.count = uint32_t(indices.size());
+        buffer.count = count;
 
-        _vulkanDevice->CopyBuffer(indexStaging.buffer, planeIndexBuffer.buffer, indexSize);
+        _vulkanDevice->_uploadQueue.CopyBuffer(buffer.buffer, src, size);
+        return buffer;
+    };
 
-        vkDestroyBuffer(_vulkanDevice->_device, indexStaging.buffer, nullptr);
-        vkFreeMemory(_vulkanDevice->_device, indexStaging.memory, nullptr);
+    //primitive meshes keep positions and shading attributes in separate streams
+    auto createPrimitiveMesh = [&](const std::vector<PrimitiveMesh::Vertex>& vertices, const std::vector<uint32_t>& indices) {
+        std::vector<glm::vec3> positions;
+        std::vector<PrimitiveMesh::Attribute> attributes;
+        PrimitiveMesh::SplitVertices(vertices, positions, attributes);
+
+        const uint32_t vertexCount = uint32_t(vertices.size());
+        vk::Buffer vertexBuffer = uploadBuffer(positions.data(), static_cast<uint32_t>(positions.size() * sizeof(glm::vec3)), vertexCount, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+        vk::Buffer attributeBuffer = uploadBuffer(attributes.data(), static_cast<uint32_t>(attributes.size() * sizeof(PrimitiveMesh::Attribute)), vertexCount, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+        vk::Buffer indexBuffer = uploadBuffer(indices.data(), static_cast<uint32_t>(indices.size() * sizeof(uint32_t)), uint32_t(indices.size()), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+
+        PolygonMesh* mesh = new PolygonMesh(_vulkanDevice, vertexBuffer, indexBuffer, uint32_t(sizeof(glm::vec3)));
+        mesh->attributeBuffer = attributeBuffer;
+        mesh->attributeStride = uint32_t(sizeof(PrimitiveMesh::Attribute));
+        mesh->contentHash = utils::HashBytes(indices.data(), indices.size() * sizeof(uint32_t), utils::HashBytes(positions.data(), positions.size() * sizeof(glm::vec3)));
+        if (r_hostBLASBuild || r_cpuReference) {
+            const unsigned char* positionBytes = reinterpret_cast<const unsigned char*>(positions.data());
+            const unsigned char* indexBytes = reinterpret_cast<const unsigned char*>(indices.data());
+            const unsigned char* attributeBytes = reinterpret_cast<const unsigned char*>(attributes.data());
+            mesh->hostVertices = std::make_shared<std::vector<unsigned char>>(positionBytes, positionBytes + positions.size() * sizeof(glm::vec3));
+            mesh->hostIndices = std::make_shared<std::vector<unsigned char>>(indexBytes, indexBytes + indices.size() * sizeof(uint32_t));
+            mesh->hostAttributes = std::make_shared<std::vector<unsigned char>>(attributeBytes, attributeBytes + attributes.size() * sizeof(PrimitiveMesh::Attribute));
+        }
+        return mesh;
+    };
 
-        r_meshPlane = new PolygonMesh(_vulkanDevice, planeVertexBuffer, planeIndexBuffer, uint32_t(sizeof(PrimitiveMesh::Vertex)));
+    //plane
+    {
+        std::vector <PrimitiveMesh::Vertex> vertices;
+        std::vector<uint32_t> indices;
+        PrimitiveMesh::GetPlane(vertices, indices);
+        r_meshPlane = createPrimitiveMesh(vertices, indices);
+        r_meshes.push_back(r_meshPlane);
     }
 
     //sphere
     {
-        vk::Buffer sphereVertexBuffer;
-        vk::Buffer sphereIndexBuffer;
         std::vector <PrimitiveMesh::Vertex> vertices;
         std::vector<uint32_t> indices;
         PrimitiveMesh::GetSphere(vertices, indices, 1.0, 32, 32);
-        uint32_t vertexSize = static_cast<uint32_t>(vertices.size() * sizeof(PrimitiveMesh::Vertex));
-        uint32_t indexSize = static_cast<uint32_t>(indices.size() * sizeof(uint32_t));
-
-        //vertex
-        vk::Buffer vertexStaging;
-        vertexStaging = _vulkanDevice->CreateBuffer(
-            vertexSize,
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-        );
-
-        void* data;
-        vkMapMemory(_vulkanDevice->_device, vertexStaging.memory, 0, VK_WHOLE_SIZE, 0, &data);
-        memcpy(data, vertices.data(), vertexSize);
-        vkUnmapMemory(_vulkanDevice->_device, vertexStaging.memory);
-
-        sphereVertexBuffer = _vulkanDevice->CreateBuffer(
-            vertexSize,
-            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-        );
-        sphereVertexBuffer.count = uint32_t(vertices.size());
-
-        _vulkanDevice->CopyBuffer(vertexStaging.buffer, sphereVertexBuffer.buffer, vertexSize);
-
-        vkDestroyBuffer(_vulkanDevice->_device, vertexStaging.buffer, nullptr);
-        vkFreeMemory(_vulkanDevice->_device, vertexStaging.memory, nullptr);
-
-        //index
-        vk::Buffer indexStaging;
-        indexStaging = _vulkanDevice->CreateBuffer(
-            indexSize,
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-        );
-
-        vkMapMemory(_vulkanDevice->_device, indexStaging.memory, 0, VK_WHOLE_SIZE, 0, &data);
-        memcpy(data, indices.data(), indexSize);
-        vkUnmapMemory(_vulkanDevice->_device, indexStaging.memory);
-
-        sphereIndexBuffer = _vulkanDevice->CreateBuffer(
-            indexSize,
-            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
-        );
-        sphereIndexBuffer.count = uint32_t(indices.size());
-
-        _vulkanDevice->CopyBuffer(indexStaging.buffer, sphereIndexBuffer.buffer, indexSize);
-
-        vkDestroyBuffer(_vulkanDevice->_device, indexStaging.buffer, nullptr);
-        vkFreeMemory(_vulkanDevice->_device, indexStaging.memory, nullptr);
-
-        r_meshSphere = new PolygonMesh(_vulkanDevice, sphereVertexBuffer, sphereIndexBuffer, uint32_t(sizeof(PrimitiveMesh::Vertex)));
+        r_meshSphere = createPrimitiveMesh(vertices, indices);
+        r_meshes.push_back(r_meshSphere);
     }
 
 }
@@ -2486,6 +4130,10 @@ void AppBase::PrepareTexture() {
     for (const auto* fileName : { L"Assets/textures/trianglify-lowres.png", L"Assets/textures/land_ocean_ice_cloud.jpg" }) {
         auto usage = VK_IMAGE_USAGE_SAMPLED_BIT;
         r_textures.push_back(Create2DTexture(fileName, VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+        //IMAGE_FORMAT is srgb
+        if (r_cpuReference) {
+            r_hostTextures.push_back(LoadHostImage(fileName, true));
+        }
     }
 
     //background texture
@@ -2495,19 +4143,82 @@ void AppBase::PrepareTexture() {
         L"Assets/textures/posz.jpg", L"Assets/textures/negz.jpg"
     };
     r_cubeMap = CreateTextureCube(textures, VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    //the cube map is unorm
+    if (r_cpuReference) {
+        for (uint32_t i = 0; i < 6; i++) {
+            r_hostCubeMap[i] = LoadHostImage(textures[i], false);
+        }
+    }
 }
 
 void AppBase::CreateBLAS() {
     VkBuildAccelerationStructureFlagsKHR buildFlags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
-    r_meshGlTF->BuildBLAS(_vulkanDevice, buildFlags);
-    r_meshPlane->BuildBLAS(_vulkanDevice, buildFlags);
-    r_meshSphere->BuildBLAS(_vulkanDevice, buildFlags);
+
+    //every mesh needs its host copy, otherwise the device builds all of them
+    bool hostBuild = r_hostBLASBuild && _vulkanDevice->_accelerationStructureHostCommands;
+    for (PolygonMesh* mesh : r_meshes) {
+        hostBuild = hostBuild && mesh->hostVertices && mesh->hostIndices;
+    }
+
+    //the flags BuildBatch or BuildBatchOnHost builds with, host builds are not compacted
+    const VkBuildAccelerationStructureFlagsKHR cacheFlags = buildFlags | VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR |
+        (hostBuild ? 0 : VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR);
+
+    AccelerationStructureCache cache;
+    cache.Open(BLAS_CACHE_FILENAME, _vulkanDevice->_physicalDevice, _vulkanDevice->_device);
+
+    std::vector<AccelerationStructure::BuildInput> inputs;
+    //0 : the mesh is not cached
+    std::vector<uint64_t> keys;
+    std::vector<AccelerationStructure*> cached;
+    std::vector<const unsigned char*> cachedData;
+    std::vector<size_t> cachedSizes;
+    for (PolygonMesh* mesh : r_meshes) {
+        AccelerationStructure::BuildInput input;
+        input.accelerationStructure = mesh->blas;
+        mesh->GetBLASGeometries(_vulkanDevice, input.geometryInfos, input.primitiveCounts, hostBuild);
+
+        const uint64_t key = mesh->contentHash != 0 ? mesh->GetBLASCacheKey(cacheFlags) : 0;
+        size_t size = 0;
+        const unsigned char* data = key != 0 ? cache.Find(key, size) : nullptr;
+        if (data) {
+            cached.push_back(mesh->blas);
+            cachedData.push_back(data);
+            cachedSizes.push_back(size);
+            continue;
+        }
+        inputs.push_back(std::move(input));
+        keys.push_back(key);
+    }
+
+    r_blasCacheStorageBuffer = AccelerationStructure::Deserialize(_vulkanDevice, cached, cachedData, cachedSizes);
+    if (hostBuild) {
+        r_blasStorageBuffer = AccelerationStructure::BuildBatchOnHost(_vulkanDevice, inputs, buildFlags);
+    }
+    else {
+        //the meshes are static, compaction usually halves their storage
+        r_blasStorageBuffer = AccelerationStructure::BuildBatch(_vulkanDevice, inputs, buildFlags, true);
+    }
+
+    //the compacted structures are written, which is what the next launch loads
+    std::vector<AccelerationStructure*> built;
+    std::vector<uint64_t> builtKeys;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        if (keys[i] != 0) {
+            built.push_back(inputs[i].accelerationStructure);
+            builtKeys.push_back(keys[i]);
+        }
+    }
+    std::vector<std::vector<unsigned char>> serialized = AccelerationStructure::Serialize(_vulkanDevice, built);
+    for (size_t i = 0; i < serialized.size(); i++) {
+        cache.Add(builtKeys[i], std::move(serialized[i]));
+    }
+    cache.Write();
 }
 
 void AppBase::CreateSceneObject() {
     //glTF model
     r_gltfModel.transform = glm::translate(glm::mat4(1.0f), glm::vec3(-5.0f, -1.0f, 0.0f));
-    r_gltfModel.mesh = r_meshGlTF;
     r_gltfModel.material.materialType = LAMBERT;
     r_gltfModel.useShadow = false;
 
@@ -2522,43 +4233,60 @@ void AppBase::CreateSceneObject() {
     r_sphere.mesh = r_meshSphere;
     r_sphere.material.materialType = METAL;
     r_sphere.useShadow = false;
+    r_sphere.isDynamic = true;
 
+    //glTF nodes come first, they share the material of r_gltfModel
     r_sceneObjects.clear();
-    r_sceneObjects.push_back(r_gltfModel);
+    for (const MeshInstance& instance : r_gltfInstances) {
+        SceneObject object = r_gltfModel;
+        object.mesh = instance.mesh;
+        object.transform = r_gltfModel.transform * instance.transform;
+        r_sceneObjects.push_back(object);
+    }
     r_sceneObjects.push_back(r_ceiling);
     r_sceneObjects.push_back(r_sphere);
+    PartitionSceneObjects();
 }
 
-void AppBase::UpdateMaterialsBuffer() {
+void AppBase::PartitionSceneObjects() {
 
-    r_materialStorageBuffer.Destroy(_vulkanDevice->_device);
+    const auto firstDynamic = std::stable_partition(r_sceneObjects.begin(), r_sceneObjects.end(), [](const SceneObject& object) {
+        return !object.isDynamic;
+    });
+    r_dynamicObjectOffset = uint32_t(firstDynamic - r_sceneObjects.begin());
+}
+
+std::vector<AppBase::Material> AppBase::CollectMaterials() const {
 
-    std::vector<Material> materialParams;
+    //glTF materials follow the material type selected for the model
+    std::vector<Material> materialParams = r_gltfMaterials;
+    for (Material& material : materialParams) {
+        material.materialType = r_gltfModel.material.materialType;
+    }
     for (auto obj : r_sceneObjects) {
         materialParams.push_back(obj.material);
     }
+    return materialParams;
+}
 
-    auto materialStorageBufferSize = static_cast<uint32_t>(sizeof(Material) * materialParams.size());
-    auto stagingBuffer = _vulkanDevice->CreateBuffer(
-        materialStorageBufferSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-    );
+void AppBase::UpdateMaterialsBuffer() {
+
+    //a pending upload may still write into the old buffer
+    _vulkanDevice->_uploadQueue.Wait(_vulkanDevice->_uploadQueue.Submit());
+    r_materialStorageBuffer.Destroy(_vulkanDevice->_device);
 
-    void* data;
-    vkMapMemory(_vulkanDevice->_device, stagingBuffer.memory, 0, VK_WHOLE_SIZE, 0, &data);
-    memcpy(data, materialParams.data(), materialStorageBufferSize);
-    vkUnmapMemory(_vulkanDevice->_device, stagingBuffer.memory);
+    std::vector<Material> materialParams = CollectMaterials();
 
+    auto materialStorageBufferSize = static_cast<uint32_t>(sizeof(Material) * materialParams.size());
     r_materialStorageBuffer = _vulkanDevice->CreateBuffer(
         materialStorageBufferSize,
         VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        vk::MemoryCategory::Geometry
     );
 
     //write info to storage buffer
-    _vulkanDevice->CopyBuffer(stagingBuffer.buffer, r_materialStorageBuffer.buffer, materialStorageBufferSize);
-    stagingBuffer.Destroy(_vulkanDevice->_device);
+    _vulkanDevice->_uploadQueue.CopyBuffer(r_materialStorageBuffer.buffer, materialParams.data(), materialStorageBufferSize);
 
     //update descriptor
     VkDescriptorBufferInfo materialInfo{};
@@ -2580,96 +4308,478 @@ void AppBase::UpdateMaterialsBuffer() {
 void AppBase::CreateSceneBuffers() {
     
     std::vector<PrimParam> objParams;
-    std::vector<Material> materialParams;
+    std::vector<Material> materialParams = CollectMaterials();
+
+    //geometry table, gl_GeometryIndexEXT indexes the entries of a mesh
+    std::vector<GeometryParam> geometryParams;
+    for (PolygonMesh* mesh : r_meshes) {
+        mesh->geometryOffset = uint32_t(geometryParams.size());
+        for (const PolygonMesh::Geometry& geometry : mesh->geometries) {
+            GeometryParam geometryParam;
+            geometryParam.firstIndex = geometry.firstIndex;
+            geometryParam.materialIndex = geometry.materialIndex;
+            geometryParam.baseVertex = geometry.baseVertex;
+            geometryParam.useShortIndex = geometry.indexType == VK_INDEX_TYPE_UINT16 ? 1 : 0;
+            geometryParams.push_back(geometryParam);
+        }
+    }
+
+    {
+        auto geometryStorageBufferSize = static_cast<uint32_t>(sizeof(GeometryParam) * geometryParams.size());
+        r_geometryStorageBuffer = _vulkanDevice->CreateBuffer(
+            geometryStorageBufferSize,
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            vk::MemoryCategory::Geometry
+        );
+
+        _vulkanDevice->_uploadQueue.CopyBuffer(r_geometryStorageBuffer.buffer, geometryParams.data(), geometryStorageBufferSize);
+    }
+    const uint64_t geometryBufferAddress = r_geometryStorageBuffer.GetBufferDeviceAddress(_vulkanDevice->_device);
 
     for (auto obj : r_sceneObjects) {
         auto mesh = obj.mesh;
         PrimParam objParam;
         objParam.vertexBufferAddress = mesh->vertexBuffer.GetBufferDeviceAddress(_vulkanDevice->_device);
         objParam.indexBufferAddress = mesh->indexBuffer.GetBufferDeviceAddress(_vulkanDevice->_device);
-        //one scene obj has one material
-        objParam.materialIndex = uint32_t(materialParams.size());
+        //one scene obj has one material, used by the geometries without a glTF material
+        objParam.materialIndex = uint32_t(r_gltfMaterials.size() + objParams.size());
         objParam.useShadow = obj.useShadow;
+        objParam.useQuantizedVertex = mesh->vertexFormat == VK_FORMAT_R16G16B16A16_SNORM ? 1 : 0;
+        objParam.positionStride = mesh->vertexStride;
+        objParam.geometryBufferAddress = geometryBufferAddress + mesh->geometryOffset * sizeof(GeometryParam);
+        if (mesh->attributeBuffer.buffer != VK_NULL_HANDLE) {
+            objParam.attributeBufferAddress = mesh->attributeBuffer.GetBufferDeviceAddress(_vulkanDevice->_device);
+            objParam.attributeStride = mesh->attributeStride;
+        }
+        else {
+            //interleaved, the attributes follow the position
+            const uint32_t positionSize = objParam.useQuantizedVertex ? sizeof(vertexConverter::QuantizedVertex::pos) : sizeof(glm::vec3);
+            objParam.attributeBufferAddress = objParam.vertexBufferAddress + positionSize;
+            objParam.attributeStride = mesh->vertexStride;
+        }
+        objParam.positionScale = glm::vec4(mesh->positionScale, 0.0f);
+        objParam.positionOffset = glm::vec4(mesh->positionOffset, 0.0f);
         objParams.push_back(objParam);
-        materialParams.push_back(obj.material);
     }
 
     //scene objects
     {
         auto objectStorageBufferSize = static_cast<uint32_t>(sizeof(PrimParam) * objParams.size());
-        auto stagingBuffer = _vulkanDevice->CreateBuffer(
-            objectStorageBufferSize,
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-        );
-
-        void* data;
-        vkMapMemory(_vulkanDevice->_device, stagingBuffer.memory, 0, VK_WHOLE_SIZE, 0, &data);
-        memcpy(data, objParams.data(), objectStorageBufferSize);
-        vkUnmapMemory(_vulkanDevice->_device, stagingBuffer.memory);
-
-
         r_objectStorageBuffer = _vulkanDevice->CreateBuffer(
             objectStorageBufferSize,
             VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            vk::MemoryCategory::Geometry
         );
 
         //write info to storage buffer
-        _vulkanDevice->CopyBuffer(stagingBuffer.buffer, r_objectStorageBuffer.buffer, objectStorageBufferSize);
-        stagingBuffer.Destroy(_vulkanDevice->_device);
+        _vulkanDevice->_uploadQueue.CopyBuffer(r_objectStorageBuffer.buffer, objParams.data(), objectStorageBufferSize);
     }
 
     //materials
     {
         auto materialStorageBufferSize = static_cast<uint32_t>(sizeof(Material) * materialParams.size());
-        auto stagingBuffer = _vulkanDevice->CreateBuffer(
-            materialStorageBufferSize,
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-        );
-
-        void* data;
-        vkMapMemory(_vulkanDevice->_device, stagingBuffer.memory, 0, VK_WHOLE_SIZE, 0, &data);
-        memcpy(data, materialParams.data(), materialStorageBufferSize);
-        vkUnmapMemory(_vulkanDevice->_device, stagingBuffer.memory);
-
         r_materialStorageBuffer = _vulkanDevice->CreateBuffer(
             materialStorageBufferSize,
             VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            vk::MemoryCategory::Geometry
         );
 
 
         //write info to storage buffer
-        _vulkanDevice->CopyBuffer(stagingBuffer.buffer, r_materialStorageBuffer.buffer, materialStorageBufferSize);
-        stagingBuffer.Destroy(_vulkanDevice->_device);
+        _vulkanDevice->_uploadQueue.CopyBuffer(r_materialStorageBuffer.buffer, materialParams.data(), materialStorageBufferSize);
     }
 
 }
 
-void AppBase::UpdateTLAS(VkCommandBuffer commandBuffer) {
-    
-    std::vector<VkAccelerationStructureInstanceKHR> instances;
-    VkAccelerationStructureInstanceKHR instance{};
+cpuRayTracer::Scene AppBase::CreateCPUScene() const {
+
+    cpuRayTracer::Scene scene;
+
+    //the same layout as the PrimParams of CreateSceneBuffers
+    std::unordered_map<const PolygonMesh*, uint32_t> meshIndices;
+    for (const PolygonMesh* mesh : r_meshes) {
+        if (!mesh->hostVertices || !mesh->hostIndices) {
+            throw std::runtime_error("failed to find host geometry for the CPU ray tracer!");
+        }
+        cpuRayTracer::Mesh cpuMesh;
+        cpuMesh.vertices = mesh->hostVertices->data();
+        cpuMesh.positionStride = mesh->vertexStride;
+        cpuMesh.quantized = mesh->vertexFormat == VK_FORMAT_R16G16B16A16_SNORM;
+        cpuMesh.positionScale = mesh->positionScale;
+        cpuMesh.positionOffset = mesh->positionOffset;
+        if (mesh->attributeBuffer.buffer != VK_NULL_HANDLE) {
+            if (!mesh->hostAttributes) {
+                throw std::runtime_error("failed to find host attributes for the CPU ray tracer!");
+            }
+            cpuMesh.attributes = mesh->hostAttributes->data();
+            cpuMesh.attributeStride = mesh->attributeStride;
+        }
+        else {
+            //interleaved, the attributes follow the position
+            const uint32_t positionSize = cpuMesh.quantized ? sizeof(vertexConverter::QuantizedVertex::pos) : sizeof(glm::vec3);
+            cpuMesh.attributes = mesh->hostVertices->data() + positionSize;
+            cpuMesh.attributeStride = mesh->vertexStride;
+        }
+        cpuMesh.indices = mesh->hostIndices->data();
+        for (const PolygonMesh::Geometry& geometry : mesh->geometries) {
+            cpuRayTracer::Geometry cpuGeometry;
+            cpuGeometry.firstIndex = geometry.firstIndex;
+            cpuGeometry.indexCount = geometry.indexCount;
+            cpuGeometry.materialIndex = geometry.materialIndex;
+            cpuGeometry.baseVertex = geometry.baseVertex;
+            cpuGeometry.shortIndices = geometry.indexType == VK_INDEX_TYPE_UINT16;
+            cpuMesh.geometries.push_back(cpuGeometry);
+        }
+        meshIndices[mesh] = uint32_t(scene.meshes.size());
+        scene.meshes.push_back(cpuMesh);
+    }
+
+    for (size_t i = 0; i < r_sceneObjects.size(); i++) {
+        const SceneObject& object = r_sceneObjects[i];
+        cpuRayTracer::Instance instance;
+        instance.mesh = meshIndices.at(object.mesh);
+        instance.transform = object.transform;
+        instance.materialIndex = uint32_t(r_gltfMaterials.size() + i);
+        instance.useShadow = object.useShadow != 0;
+        scene.instances.push_back(instance);
+    }
+
+    for (const Material& material : CollectMaterials()) {
+        cpuRayTracer::Material cpuMaterial;
+        cpuMaterial.diffuse = material.diffuse;
+        cpuMaterial.specular = material.specular;
+        cpuMaterial.materialType = material.materialType;
+        cpuMaterial.textureIndex = int32_t(material.textureIndex);
+        scene.materials.push_back(cpuMaterial);
+    }
+
+    scene.textures = r_hostTextures;
+    for (uint32_t i = 0; i < 6; i++) {
+        scene.background[i] = r_hostCubeMap[i];
+    }
+    return scene;
+}
+
+void AppBase::RenderOnCPU(const std::string& filename) {
+
+    const cpuRayTracer::Scene scene = CreateCPUScene();
+    ThreadPool threadPool;
+    const cpuRayTracer::Renderer renderer(scene, &threadPool);
+
+    //the uniforms of the last frame
+    cpuRayTracer::Uniforms uniforms;
+    uniforms.viewInverse = _uniformData.viewInverse;
+    uniforms.projInverse = _uniformData.projInverse;
+    uniforms.lightDirection = _uniformData.lightDirection;
+    uniforms.lightColor = _uniformData.lightColor;
+    uniforms.ambientColor = _uniformData.ambientColor;
+    uniforms.cameraPosition = _uniformData.cameraPosition;
+    uniforms.pointLightPosition = _uniformData.pointLightPosition;
+    uniforms.shaderFlags = _uniformData.shaderFlags;
+
+    //the size of r_strageImage
+    cpuRayTracer::RenderSettings settings;
+    settings.width = _swapchain->_extent.width;
+    settings.height = _swapchain->_extent.height;
+
+    std::vector<uint8_t> pixels;
+    const cpuRayTracer::RenderStats stats = renderer.Render(uniforms, settings, pixels, &threadPool);
+
+    std::cout << "CPU reference : " << settings.width << "x" << settings.height
+        << " BVH " << renderer.GetBuildTime() << "ms, render " << stats.renderTime << "ms, "
+        << stats.GetRayCount() << " rays (primary " << stats.primaryRays << ", secondary " << stats.secondaryRays << ", shadow " << stats.shadowRays << "), "
+        << stats.GetRaysPerSecond() * 1e-6 << " Mrays/s on " << stats.threadCount << " threads, "
+        << stats.stolenTiles << "/" << stats.tileCount << " tiles stolen" << std::endl;
+
+    if (!cpuRayTracer::WriteBmp(filename, settings.width, settings.height, pixels.data())) {
+        std::cerr << "failed to write " << filename << std::endl;
+    }
+}
+
+void AppBase::SetObjectTransform(uint32_t objectIndex, const glm::mat4& transform) {
+
+    SceneObject& object = r_sceneObjects[objectIndex];
+    if (object.transform == transform) {
+        return;
+    }
+    object.transform = transform;
+    ++r_transformVersion;
+    if (!object.isDynamic) {
+        r_staticTransformVersion = r_transformVersion;
+        r_staticMinPosition = glm::min(r_staticMinPosition, glm::vec3(transform[3]));
+        r_staticMaxPosition = glm::max(r_staticMaxPosition, glm::vec3(transform[3]));
+    }
+    //objects added since the last pack are picked up by PackInstances
+    if (objectIndex < r_instances.size()) {
+        r_instances[objectIndex].transform = utils::ConvertFrom4x4To3x4(transform);
+        r_instanceVersions[objectIndex] = r_transformVersion;
+    }
+}
+
+float AppBase::GetInstanceExtent() const {
+
+    //only the dynamic objects are visited, the static bounds are kept by PackInstances
+    glm::vec3 minPosition = r_staticMinPosition;
+    glm::vec3 maxPosition = r_staticMaxPosition;
+    for (size_t i = r_dynamicObjectOffset; i < r_sceneObjects.size(); i++) {
+        const glm::vec3 position = glm::vec3(r_sceneObjects[i].transform[3]);
+        minPosition = glm::min(minPosition, position);
+        maxPosition = glm::max(maxPosition, position);
+    }
+    if (minPosition.x > maxPosition.x) {
+        return 0.0f;
+    }
+    return glm::length(maxPosition - minPosition);
+}
 
+void AppBase::PackInstances() {
+
+    VkAccelerationStructureInstanceKHR instance{};
     instance.instanceCustomIndex = 0;
     instance.mask = 0xFF;
     instance.flags = 0;
-    for (auto obj : r_sceneObjects) {
-        auto asInstance = instance;
+
+    r_instances.resize(r_sceneObjects.size());
+    r_instanceVersions.assign(r_sceneObjects.size(), r_transformVersion);
+    r_staticMinPosition = glm::vec3(std::numeric_limits<float>::max());
+    r_staticMaxPosition = glm::vec3(std::numeric_limits<float>::lowest());
+    for (uint32_t i = 0; i < r_dynamicObjectOffset; i++) {
+        r_staticMinPosition = glm::min(r_staticMinPosition, glm::vec3(r_sceneObjects[i].transform[3]));
+        r_staticMaxPosition = glm::max(r_staticMaxPosition, glm::vec3(r_sceneObjects[i].transform[3]));
+    }
+    for (size_t i = 0; i < r_sceneObjects.size(); i++) {
+        const SceneObject& obj = r_sceneObjects[i];
+        VkAccelerationStructureInstanceKHR& asInstance = r_instances[i];
+        asInstance = instance;
         asInstance.transform = utils::ConvertFrom4x4To3x4(obj.transform);
         asInstance.instanceCustomIndex = obj.index;
         asInstance.instanceShaderBindingTableRecordOffset = obj.shaderOffset;
         asInstance.accelerationStructureReference = obj.mesh->blas->deviceAddress;
-        instances.push_back(asInstance);
+    }
+}
+
+void AppBase::WriteInstances(InstanceBuffer& instanceBuffer) {
+
+    if (instanceBuffer.buffer.buffer == VK_NULL_HANDLE) {
+        instanceBuffer.buffer = _vulkanDevice->CreateBuffer(
+            sizeof(VkAccelerationStructureInstanceKHR) * r_tlasInstanceCapacity,
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            vk::MemoryCategory::TLAS
+        );
+        //stays mapped until the buffer is destroyed
+        instanceBuffer.buffer.mapped = instanceBuffer.buffer.Map(_vulkanDevice->_device);
+        instanceBuffer.buffer.GetBufferDeviceAddress(_vulkanDevice->_device);
+        instanceBuffer.instanceCount = 0;
+    }
+
+    auto* records = static_cast<VkAccelerationStructureInstanceKHR*>(instanceBuffer.buffer.mapped);
+    const uint32_t instanceCount = uint32_t(r_instances.size());
+    if (instanceBuffer.instanceCount != instanceCount) {
+        memcpy(records, r_instances.data(), sizeof(VkAccelerationStructureInstanceKHR) * instanceCount);
+    }
+    else {
+        //copy the runs of records changed since this buffer was last written
+        //the static region is only visited when a static object has moved since then
+        const uint64_t writtenVersion = instanceBuffer.transformVersion;
+        const uint32_t first = r_staticTransformVersion > writtenVersion ? 0 : std::min(r_dynamicObjectOffset, instanceCount);
+        for (uint32_t i = first; i < instanceCount;) {
+            if (r_instanceVersions[i] <= writtenVersion) {
+                i++;
+                continue;
+            }
+            uint32_t end = i + 1;
+            while (end < instanceCount && r_instanceVersions[end] > writtenVersion) {
+                end++;
+            }
+            memcpy(records + i, r_instances.data() + i, sizeof(VkAccelerationStructureInstanceKHR) * (end - i));
+            i = end;
+        }
+    }
+    instanceBuffer.transformVersion = r_transformVersion;
+    instanceBuffer.instanceCount = instanceCount;
+}
+
+void AppBase::CreateInstanceGeneration() {
+
+    const VkBufferUsageFlags inputUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    r_objectTransformBuffer = _vulkanDevice->CreateBuffer(
+        sizeof(glm::mat4) * r_tlasInstanceCapacity,
+        inputUsage,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        vk::MemoryCategory::TLAS
+    );
+    r_instanceParamBuffer = _vulkanDevice->CreateBuffer(
+        sizeof(InstanceParam) * r_tlasInstanceCapacity,
+        inputUsage,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        vk::MemoryCategory::TLAS
+    );
+    r_gpuInstanceBuffer = _vulkanDevice->CreateBuffer(
+        sizeof(VkAccelerationStructureInstanceKHR) * r_tlasInstanceCapacity,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        vk::MemoryCategory::TLAS
+    );
+    UploadInstanceData();
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.size = sizeof(InstanceGenerationConstants);
+    pushConstantRange.offset = 0;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    if (vkCreatePipelineLayout(_vulkanDevice->_device, &pipelineLayoutInfo, nullptr, &r_instancePipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline layout!");
+    }
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage = _shader->LoadShaderProgram("Shaders/raytracingMaterials/instances.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+    pipelineInfo.layout = r_instancePipelineLayout;
+    const VkResult result = vkCreateComputePipelines(_vulkanDevice->_device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &r_instancePipeline);
+    vkDestroyShaderModule(_vulkanDevice->_device, pipelineInfo.stage.module, nullptr);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("failed to create instance generation pipeline!");
+    }
+}
+
+void AppBase::UploadInstanceData() {
+
+    const uint32_t instanceCount = uint32_t(r_instances.size());
+    std::vector<InstanceParam> params(instanceCount);
+    std::vector<glm::mat4> transforms(instanceCount);
+    for (uint32_t i = 0; i < instanceCount; i++) {
+        const VkAccelerationStructureInstanceKHR& instance = r_instances[i];
+        params[i].accelerationStructureReference = instance.accelerationStructureReference;
+        params[i].customIndexAndMask = instance.instanceCustomIndex | (instance.mask << 24);
+        params[i].sbtOffsetAndFlags = instance.instanceShaderBindingTableRecordOffset | (instance.flags << 24);
+        transforms[i] = r_sceneObjects[i].transform;
+    }
+    _vulkanDevice->_uploadQueue.CopyBuffer(r_instanceParamBuffer.buffer, params.data(), sizeof(InstanceParam) * instanceCount);
+    _vulkanDevice->_uploadQueue.CopyBuffer(r_objectTransformBuffer.buffer, transforms.data(), sizeof(glm::mat4) * instanceCount);
+}
+
+void AppBase::RecordInstanceGeneration(VkCommandBuffer commandBuffer, uint32_t instanceCount, uint64_t writtenVersion) {
+
+    //the pass and the build of the previous frame read the buffers written here
+    VkMemoryBarrier memoryBarrier{};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &memoryBarrier, 0, nullptr, 0, nullptr
+    );
+
+    //the transforms changed since the TLAS was built go inline in the command buffer
+    //which keeps them on this queue and drops them with the recording if it is never submitted
+    std::vector<glm::mat4> transforms;
+    const uint32_t first = r_staticTransformVersion > writtenVersion ? 0 : std::min(r_dynamicObjectOffset, instanceCount);
+    for (uint32_t i = first; i < instanceCount;) {
+        if (r_instanceVersions[i] <= writtenVersion) {
+            i++;
+            continue;
+        }
+        uint32_t end = i + 1;
+        while (end < instanceCount && end - i < MAX_INLINE_TRANSFORM_COUNT && r_instanceVersions[end] > writtenVersion) {
+            end++;
+        }
+        transforms.clear();
+        for (uint32_t j = i; j < end; j++) {
+            transforms.push_back(r_sceneObjects[j].transform);
+        }
+        vkCmdUpdateBuffer(commandBuffer, r_objectTransformBuffer.buffer, sizeof(glm::mat4) * i, sizeof(glm::mat4) * transforms.size(), transforms.data());
+        i = end;
+    }
+
+    memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &memoryBarrier, 0, nullptr, 0, nullptr
+    );
+
+    InstanceGenerationConstants constants;
+    constants.transformAddress = r_objectTransformBuffer.address;
+    constants.paramAddress = r_instanceParamBuffer.address;
+    constants.instanceAddress = r_gpuInstanceBuffer.address;
+    constants.instanceCount = instanceCount;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, r_instancePipeline);
+    vkCmdPushConstants(commandBuffer, r_instancePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(InstanceGenerationConstants), &constants);
+    vkCmdDispatch(commandBuffer, (instanceCount + INSTANCE_GENERATION_GROUP_SIZE - 1) / INSTANCE_GENERATION_GROUP_SIZE, 1, 1);
+
+    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        0, 1, &memoryBarrier, 0, nullptr, 0, nullptr
+    );
+}
+
+AppBase::TLASState AppBase::UpdateTLAS(VkCommandBuffer commandBuffer, VkDeviceAddress scratchAddress, InstanceBuffer& instanceBuffer) {
+
+    TLASState state = r_tlasState;
+    const uint32_t instanceCount = uint32_t(r_sceneObjects.size());
+    if (instanceCount > r_tlasInstanceCapacity) {
+        throw std::runtime_error("too many instances for the TLAS, it has to be recreated!");
+    }
+
+    //nothing has moved since the TLAS was built
+    if (instanceCount == state.instanceCount && state.transformVersion == r_transformVersion) {
+        return state;
+    }
+
+    //instances added or removed, a static object moved, or the refit tree has degraded too far
+    const float extent = GetInstanceExtent();
+    const bool rebuild =
+        instanceCount != state.instanceCount ||
+        r_staticTransformVersion > state.transformVersion ||
+        state.refitCount >= MAX_TLAS_REFIT_COUNT ||
+        extent > state.buildExtent * MAX_TLAS_EXTENT_GROWTH;
+
+    state.transformVersion = r_transformVersion;
+    state.instanceCount = instanceCount;
+    if (rebuild) {
+        state.refitCount = 0;
+        state.buildExtent = extent;
+    }
+    else {
+        state.refitCount++;
     }
 
-    auto instanceBufferSize = static_cast<uint32_t>(sizeof(VkAccelerationStructureInstanceKHR) * instances.size());
-    memcpy(r_instanceBuffer.mapped, instances.data(), instanceBufferSize);
+    const bool packed = r_instances.size() != r_sceneObjects.size();
+    if (packed) {
+        PackInstances();
+    }
 
     VkDeviceOrHostAddressConstKHR instanceDataDeviceAddress{};
-    instanceDataDeviceAddress.deviceAddress = r_instanceBuffer.GetBufferDeviceAddress(_vulkanDevice->_device);
+    if (r_gpuInstanceGeneration) {
+        //a full upload is submitted before this frame, which waits for it
+        if (packed) {
+            UploadInstanceData();
+        }
+        RecordInstanceGeneration(commandBuffer, instanceCount, packed ? r_transformVersion : r_tlasState.transformVersion);
+        instanceDataDeviceAddress.deviceAddress = r_gpuInstanceBuffer.address;
+    }
+    else {
+        //the fence of this frame has signalled, so its buffer is no longer read
+        WriteInstances(instanceBuffer);
+        instanceDataDeviceAddress.deviceAddress = instanceBuffer.buffer.address;
+    }
 
     VkAccelerationStructureGeometryKHR geometryInfo{};
     geometryInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
@@ -2679,40 +4789,22 @@ void AppBase::UpdateTLAS(VkCommandBuffer commandBuffer) {
     geometryInfo.geometry.instances.arrayOfPointers = VK_FALSE;
     geometryInfo.geometry.instances.data = instanceDataDeviceAddress;
     VkBuildAccelerationStructureFlagsKHR buildFlags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
-    r_topLevelAS->Update(commandBuffer, VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR, geometryInfo, uint32_t(instances.size()), buildFlags);
+    const VkBuildAccelerationStructureModeKHR mode = rebuild ? VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR : VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+    r_topLevelAS->Update(commandBuffer, scratchAddress, VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR, geometryInfo, instanceCount, buildFlags, mode);
+    return state;
 }
 
 void AppBase::CreateTLAS() {
 
-    std::vector<VkAccelerationStructureInstanceKHR> instances;
-    VkAccelerationStructureInstanceKHR instance{};
-
-    instance.instanceCustomIndex = 0;
-    instance.mask = 0xFF;
-    instance.flags = 0;
-
-    for (auto obj : r_sceneObjects) {
-        auto asInstance = instance;
-        asInstance.transform = utils::ConvertFrom4x4To3x4(obj.transform);
-        asInstance.instanceCustomIndex = obj.index;
-        asInstance.instanceShaderBindingTableRecordOffset = obj.shaderOffset;
-        asInstance.accelerationStructureReference = obj.mesh->blas->deviceAddress;
-        instances.push_back(asInstance);
-    }
-
-    auto instanceBufferSize = static_cast<uint32_t>(sizeof(VkAccelerationStructureInstanceKHR) * instances.size());
-    r_instanceBuffer = _vulkanDevice->CreateBuffer(
-        instanceBufferSize,
-        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-    );
+    PackInstances();
+    r_tlasInstanceCapacity = uint32_t(r_instances.size());
 
-    vkMapMemory(_vulkanDevice->_device, r_instanceBuffer.memory, 0, VK_WHOLE_SIZE, 0, &r_instanceBuffer.mapped);
-    memcpy(r_instanceBuffer.mapped, instances.data(), instanceBufferSize);
-    vkUnmapMemory(_vulkanDevice->_device, r_instanceBuffer.memory);
+    //the first build reads a buffer of its own, the frames write theirs when something moves
+    InstanceBuffer instanceBuffer;
+    WriteInstances(instanceBuffer);
 
     VkDeviceOrHostAddressConstKHR instanceDataDeviceAddress{};
-    instanceDataDeviceAddress.deviceAddress = r_instanceBuffer.GetBufferDeviceAddress(_vulkanDevice->_device);
+    instanceDataDeviceAddress.deviceAddress = instanceBuffer.buffer.address;
 
     VkAccelerationStructureGeometryKHR geometryInfo{};
     geometryInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR;
@@ -2723,7 +4815,14 @@ void AppBase::CreateTLAS() {
     geometryInfo.geometry.instances.data = instanceDataDeviceAddress;
     r_topLevelAS = new AccelerationStructure(_vulkanDevice);
     VkBuildAccelerationStructureFlagsKHR buildFlags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
-    r_topLevelAS->CreateAccelerationStructureBuffer(VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR, geometryInfo, uint32_t(instances.size()), buildFlags);
+    r_topLevelAS->CreateAccelerationStructureBuffer(VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR, geometryInfo, r_tlasInstanceCapacity, buildFlags);
+    //the build has finished (FlushCommandBuffer waits for it)
+    instanceBuffer.buffer.Destroy(_vulkanDevice->_device);
+
+    r_tlasState = TLASState();
+    r_tlasState.transformVersion = r_transformVersion;
+    r_tlasState.instanceCount = r_tlasInstanceCapacity;
+    r_tlasState.buildExtent = GetInstanceExtent();
 }
 
 void AppBase::CreateStrageImage() {
@@ -2734,7 +4833,8 @@ void AppBase::CreateStrageImage() {
         SWAPCHAIN_COLOR_FORMAT,
         VK_IMAGE_ASPECT_COLOR_BIT,
         VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        vk::MemoryCategory::RenderTarget
     );
     
     auto commandBuffer = _vulkanDevice->BeginCommand();
@@ -2756,10 +4856,11 @@ void AppBase::CreateUniformBuffer() {
     r_uniformBuffer = _vulkanDevice->CreateBuffer(
         bufferSize,
         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        vk::MemoryCategory::Uniform
     );
 
-    vkMapMemory(_vulkanDevice->_device, r_uniformBuffer.memory, 0, VK_WHOLE_SIZE, 0, &r_uniformBuffer.mapped);
+    r_uniformBuffer.mapped = r_uniformBuffer.Map(_vulkanDevice->_device);
 
     UpdateUniformBuffer();
 }
@@ -2926,25 +5027,25 @@ VkPhysicalDeviceRayTracingPipelinePropertiesKHR AppBase::GetRayTracingPipelinePr
 void AppBase::CreateShaderBindingTable() {
     const auto raytracingPipelineProperties = GetRayTracingPipelineProperties();
     
-    //eGg̃TCY߂
+    //各エントリのサイズを求める
     const uint32_t handleSize = raytracingPipelineProperties.shaderGroupHandleSize;
     const uint32_t handleAligned = raytracingPipelineProperties.shaderGroupHandleAlignment;
     const uint32_t handleSizeAligned = utils::GetAlinedSize(handleSize, handleAligned);
     const uint32_t shaderGroupSize = static_cast<uint32_t>(r_shaderGroups.size()) * handleAligned;
 
-    //VF[_[O[ṽnh擾
+    //シェーダーグループのハンドルを取得する
     std::vector<uint8_t> shaderHandleStorage(shaderGroupSize);
     vkGetRayTracingShaderGroupHandlesKHR(_vulkanDevice->_device, r_pipeline, 0, static_cast<uint32_t>(r_shaderGroups.size()), shaderGroupSize, shaderHandleStorage.data());
 
     const VkBufferUsageFlags bufferUsageFlags = VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
     const VkMemoryPropertyFlags propertyFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
-    r_raygenShaderBindingTable = _vulkanDevice->CreateBuffer(handleSize, bufferUsageFlags, propertyFlags);
-    r_missShaderBindingTable = _vulkanDevice->CreateBuffer(handleSize * 2, bufferUsageFlags, propertyFlags);
-    r_hitShaderBindingTable = _vulkanDevice->CreateBuffer(handleSize, bufferUsageFlags, propertyFlags);
+    r_raygenShaderBindingTable = _vulkanDevice->CreateBuffer(handleSize, bufferUsageFlags, propertyFlags, vk::MemoryCategory::SBT);
+    r_missShaderBindingTable = _vulkanDevice->CreateBuffer(handleSize * 2, bufferUsageFlags, propertyFlags, vk::MemoryCategory::SBT);
+    r_hitShaderBindingTable = _vulkanDevice->CreateBuffer(handleSize, bufferUsageFlags, propertyFlags, vk::MemoryCategory::SBT);
 
-    vkMapMemory(_vulkanDevice->_device, r_raygenShaderBindingTable.memory, 0, VK_WHOLE_SIZE, 0, &r_raygenShaderBindingTable.mapped);
-    vkMapMemory(_vulkanDevice->_device, r_missShaderBindingTable.memory, 0, VK_WHOLE_SIZE, 0, &r_missShaderBindingTable.mapped);
-    vkMapMemory(_vulkanDevice->_device, r_hitShaderBindingTable.memory, 0, VK_WHOLE_SIZE, 0, &r_hitShaderBindingTable.mapped);
+    r_raygenShaderBindingTable.mapped = r_raygenShaderBindingTable.Map(_vulkanDevice->_device);
+    r_missShaderBindingTable.mapped = r_missShaderBindingTable.Map(_vulkanDevice->_device);
+    r_hitShaderBindingTable.mapped = r_hitShaderBindingTable.Map(_vulkanDevice->_device);
     
     memcpy(r_raygenShaderBindingTable.mapped, shaderHandleStorage.data() + handleSizeAligned * raygenShaderIndex, handleSize);
     memcpy(r_missShaderBindingTable.mapped, shaderHandleStorage.data() + handleSizeAligned * missShaderIndex, handleSize * 2);
@@ -3109,6 +5210,8 @@ void AppBase::InitRayTracing() {
     CreateSceneBuffers();
 
     CreateTLAS();
+    //the scratch of the builds above is no longer needed
+    _vulkanDevice->_scratchPool.Trim();
     CreateStrageImage();
     CreateUniformBuffer();
     
@@ -3116,12 +5219,15 @@ void AppBase::InitRayTracing() {
     _shader = new Shader();
     _shader->Connect(_vulkanDevice);
     CreateRaytracingPipeline();
+    if (r_gpuInstanceGeneration) {
+        CreateInstanceGeneration();
+    }
     CreateShaderBindingTable();
     CreateDescriptorSets();
 }
 
 /*******************************************************************************************************************
-*                                             `
+*                                             描画
 ********************************************************************************************************************/
 
 void AppBase::RecreateSwapChain() {
@@ -3190,10 +5296,24 @@ void AppBase::drawFrame() {
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+    //uploads recorded since the last submit (e.g. edited materials) run before this frame
+    const UploadQueue::Ticket uploadTicket = _vulkanDevice->_uploadQueue.Submit();
+    VkSemaphore waitSemaphores[] = { _presentCompleteSemaphore, _vulkanDevice->_uploadQueue.GetSemaphore() };
+    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT };
+    //the value of the binary semaphore is ignored
+    const uint64_t waitValues[] = { 0, uploadTicket };
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = 2;
+    timelineInfo.pWaitSemaphoreValues = waitValues;
+
     submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = &_presentCompleteSemaphore;
+    submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
+    if (!_vulkanDevice->_uploadQueue.IsComplete(uploadTicket)) {
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.waitSemaphoreCount = 2;
+    }
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &submitCommandBuffer;
     submitInfo.signalSemaphoreCount = 1;
@@ -3206,6 +5326,8 @@ void AppBase::drawFrame() {
     if ( result != VK_SUCCESS) {
         throw std::runtime_error("failed to submit draw command buffer!");
     }
+    //recordings that are never submitted (CreateCommandBuffers) must not change what the TLAS is assumed to hold
+    r_tlasState = _commandBuffers[_frameIndex].tlasState;
 
     _swapchain->QueuePresent(_vulkanDevice->_queue, _frameIndex, _renderCompleteSemaphore);
     vkQueueWaitIdle(_vulkanDevice->_queue);
@@ -3311,13 +5433,25 @@ void AppBase::UpdateGUI() {
     bool changed = false;
     if (ImGui::CollapsingHeader("Sphere Material", ImGuiTreeNodeFlags_DefaultOpen))
     {
-        changed |= ImGui::RadioButton("Lambert", (int*)&r_sceneObjects[0].material.materialType, LAMBERT);
+        changed |= ImGui::RadioButton("Lambert", (int*)&r_gltfModel.material.materialType, LAMBERT);
         ImGui::SameLine();
-        changed |= ImGui::RadioButton("Metal", (int*)&r_sceneObjects[0].material.materialType, METAL);
+        changed |= ImGui::RadioButton("Metal", (int*)&r_gltfModel.material.materialType, METAL);
         ImGui::SameLine();
-        changed |= ImGui::RadioButton("Glass", (int*)&r_sceneObjects[0].material.materialType, GLASS);
+        changed |= ImGui::RadioButton("Glass", (int*)&r_gltfModel.material.materialType, GLASS);
+    }
+    if (changed) {
+        for (size_t i = 0; i < r_gltfInstances.size(); i++) {
+            r_sceneObjects[i].material.materialType = r_gltfModel.material.materialType;
+        }
+        UpdateMaterialsBuffer();
+    }
+
+    //sphere position, refits the TLAS
+    const uint32_t sphereIndex = uint32_t(r_sceneObjects.size() - 1);
+    glm::vec3 spherePosition = glm::vec3(r_sceneObjects[sphereIndex].transform[3]);
+    if (ImGui::DragFloat3("sphere position", &spherePosition.x, 0.1f)) {
+        SetObjectTransform(sphereIndex, glm::translate(glm::mat4(1.0f), spherePosition));
     }
-    if (changed) UpdateMaterialsBuffer();
 
     //light
     if (ImGui::CollapsingHeader("light", ImGuiTreeNodeFlags_DefaultOpen))
@@ -3330,6 +5464,46 @@ void AppBase::UpdateGUI() {
     ImGui::DragFloat3("directional light vector", &_uniformData.lightDirection.x, 1.0f);
     //point light pos
     ImGui::DragFloat3("point light position", &_uniformData.pointLightPosition.x, 1.0f);
+
+    //reference image of the current frame
+    if (r_cpuReference && ImGui::CollapsingHeader("CPU reference"))
+    {
+        if (ImGui::Button("render on CPU")) {
+            RenderOnCPU("cpu_reference.bmp");
+        }
+    }
+
+    //device memory
+    if (ImGui::CollapsingHeader("memory"))
+    {
+        const MemoryAllocator::Statistics statistics = _vulkanDevice->_allocator.GetStatistics();
+        ImGui::Text("blocks : %u (%.1f MB)", statistics.blockCount, statistics.blockBytes / (1024.0 * 1024.0));
+        ImGui::Text("dedicated : %u (%.1f MB)", statistics.dedicatedCount, statistics.dedicatedBytes / (1024.0 * 1024.0));
+        ImGui::Text("allocations : %u", statistics.allocationCount);
+        ImGui::Text("used : %.1f MB", statistics.usedBytes / (1024.0 * 1024.0));
+        ImGui::Text("fragmentation : %.2f", statistics.fragmentation);
+        ImGui::Text("scratch pool : %.1f MB (peak %.1f MB)", _vulkanDevice->_scratchPool.GetSize() / (1024.0 * 1024.0), _vulkanDevice->_scratchPool.GetPeakSize() / (1024.0 * 1024.0));
+
+        ImGui::Separator();
+        for (size_t i = 0; i < size_t(vk::MemoryCategory::Count); i++) {
+            if (statistics.categories[i].count == 0) {
+                continue;
+            }
+            ImGui::Text("%s : %u (%.1f MB)", MemoryAllocator::GetCategoryName(vk::MemoryCategory(i)), statistics.categories[i].count, statistics.categories[i].bytes / (1024.0 * 1024.0));
+        }
+
+        ImGui::Separator();
+        const std::vector<MemoryAllocator::HeapBudget> heapBudgets = _vulkanDevice->_allocator.GetHeapBudgets();
+        for (size_t i = 0; i < heapBudgets.size(); i++) {
+            const MemoryAllocator::HeapBudget& heap = heapBudgets[i];
+            ImGui::Text("heap %zu%s : %.1f / %.1f MB", i, heap.deviceLocal ? " (device local)" : "", heap.usage / (1024.0 * 1024.0), heap.budget / (1024.0 * 1024.0));
+            ImGui::ProgressBar(heap.budget > 0 ? float(double(heap.usage) / double(heap.budget)) : 0.0f);
+        }
+
+        if (ImGui::Button("dump json")) {
+            _vulkanDevice->_allocator.WriteReport("memory_report.json");
+        }
+    }
     ImGui::Render();
 }
 
@@ -3349,7 +5523,7 @@ void AppBase::Run() {
 }
 
 /*******************************************************************************************************************
-*                                             I
+*                                             終了時
 ********************************************************************************************************************/
 
 void AppBase::CleanupWindow() {
@@ -3367,9 +5541,12 @@ void AppBase::CleanupSwapchain() {
     }
 
 
-    for (auto frameCommandBuffer : _commandBuffers) {
+    for (auto& frameCommandBuffer : _commandBuffers) {
         vkFreeCommandBuffers(_vulkanDevice->_device, _vulkanDevice->_commandPool, 1, &frameCommandBuffer.commandBuffer);
         vkDestroyFence(_vulkanDevice->_device, frameCommandBuffer.fence, nullptr);
+        _vulkanDevice->_scratchPool.Free(frameCommandBuffer.tlasScratch);
+        frameCommandBuffer.instanceBuffer.buffer.Destroy(_vulkanDevice->_device);
+        frameCommandBuffer.instanceBuffer = InstanceBuffer();
     }
     vkDestroyRenderPass(_vulkanDevice->_device, _renderPass, nullptr);
     r_strageImage.Destroy(_vulkanDevice->_device);
@@ -3382,23 +5559,34 @@ void AppBase::Destroy() {
     //raytracing
     s_model->Cleanup();
     s_model->Destroy();
-    r_instanceBuffer.Destroy(_vulkanDevice->_device);
     r_uniformBuffer.Destroy(_vulkanDevice->_device);
     r_raygenShaderBindingTable.Destroy(_vulkanDevice->_device);
     r_missShaderBindingTable.Destroy(_vulkanDevice->_device);
     r_hitShaderBindingTable.Destroy(_vulkanDevice->_device);
     r_materialStorageBuffer.Destroy(_vulkanDevice->_device);
     r_objectStorageBuffer.Destroy(_vulkanDevice->_device);
+    r_geometryStorageBuffer.Destroy(_vulkanDevice->_device);
 
     for (auto texture : r_textures) {
         texture.Destroy(_vulkanDevice->_device);
     }
     r_cubeMap.Destroy(_vulkanDevice->_device);
 
-    for (auto sceneObj : r_sceneObjects) {
-        sceneObj.Destroy(_vulkanDevice->_device);
+    for (PolygonMesh* mesh : r_meshes) {
+        mesh->Destroy(_vulkanDevice->_device);
+        delete mesh;
     }
+    r_meshes.clear();
+    r_blasStorageBuffer.Destroy(_vulkanDevice->_device);
+    r_blasCacheStorageBuffer.Destroy(_vulkanDevice->_device);
     r_topLevelAS->Destroy();
+    if (r_gpuInstanceGeneration) {
+        r_objectTransformBuffer.Destroy(_vulkanDevice->_device);
+        r_instanceParamBuffer.Destroy(_vulkanDevice->_device);
+        r_gpuInstanceBuffer.Destroy(_vulkanDevice->_device);
+        vkDestroyPipelineLayout(_vulkanDevice->_device, r_instancePipelineLayout, nullptr);
+        vkDestroyPipeline(_vulkanDevice->_device, r_instancePipeline, nullptr);
+    }
 
 
     
@@ -3408,7 +5596,7 @@ void AppBase::Destroy() {
     vkDestroyPipelineLayout(_vulkanDevice->_device, r_pipelineLayout, nullptr);
     vkDestroyPipeline(_vulkanDevice->_device, r_pipeline, nullptr);
 
-    //UIp
+    //UI用
     vkDestroyDescriptorPool(_vulkanDevice->_device, _descriptorPool, nullptr);
     ImGui_ImplVulkan_Shutdown();
 
@@ -13,11 +13,16 @@
 #include <vulkan/vulkan.h>
 
 #include <stdexcept>
+#include <algorithm>
 #include <vector>
 #include <iostream>
 #include <array>
 #include <chrono>
 #include <unordered_map>
+#include <unordered_set>
+#include <limits>
+#include <memory>
+#include <filesystem>
 
 #include "camera.h"
 #include "swapchain.h"
@@ -25,23 +30,84 @@
 #include "shader.h"
 #include "common.h"
 #include "utils.h"
+#include "threadPool.h"
+#include "mappedFile.h"
+#include "cacheFileWriter.h"
+#include "vertexConverter.h"
+#include "meshOptimizer.h"
+#include "accelerationStructureCache.h"
+#include "cpuRayTracer.h"
 
 class AccelerationStructure {
 
 public:
 
+    //inputs of one structure built by BuildBatch
+    struct BuildInput {
+        AccelerationStructure* accelerationStructure = nullptr;
+        std::vector<VkAccelerationStructureGeometryKHR> geometryInfos;
+        std::vector<uint32_t> primitiveCounts;
+    };
+
+    //scratch of one vkCmdBuildAccelerationStructuresKHR in BuildBatch, larger batches are split
+    static constexpr VkDeviceSize MAX_BATCH_SCRATCH_SIZE = 256ull * 1024 * 1024;
+    //offset alignment of an acceleration structure in its buffer
+    static constexpr VkDeviceSize STORAGE_ALIGNMENT = 256;
+
     AccelerationStructure(){};
     AccelerationStructure(VulkanDevice* device);
-    void Update(VkCommandBuffer commandBuffer, VkAccelerationStructureTypeKHR type, VkAccelerationStructureGeometryKHR geometryInfo, uint32_t primitiveCount, VkBuildAccelerationStructureFlagsKHR flags = 0);
+
+    /**
+    * @brief    加速構造を再ビルドする（scratchAddressはbuildScratchSize以上のスクラッチ領域）
+    *           MODE_UPDATEならALLOW_UPDATEでビルド済みの構造をその場でリフィットする（updateScratchSize以上）
+    */
+    void Update(VkCommandBuffer commandBuffer, VkDeviceAddress scratchAddress, VkAccelerationStructureTypeKHR type, VkAccelerationStructureGeometryKHR geometryInfo, uint32_t primitiveCount, VkBuildAccelerationStructureFlagsKHR flags = 0, VkBuildAccelerationStructureModeKHR mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR);
+    void Update(VkCommandBuffer commandBuffer, VkDeviceAddress scratchAddress, VkAccelerationStructureTypeKHR type, const std::vector<VkAccelerationStructureGeometryKHR>& geometryInfos, const std::vector<uint32_t>& primitiveCounts, VkBuildAccelerationStructureFlagsKHR flags = 0, VkBuildAccelerationStructureModeKHR mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR);
     void CreateAccelerationStructureBuffer(VkAccelerationStructureTypeKHR type, VkAccelerationStructureGeometryKHR geometryInfo, uint32_t primitiveCount, VkBuildAccelerationStructureFlagsKHR flags = 0);
+
+    /**
+    * @brief    複数のジオメトリから加速構造を作成する（ジオメトリごとにビルド範囲を持つ）
+    */
+    void CreateAccelerationStructureBuffer(VkAccelerationStructureTypeKHR type, const std::vector<VkAccelerationStructureGeometryKHR>& geometryInfos, const std::vector<uint32_t>& primitiveCounts, VkBuildAccelerationStructureFlagsKHR flags = 0);
+
+    /**
+    * @brief    複数のBLASをまとめてビルドする（1回のビルドコマンドと1つのバリア）
+    *           記憶領域は返すバッファから切り出すので、加速構造を破棄してから呼び出し側で破棄する
+    *           compactならビルド後に圧縮したサイズのバッファへコピーし、handleとdeviceAddressを差し替える
+    */
+    static vk::Buffer BuildBatch(VulkanDevice* device, const std::vector<BuildInput>& inputs, VkBuildAccelerationStructureFlagsKHR flags = 0, bool compact = false);
+
+    /**
+    * @brief    複数のBLASをホストでビルドする（accelerationStructureHostCommandsが必要）
+    *           ジオメトリはホストアドレスで指定し、記憶領域はホストから見えるメモリに置く（圧縮はしない）
+    */
+    static vk::Buffer BuildBatchOnHost(VulkanDevice* device, const std::vector<BuildInput>& inputs, VkBuildAccelerationStructureFlagsKHR flags = 0);
+
+    /**
+    * @brief    加速構造をシリアライズする（vkCmdCopyAccelerationStructureToMemoryKHR）
+    */
+    static std::vector<std::vector<unsigned char>> Serialize(VulkanDevice* device, const std::vector<AccelerationStructure*>& accelerationStructures);
+
+    /**
+    * @brief    シリアライズしたデータからBLASを作成する（sizesはdataそれぞれのバイト数）
+    *           記憶領域は返すバッファから切り出すので、加速構造を破棄してから呼び出し側で破棄する
+    */
+    static vk::Buffer Deserialize(VulkanDevice* device, const std::vector<AccelerationStructure*>& accelerationStructures, const std::vector<const unsigned char*>& data, const std::vector<size_t>& sizes);
     void Destroy();
     
     VkAccelerationStructureKHR handle = VK_NULL_HANDLE;
     uint64_t deviceAddress = 0;
+    //empty when the storage is shared with other structures (BuildBatch)
     vk::Buffer asBuffer;
-    vk::Buffer updateBuffer;
+    //scratch is borrowed from VulkanDevice::_scratchPool for each build
+    VkDeviceSize buildScratchSize = 0;
+    VkDeviceSize updateScratchSize = 0;
 
 private:
+
+    //copies the structures into a buffer of the compacted sizes written to queryPool
+    static vk::Buffer Compact(VulkanDevice* device, const std::vector<BuildInput>& inputs, vk::Buffer& storageBuffer, VkQueryPool queryPool);
+
     VulkanDevice* vulkanDevice = VK_NULL_HANDLE;
 };
 
@@ -50,15 +116,74 @@ class AppBase
 
 public:
 
+    //material index of a geometry that uses the material of its scene object
+    static constexpr uint32_t OBJECT_MATERIAL = ~0u;
+    //serialized BLASes keyed by PolygonMesh::GetBLASCacheKey
+    static constexpr const char* BLAS_CACHE_FILENAME = "Assets/blas.cache";
+
     struct PolygonMesh {
 
-        PolygonMesh(VulkanDevice* vulkandevice, vk::Buffer& vertBuffer, vk::Buffer& idxBuffer, uint32_t stride);
+        //triangles built as one BLAS geometry (gl_GeometryIndexEXT)
+        struct Geometry {
+            //in indices of indexType
+            uint32_t firstIndex = 0;
+            uint32_t indexCount = 0;
+            uint32_t materialIndex = OBJECT_MATERIAL;
+            //added to the stored indices, the BLAS geometry starts its vertex data there
+            uint32_t baseVertex = 0;
+            VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+        };
+
+        PolygonMesh(VulkanDevice* vulkandevice, vk::Buffer& vertBuffer, vk::Buffer& idxBuffer, uint32_t stride, VkIndexType idxType = VK_INDEX_TYPE_UINT32);
         void BuildBLAS(VulkanDevice* vulkanDevice, VkBuildAccelerationStructureFlagsKHR flags = 0);
+
+        /**
+        * @brief    BLASのジオメトリを作成する（量子化された頂点の変換行列もここで書き込む）
+        */
+        void GetBLASGeometries(VulkanDevice* vulkanDevice, std::vector<VkAccelerationStructureGeometryKHR>& geometryInfos, std::vector<uint32_t>& primitiveCounts, bool host = false);
+
+        /**
+        * @brief    BLASキャッシュのキーを取得する（GetBLASGeometriesの後に呼ぶこと）
+        */
+        uint64_t GetBLASCacheKey(VkBuildAccelerationStructureFlagsKHR flags) const;
+        void Destroy(VkDevice device);
         
         AccelerationStructure* blas;
         vk::Buffer vertexBuffer;
         vk::Buffer indexBuffer;
         uint32_t vertexStride = 0;
+        //index type of the single geometry covering firstIndex/indexCount, the glTF geometries have their own
+        VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+        //VK_FORMAT_R16G16B16A16_SNORM : quantized vertices, dequantized by the BLAS geometry transform
+        VkFormat vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+        glm::vec3 positionScale = glm::vec3(1.0f);
+        glm::vec3 positionOffset = glm::vec3(0.0f);
+        vk::Buffer transformBuffer;
+        //normal/uv/color stream, VK_NULL_HANDLE when they are interleaved after the position in vertexBuffer
+        vk::Buffer attributeBuffer;
+        uint32_t attributeStride = 0;
+        //triangles of indexBuffer used by this mesh (indexCount 0 : the whole buffer)
+        uint32_t firstIndex = 0;
+        uint32_t indexCount = 0;
+        //false when the buffers belong to a glTF model shared by several meshes
+        bool ownsBuffers = true;
+        //one geometry per glTF primitive, empty : a single geometry covering firstIndex/indexCount
+        std::vector<Geometry> geometries;
+        //first entry of the mesh in the geometry table
+        uint32_t geometryOffset = 0;
+        //hash of the vertex and index buffer contents, 0 : the BLAS is not cached
+        uint64_t contentHash = 0;
+        //host copies of vertexBuffer, indexBuffer and attributeBuffer, only kept for r_hostBLASBuild or r_cpuReference
+        std::shared_ptr<const std::vector<unsigned char>> hostVertices;
+        std::shared_ptr<const std::vector<unsigned char>> hostIndices;
+        std::shared_ptr<const std::vector<unsigned char>> hostAttributes;
+        //dequantization transform read by host builds
+        VkTransformMatrixKHR hostTransform{};
+    };
+
+    struct MeshInstance {
+        PolygonMesh* mesh = nullptr;
+        glm::mat4 transform = glm::mat4(1.0f);
     };
 
     enum MaterialType {
@@ -86,22 +211,87 @@ public:
         uint32_t shaderOffset = 0;
         uint32_t index = 0;
         uint32_t useShadow = 0;
+        //moved at runtime, dynamic objects are kept behind the static ones in r_sceneObjects
+        bool isDynamic = false;
+    };
+
+    //what the TLAS holds, committed when the frame that builds it is submitted
+    struct TLASState {
+        //r_transformVersion baked into the instances
+        uint64_t transformVersion = 0;
+        uint32_t instanceCount = 0;
+        //refits since the last full build
+        uint32_t refitCount = 0;
+        //diagonal of the bounds of the instance origins at the last full build
+        float buildExtent = 0.0f;
+    };
+
+    //persistently mapped TLAS build input of one frame in flight
+    struct InstanceBuffer {
+        vk::Buffer buffer;
+        //r_transformVersion and instance count of the records written so far
+        uint64_t transformVersion = 0;
+        uint32_t instanceCount = 0;
+    };
 
-        void Destroy(VkDevice device) {
-            mesh->vertexBuffer.Destroy(device);
-            mesh->indexBuffer.Destroy(device);
-            mesh->blas->Destroy();
-        }
+    //per-object data of the instance generation shader (Shaders/raytracingMaterials/instances.comp)
+    struct InstanceParam {
+        uint64_t accelerationStructureReference = 0;
+        //instanceCustomIndex | mask << 24
+        uint32_t customIndexAndMask = 0;
+        //instanceShaderBindingTableRecordOffset | flags << 24
+        uint32_t sbtOffsetAndFlags = 0;
     };
 
+    //push constants of the instance generation shader
+    struct InstanceGenerationConstants {
+        VkDeviceAddress transformAddress = 0;
+        VkDeviceAddress paramAddress = 0;
+        VkDeviceAddress instanceAddress = 0;
+        uint32_t instanceCount = 0;
+    };
+
+    //local_size_x of instances.comp
+    static constexpr uint32_t INSTANCE_GENERATION_GROUP_SIZE = 64;
+    //vkCmdUpdateBuffer writes at most 65536 bytes
+    static constexpr uint32_t MAX_INLINE_TRANSFORM_COUNT = 65536 / sizeof(glm::mat4);
+
+    //refitting keeps the tree of the last build, so rebuild once it has been refit this often
+    static constexpr uint32_t MAX_TLAS_REFIT_COUNT = 64;
+    //or once the instance origins have spread this much beyond their extent at the last build
+    static constexpr float MAX_TLAS_EXTENT_GROWTH = 1.5f;
+
     struct PrimParam
     {
         uint64_t indexBufferAddress;
         uint64_t vertexBufferAddress;
+        uint64_t attributeBufferAddress;
         uint32_t materialIndex;
-        //memory alignment:4+8byte
         uint32_t useShadow = 0;
-        uint64_t padding1 = 0;
+        uint32_t useQuantizedVertex = 0;
+        //byte strides of the position and attribute streams
+        uint32_t positionStride = 0;
+        uint32_t attributeStride = 0;
+        //memory alignment:4byte
+        uint32_t padding0 = 0;
+        //GeometryParam of the mesh, indexed by gl_GeometryIndexEXT
+        uint64_t geometryBufferAddress = 0;
+        //memory alignment:4+4byte
+        uint32_t padding1 = 0;
+        uint32_t padding2 = 0;
+        //pos = snorm * positionScale + positionOffset
+        glm::vec4 positionScale = glm::vec4(1.0f);
+        glm::vec4 positionOffset = glm::vec4(0.0f);
+    };
+
+    struct GeometryParam {
+        //first index of the geometry in the shared index buffer, in indices of its own type
+        uint32_t firstIndex = 0;
+        //OBJECT_MATERIAL : PrimParam::materialIndex
+        uint32_t materialIndex = OBJECT_MATERIAL;
+        //added to the stored indices
+        uint32_t baseVertex = 0;
+        uint32_t useShortIndex = 0;
     };
 
     struct UniformBlock {
@@ -123,119 +313,119 @@ public:
     };
 
     /**
-    * @brief    RXgN^
+    * @brief    コンストラクタ
     */
     AppBase();
 
     /**
-    * @brief    fXgN^
+    * @brief    デストラクタ
     */
     ~AppBase() {};
 
     /**
-    * @brief    }EXړ
+    * @brief    マウス移動
     */
     void MouseMove(double x, double y);
 
 
     /*******************************************************************************************************************
-    *                                             
+    *                                             初期化
     ********************************************************************************************************************/
 
     /**
-    * @brief    EBhȄ
+    * @brief    ウィンドウの初期化
     */
     void InitializeWindow();
 
     /**
-    * @brief    R[obN̏
+    * @brief    コールバックの初期化
     */
     void SetupGlfwCallbacks();
 
     /**
-    * @brief    ؃C[̃T|[gmF
+    * @brief    検証レイヤーのサポートを確認する
     */
     bool CheckValidationLayerSupport();
 
     /**
-    * @brief    GLFWKvƂĂg@\擾
+    * @brief    GLFWが必要としている拡張機能を取得する
     */
     std::vector<const char*> getRequiredExtensions();
 
     /**
-    * @brief    fobObZ[WLɂ
+    * @brief    デバッグメッセージを有効にする
     */
     void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo);
 
     /**
-    * @brief    CX^X쐬
+    * @brief    インスタンスを作成する
     */
     void CreateInstance();
 
     /**
-    * @brief    fobObZ[WLɂ
+    * @brief    デバッグメッセージを有効にする
     */
     void SetupDebugMessenger();
 
     /**
-    * @brief    foCX擾
+    * @brief    物理デバイスを取得する
     */
     void PickupPhysicalDevice();
 
     /**
-    * @brief    _[pX쐬
+    * @brief    レンダーパスを作成する
     */
     void CreateRenderPass();
 
     /**
-    * @brief    ʏ̃OtBbNXpCvC쐬
+    * @brief    通常のグラフィックスパイプラインを作成する
     */
     void CreateGraphicsPipeline();
     
     /**
-    * @brief    examplegImGUI̕\
+    * @brief    exampleを使ったImGUIの表示
     */
     void InitGUI();
 
     /**
-    * @brief    [x\[X쐬
+    * @brief    深度リソースを作成する
     */
     void CreateDepthResources();
 
     /**
-    * @brief    t[obt@쐬
+    * @brief    フレームバッファを作成する
     */
     void CreateFramebuffers();
 
     /**
-    * @brief    R}hobt@쐬
+    * @brief    コマンドバッファを作成する
     */
     void CreateCommandBuffers();
 
     /**
-    * @brief    R}hobt@XV
+    * @brief    コマンドバッファを更新する
     */
     void BuildCommandBuffers(uint32_t index, bool renderImgui);
 
     /**
-    * @brief    IuWFNg쐬
+    * @brief    同期オブジェクトを作成する
     */
     void CreateSyncObjects();
 
     /**
-    * @brief    
+    * @brief    初期化
     */
     void Initialize();
 
 
     /*******************************************************************************************************************
-    *                                             Cg[VO
+    *                                             レイトレーシング
     ********************************************************************************************************************/
 
-    //ƂdeviceNXɈړ
+    //あとでdeviceクラスに移動
     vk::Image CreateTextureCube(const wchar_t* fileNames[6], VkImageUsageFlags usage, VkMemoryPropertyFlags memProps);
 
-    vk::Image CreateTextureImageAndView(uint32_t width, uint32_t height, VkFormat format, VkImageAspectFlags aspectFlags, VkImageUsageFlags usage, VkMemoryPropertyFlags memProps);
+    vk::Image CreateTextureImageAndView(uint32_t width, uint32_t height, VkFormat format, VkImageAspectFlags aspectFlags, VkImageUsageFlags usage, VkMemoryPropertyFlags memProps, vk::MemoryCategory category);
 
     vk::Image Create2DTexture(const wchar_t* fileNames, VkImageUsageFlags usage, VkMemoryPropertyFlags memProps);
 
@@ -244,11 +434,64 @@ public:
     void PrepareTexture();
     void CreateBLAS();
     void CreateSceneObject();
+
+    /**
+    * @brief    静的なオブジェクトを前に、動的なオブジェクトを後ろにまとめる（それぞれの順序は保つ）
+    *           インスタンスの並びはgl_InstanceIDとしてオブジェクトのバッファの添字になるので、バッファの作成前に呼ぶ
+    */
+    void PartitionSceneObjects();
+    std::vector<Material> CollectMaterials() const;
     void UpdateMaterialsBuffer();
     void CreateSceneBuffers();
 
-    void UpdateTLAS(VkCommandBuffer commandBuffer);
+    /**
+    * @brief    CPUのレイトレーサーに渡すシーンを作る（r_cpuReferenceのとき、メッシュはホスト側のコピーを指す、CreateBLASの後に呼ぶこと）
+    */
+    cpuRayTracer::Scene CreateCPUScene() const;
+
+    /**
+    * @brief    現在のシーンとカメラをCPUで描画して画像を書き出し、レイの処理速度を表示する
+    */
+    void RenderOnCPU(const std::string& filename);
+
+    /**
+    * @brief    シーンオブジェクトの変換行列を変更する（次のフレームでTLASをリフィットする）
+    */
+    void SetObjectTransform(uint32_t objectIndex, const glm::mat4& transform);
+
+    /**
+    * @brief    変更があればTLASの更新を記録し、コマンドの完了後のTLASの状態を返す
+    *           変換行列だけならリフィット、インスタンス数が変わったかリフィットで品質が落ちたら再ビルド
+    *           instanceBufferはこのフレームのもので、前回の書き込みから変わったインスタンスだけを書き込む
+    */
+    TLASState UpdateTLAS(VkCommandBuffer commandBuffer, VkDeviceAddress scratchAddress, InstanceBuffer& instanceBuffer);
     void CreateTLAS();
+    float GetInstanceExtent() const;
+
+    /**
+    * @brief    シーンオブジェクトからインスタンスを作り直す（インスタンス数が変わったとき）
+    */
+    void PackInstances();
+
+    /**
+    * @brief    GPUでインスタンスを書き込むためのバッファとパイプラインを作成する（r_gpuInstanceGenerationのとき）
+    */
+    void CreateInstanceGeneration();
+
+    /**
+    * @brief    すべてのインスタンスのパラメータと変換行列をアップロードする
+    */
+    void UploadInstanceData();
+
+    /**
+    * @brief    writtenVersionから変わった変換行列を書き込み、変換行列のバッファからインスタンスを書き込むコンピュートパスを記録する
+    */
+    void RecordInstanceGeneration(VkCommandBuffer commandBuffer, uint32_t instanceCount, uint64_t writtenVersion);
+
+    /**
+    * @brief    フレームのインスタンスバッファをr_instancesに合わせる（なければ作成する）
+    */
+    void WriteInstances(InstanceBuffer& instanceBuffer);
 
     void CreateStrageImage();
 
@@ -267,52 +510,52 @@ public:
     void InitRayTracing();
 
     /*******************************************************************************************************************
-    *                                             [v
+    *                                             ループ内
     ********************************************************************************************************************/
 
     /**
-    * @brief   Xbv`F[č\
+    * @brief   スワップチェーンを再構成する
     */
     void RecreateSwapChain();
 
     /**
-    * @brief    `悷
+    * @brief    描画する
     */
     void drawFrame();
 
     void ShowMenuFile();
 
     /**
-    * @brief    GUIEBhE̍쐬
+    * @brief    GUIウィンドウの作成
     */
     void SetGUIWindow();
 
     /**
-    * @brief    GUI̍XV
+    * @brief    GUIの更新
     */
     void UpdateGUI();
 
     /**
-    * @brief    [v
+    * @brief    ループ
     */
     void Run();
 
 
     /*******************************************************************************************************************
-    *                                             I
+    *                                             終了時
     ********************************************************************************************************************/
     /**
-    * @brief    EBhE̔j
+    * @brief    ウィンドウの破棄
     */
     void CleanupWindow();
 
     /**
-    * @brief    Xbv`F[̃\[XJ
+    * @brief    スワップチェーンのリソースを開放する
     */
     void CleanupSwapchain();
 
     /**
-    * @brief    \[Xj
+    * @brief    リソースを破棄する
     */
     void Destroy();
 
@@ -350,6 +593,12 @@ public:
     struct FrameCommandBuffer {
         VkCommandBuffer commandBuffer;
         VkFence fence;
+        //scratch of the TLAS rebuild recorded in commandBuffer, in use until fence signals
+        ScratchPool::Allocation tlasScratch;
+        //state of the TLAS once commandBuffer has run, becomes r_tlasState on submit
+        TLASState tlasState;
+        //read by the TLAS build recorded in commandBuffer
+        InstanceBuffer instanceBuffer;
     };
     std::vector<FrameCommandBuffer> _commandBuffers;
 
@@ -362,18 +611,19 @@ public:
     vk::MouseButtons _mouseButtons;
     bool _framebufferResized;
     
-    //UIp
+    //UI用
     VkDescriptorPool _descriptorPool;
 
-    //Cg[VOiƂŕʃNXɂj
-    vk::Buffer r_instanceBuffer;
+    //レイトレーシング（あとで別クラスにする）
     vk::Buffer r_uniformBuffer;
     vk::Buffer r_raygenShaderBindingTable;
     vk::Buffer r_missShaderBindingTable;
     vk::Buffer r_hitShaderBindingTable;
 
 
-    PolygonMesh* r_meshGlTF;
+    //every mesh below is owned by r_meshes
+    std::vector<PolygonMesh*> r_meshes;
+    std::vector<MeshInstance> r_gltfInstances;
     PolygonMesh* r_meshPlane;
     PolygonMesh* r_meshSphere;
     SceneObject r_gltfModel;
@@ -383,12 +633,54 @@ public:
     std::vector<SceneObject> r_sceneObjects;
     vk::Buffer r_materialStorageBuffer;
     vk::Buffer r_objectStorageBuffer;
+    vk::Buffer r_geometryStorageBuffer;
+    //glTF materials, stored in front of the scene object materials
+    std::vector<Material> r_gltfMaterials;
 
     std::vector<vk::Image> r_textures;
     vk::Image r_cubeMap;
 
+    //keep host copies of the meshes and textures so that RenderOnCPU can trace the scene, set before PrepareMesh
+    bool r_cpuReference = false;
+    //decoded r_textures and faces of r_cubeMap, only loaded for r_cpuReference
+    std::vector<cpuRayTracer::Image> r_hostTextures;
+    cpuRayTracer::Image r_hostCubeMap[6];
+
+    //storage of every BLAS, built together by AccelerationStructure::BuildBatch
+    vk::Buffer r_blasStorageBuffer;
+    //keep host copies of the meshes and build the BLASes on the host when accelerationStructureHostCommands is supported
+    //(otherwise on the device), set before PrepareMesh
+    bool r_hostBLASBuild = false;
+    //storage of the BLASes loaded from BLAS_CACHE_FILENAME
+    vk::Buffer r_blasCacheStorageBuffer;
     //TLAS
     AccelerationStructure* r_topLevelAS;
+    TLASState r_tlasState;
+    //instances the instance buffers and r_topLevelAS were sized for
+    uint32_t r_tlasInstanceCapacity = 0;
+    //bumped by every SetObjectTransform
+    uint64_t r_transformVersion = 0;
+    //r_transformVersion when a static object was last moved, which costs a full rebuild
+    uint64_t r_staticTransformVersion = 0;
+    //first dynamic object in r_sceneObjects and r_instances
+    uint32_t r_dynamicObjectOffset = 0;
+    //bounds of the static instance origins, the dynamic ones are added to it for the refit heuristic
+    glm::vec3 r_staticMinPosition = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 r_staticMaxPosition = glm::vec3(std::numeric_limits<float>::lowest());
+    //instance records of r_sceneObjects, copied into the instance buffer of each frame
+    std::vector<VkAccelerationStructureInstanceKHR> r_instances;
+    //r_transformVersion when each record was last changed
+    std::vector<uint64_t> r_instanceVersions;
+
+    //write the instances with a compute pass instead of on the CPU, set before InitRayTracing
+    bool r_gpuInstanceGeneration = false;
+    //device-local inputs of the pass, glm::mat4 and InstanceParam per object
+    vk::Buffer r_objectTransformBuffer;
+    vk::Buffer r_instanceParamBuffer;
+    //written by the pass and read by the TLAS build in the same command buffer
+    vk::Buffer r_gpuInstanceBuffer;
+    VkPipelineLayout r_instancePipelineLayout = VK_NULL_HANDLE;
+    VkPipeline r_instancePipeline = VK_NULL_HANDLE;
     vk::Image r_strageImage;
 
     VkDescriptorSetLayout r_descriptorSetLayout;
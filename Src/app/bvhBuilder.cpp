@@ -0,0 +1,542 @@
+#include "bvhBuilder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <future>
+#include <mutex>
+
+#include "threadPool.h"
+
+namespace bvhBuilder
+{
+    void Aabb::Grow(const float* point) {
+        for (int c = 0; c < 3; c++) {
+            min[c] = std::min(min[c], point[c]);
+            max[c] = std::max(max[c], point[c]);
+        }
+    }
+
+    void Aabb::Grow(const Aabb& other) {
+        for (int c = 0; c < 3; c++) {
+            min[c] = std::min(min[c], other.min[c]);
+            max[c] = std::max(max[c], other.max[c]);
+        }
+    }
+
+    float Aabb::SurfaceArea() const {
+        const float dx = max[0] - min[0];
+        const float dy = max[1] - min[1];
+        const float dz = max[2] - min[2];
+        if (dx < 0.0f || dy < 0.0f || dz < 0.0f) {
+            return 0.0f;
+        }
+        return 2.0f * (dx * dy + dy * dz + dz * dx);
+    }
+
+    namespace {
+
+        constexpr uint32_t MAX_BIN_COUNT = 32;
+        //binning a range smaller than this is not worth a task
+        constexpr size_t MIN_PARALLEL_RANGE = 16384;
+
+        //bounds of a primitive, partitioned in place instead of an index array so that every pass reads sequentially
+        struct PrimitiveRef {
+            float min[3];
+            uint32_t index;
+            float max[3];
+            uint32_t padding;
+
+            float Centroid(int axis) const { return 0.5f * (min[axis] + max[axis]); }
+        };
+
+        //no default member initializers, a node resets only the bins it uses
+        struct Bin {
+            float min[3];
+            float max[3];
+            uint32_t count;
+
+            void Reset() {
+                std::fill(min, min + 3, 1e30f);
+                std::fill(max, max + 3, -1e30f);
+                count = 0;
+            }
+
+            void Grow(const float* boundsMin, const float* boundsMax) {
+                for (int c = 0; c < 3; c++) {
+                    min[c] = std::min(min[c], boundsMin[c]);
+                    max[c] = std::max(max[c], boundsMax[c]);
+                }
+            }
+        };
+
+        struct BinSet {
+            Bin bins[3][MAX_BIN_COUNT];
+
+            explicit BinSet(uint32_t binCount) {
+                for (int axis = 0; axis < 3; axis++) {
+                    for (uint32_t b = 0; b < binCount; b++) {
+                        bins[axis][b].Reset();
+                    }
+                }
+            }
+        };
+
+        //bounds of the primitives and of their centroids
+        struct RangeBounds {
+            Aabb bounds;
+            Aabb centroidBounds;
+        };
+
+        struct Range {
+            uint32_t node;
+            uint32_t begin;
+            uint32_t end;
+            RangeBounds bounds;
+        };
+
+        //runs func(begin, end) over chunks of [0, count), on the calling thread when threadPool is null
+        template<class F>
+        void ParallelFor(ThreadPool* threadPool, size_t count, F&& func) {
+            if (!threadPool || count < MIN_PARALLEL_RANGE) {
+                func(size_t(0), count);
+                return;
+            }
+            const size_t chunkCount = std::min<size_t>(threadPool->GetThreadCount(), count / (MIN_PARALLEL_RANGE / 4));
+            const size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+            std::vector<std::future<void>> tasks;
+            for (size_t begin = 0; begin < count; begin += chunkSize) {
+                const size_t end = std::min(count, begin + chunkSize);
+                tasks.push_back(threadPool->Submit([&func, begin, end]() { func(begin, end); }));
+            }
+            for (auto& task : tasks) {
+                task.get();
+            }
+        }
+
+        //func(begin, end, T&) accumulates a chunk into a T made by create(), merge(T&, const T&) combines the chunks
+        template<class C, class F, class M>
+        auto ParallelReduce(ThreadPool* threadPool, size_t count, C&& create, F&& func, M&& merge) {
+            using T = decltype(create());
+            T result = create();
+            if (!threadPool || count < MIN_PARALLEL_RANGE) {
+                func(size_t(0), count, result);
+                return result;
+            }
+            std::vector<T> partial;
+            std::mutex mutex;
+            ParallelFor(threadPool, count, [&](size_t begin, size_t end) {
+                T local = create();
+                func(begin, end, local);
+                std::lock_guard<std::mutex> lock(mutex);
+                partial.push_back(local);
+            });
+            for (const T& local : partial) {
+                merge(result, local);
+            }
+            return result;
+        }
+
+        class Builder {
+
+        public:
+
+            Builder(PrimitiveRef* refs, const BuildSettings& settings)
+                : _refs(refs), _settings(settings) {
+                _binCount = std::max(2u, std::min(settings.binCount, MAX_BIN_COUNT));
+            }
+
+            /**
+            * @brief    範囲の境界ボックスと重心の境界ボックスを計算する
+            */
+            RangeBounds ComputeBounds(uint32_t begin, uint32_t end, ThreadPool* threadPool) const {
+                return ParallelReduce(threadPool, end - begin, []() { return RangeBounds(); },
+                    [&](size_t first, size_t last, RangeBounds& local) {
+                        for (size_t i = begin + first; i < begin + last; i++) {
+                            const PrimitiveRef& ref = _refs[i];
+                            const float centroid[3] = { ref.Centroid(0), ref.Centroid(1), ref.Centroid(2) };
+                            local.bounds.Grow(ref.min);
+                            local.bounds.Grow(ref.max);
+                            local.centroidBounds.Grow(centroid);
+                        }
+                    },
+                    [](RangeBounds& result, const RangeBounds& local) {
+                        result.bounds.Grow(local.bounds);
+                        result.centroidBounds.Grow(local.centroidBounds);
+                    });
+            }
+
+            /**
+            * @brief    範囲を二つに分割する（葉にするときはfalse）
+            *           子の範囲の境界はビンと分割のパスで求めるので、範囲を読み直さない
+            */
+            bool Split(const Range& range, Range& left, Range& right, ThreadPool* threadPool) const {
+
+                const uint32_t begin = range.begin;
+                const uint32_t end = range.end;
+                const uint32_t count = end - begin;
+                if (count <= 1) {
+                    return false;
+                }
+
+                //small nodes do not need more bins than primitives, most nodes of the tree are small
+                const uint32_t binCount = std::min(_binCount, count);
+                const Aabb& centroidBounds = range.bounds.centroidBounds;
+                float scale[3];
+                for (int axis = 0; axis < 3; axis++) {
+                    const float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+                    scale[axis] = extent > 0.0f ? binCount / extent : 0.0f;
+                }
+
+                const BinSet binSet = ParallelReduce(threadPool, count, [binCount]() { return BinSet(binCount); },
+                    [&](size_t first, size_t last, BinSet& local) {
+                        for (size_t i = begin + first; i < begin + last; i++) {
+                            const PrimitiveRef& ref = _refs[i];
+                            for (int axis = 0; axis < 3; axis++) {
+                                Bin& bin = local.bins[axis][BinIndex(ref.Centroid(axis), centroidBounds.min[axis], scale[axis], binCount)];
+                                bin.Grow(ref.min, ref.max);
+                                bin.count++;
+                            }
+                        }
+                    },
+                    [binCount](BinSet& result, const BinSet& local) {
+                        for (int axis = 0; axis < 3; axis++) {
+                            for (uint32_t b = 0; b < binCount; b++) {
+                                result.bins[axis][b].Grow(local.bins[axis][b].min, local.bins[axis][b].max);
+                                result.bins[axis][b].count += local.bins[axis][b].count;
+                            }
+                        }
+                    });
+
+                //sweep from both sides, the split after bin b puts [0, b] on the left
+                float bestCost = 1e30f;
+                int bestAxis = -1;
+                uint32_t bestBin = 0;
+                Aabb bestLeft, bestRight;
+                for (int axis = 0; axis < 3; axis++) {
+                    if (scale[axis] == 0.0f) {
+                        continue;
+                    }
+                    Aabb rightBounds[MAX_BIN_COUNT];
+                    uint32_t rightCount[MAX_BIN_COUNT];
+                    uint32_t rightSum = 0;
+                    for (uint32_t b = binCount - 1; b > 0; b--) {
+                        const Bin& bin = binSet.bins[axis][b];
+                        if (b < binCount - 1) {
+                            rightBounds[b] = rightBounds[b + 1];
+                        }
+                        if (bin.count > 0) {
+                            rightBounds[b].Grow(bin.min);
+                            rightBounds[b].Grow(bin.max);
+                            rightSum += bin.count;
+                        }
+                        rightCount[b] = rightSum;
+                    }
+                    Aabb leftBounds;
+                    uint32_t leftSum = 0;
+                    for (uint32_t b = 0; b < binCount - 1; b++) {
+                        const Bin& bin = binSet.bins[axis][b];
+                        if (bin.count > 0) {
+                            leftBounds.Grow(bin.min);
+                            leftBounds.Grow(bin.max);
+                            leftSum += bin.count;
+                        }
+                        if (leftSum == 0 || rightCount[b + 1] == 0) {
+                            continue;
+                        }
+                        const float cost = leftSum * leftBounds.SurfaceArea() + rightCount[b + 1] * rightBounds[b + 1].SurfaceArea();
+                        if (cost < bestCost) {
+                            bestCost = cost;
+                            bestAxis = axis;
+                            bestBin = b;
+                            bestLeft = leftBounds;
+                            bestRight = rightBounds[b + 1];
+                        }
+                    }
+                }
+
+                const float area = range.bounds.bounds.SurfaceArea();
+                const float leafCost = _settings.intersectionCost * count;
+                const float splitCost = bestAxis >= 0 && area > 0.0f
+                    ? _settings.traversalCost + _settings.intersectionCost * bestCost / area
+                    : 1e30f;
+                if (count <= _settings.maxLeafSize && splitCost >= leafCost) {
+                    return false;
+                }
+
+                left = { 0, begin, end, RangeBounds() };
+                right = { 0, begin, end, RangeBounds() };
+                if (bestAxis >= 0) {
+                    //the centroid bounds of the children are gathered while partitioning
+                    const float minimum = centroidBounds.min[bestAxis];
+                    const float axisScale = scale[bestAxis];
+                    uint32_t i = begin;
+                    uint32_t j = end;
+                    while (i < j) {
+                        const PrimitiveRef& ref = _refs[i];
+                        const float centroid[3] = { ref.Centroid(0), ref.Centroid(1), ref.Centroid(2) };
+                        if (BinIndex(centroid[bestAxis], minimum, axisScale, binCount) <= bestBin) {
+                            left.bounds.centroidBounds.Grow(centroid);
+                            i++;
+                        }
+                        else {
+                            right.bounds.centroidBounds.Grow(centroid);
+                            std::swap(_refs[i], _refs[--j]);
+                        }
+                    }
+                    left.end = right.begin = i;
+                    left.bounds.bounds = bestLeft;
+                    right.bounds.bounds = bestRight;
+                }
+                else {
+                    //all centroids coincide, any split is as good as another
+                    left.end = right.begin = begin + count / 2;
+                    left.bounds = ComputeBounds(left.begin, left.end, threadPool);
+                    right.bounds = ComputeBounds(right.begin, right.end, threadPool);
+                }
+                return true;
+            }
+
+            /**
+            * @brief    範囲のノードを葉または内部ノードにし、内部ノードなら子を追加する
+            */
+            bool Emit(std::vector<Node>& nodes, const Range& range, Range& left, Range& right, ThreadPool* threadPool) const {
+
+                Node& node = nodes[range.node];
+                std::copy(range.bounds.bounds.min, range.bounds.bounds.min + 3, node.min);
+                std::copy(range.bounds.bounds.max, range.bounds.bounds.max + 3, node.max);
+                if (!Split(range, left, right, threadPool)) {
+                    node.leftFirst = range.begin;
+                    node.count = range.end - range.begin;
+                    return false;
+                }
+                node.leftFirst = left.node = static_cast<uint32_t>(nodes.size());
+                node.count = 0;
+                right.node = left.node + 1;
+                nodes.push_back(Node{});
+                nodes.push_back(Node{});
+                return true;
+            }
+
+            /**
+            * @brief    部分木を構築する（nodes[range.node]が部分木のルート）
+            */
+            void BuildSubtree(std::vector<Node>& nodes, const Range& root) const {
+
+                std::vector<Range> stack;
+                stack.push_back(root);
+                while (!stack.empty()) {
+                    const Range range = stack.back();
+                    stack.pop_back();
+                    Range left, right;
+                    if (Emit(nodes, range, left, right, nullptr)) {
+                        stack.push_back(right);
+                        stack.push_back(left);
+                    }
+                }
+            }
+
+        private:
+
+            static uint32_t BinIndex(float centroid, float minimum, float scale, uint32_t binCount) {
+                const int32_t bin = static_cast<int32_t>((centroid - minimum) * scale);
+                return static_cast<uint32_t>(std::min(std::max(bin, 0), static_cast<int32_t>(binCount) - 1));
+            }
+
+            PrimitiveRef* _refs;
+            const BuildSettings& _settings;
+            uint32_t _binCount;
+        };
+    }
+
+    Bvh Build(const Aabb* bounds, size_t count, const BuildSettings& settings, ThreadPool* threadPool) {
+
+        auto tStart = std::chrono::high_resolution_clock::now();
+
+        Bvh bvh;
+        if (count == 0) {
+            return bvh;
+        }
+
+        std::vector<PrimitiveRef> refs(count);
+        ParallelFor(threadPool, count, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                std::copy(bounds[i].min, bounds[i].min + 3, refs[i].min);
+                std::copy(bounds[i].max, bounds[i].max + 3, refs[i].max);
+                refs[i].index = static_cast<uint32_t>(i);
+            }
+        });
+
+        Builder builder(refs.data(), settings);
+        bvh.nodes.reserve(2 * count);
+        bvh.nodes.push_back(Node{});
+        const Range root = { 0, 0, static_cast<uint32_t>(count), builder.ComputeBounds(0, static_cast<uint32_t>(count), threadPool) };
+
+        if (!threadPool) {
+            builder.BuildSubtree(bvh.nodes, root);
+        }
+        else {
+            //the top of the tree is split here with parallel binning until the ranges are small enough to be tasks
+            //tasks never wait on other tasks, so the pool cannot run out of workers
+            const size_t taskThreshold = std::max(settings.taskThreshold, count / (4 * threadPool->GetThreadCount()));
+            std::deque<Range> ranges;
+            std::vector<Range> subtrees;
+            ranges.push_back(root);
+            while (!ranges.empty()) {
+                const Range range = ranges.front();
+                ranges.pop_front();
+                if (range.end - range.begin <= taskThreshold) {
+                    subtrees.push_back(range);
+                    continue;
+                }
+                Range left, right;
+                if (builder.Emit(bvh.nodes, range, left, right, threadPool)) {
+                    ranges.push_back(left);
+                    ranges.push_back(right);
+                }
+            }
+
+            //each subtree is built into its own array, the primitive ranges are disjoint
+            std::vector<std::vector<Node>> subtreeNodes(subtrees.size());
+            std::vector<std::future<void>> tasks;
+            for (size_t i = 0; i < subtrees.size(); i++) {
+                tasks.push_back(threadPool->Submit([&builder, &subtrees, &subtreeNodes, i]() {
+                    std::vector<Node>& nodes = subtreeNodes[i];
+                    Range root = subtrees[i];
+                    root.node = 0;
+                    nodes.reserve(2 * (root.end - root.begin));
+                    nodes.push_back(Node{});
+                    builder.BuildSubtree(nodes, root);
+                }));
+            }
+            for (auto& task : tasks) {
+                task.get();
+            }
+
+            //local node i > 0 is appended at base + i - 1, the local root replaces the placeholder
+            for (size_t i = 0; i < subtrees.size(); i++) {
+                std::vector<Node>& nodes = subtreeNodes[i];
+                const uint32_t base = static_cast<uint32_t>(bvh.nodes.size());
+                for (Node& node : nodes) {
+                    if (!node.IsLeaf()) {
+                        node.leftFirst = base + node.leftFirst - 1;
+                    }
+                }
+                bvh.nodes[subtrees[i].node] = nodes[0];
+                bvh.nodes.insert(bvh.nodes.end(), nodes.begin() + 1, nodes.end());
+            }
+        }
+
+        bvh.primitiveIndices.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            bvh.primitiveIndices[i] = refs[i].index;
+        }
+
+        auto tEnd = std::chrono::high_resolution_clock::now();
+        bvh.stats = ComputeStats(bvh, settings);
+        bvh.stats.buildTime = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+        return bvh;
+    }
+
+    void GatherTriangles(const TriangleInput* inputs, size_t inputCount, std::vector<float>& positions) {
+
+        size_t triangleCount = 0;
+        for (size_t i = 0; i < inputCount; i++) {
+            triangleCount += inputs[i].indexCount / 3;
+        }
+        positions.resize(9 * triangleCount);
+
+        float* dst = positions.data();
+        for (size_t i = 0; i < inputCount; i++) {
+            const TriangleInput& input = inputs[i];
+            const unsigned char* vertices = static_cast<const unsigned char*>(input.vertices);
+            const unsigned char* indices = static_cast<const unsigned char*>(input.indices) + input.firstIndex * input.indexSize;
+            const size_t indexCount = input.indexCount / 3 * 3;
+            for (size_t j = 0; j < indexCount; j++) {
+                uint32_t index;
+                if (input.indexSize == sizeof(uint16_t)) {
+                    index = reinterpret_cast<const uint16_t*>(indices)[j];
+                }
+                else {
+                    index = reinterpret_cast<const uint32_t*>(indices)[j];
+                }
+                const unsigned char* vertex = vertices + index * input.vertexStride;
+                if (input.vertexFormat == VertexFormat::Float3) {
+                    const float* position = reinterpret_cast<const float*>(vertex);
+                    std::copy(position, position + 3, dst);
+                }
+                else {
+                    //the same dequantization as the BLAS geometry transform
+                    const int16_t* position = reinterpret_cast<const int16_t*>(vertex);
+                    for (int c = 0; c < 3; c++) {
+                        dst[c] = std::max(position[c] / 32767.0f, -1.0f) * input.positionScale[c] + input.positionOffset[c];
+                    }
+                }
+                dst += 3;
+            }
+        }
+    }
+
+    Bvh BuildTriangles(const TriangleInput* inputs, size_t inputCount, const BuildSettings& settings, ThreadPool* threadPool) {
+
+        auto tStart = std::chrono::high_resolution_clock::now();
+
+        std::vector<float> positions;
+        GatherTriangles(inputs, inputCount, positions);
+        const size_t triangleCount = positions.size() / 9;
+        std::vector<Aabb> bounds(triangleCount);
+        ParallelFor(threadPool, triangleCount, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                for (int v = 0; v < 3; v++) {
+                    bounds[i].Grow(&positions[9 * i + 3 * v]);
+                }
+            }
+        });
+
+        Bvh bvh = Build(bounds.data(), triangleCount, settings, threadPool);
+        auto tEnd = std::chrono::high_resolution_clock::now();
+        bvh.stats.buildTime = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+        return bvh;
+    }
+
+    BuildStats ComputeStats(const Bvh& bvh, const BuildSettings& settings) {
+
+        BuildStats stats;
+        if (bvh.nodes.empty()) {
+            return stats;
+        }
+        stats.nodeCount = static_cast<uint32_t>(bvh.nodes.size());
+
+        auto area = [](const Node& node) {
+            Aabb bounds;
+            std::copy(node.min, node.min + 3, bounds.min);
+            std::copy(node.max, node.max + 3, bounds.max);
+            return static_cast<double>(bounds.SurfaceArea());
+        };
+        const double rootArea = area(bvh.nodes[0]);
+
+        size_t leafPrimitives = 0;
+        double cost = 0.0;
+        std::vector<std::pair<uint32_t, uint32_t>> stack;
+        stack.push_back({ 0u, 1u });
+        while (!stack.empty()) {
+            const uint32_t index = stack.back().first;
+            const uint32_t depth = stack.back().second;
+            stack.pop_back();
+            const Node& node = bvh.nodes[index];
+            stats.maxDepth = std::max(stats.maxDepth, depth);
+            if (node.IsLeaf()) {
+                stats.leafCount++;
+                leafPrimitives += node.count;
+                cost += settings.intersectionCost * node.count * area(node);
+                continue;
+            }
+            cost += settings.traversalCost * area(node);
+            stack.push_back({ node.leftFirst, depth + 1 });
+            stack.push_back({ node.leftFirst + 1, depth + 1 });
+        }
+        stats.sahCost = rootArea > 0.0 ? cost / rootArea : 0.0;
+        stats.averageLeafSize = stats.leafCount > 0 ? static_cast<double>(leafPrimitives) / stats.leafCount : 0.0;
+        return stats;
+    }
+}
\ No newline at end of file
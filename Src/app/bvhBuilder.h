@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+namespace bvhBuilder
+{
+    /**
+    * @brief    軸平行境界ボックス
+    */
+    struct Aabb {
+        float min[3] = { 1e30f, 1e30f, 1e30f };
+        float max[3] = { -1e30f, -1e30f, -1e30f };
+
+        void Grow(const float* point);
+        void Grow(const Aabb& other);
+        float SurfaceArea() const;
+    };
+
+    /**
+    * @brief    BVHのノード（32byte）
+    *           count 0 : 内部ノード（子はleftFirstとleftFirst + 1）
+    *           count > 0 : 葉（primitiveIndicesの[leftFirst, leftFirst + count)）
+    */
+    struct Node {
+        float min[3];
+        uint32_t leftFirst;
+        float max[3];
+        uint32_t count;
+
+        bool IsLeaf() const { return count > 0; }
+    };
+
+    /**
+    * @brief    頂点フォーマット（PolygonMesh::vertexFormatと同じもの）
+    */
+    enum class VertexFormat {
+        //VK_FORMAT_R32G32B32_SFLOAT
+        Float3,
+        //VK_FORMAT_R16G16B16A16_SNORM, pos = snorm * positionScale + positionOffset
+        Snorm16x4
+    };
+
+    /**
+    * @brief    三角形の入力（PolygonMeshの頂点とインデックスのホスト側のコピー）
+    */
+    struct TriangleInput {
+        const void* vertices = nullptr;
+        size_t vertexStride = 0;
+        VertexFormat vertexFormat = VertexFormat::Float3;
+        float positionScale[3] = { 1.0f, 1.0f, 1.0f };
+        float positionOffset[3] = { 0.0f, 0.0f, 0.0f };
+        const void* indices = nullptr;
+        //2 : uint16, 4 : uint32
+        uint32_t indexSize = sizeof(uint32_t);
+        size_t firstIndex = 0;
+        size_t indexCount = 0;
+    };
+
+    /**
+    * @brief    ビルドの設定
+    */
+    struct BuildSettings {
+        uint32_t binCount = 16;
+        //nodes this small become leaves when the split does not pay off
+        uint32_t maxLeafSize = 8;
+        //SAH costs of a node visit and of a primitive test
+        float traversalCost = 1.0f;
+        float intersectionCost = 1.0f;
+        //nodes with fewer primitives are built as one task
+        size_t taskThreshold = 4096;
+    };
+
+    /**
+    * @brief    ビルド結果の統計情報
+    */
+    struct BuildStats {
+        //expected cost of a ray query relative to intersecting the root bounds
+        double sahCost = 0.0;
+        uint32_t nodeCount = 0;
+        uint32_t leafCount = 0;
+        uint32_t maxDepth = 0;
+        double averageLeafSize = 0.0;
+        double buildTime = 0.0;
+    };
+
+    /**
+    * @brief    ビルドしたBVH（nodes[0]がルート）
+    */
+    struct Bvh {
+        std::vector<Node> nodes;
+        //primitive (triangle) indices in leaf order
+        std::vector<uint32_t> primitiveIndices;
+        BuildStats stats;
+    };
+
+    /**
+    * @brief    境界ボックスの配列からビンSAHでBVHを構築する
+    *           threadPoolがnullでなければ大きなノードのビニングと部分木をワーカースレッドで処理する
+    *           threadPoolのワーカースレッドからは呼ばないこと
+    */
+    Bvh Build(const Aabb* bounds, size_t count, const BuildSettings& settings = BuildSettings(), ThreadPool* threadPool = nullptr);
+
+    /**
+    * @brief    三角形の入力からBVHを構築する（三角形の番号はinputsの順の通し番号）
+    */
+    Bvh BuildTriangles(const TriangleInput* inputs, size_t inputCount, const BuildSettings& settings = BuildSettings(), ThreadPool* threadPool = nullptr);
+
+    /**
+    * @brief    三角形の頂点座標を取り出す（positionsに三角形ごとに9つのfloatを書き込む）
+    */
+    void GatherTriangles(const TriangleInput* inputs, size_t inputCount, std::vector<float>& positions);
+
+    /**
+    * @brief    SAHコスト、ノード数、葉の数、深さを計算する（buildTime以外）
+    */
+    BuildStats ComputeStats(const Bvh& bvh, const BuildSettings& settings = BuildSettings());
+}
\ No newline at end of file
@@ -0,0 +1,62 @@
+#include "cacheFileWriter.h"
+
+#include <algorithm>
+#include <cstdio>
+
+CacheFileWriter::CacheFileWriter(const std::string& filename)
+    : _filename(filename)
+    , _tempFilename(filename + ".tmp")
+    , _file(_tempFilename, std::ios::binary | std::ios::trunc) {
+}
+
+CacheFileWriter::~CacheFileWriter() {
+
+    //an unfinished or failed write never leaves the temporary file behind
+    if (!_committed) {
+        if (_file.is_open()) {
+            _file.close();
+        }
+        std::remove(_tempFilename.c_str());
+    }
+}
+
+void CacheFileWriter::WriteSection(uint64_t offset, const void* data, size_t size) {
+
+    static const char zero[16] = {};
+    if (!_file) {
+        return;
+    }
+    uint64_t position = static_cast<uint64_t>(_file.tellp());
+    while (_file && position < offset) {
+        const uint64_t padding = std::min<uint64_t>(offset - position, sizeof(zero));
+        _file.write(zero, static_cast<std::streamsize>(padding));
+        position += padding;
+    }
+    if (size > 0) {
+        _file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    }
+}
+
+bool CacheFileWriter::Finish() {
+
+    if (_file.is_open()) {
+        _file.close();
+    }
+    //close flushes the last writes, so the state is checked only after it
+    _finished = static_cast<bool>(_file);
+    if (!_finished) {
+        std::remove(_tempFilename.c_str());
+    }
+    return _finished;
+}
+
+bool CacheFileWriter::Commit() {
+
+    if (!_finished) {
+        return false;
+    }
+    //std::rename does not replace an existing file on Windows
+    std::remove(_filename.c_str());
+    _committed = std::rename(_tempFilename.c_str(), _filename.c_str()) == 0;
+    return _committed;
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+/**
+* @brief    キャッシュファイルを一時ファイルに書き出し、書き込みに成功した時だけ元のファイルと置き換える
+*           Finishで書き込みを確認し、元のファイルを使い終わってからCommitで置き換える
+*/
+class CacheFileWriter {
+
+public:
+
+    explicit CacheFileWriter(const std::string& filename);
+    ~CacheFileWriter();
+
+    /**
+    * @brief    コピーコンストラクタの禁止
+    */
+    CacheFileWriter(const CacheFileWriter&) = delete;
+    CacheFileWriter& operator=(const CacheFileWriter&) = delete;
+
+    /**
+    * @brief    offsetまでゼロで埋めてからデータを書き込む
+    */
+    void WriteSection(uint64_t offset, const void* data, size_t size);
+
+    /**
+    * @brief    一時ファイルを閉じて書き込めたか確認する（失敗した時は一時ファイルを削除してfalse）
+    */
+    bool Finish();
+
+    /**
+    * @brief    元のファイルを削除して一時ファイルの名前を変える（置き換えなかった一時ファイルはデストラクタで削除する）
+    */
+    bool Commit();
+
+private:
+
+    std::string _filename;
+    std::string _tempFilename;
+    std::ofstream _file;
+    bool _finished = false;
+    bool _committed = false;
+};
\ No newline at end of file
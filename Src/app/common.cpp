@@ -1,4 +1,54 @@
 #include "common.h"
+#include "memoryAllocator.h"
+
+void* vk::Buffer::Map(VkDevice device) {
+    if (allocation.mapped) {
+        return allocation.mapped;
+    }
+    void* data;
+    vkMapMemory(device, memory, allocation.offset, VK_WHOLE_SIZE, 0, &data);
+    return data;
+}
+
+void vk::Buffer::Unmap(VkDevice device) {
+    if (!allocation.mapped) {
+        vkUnmapMemory(device, memory);
+    }
+}
+
+void vk::Buffer::Destroy(VkDevice device) {
+    vkDestroyBuffer(device, buffer, nullptr);
+    if (allocation.allocator) {
+        allocation.allocator->Free(allocation);
+    }
+    else if (memory != VK_NULL_HANDLE) {
+        vkFreeMemory(device, memory, nullptr);
+    }
+    buffer = VK_NULL_HANDLE;
+    memory = VK_NULL_HANDLE;
+}
+
+void vk::Image::Destroy(VkDevice device) {
+    if (view != VK_NULL_HANDLE) {
+        vkDestroyImageView(device, view, nullptr);
+    }
+    if (image != VK_NULL_HANDLE) {
+        vkDestroyImage(device, image, nullptr);
+    }
+    if (allocation.allocator) {
+        allocation.allocator->Free(allocation);
+    }
+    else if (memory != VK_NULL_HANDLE) {
+        vkFreeMemory(device, memory, nullptr);
+    }
+    if (sampler != VK_NULL_HANDLE) {
+        vkDestroySampler(device, sampler, nullptr);
+    }
+    image = VK_NULL_HANDLE;
+    memory = VK_NULL_HANDLE;
+    view = VK_NULL_HANDLE;
+    sampler = VK_NULL_HANDLE;
+}
 
 
 void vk::Image::SetImageLayout(VkCommandBuffer commandBuffer, VkImageLayout newLayout, uint32_t mipLevels) {
@@ -7,6 +57,8 @@ void vk::Image::SetImageLayout(VkCommandBuffer commandBuffer, VkImageLayout newL
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     barrier.oldLayout = currentLayout;
     barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     barrier.image = image;
     barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     barrier.subresourceRange.baseMipLevel = 0;
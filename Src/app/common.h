@@ -17,6 +17,8 @@
 const uint32_t WIDTH = 1280;
 const uint32_t HEIGHT = 720;
 
+class MemoryAllocator;
+
 namespace vk {
 	
 	struct MouseButtons {
@@ -25,9 +27,29 @@ namespace vk {
 		bool middle = false;
 	};
 
+	//what an allocation is used for, reported per category by MemoryAllocator
+	enum class MemoryCategory : uint32_t {
+		Geometry, Texture, BLAS, TLAS, Scratch, SBT, Uniform, Staging, RenderTarget, Other, Count
+	};
+
+	//range of a VkDeviceMemory block handed out by MemoryAllocator
+	struct Allocation {
+		MemoryAllocator* allocator = nullptr;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		uint32_t memoryTypeIndex = 0;
+		uint32_t type = 0;
+		MemoryCategory category = MemoryCategory::Other;
+		uint32_t block = 0;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		//host visible memory is persistently mapped
+		void* mapped = nullptr;
+	};
+
 	struct Buffer {
 		VkBuffer buffer = VK_NULL_HANDLE;
 		VkDeviceMemory memory = VK_NULL_HANDLE;
+		Allocation allocation;
 		int count = 0;
 		void* mapped;
 		VkDeviceAddress address = 0;
@@ -37,15 +59,22 @@ namespace vk {
 			VkMappedMemoryRange mappedRange = {};
 			mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
 			mappedRange.memory = memory;
-			mappedRange.offset = 0;
+			mappedRange.offset = allocation.offset;
 			mappedRange.size = uploadSize;
 			vkFlushMappedMemoryRanges(device, 1, &mappedRange);
 		}
 
-		void Destroy(VkDevice& device) {
-			vkDestroyBuffer(device, buffer, nullptr);
-			vkFreeMemory(device, memory, nullptr);
-		}
+		/**
+		* @brief    ホストから書き込むアドレスを取得する（サブアロケーションされたメモリはマップ済み）
+		*/
+		void* Map(VkDevice device);
+
+		/**
+		* @brief    Mapの対になる呼び出し
+		*/
+		void Unmap(VkDevice device);
+
+		void Destroy(VkDevice device);
 
 		uint64_t GetBufferDeviceAddress(VkDevice device) {
 			VkBufferDeviceAddressInfo bufferDeviceInfo{};
@@ -60,24 +89,12 @@ namespace vk {
 	struct Image {
 		VkImage image = VK_NULL_HANDLE;
 		VkDeviceMemory memory = VK_NULL_HANDLE;
+		Allocation allocation;
 		VkImageView view = VK_NULL_HANDLE;
 		VkSampler sampler = VK_NULL_HANDLE;
 		VkImageLayout currentLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 		uint32_t layerCount = 1;
-		void Destroy(VkDevice device) {
-			if (image != VK_NULL_HANDLE) {
-				vkDestroyImage(device, image, nullptr);
-			}
-			if (memory != VK_NULL_HANDLE) {
-				vkDestroyImageView(device, view, nullptr);
-			}
-			if (view != VK_NULL_HANDLE) {
-				vkFreeMemory(device, memory, nullptr);
-			}
-			if (sampler != VK_NULL_HANDLE) {
-				vkDestroySampler(device, sampler, nullptr);
-			}
-		}
+		void Destroy(VkDevice device);
 		
 		void SetImageLayout(VkCommandBuffer commandBuffer, VkImageLayout newLayout, uint32_t mipLevels);
 
@@ -93,6 +110,13 @@ namespace PrimitiveMesh {
 		glm::vec4 color;
 	};
 
+	//shading attributes of a vertex whose position lives in a separate stream
+	struct Attribute {
+		glm::vec3 normal;
+		glm::vec2 uv;
+		glm::vec4 color;
+	};
+
 	inline void GetPlane(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
 	{
 		glm::vec4 color = glm::vec4(1, 1, 1, 1);
@@ -125,7 +149,7 @@ namespace PrimitiveMesh {
 		for (uint32_t stack = 0; stack <= stacks; stack++) {
 			for (uint32_t slice = 0; slice <= slices; slice++) {
 				glm::vec3 p;
-				//-1`1
+				//-1～1
 				p.y = 2.0f * stack / STACKS - 1.0f;
 				//circle radius correspond to y
 				float r = std::sqrtf(1 - p.y * p.y);
@@ -164,4 +188,14 @@ namespace PrimitiveMesh {
 			}
 		}
 	}
+
+	//tightly packed positions for the BLAS build, the rest goes to the attribute stream
+	inline void SplitVertices(const std::vector<Vertex>& vertices, std::vector<glm::vec3>& positions, std::vector<Attribute>& attributes) {
+		positions.resize(vertices.size());
+		attributes.resize(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++) {
+			positions[i] = vertices[i].pos;
+			attributes[i] = Attribute{ vertices[i].normal, vertices[i].uv, vertices[i].color };
+		}
+	}
 }
\ No newline at end of file
@@ -0,0 +1,1066 @@
+#include "cpuRayTracer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <mutex>
+
+#include "threadPool.h"
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define CPU_RAY_TRACER_SSE
+#include <emmintrin.h>
+#endif
+
+namespace cpuRayTracer
+{
+    namespace {
+
+        //tmin / tmax of the traceRayEXT calls in raygen.rgen and tracenextRay.glsl
+        constexpr float PRIMARY_T_MIN = 0.001f;
+        constexpr float REFLECTION_T_MIN = 0.001f;
+        constexpr float REFRACTION_T_MIN = 0.00001f;
+        constexpr float SHADOW_T_MIN = 0.00001f;
+        constexpr float T_MAX = 10000.0f;
+        //tmax of the lanes that take no part in a trace, every test fails for them
+        constexpr float INACTIVE_T_MAX = -1.0f;
+        constexpr uint32_t MISS = ~0u;
+        constexpr uint32_t CONE_SAMPLE_COUNT = 5;
+
+#ifdef CPU_RAY_TRACER_SSE
+        struct Float4 {
+            __m128 v;
+
+            Float4() = default;
+            Float4(__m128 value) : v(value) {}
+            explicit Float4(float value) : v(_mm_set1_ps(value)) {}
+
+            static Float4 Load(const float* src) { return _mm_load_ps(src); }
+            void Store(float* dst) const { _mm_store_ps(dst, v); }
+        };
+
+        inline Float4 operator+(Float4 a, Float4 b) { return _mm_add_ps(a.v, b.v); }
+        inline Float4 operator-(Float4 a, Float4 b) { return _mm_sub_ps(a.v, b.v); }
+        inline Float4 operator*(Float4 a, Float4 b) { return _mm_mul_ps(a.v, b.v); }
+        inline Float4 operator/(Float4 a, Float4 b) { return _mm_div_ps(a.v, b.v); }
+        inline Float4 Min(Float4 a, Float4 b) { return _mm_min_ps(a.v, b.v); }
+        inline Float4 Max(Float4 a, Float4 b) { return _mm_max_ps(a.v, b.v); }
+        inline Float4 CmpLt(Float4 a, Float4 b) { return _mm_cmplt_ps(a.v, b.v); }
+        inline Float4 CmpLe(Float4 a, Float4 b) { return _mm_cmple_ps(a.v, b.v); }
+        inline Float4 CmpNeq(Float4 a, Float4 b) { return _mm_cmpneq_ps(a.v, b.v); }
+        inline Float4 And(Float4 a, Float4 b) { return _mm_and_ps(a.v, b.v); }
+        inline Float4 Select(Float4 mask, Float4 a, Float4 b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+        inline int MoveMask(Float4 mask) { return _mm_movemask_ps(mask.v); }
+#else
+        struct Float4 {
+            float v[4];
+
+            Float4() = default;
+            explicit Float4(float value) : v{ value, value, value, value } {}
+
+            static Float4 Load(const float* src) { Float4 r; memcpy(r.v, src, sizeof(r.v)); return r; }
+            void Store(float* dst) const { memcpy(dst, v, sizeof(v)); }
+        };
+
+        //comparisons return all bits set in the lanes where they hold, like SSE
+        inline float MaskLane(bool value) {
+            const uint32_t bits = value ? ~0u : 0u;
+            float lane;
+            memcpy(&lane, &bits, sizeof(lane));
+            return lane;
+        }
+
+        inline uint32_t LaneBits(float lane) {
+            uint32_t bits;
+            memcpy(&bits, &lane, sizeof(bits));
+            return bits;
+        }
+
+        template<class F>
+        inline Float4 Apply(Float4 a, Float4 b, F func) {
+            Float4 r;
+            for (int i = 0; i < 4; i++) {
+                r.v[i] = func(a.v[i], b.v[i]);
+            }
+            return r;
+        }
+
+        inline Float4 operator+(Float4 a, Float4 b) { return Apply(a, b, [](float x, float y) { return x + y; }); }
+        inline Float4 operator-(Float4 a, Float4 b) { return Apply(a, b, [](float x, float y) { return x - y; }); }
+        inline Float4 operator*(Float4 a, Float4 b) { return Apply(a, b, [](float x, float y) { return x * y; }); }
+        inline Float4 operator/(Float4 a, Float4 b) { return Apply(a, b, [](float x, float y) { return x / y; }); }
+        inline Float4 Min(Float4 a, Float4 b) { return Apply(a, b, [](float x, float y) { return x < y ? x : y; }); }
+        inline Float4 Max(Float4 a, Float4 b) { return Apply(a, b, [](float x, float y) { return x > y ? x : y; }); }
+        inline Float4 CmpLt(Float4 a, Float4 b) { return Apply(a, b, [](float x, float y) { return MaskLane(x < y); }); }
+        inline Float4 CmpLe(Float4 a, Float4 b) { return Apply(a, b, [](float x, float y) { return MaskLane(x <= y); }); }
+        inline Float4 CmpNeq(Float4 a, Float4 b) { return Apply(a, b, [](float x, float y) { return MaskLane(x != y); }); }
+        inline Float4 And(Float4 a, Float4 b) { return Apply(a, b, [](float x, float y) { return LaneBits(x) & LaneBits(y) ? MaskLane(true) : MaskLane(false); }); }
+        inline Float4 Select(Float4 mask, Float4 a, Float4 b) {
+            Float4 r;
+            for (int i = 0; i < 4; i++) {
+                r.v[i] = LaneBits(mask.v[i]) ? a.v[i] : b.v[i];
+            }
+            return r;
+        }
+        inline int MoveMask(Float4 mask) {
+            int bits = 0;
+            for (int i = 0; i < 4; i++) {
+                bits |= (LaneBits(mask.v[i]) >> 31) << i;
+            }
+            return bits;
+        }
+#endif
+
+        inline int BitCount(int mask) {
+            return (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+        }
+
+        float HalfToFloat(uint16_t half) {
+            const uint32_t sign = uint32_t(half >> 15) << 31;
+            const uint32_t exponent = (half >> 10) & 0x1F;
+            const uint32_t mantissa = half & 0x3FF;
+            float value;
+            if (exponent == 0) {
+                value = std::ldexp(float(mantissa), -24);
+            }
+            else if (exponent == 31) {
+                value = mantissa == 0 ? INFINITY : NAN;
+            }
+            else {
+                value = std::ldexp(float(mantissa | 0x400), int(exponent) - 25);
+            }
+            uint32_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            bits |= sign;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        //unpackSnorm2x16
+        inline float Snorm16(int16_t value) {
+            return std::max(value / 32767.0f, -1.0f);
+        }
+
+        //OctDecode of vertex.glsl
+        glm::vec3 OctDecode(glm::vec2 e) {
+            glm::vec3 n = glm::vec3(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+            const float t = std::max(-n.z, 0.0f);
+            n.x += n.x >= 0.0f ? -t : t;
+            n.y += n.y >= 0.0f ? -t : t;
+            return glm::normalize(n);
+        }
+
+        const float* GetSrgbTable() {
+            static const std::vector<float> table = []() {
+                std::vector<float> values(256);
+                for (int i = 0; i < 256; i++) {
+                    const float c = i / 255.0f;
+                    values[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+                }
+                return values;
+            }();
+            return table.data();
+        }
+
+        glm::vec3 Fetch(const Image& image, int32_t x, int32_t y) {
+            const uint8_t* texel = &image.pixels[(size_t(y) * image.width + x) * 4];
+            if (image.srgb) {
+                const float* table = GetSrgbTable();
+                return glm::vec3(table[texel[0]], table[texel[1]], table[texel[2]]);
+            }
+            return glm::vec3(texel[0], texel[1], texel[2]) / 255.0f;
+        }
+
+        //bilinear, repeat wraps the coordinates, otherwise they are clamped to the edge
+        glm::vec3 Sample(const Image& image, glm::vec2 uv, bool repeat) {
+            const float x = uv.x * image.width - 0.5f;
+            const float y = uv.y * image.height - 0.5f;
+            const float fx = std::floor(x);
+            const float fy = std::floor(y);
+            const int32_t width = int32_t(image.width);
+            const int32_t height = int32_t(image.height);
+            auto wrap = [repeat](int64_t i, int32_t size) {
+                if (repeat) {
+                    const int64_t r = i % size;
+                    return int32_t(r < 0 ? r + size : r);
+                }
+                return int32_t(std::min<int64_t>(std::max<int64_t>(i, 0), size - 1));
+            };
+            //huge or broken coordinates are not worth more than a texel
+            if (!std::isfinite(fx) || !std::isfinite(fy) || std::abs(fx) > 1e9f || std::abs(fy) > 1e9f) {
+                return Fetch(image, 0, 0);
+            }
+            const int32_t x0 = wrap(int64_t(fx), width);
+            const int32_t x1 = wrap(int64_t(fx) + 1, width);
+            const int32_t y0 = wrap(int64_t(fy), height);
+            const int32_t y1 = wrap(int64_t(fy) + 1, height);
+            const float tx = x - fx;
+            const float ty = y - fy;
+            return glm::mix(
+                glm::mix(Fetch(image, x0, y0), Fetch(image, x1, y0), tx),
+                glm::mix(Fetch(image, x0, y1), Fetch(image, x1, y1), tx),
+                ty
+            );
+        }
+
+        //face selection of the cube map lookup in the Vulkan specification
+        glm::vec3 SampleCube(const Image faces[6], glm::vec3 direction) {
+            const glm::vec3 a = glm::abs(direction);
+            int face;
+            float sc, tc, ma;
+            if (a.x >= a.y && a.x >= a.z) {
+                face = direction.x >= 0.0f ? 0 : 1;
+                sc = direction.x >= 0.0f ? -direction.z : direction.z;
+                tc = -direction.y;
+                ma = a.x;
+            }
+            else if (a.y >= a.z) {
+                face = direction.y >= 0.0f ? 2 : 3;
+                sc = direction.x;
+                tc = direction.y >= 0.0f ? direction.z : -direction.z;
+                ma = a.y;
+            }
+            else {
+                face = direction.z >= 0.0f ? 4 : 5;
+                sc = direction.z >= 0.0f ? direction.x : -direction.x;
+                tc = -direction.y;
+                ma = a.z;
+            }
+            if (!(ma > 0.0f) || faces[face].pixels.empty()) {
+                return glm::vec3(0.0f);
+            }
+            return Sample(faces[face], glm::vec2(0.5f * (sc / ma + 1.0f), 0.5f * (tc / ma + 1.0f)), false);
+        }
+
+        //randomU, nextRand, angleAxis3x3 and getConeSample of common.glsl
+        uint32_t RandomU(glm::vec2 uv) {
+            const float r = glm::dot(uv, glm::vec2(127.1f, 311.7f));
+            return uint32_t(12345.0f * glm::fract(std::sin(r) * 43758.5453123f));
+        }
+
+        float NextRand(uint32_t& s) {
+            s = 1664525u * s + 1013904223u;
+            return float(s & 0x00FFFFFF) / float(0x01000000);
+        }
+
+        glm::mat3 AngleAxis3x3(float angle, glm::vec3 axis) {
+            const float s = std::sin(angle);
+            const float c = std::cos(angle);
+            const float t = 1.0f - c;
+            const float x = axis.x;
+            const float y = axis.y;
+            const float z = axis.z;
+
+            //column-major like the GLSL constructor
+            return glm::mat3(
+                t * x * x + c, t * x * y - s * z, t * x * z + s * y,
+                t * x * y + s * z, t * y * y + c, t * y * z - s * x,
+                t * x * z - s * y, t * y * z + s * x, t * z * z + c
+            );
+        }
+
+        glm::vec3 GetConeSample(uint32_t& randSeed, glm::vec3 direction, float coneAngle) {
+            const float cosAngle = std::cos(coneAngle);
+            const float PI = 3.1415926535f;
+
+            const float z = NextRand(randSeed) * (1.0f - cosAngle) + cosAngle;
+            const float phi = NextRand(randSeed) * 2.0f * PI;
+            const float x = std::sqrt(1.0f - z * z) * std::cos(phi);
+            const float y = std::sqrt(1.0f - z * z) * std::sin(phi);
+            const glm::vec3 north = glm::vec3(0.0f, 0.0f, 1.0f);
+            const glm::vec3 axis = glm::normalize(glm::cross(glm::normalize(direction), north));
+            const float angle = std::acos(glm::dot(glm::normalize(direction), north));
+            return AngleAxis3x3(angle, axis) * glm::vec3(x, y, z);
+        }
+
+        //calcLight.glsl
+        glm::vec3 LambertLight(glm::vec3 worldNormal, glm::vec3 toLightDir, glm::vec3 albedo, glm::vec3 lightColor, glm::vec3 ambientColor) {
+            const float dotNL = std::max(glm::dot(worldNormal, toLightDir), 0.0f);
+            glm::vec3 color = dotNL * lightColor * albedo;
+            color += ambientColor * albedo;
+            return color;
+        }
+
+        glm::vec3 PhongSpecular(glm::vec3 worldNormal, glm::vec3 incidentLightRay, glm::vec3 toEyeDir, glm::vec4 specular) {
+            const glm::vec3 reflectedLightRay = glm::normalize(glm::reflect(incidentLightRay, worldNormal));
+            const float specularReflection = std::pow(std::max(0.0f, glm::dot(reflectedLightRay, toEyeDir)), specular.w);
+            return specularReflection * glm::vec3(specular);
+        }
+
+        /**
+        * @brief    タイルの番号をスレッドごとの連続した範囲に分けて配るキュー
+        *           自分の範囲を前から取り、空になったら他のスレッドの範囲の後ろ半分を取る
+        */
+        class TileQueue {
+
+        public:
+
+            TileQueue(uint32_t tileCount, uint32_t workerCount) : _ranges(workerCount) {
+                for (uint32_t i = 0; i < workerCount; i++) {
+                    _ranges[i].begin = uint32_t(uint64_t(tileCount) * i / workerCount);
+                    _ranges[i].end = uint32_t(uint64_t(tileCount) * (i + 1) / workerCount);
+                }
+            }
+
+            bool Pop(uint32_t worker, uint32_t& tile, uint32_t& stolenTiles) {
+                {
+                    Range& own = _ranges[worker];
+                    std::lock_guard<std::mutex> lock(own.mutex);
+                    if (own.begin < own.end) {
+                        tile = own.begin++;
+                        return true;
+                    }
+                }
+
+                //only one lock is held at a time, tiles in transit are finished by the thief
+                const uint32_t workerCount = uint32_t(_ranges.size());
+                for (uint32_t i = 1; i < workerCount; i++) {
+                    Range& victim = _ranges[(worker + i) % workerCount];
+                    uint32_t begin, end;
+                    {
+                        std::lock_guard<std::mutex> lock(victim.mutex);
+                        const uint32_t remaining = victim.end - victim.begin;
+                        if (remaining == 0) {
+                            continue;
+                        }
+                        end = victim.end;
+                        begin = end - (remaining + 1) / 2;
+                        victim.end = begin;
+                    }
+                    stolenTiles += end - begin;
+                    tile = begin;
+                    if (end - begin > 1) {
+                        Range& own = _ranges[worker];
+                        std::lock_guard<std::mutex> lock(own.mutex);
+                        own.begin = begin + 1;
+                        own.end = end;
+                    }
+                    return true;
+                }
+                return false;
+            }
+
+        private:
+
+            struct Range {
+                std::mutex mutex;
+                uint32_t begin = 0;
+                uint32_t end = 0;
+            };
+
+            std::vector<Range> _ranges;
+        };
+    }
+
+    /**
+    * @brief    1スレッド分のパケットの走査とシェーディング
+    */
+    class PacketTracer {
+
+    public:
+
+        PacketTracer(const Renderer& renderer, const Uniforms& uniforms, const RenderSettings& settings) :
+            _renderer(renderer), _scene(renderer._scene), _uniforms(uniforms), _settings(settings) {
+        }
+
+        //pixels of [x0, x1) x [y0, y1) in 2x2 quads, one packet per quad
+        void RenderTile(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, uint8_t* pixels) {
+            for (uint32_t y = y0; y < y1; y += 2) {
+                for (uint32_t x = x0; x < x1; x += 2) {
+                    uint32_t px[4] = { x, x + 1, x, x + 1 };
+                    uint32_t py[4] = { y, y, y + 1, y + 1 };
+                    int valid = 0;
+                    for (int lane = 0; lane < 4; lane++) {
+                        if (px[lane] < x1 && py[lane] < y1) {
+                            valid |= 1 << lane;
+                        }
+                    }
+                    glm::vec3 colors[4];
+                    TraceQuad(px, py, valid, colors);
+                    for (int lane = 0; lane < 4; lane++) {
+                        if (!(valid & (1 << lane))) {
+                            continue;
+                        }
+                        uint8_t* pixel = &pixels[(size_t(py[lane]) * _settings.width + px[lane]) * 4];
+                        for (int c = 0; c < 3; c++) {
+                            pixel[c] = uint8_t(std::min(std::max(colors[lane][c], 0.0f), 1.0f) * 255.0f + 0.5f);
+                        }
+                        pixel[3] = 255;
+                    }
+                }
+            }
+        }
+
+        const RenderStats& GetStats() const {
+            return _stats;
+        }
+
+        RenderStats& GetStats() {
+            return _stats;
+        }
+
+    private:
+
+        //the rays of one quad, lanes outside active have tMax INACTIVE_T_MAX
+        struct Packet {
+            alignas(16) float origin[3][4];
+            alignas(16) float direction[3][4];
+            alignas(16) float tMin[4];
+            alignas(16) float tMax[4];
+        };
+
+        struct Hit {
+            alignas(16) float t[4];
+            alignas(16) float u[4];
+            alignas(16) float v[4];
+            uint32_t instance[4];
+            //index into MeshData::triangles
+            uint32_t triangle[4];
+        };
+
+        struct RayState {
+            Float4 origin[3];
+            Float4 direction[3];
+            Float4 inverseDirection[3];
+            Float4 tMin;
+            Float4 tMax;
+            Float4 u;
+            Float4 v;
+            //children of the lane with the lowest index are visited nearest first
+            bool negative[3];
+        };
+
+        struct Surface {
+            glm::vec3 worldPos;
+            glm::vec3 worldNormal;
+            glm::vec2 uv;
+            const Material* material;
+            bool useShadow;
+        };
+
+        void InitializeState(RayState& state) const {
+            int lane = 0;
+            int active = MoveMask(CmpLe(state.tMin, state.tMax));
+            while (active && !(active & (1 << lane))) {
+                lane++;
+            }
+            alignas(16) float direction[4];
+            for (int c = 0; c < 3; c++) {
+                state.inverseDirection[c] = Float4(1.0f) / state.direction[c];
+                state.direction[c].Store(direction);
+                state.negative[c] = direction[lane & 3] < 0.0f;
+            }
+        }
+
+        //mask of the lanes that enter the node before their tMax
+        static int IntersectBounds(const bvhBuilder::Node& node, const RayState& state) {
+            Float4 tNear = state.tMin;
+            Float4 tFar = state.tMax;
+            for (int c = 0; c < 3; c++) {
+                const Float4 t0 = (Float4(node.min[c]) - state.origin[c]) * state.inverseDirection[c];
+                const Float4 t1 = (Float4(node.max[c]) - state.origin[c]) * state.inverseDirection[c];
+                tNear = Max(tNear, Min(t0, t1));
+                tFar = Min(tFar, Max(t0, t1));
+            }
+            return MoveMask(CmpLe(tNear, tFar));
+        }
+
+        //Moller-Trumbore, u and v are the barycentrics of v1 and v2 like the hit attributes
+        static Float4 IntersectTriangle(const Renderer::Triangle& triangle, const RayState& state, Float4& t, Float4& u, Float4& v) {
+            const Float4 e1[3] = { Float4(triangle.e1.x), Float4(triangle.e1.y), Float4(triangle.e1.z) };
+            const Float4 e2[3] = { Float4(triangle.e2.x), Float4(triangle.e2.y), Float4(triangle.e2.z) };
+            const Float4* d = state.direction;
+
+            const Float4 p[3] = {
+                d[1] * e2[2] - d[2] * e2[1],
+                d[2] * e2[0] - d[0] * e2[2],
+                d[0] * e2[1] - d[1] * e2[0]
+            };
+            const Float4 det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+            const Float4 inverseDet = Float4(1.0f) / det;
+
+            const Float4 s[3] = {
+                state.origin[0] - Float4(triangle.v0.x),
+                state.origin[1] - Float4(triangle.v0.y),
+                state.origin[2] - Float4(triangle.v0.z)
+            };
+            u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inverseDet;
+
+            const Float4 q[3] = {
+                s[1] * e1[2] - s[2] * e1[1],
+                s[2] * e1[0] - s[0] * e1[2],
+                s[0] * e1[1] - s[1] * e1[0]
+            };
+            v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inverseDet;
+            t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inverseDet;
+
+            const Float4 zero(0.0f);
+            Float4 mask = CmpNeq(det, zero);
+            mask = And(mask, CmpLe(zero, u));
+            mask = And(mask, CmpLe(zero, v));
+            mask = And(mask, CmpLe(u + v, Float4(1.0f)));
+            mask = And(mask, CmpLe(state.tMin, t));
+            mask = And(mask, CmpLt(t, state.tMax));
+            return mask;
+        }
+
+        //pushes the children of an inner node, the nearer one ends up on top
+        static void PushChildren(const bvhBuilder::Node* nodes, const bvhBuilder::Node& node, const RayState& state, std::vector<uint32_t>& stack) {
+            const bvhBuilder::Node& left = nodes[node.leftFirst];
+            const bvhBuilder::Node& right = nodes[node.leftFirst + 1];
+            int axis = 0;
+            float separation = -1.0f;
+            float leftCenter = 0.0f;
+            float rightCenter = 0.0f;
+            for (int c = 0; c < 3; c++) {
+                const float l = left.min[c] + left.max[c];
+                const float r = right.min[c] + right.max[c];
+                if (std::abs(r - l) > separation) {
+                    separation = std::abs(r - l);
+                    axis = c;
+                    leftCenter = l;
+                    rightCenter = r;
+                }
+            }
+            const bool leftFirst = (leftCenter <= rightCenter) != state.negative[axis];
+            stack.push_back(leftFirst ? node.leftFirst + 1 : node.leftFirst);
+            stack.push_back(leftFirst ? node.leftFirst : node.leftFirst + 1);
+        }
+
+        template<bool Occlusion>
+        void TraverseMesh(uint32_t instanceIndex, RayState& world, Hit& hit) {
+
+            const Renderer::MeshData& mesh = _renderer._meshes[_scene.instances[instanceIndex].mesh];
+            const glm::mat4& m = _renderer._instances[instanceIndex].worldToObject;
+
+            //the direction is not renormalized, so t is the same in both spaces
+            RayState state;
+            for (int r = 0; r < 3; r++) {
+                state.origin[r] = Float4(m[0][r]) * world.origin[0] + Float4(m[1][r]) * world.origin[1] + Float4(m[2][r]) * world.origin[2] + Float4(m[3][r]);
+                state.direction[r] = Float4(m[0][r]) * world.direction[0] + Float4(m[1][r]) * world.direction[1] + Float4(m[2][r]) * world.direction[2];
+            }
+            state.tMin = world.tMin;
+            state.tMax = world.tMax;
+            state.u = world.u;
+            state.v = world.v;
+            InitializeState(state);
+
+            const bvhBuilder::Node* nodes = mesh.nodes.data();
+            std::vector<uint32_t>& stack = _meshStack;
+            stack.clear();
+            stack.push_back(0);
+            while (!stack.empty()) {
+                const bvhBuilder::Node& node = nodes[stack.back()];
+                stack.pop_back();
+                if (!IntersectBounds(node, state)) {
+                    continue;
+                }
+                if (!node.IsLeaf()) {
+                    PushChildren(nodes, node, state, stack);
+                    continue;
+                }
+                for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+                    Float4 t, u, v;
+                    const Float4 mask = IntersectTriangle(mesh.triangles[i], state, t, u, v);
+                    const int bits = MoveMask(mask);
+                    if (!bits) {
+                        continue;
+                    }
+                    if (Occlusion) {
+                        //occluded lanes drop out of the packet
+                        state.tMax = Select(mask, Float4(INACTIVE_T_MAX), state.tMax);
+                        if (!MoveMask(CmpLe(state.tMin, state.tMax))) {
+                            world.tMax = state.tMax;
+                            return;
+                        }
+                        continue;
+                    }
+                    state.tMax = Select(mask, t, state.tMax);
+                    state.u = Select(mask, u, state.u);
+                    state.v = Select(mask, v, state.v);
+                    for (int lane = 0; lane < 4; lane++) {
+                        if (bits & (1 << lane)) {
+                            hit.instance[lane] = instanceIndex;
+                            hit.triangle[lane] = i;
+                        }
+                    }
+                }
+            }
+            world.tMax = state.tMax;
+            world.u = state.u;
+            world.v = state.v;
+        }
+
+        //closest hit, or with Occlusion the lanes that hit anything get tMax INACTIVE_T_MAX
+        template<bool Occlusion>
+        void Trace(Packet& packet, Hit& hit) {
+
+            for (int lane = 0; lane < 4; lane++) {
+                hit.instance[lane] = MISS;
+                hit.triangle[lane] = MISS;
+            }
+            const std::vector<bvhBuilder::Node>& nodes = _renderer._topLevelNodes;
+            if (nodes.empty()) {
+                return;
+            }
+
+            RayState state;
+            for (int c = 0; c < 3; c++) {
+                state.origin[c] = Float4::Load(packet.origin[c]);
+                state.direction[c] = Float4::Load(packet.direction[c]);
+            }
+            state.tMin = Float4::Load(packet.tMin);
+            state.tMax = Float4::Load(packet.tMax);
+            state.u = Float4(0.0f);
+            state.v = Float4(0.0f);
+            InitializeState(state);
+
+            std::vector<uint32_t>& stack = _topLevelStack;
+            stack.clear();
+            stack.push_back(0);
+            while (!stack.empty()) {
+                const bvhBuilder::Node& node = nodes[stack.back()];
+                stack.pop_back();
+                if (!IntersectBounds(node, state)) {
+                    continue;
+                }
+                if (!node.IsLeaf()) {
+                    PushChildren(nodes.data(), node, state, stack);
+                    continue;
+                }
+                for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+                    TraverseMesh<Occlusion>(_renderer._topLevelInstances[i], state, hit);
+                    if (Occlusion && !MoveMask(CmpLe(state.tMin, state.tMax))) {
+                        stack.clear();
+                        break;
+                    }
+                }
+            }
+            state.tMax.Store(packet.tMax);
+            state.tMax.Store(hit.t);
+            state.u.Store(hit.u);
+            state.v.Store(hit.v);
+        }
+
+        //closesthit.rchit up to the lighting, GetVertex of vertex.glsl
+        Surface GetSurface(const Hit& hit, int lane) const {
+
+            const Instance& instance = _scene.instances[hit.instance[lane]];
+            const Mesh& mesh = _scene.meshes[instance.mesh];
+            const Renderer::MeshData& meshData = _renderer._meshes[instance.mesh];
+
+            const uint32_t id = meshData.triangleIds[hit.triangle[lane]];
+            const size_t geometryIndex = std::upper_bound(meshData.geometryFirstTriangle.begin(), meshData.geometryFirstTriangle.end(), id) - meshData.geometryFirstTriangle.begin() - 1;
+            const Geometry& geometry = mesh.geometries[geometryIndex];
+            const uint32_t primitiveId = id - meshData.geometryFirstTriangle[geometryIndex];
+
+            Surface surface;
+            const uint32_t materialIndex = geometry.materialIndex != OBJECT_MATERIAL ? geometry.materialIndex : instance.materialIndex;
+            surface.material = &_scene.materials[materialIndex];
+            surface.useShadow = instance.useShadow;
+
+            const float barycentrics[3] = { 1.0f - hit.u[lane] - hit.v[lane], hit.u[lane], hit.v[lane] };
+            glm::vec3 pos(0.0f);
+            glm::vec3 normal(0.0f);
+            glm::vec2 uv(0.0f);
+            for (uint32_t k = 0; k < 3; k++) {
+                const size_t i = size_t(geometry.firstIndex) + size_t(primitiveId) * 3 + k;
+                const uint32_t index = geometry.baseVertex + (geometry.shortIndices ? static_cast<const uint16_t*>(mesh.indices)[i] : static_cast<const uint32_t*>(mesh.indices)[i]);
+
+                const unsigned char* position = static_cast<const unsigned char*>(mesh.vertices) + size_t(index) * mesh.positionStride;
+                const unsigned char* attribute = static_cast<const unsigned char*>(mesh.attributes) + size_t(index) * mesh.attributeStride;
+                glm::vec3 p, n;
+                glm::vec2 t;
+                if (!mesh.quantized) {
+                    memcpy(&p, position, sizeof(p));
+                    memcpy(&n, attribute, sizeof(n));
+                    memcpy(&t, attribute + sizeof(n), sizeof(t));
+                }
+                else {
+                    int16_t snorm[3];
+                    memcpy(snorm, position, sizeof(snorm));
+                    p = glm::vec3(Snorm16(snorm[0]), Snorm16(snorm[1]), Snorm16(snorm[2])) * mesh.positionScale + mesh.positionOffset;
+                    int16_t octNormal[2];
+                    uint16_t halfUV[2];
+                    memcpy(octNormal, attribute, sizeof(octNormal));
+                    memcpy(halfUV, attribute + sizeof(octNormal), sizeof(halfUV));
+                    n = OctDecode(glm::vec2(Snorm16(octNormal[0]), Snorm16(octNormal[1])));
+                    t = glm::vec2(HalfToFloat(halfUV[0]), HalfToFloat(halfUV[1]));
+                }
+                pos += p * barycentrics[k];
+                normal += n * barycentrics[k];
+                uv += t * barycentrics[k];
+            }
+
+            surface.worldPos = glm::vec3(instance.transform * glm::vec4(pos, 1.0f));
+            surface.worldNormal = glm::mat3(instance.transform) * normal;
+            surface.uv = uv;
+            return surface;
+        }
+
+        glm::vec3 GetAlbedo(const Surface& surface) const {
+            const Material& material = *surface.material;
+            if (material.textureIndex > -1 && size_t(material.textureIndex) < _scene.textures.size() && !_scene.textures[material.textureIndex].pixels.empty()) {
+                return Sample(_scene.textures[material.textureIndex], surface.uv, true);
+            }
+            return glm::vec3(material.diffuse);
+        }
+
+        glm::vec3 GetBackground(glm::vec3 direction) const {
+            if (_scene.background[0].pixels.empty()) {
+                return _scene.backgroundColor;
+            }
+            return SampleCube(_scene.background, direction);
+        }
+
+        void SetRay(Packet& packet, int lane, glm::vec3 origin, glm::vec3 direction, float tMin) const {
+            for (int c = 0; c < 3; c++) {
+                packet.origin[c][lane] = origin[c];
+                packet.direction[c][lane] = direction[c];
+            }
+            packet.tMin[lane] = tMin;
+            packet.tMax[lane] = T_MAX;
+        }
+
+        static Packet EmptyPacket() {
+            Packet packet;
+            memset(&packet, 0, sizeof(packet));
+            for (int lane = 0; lane < 4; lane++) {
+                packet.tMax[lane] = INACTIVE_T_MAX;
+            }
+            return packet;
+        }
+
+        //raygen.rgen, then closesthit.rchit as long as metal and glass pass the ray on
+        void TraceQuad(const uint32_t px[4], const uint32_t py[4], int valid, glm::vec3 colors[4]) {
+
+            Packet packet = EmptyPacket();
+            const glm::vec3 origin = glm::vec3(_uniforms.viewInverse * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+            for (int lane = 0; lane < 4; lane++) {
+                colors[lane] = glm::vec3(0.0f);
+                if (!(valid & (1 << lane))) {
+                    continue;
+                }
+                const glm::vec2 pixelCenter = glm::vec2(float(px[lane]), float(py[lane])) + glm::vec2(0.5f);
+                const glm::vec2 inUV = pixelCenter / glm::vec2(float(_settings.width), float(_settings.height));
+                const glm::vec2 d = inUV * 2.0f - 1.0f;
+                const glm::vec4 target = _uniforms.projInverse * glm::vec4(d.x, -d.y, 1.0f, 1.0f);
+                const glm::vec3 direction = glm::vec3(_uniforms.viewInverse * glm::vec4(glm::normalize(glm::vec3(target)), 0.0f));
+                SetRay(packet, lane, origin, direction, PRIMARY_T_MIN);
+            }
+
+            int32_t recursive[4] = { _settings.recursion, _settings.recursion, _settings.recursion, _settings.recursion };
+            int active = valid;
+            bool primary = true;
+            while (active) {
+                Hit hit;
+                Trace<false>(packet, hit);
+                (primary ? _stats.primaryRays : _stats.secondaryRays) += BitCount(active);
+                primary = false;
+
+                Packet next = EmptyPacket();
+                int nextActive = 0;
+                int shadowed = 0;
+                int shadowLanes = 0;
+                glm::vec3 shadowOrigins[4];
+                glm::vec3 shadowDirections[4][CONE_SAMPLE_COUNT];
+                for (int lane = 0; lane < 4; lane++) {
+                    if (!(active & (1 << lane))) {
+                        continue;
+                    }
+                    const glm::vec3 rayDirection = glm::vec3(packet.direction[0][lane], packet.direction[1][lane], packet.direction[2][lane]);
+                    if (hit.instance[lane] == MISS) {
+                        colors[lane] = GetBackground(rayDirection);
+                        continue;
+                    }
+                    if (--recursive[lane] < 0) {
+                        colors[lane] = glm::vec3(0.0f);
+                        continue;
+                    }
+
+                    const Surface surface = GetSurface(hit, lane);
+                    const Material& material = *surface.material;
+                    const glm::vec3 worldPos = surface.worldPos;
+                    const glm::vec3 worldNormal = surface.worldNormal;
+
+                    glm::vec3 toLightDir;
+                    if (_uniforms.shaderFlags == 1) {
+                        toLightDir = glm::normalize(glm::vec3(_uniforms.pointLightPosition) - worldPos);
+                    }
+                    else {
+                        toLightDir = glm::normalize(-glm::vec3(_uniforms.lightDirection));
+                    }
+                    const float dotNL = glm::dot(worldNormal, toLightDir);
+
+                    colors[lane] = glm::vec3(0.0f);
+                    if (material.materialType == LAMBERT) {
+                        const glm::vec3 albedo = GetAlbedo(surface);
+                        const glm::vec3 toEyeDir = glm::normalize(glm::vec3(_uniforms.cameraPosition) - worldPos);
+                        glm::vec3 color = LambertLight(worldNormal, toLightDir, albedo, glm::vec3(_uniforms.lightColor), glm::vec3(_uniforms.ambientColor));
+                        if (dotNL > 0.0f) {
+                            color += PhongSpecular(worldNormal, -toLightDir, toEyeDir, material.specular);
+                        }
+                        colors[lane] = color;
+
+                        if (surface.useShadow) {
+                            shadowLanes |= 1 << lane;
+                            shadowOrigins[lane] = worldPos;
+                            if (_uniforms.shaderFlags == 1) {
+                                //the cone of a light of radius 1, every sample is drawn even when an earlier one is blocked
+                                const glm::vec3 lightPosition = glm::vec3(_uniforms.pointLightPosition);
+                                const glm::vec3 toPointLightDir = glm::normalize(lightPosition - worldPos);
+                                glm::vec3 perpL = glm::cross(toPointLightDir, glm::vec3(0.0f, 1.0f, 0.0f));
+                                if (perpL == glm::vec3(0.0f)) {
+                                    perpL.x = 1.0f;
+                                }
+                                const float radius = 1.0f;
+                                const glm::vec3 toLightEdge = glm::normalize((lightPosition + perpL * radius) - worldPos);
+                                const float coneAngle = std::acos(std::min(std::max(glm::dot(toPointLightDir, toLightEdge), -1.0f), 1.0f));
+                                uint32_t randSeed = RandomU(glm::vec2(worldPos.x, worldPos.z) * 0.1f);
+                                for (uint32_t i = 0; i < CONE_SAMPLE_COUNT; i++) {
+                                    shadowDirections[lane][i] = GetConeSample(randSeed, toPointLightDir, coneAngle);
+                                }
+                            }
+                            else {
+                                shadowDirections[lane][0] = toLightDir;
+                            }
+                        }
+                    }
+                    else if (material.materialType == METAL) {
+                        const glm::vec3 normal = glm::normalize(worldNormal);
+                        SetRay(next, lane, worldPos, glm::reflect(rayDirection, normal), REFLECTION_T_MIN);
+                        nextActive |= 1 << lane;
+                    }
+                    else if (material.materialType == GLASS) {
+                        const glm::vec3 normal = glm::normalize(worldNormal);
+                        const float refraction = 1.4f;
+                        glm::vec3 refractedDir, faceNormal;
+                        if (glm::dot(normal, rayDirection) < 0.0f) {
+                            refractedDir = glm::refract(rayDirection, normal, 1.0f / refraction);
+                            faceNormal = normal;
+                        }
+                        else {
+                            refractedDir = glm::refract(rayDirection, -normal, refraction);
+                            faceNormal = -normal;
+                        }
+                        //total internal reflection
+                        if (glm::length(refractedDir) < 0.01f) {
+                            SetRay(next, lane, worldPos, glm::reflect(rayDirection, glm::normalize(faceNormal)), REFLECTION_T_MIN);
+                        }
+                        else {
+                            SetRay(next, lane, worldPos, refractedDir, REFRACTION_T_MIN);
+                        }
+                        nextActive |= 1 << lane;
+                    }
+                }
+
+                //isShadow = isShadow || ShootShadowRay(...), a lane stops once it is blocked
+                const uint32_t sampleCount = _uniforms.shaderFlags == 1 ? CONE_SAMPLE_COUNT : 1;
+                for (uint32_t i = 0; i < sampleCount && (shadowLanes & ~shadowed); i++) {
+                    Packet shadow = EmptyPacket();
+                    const int lanes = shadowLanes & ~shadowed;
+                    for (int lane = 0; lane < 4; lane++) {
+                        if (lanes & (1 << lane)) {
+                            SetRay(shadow, lane, shadowOrigins[lane], shadowDirections[lane][i], SHADOW_T_MIN);
+                        }
+                    }
+                    Hit shadowHit;
+                    Trace<true>(shadow, shadowHit);
+                    _stats.shadowRays += BitCount(lanes);
+                    for (int lane = 0; lane < 4; lane++) {
+                        if ((lanes & (1 << lane)) && shadow.tMax[lane] < shadow.tMin[lane]) {
+                            shadowed |= 1 << lane;
+                        }
+                    }
+                }
+                for (int lane = 0; lane < 4; lane++) {
+                    if (shadowed & (1 << lane)) {
+                        colors[lane] *= 0.8f;
+                    }
+                }
+
+                packet = next;
+                active = nextActive;
+            }
+        }
+
+        const Renderer& _renderer;
+        const Scene& _scene;
+        const Uniforms& _uniforms;
+        const RenderSettings& _settings;
+        RenderStats _stats;
+        std::vector<uint32_t> _topLevelStack;
+        std::vector<uint32_t> _meshStack;
+    };
+
+    Renderer::Renderer(const Scene& scene, ThreadPool* threadPool) : _scene(scene) {
+
+        auto tStart = std::chrono::high_resolution_clock::now();
+
+        //one BVH per mesh, the instances share it like BLASes
+        _meshes.resize(scene.meshes.size());
+        for (size_t m = 0; m < scene.meshes.size(); m++) {
+            const Mesh& mesh = scene.meshes[m];
+            MeshData& data = _meshes[m];
+
+            std::vector<bvhBuilder::TriangleInput> inputs;
+            uint32_t triangleCount = 0;
+            for (const Geometry& geometry : mesh.geometries) {
+                bvhBuilder::TriangleInput input;
+                input.vertices = static_cast<const unsigned char*>(mesh.vertices) + size_t(geometry.baseVertex) * mesh.positionStride;
+                input.vertexStride = mesh.positionStride;
+                input.vertexFormat = mesh.quantized ? bvhBuilder::VertexFormat::Snorm16x4 : bvhBuilder::VertexFormat::Float3;
+                memcpy(input.positionScale, &mesh.positionScale, sizeof(input.positionScale));
+                memcpy(input.positionOffset, &mesh.positionOffset, sizeof(input.positionOffset));
+                input.indices = mesh.indices;
+                input.indexSize = geometry.shortIndices ? sizeof(uint16_t) : sizeof(uint32_t);
+                input.firstIndex = geometry.firstIndex;
+                input.indexCount = geometry.indexCount;
+                inputs.push_back(input);
+                data.geometryFirstTriangle.push_back(triangleCount);
+                triangleCount += geometry.indexCount / 3;
+            }
+            if (triangleCount == 0) {
+                continue;
+            }
+
+            bvhBuilder::Bvh bvh = bvhBuilder::BuildTriangles(inputs.data(), inputs.size(), bvhBuilder::BuildSettings(), threadPool);
+            std::vector<float> positions;
+            bvhBuilder::GatherTriangles(inputs.data(), inputs.size(), positions);
+
+            data.nodes = std::move(bvh.nodes);
+            data.triangles.reserve(bvh.primitiveIndices.size());
+            data.triangleIds = std::move(bvh.primitiveIndices);
+            for (uint32_t id : data.triangleIds) {
+                const float* p = &positions[size_t(id) * 9];
+                const glm::vec3 v0(p[0], p[1], p[2]);
+                data.triangles.push_back({ v0, glm::vec3(p[3], p[4], p[5]) - v0, glm::vec3(p[6], p[7], p[8]) - v0 });
+            }
+        }
+
+        //the top level holds the world bounds of the instances of non-empty meshes
+        _instances.resize(scene.instances.size());
+        std::vector<bvhBuilder::Aabb> bounds;
+        std::vector<uint32_t> instanceIndices;
+        for (size_t i = 0; i < scene.instances.size(); i++) {
+            const Instance& instance = scene.instances[i];
+            _instances[i].worldToObject = glm::inverse(instance.transform);
+            if (instance.mesh >= _meshes.size() || _meshes[instance.mesh].nodes.empty()) {
+                continue;
+            }
+            const bvhBuilder::Node& root = _meshes[instance.mesh].nodes[0];
+            bvhBuilder::Aabb aabb;
+            for (int corner = 0; corner < 8; corner++) {
+                const glm::vec4 p = instance.transform * glm::vec4(
+                    corner & 1 ? root.max[0] : root.min[0],
+                    corner & 2 ? root.max[1] : root.min[1],
+                    corner & 4 ? root.max[2] : root.min[2],
+                    1.0f
+                );
+                aabb.Grow(&p.x);
+            }
+            bounds.push_back(aabb);
+            instanceIndices.push_back(uint32_t(i));
+        }
+        if (!bounds.empty()) {
+            bvhBuilder::Bvh topLevel = bvhBuilder::Build(bounds.data(), bounds.size());
+            _topLevelNodes = std::move(topLevel.nodes);
+            for (uint32_t index : topLevel.primitiveIndices) {
+                _topLevelInstances.push_back(instanceIndices[index]);
+            }
+        }
+
+        auto tEnd = std::chrono::high_resolution_clock::now();
+        _buildTime = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+    }
+
+    RenderStats Renderer::Render(const Uniforms& uniforms, const RenderSettings& settings, std::vector<uint8_t>& pixels, ThreadPool* threadPool) const {
+
+        pixels.assign(size_t(settings.width) * settings.height * 4, 0);
+        const uint32_t tileSize = std::max(2u, settings.tileSize);
+        const uint32_t tilesX = (settings.width + tileSize - 1) / tileSize;
+        const uint32_t tilesY = (settings.height + tileSize - 1) / tileSize;
+        const uint32_t tileCount = tilesX * tilesY;
+        const uint32_t workerCount = threadPool ? threadPool->GetThreadCount() : 1;
+
+        TileQueue queue(tileCount, workerCount);
+        std::vector<RenderStats> workerStats(workerCount);
+        auto work = [&](uint32_t worker) {
+            PacketTracer tracer(*this, uniforms, settings);
+            uint32_t tile;
+            while (queue.Pop(worker, tile, tracer.GetStats().stolenTiles)) {
+                const uint32_t x0 = (tile % tilesX) * tileSize;
+                const uint32_t y0 = (tile / tilesX) * tileSize;
+                tracer.RenderTile(x0, y0, std::min(x0 + tileSize, settings.width), std::min(y0 + tileSize, settings.height), pixels.data());
+            }
+            workerStats[worker] = tracer.GetStats();
+        };
+
+        auto tStart = std::chrono::high_resolution_clock::now();
+        if (threadPool) {
+            std::vector<std::future<void>> results;
+            for (uint32_t i = 0; i < workerCount; i++) {
+                results.push_back(threadPool->Submit([&work, i]() { work(i); }));
+            }
+            for (auto& result : results) {
+                result.get();
+            }
+        }
+        else {
+            work(0);
+        }
+        auto tEnd = std::chrono::high_resolution_clock::now();
+
+        RenderStats stats;
+        for (const RenderStats& worker : workerStats) {
+            stats.primaryRays += worker.primaryRays;
+            stats.secondaryRays += worker.secondaryRays;
+            stats.shadowRays += worker.shadowRays;
+            stats.stolenTiles += worker.stolenTiles;
+        }
+        stats.renderTime = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
+        stats.threadCount = workerCount;
+        stats.tileCount = tileCount;
+        return stats;
+    }
+
+    bool WriteBmp(const std::string& filename, uint32_t width, uint32_t height, const uint8_t* pixels) {
+
+        const uint32_t rowSize = (width * 3 + 3) & ~3u;
+        const uint32_t dataSize = rowSize * height;
+        std::vector<uint8_t> file(54 + size_t(dataSize), 0);
+        auto put = [&file](size_t offset, uint32_t value, uint32_t size) {
+            for (uint32_t i = 0; i < size; i++) {
+                file[offset + i] = uint8_t(value >> (8 * i));
+            }
+        };
+        file[0] = 'B';
+        file[1] = 'M';
+        put(2, uint32_t(file.size()), 4);
+        put(10, 54, 4);
+        put(14, 40, 4);
+        put(18, width, 4);
+        put(22, height, 4);
+        put(26, 1, 2);
+        put(28, 24, 2);
+        put(34, dataSize, 4);
+
+        //bottom-up rows of BGR
+        for (uint32_t y = 0; y < height; y++) {
+            uint8_t* row = &file[54 + size_t(height - 1 - y) * rowSize];
+            for (uint32_t x = 0; x < width; x++) {
+                const uint8_t* pixel = &pixels[(size_t(y) * width + x) * 4];
+                row[x * 3 + 0] = pixel[2];
+                row[x * 3 + 1] = pixel[1];
+                row[x * 3 + 2] = pixel[0];
+            }
+        }
+
+        std::ofstream stream(filename, std::ios::binary | std::ios::trunc);
+        stream.write(reinterpret_cast<const char*>(file.data()), std::streamsize(file.size()));
+        return bool(stream);
+    }
+}
\ No newline at end of file
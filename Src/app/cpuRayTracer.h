@@ -0,0 +1,210 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "bvhBuilder.h"
+
+class ThreadPool;
+
+namespace cpuRayTracer
+{
+    //materialIndex of the geometries that use Instance::materialIndex
+    constexpr uint32_t OBJECT_MATERIAL = ~0u;
+
+    /**
+    * @brief    マテリアルの種類（AppBase::MaterialTypeと同じもの）
+    */
+    enum MaterialType {
+        LAMBERT, METAL, GLASS
+    };
+
+    /**
+    * @brief    マテリアル（シェーダーのMaterialと同じ内容）
+    */
+    struct Material {
+        glm::vec4 diffuse = glm::vec4(0.6f);
+        //xyz : color, w : power
+        glm::vec4 specular = glm::vec4(1.0f, 1.0f, 1.0f, 20.0f);
+        uint32_t materialType = LAMBERT;
+        //-1 : diffuse is used as the albedo
+        int32_t textureIndex = -1;
+    };
+
+    /**
+    * @brief    シーンのパラメータ（AppBase::UniformBlockと同じもの）
+    */
+    struct Uniforms {
+        glm::mat4 viewInverse = glm::mat4(1.0f);
+        glm::mat4 projInverse = glm::mat4(1.0f);
+        glm::vec4 lightDirection = glm::vec4(-0.2f, -1.0f, -1.0f, 0.0f);
+        glm::vec4 lightColor = glm::vec4(1.0f);
+        glm::vec4 ambientColor = glm::vec4(0.5f);
+        glm::vec4 cameraPosition = glm::vec4(0.0f);
+        glm::vec4 pointLightPosition = glm::vec4(5.0, 10.0, 5.0, 0.0);
+        //0 : directional light, 1 : point light
+        int shaderFlags = 0;
+    };
+
+    /**
+    * @brief    メッシュの一部（GeometryParamとそのインデックス数）
+    */
+    struct Geometry {
+        //in indices of the geometry's own type
+        uint32_t firstIndex = 0;
+        uint32_t indexCount = 0;
+        //OBJECT_MATERIAL : Instance::materialIndex
+        uint32_t materialIndex = OBJECT_MATERIAL;
+        //added to the stored indices
+        uint32_t baseVertex = 0;
+        bool shortIndices = false;
+    };
+
+    /**
+    * @brief    メッシュ（PrimParamのバッファアドレスをホストのポインタにしたもの）
+    * @note     座標 float : vec3, quantized : snorm16x4（pos = snorm * positionScale + positionOffset）
+    *           アトリビュート float : normal(3), uv(2), color(4), quantized : 八面体エンコードのsnorm16x2, half uv, unorm8 color
+    */
+    struct Mesh {
+        const void* vertices = nullptr;
+        uint32_t positionStride = 0;
+        bool quantized = false;
+        glm::vec3 positionScale = glm::vec3(1.0f);
+        glm::vec3 positionOffset = glm::vec3(0.0f);
+        const void* attributes = nullptr;
+        uint32_t attributeStride = 0;
+        const void* indices = nullptr;
+        std::vector<Geometry> geometries;
+    };
+
+    /**
+    * @brief    シーンに置くメッシュ（r_sceneObjectsの1要素）
+    */
+    struct Instance {
+        uint32_t mesh = 0;
+        glm::mat4 transform = glm::mat4(1.0f);
+        uint32_t materialIndex = 0;
+        bool useShadow = false;
+    };
+
+    /**
+    * @brief    RGBA8の画像（srgbなら読み込むときにリニアに変換する）
+    */
+    struct Image {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        bool srgb = false;
+        std::vector<uint8_t> pixels;
+    };
+
+    /**
+    * @brief    描画するシーン（メッシュのポインタが指すデータはRendererより長く残すこと）
+    */
+    struct Scene {
+        std::vector<Mesh> meshes;
+        std::vector<Instance> instances;
+        std::vector<Material> materials;
+        std::vector<Image> textures;
+        //+x, -x, +y, -y, +z, -z, backgroundColor is used when they are empty
+        Image background[6];
+        glm::vec3 backgroundColor = glm::vec3(0.0f);
+    };
+
+    /**
+    * @brief    描画の設定
+    */
+    struct RenderSettings {
+        uint32_t width = 1280;
+        uint32_t height = 720;
+        //pixels per side of the tiles the threads take
+        uint32_t tileSize = 16;
+        //payload.recursive of raygen.rgen
+        int32_t recursion = 5;
+    };
+
+    /**
+    * @brief    描画の統計情報
+    */
+    struct RenderStats {
+        double renderTime = 0.0;
+        uint64_t primaryRays = 0;
+        //reflection and refraction rays
+        uint64_t secondaryRays = 0;
+        uint64_t shadowRays = 0;
+        uint32_t threadCount = 0;
+        uint32_t tileCount = 0;
+        //tiles taken from the range of another thread
+        uint32_t stolenTiles = 0;
+
+        uint64_t GetRayCount() const { return primaryRays + secondaryRays + shadowRays; }
+        double GetRaysPerSecond() const { return renderTime > 0.0 ? GetRayCount() / (renderTime * 1e-3) : 0.0; }
+    };
+
+    /**
+    * @brief    raytracingMaterialsのシェーダーと同じ処理をCPUで行うレイトレーサー
+    * @note     メッシュごとのBVHとインスタンスのBVHの2階層を、4本のレイのパケットで走査する
+    */
+    class Renderer {
+
+    public:
+
+        /**
+        * @brief    コンストラクタ（シーンのBVHを構築する）
+        */
+        explicit Renderer(const Scene& scene, ThreadPool* threadPool = nullptr);
+
+        /**
+        * @brief    画像を描画する（pixelsにwidth * heightのRGBA8を書き込む）
+        *           タイルをスレッドごとの範囲に分けて、自分の範囲が空になったスレッドは他の範囲の後ろ半分を取る
+        *           threadPoolのワーカースレッドからは呼ばないこと
+        */
+        RenderStats Render(const Uniforms& uniforms, const RenderSettings& settings, std::vector<uint8_t>& pixels, ThreadPool* threadPool = nullptr) const;
+
+        /**
+        * @brief    BVHの構築時間（ms）
+        */
+        double GetBuildTime() const {
+            return _buildTime;
+        }
+
+    private:
+
+        struct Triangle {
+            glm::vec3 v0;
+            glm::vec3 e1;
+            glm::vec3 e2;
+        };
+
+        struct MeshData {
+            std::vector<bvhBuilder::Node> nodes;
+            //in leaf order, triangleIds maps them back to the triangles of the geometries
+            std::vector<Triangle> triangles;
+            std::vector<uint32_t> triangleIds;
+            //first triangle of each geometry
+            std::vector<uint32_t> geometryFirstTriangle;
+        };
+
+        struct InstanceData {
+            glm::mat4 worldToObject;
+        };
+
+        friend class PacketTracer;
+
+        const Scene& _scene;
+        std::vector<MeshData> _meshes;
+        std::vector<InstanceData> _instances;
+        //over the world bounds of the instances
+        std::vector<bvhBuilder::Node> _topLevelNodes;
+        std::vector<uint32_t> _topLevelInstances;
+        double _buildTime = 0.0;
+    };
+
+    /**
+    * @brief    RGBA8の画像を24bitのBMPで書き出す
+    */
+    bool WriteBmp(const std::string& filename, uint32_t width, uint32_t height, const uint8_t* pixels);
+}
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "device.h"
 
+#include <cstring>
+
 namespace {
     std::vector<const char*> deviceExtensions = {
         VK_KHR_SWAPCHAIN_EXTENSION_NAME,
@@ -7,13 +9,13 @@ namespace {
         VK_KHR_MAINTENANCE3_EXTENSION_NAME,
         VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME,
 
-        //Vulkan Raytracing API ŕKv
+        //Vulkan Raytracing API で必要
         VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME,
         VK_KHR_SPIRV_1_4_EXTENSION_NAME,
         VK_KHR_SHADER_FLOAT_CONTROLS_EXTENSION_NAME,
         VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
 
-        //VK_KHR_acceleration_structureŕKv
+        //VK_KHR_acceleration_structureで必要
         VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
         VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME,
         VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME,
@@ -42,47 +44,47 @@ uint32_t VulkanDevice::FindQueueFamilyIndex(VkQueueFlagBits queueFlags) {
     _queueFamilyProperties.resize(queueFamilyCount);
     vkGetPhysicalDeviceQueueFamilyProperties(_physicalDevice, &queueFamilyCount, _queueFamilyProperties.data());
 
-    int i = 0;
-    if (queueFlags & VK_QUEUE_COMPUTE_BIT)
-    {
-        for (const auto& queueFamily : _queueFamilyProperties) {
-
-            if (queueFamily.queueFlags & queueFlags &&(queueFamily.queueFlags&& VK_QUEUE_GRAPHICS_BIT)==0) {
+    //dedicated compute queue (no graphics)
+    if (queueFlags & VK_QUEUE_COMPUTE_BIT) {
+        for (uint32_t i = 0; i < queueFamilyCount; i++) {
+            const VkQueueFlags flags = _queueFamilyProperties[i].queueFlags;
+            if ((flags & queueFlags) && (flags & VK_QUEUE_GRAPHICS_BIT) == 0) {
                 return i;
             }
         }
     }
 
-    if (queueFlags & VK_QUEUE_COMPUTE_BIT)
-    {
-        for (const auto& queueFamily : _queueFamilyProperties) {
-
-            if ((queueFamily.queueFlags & queueFlags) && ((queueFamily.queueFlags && VK_QUEUE_GRAPHICS_BIT) == 0) && ((queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT)==0)) {
+    //dedicated transfer queue (no graphics and no compute, usually the DMA engine)
+    if (queueFlags & VK_QUEUE_TRANSFER_BIT) {
+        for (uint32_t i = 0; i < queueFamilyCount; i++) {
+            const VkQueueFlags flags = _queueFamilyProperties[i].queueFlags;
+            if ((flags & queueFlags) && (flags & VK_QUEUE_GRAPHICS_BIT) == 0 && (flags & VK_QUEUE_COMPUTE_BIT) == 0) {
                 return i;
             }
         }
     }
 
-    if (queueFlags & VK_QUEUE_COMPUTE_BIT)
-    {
-        for (const auto& queueFamily : _queueFamilyProperties) {
-
-            if (queueFamily.queueFlags & queueFlags) {
-                return i;
-            }
+    for (uint32_t i = 0; i < queueFamilyCount; i++) {
+        VkQueueFlags flags = _queueFamilyProperties[i].queueFlags;
+        //graphics and compute families support transfers without reporting it
+        if (flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) {
+            flags |= VK_QUEUE_TRANSFER_BIT;
+        }
+        if ((flags & queueFlags) == queueFlags) {
+            return i;
         }
     }
 
-    return 0;
+    throw std::runtime_error("failed to find a matching queue family!");
 }
 
 void VulkanDevice::CreateLogicalDevice() {
 
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos{};
+    const float queuePriority = 1.0f;
 
     {
         _queueFamilyIndices.graphics = FindQueueFamilyIndex(VK_QUEUE_GRAPHICS_BIT);
-        float queuePriority = 1.0f;
         VkDeviceQueueCreateInfo queueCreateInfo{};
         queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
         queueCreateInfo.queueFamilyIndex = _queueFamilyIndices.graphics;
@@ -91,29 +93,47 @@ void VulkanDevice::CreateLogicalDevice() {
         queueCreateInfos.push_back(queueCreateInfo);
     }
 
+    //uploads run on the DMA engine when the device has a transfer only family
+    _queueFamilyIndices.transfer = USE_TRANSFER_QUEUE ? FindQueueFamilyIndex(VK_QUEUE_TRANSFER_BIT) : _queueFamilyIndices.graphics;
+    if (_queueFamilyIndices.transfer != _queueFamilyIndices.graphics) {
+        VkDeviceQueueCreateInfo queueCreateInfo{};
+        queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queueCreateInfo.queueFamilyIndex = _queueFamilyIndices.transfer;
+        queueCreateInfo.queueCount = 1;
+        queueCreateInfo.pQueuePriorities = &queuePriority;
+        queueCreateInfos.push_back(queueCreateInfo);
+    }
+
+    //heap budgets for the memory report, optional
+    std::vector<const char*> enabledExtensions = deviceExtensions;
+    const bool memoryBudget = IsExtensionAvailable(_physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (memoryBudget) {
+        enabledExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+
     VkDeviceCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
     createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
     createInfo.pQueueCreateInfos = queueCreateInfos.data();
-    createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+    createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
 
-    //PhysicalDevicee@\g߂̏
-    //obt@̃foCXAhXLɂ
+    //PhysicalDeviceが備える各種機能を使うための準備
+    //バッファのデバイスアドレスを有効にする
     VkPhysicalDeviceBufferDeviceAddressFeaturesKHR bufferDeviceAddressF{
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES, nullptr
     };
     bufferDeviceAddressF.bufferDeviceAddress = VK_TRUE;
 
-    //Cg[VOpCvCg悤ɂ
+    //レイトレーシングパイプラインを使えるようにする
     VkPhysicalDeviceRayTracingPipelineFeaturesKHR rayTracingPipelineF{
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR, nullptr
     };
     rayTracingPipelineF.rayTracingPipeline = VK_TRUE;
     rayTracingPipelineF.pNext = &bufferDeviceAddressF;
 
-    //Accelerationɂ郌Cg[VOLɂ
+    //Accelerationによるレイトレーシングを有効にする
     VkPhysicalDeviceAccelerationStructureFeaturesKHR accelerationStructureF{
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR, nullptr
     };
@@ -131,10 +151,17 @@ void VulkanDevice::CreateLogicalDevice() {
     descriptorIndexingF.descriptorBindingPartiallyBound = VK_TRUE;
     descriptorIndexingF.pNext = &accelerationStructureF;
 
+    //the upload queue signals a timeline semaphore
+    VkPhysicalDeviceTimelineSemaphoreFeatures timelineSemaphoreF{};
+    timelineSemaphoreF.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+    timelineSemaphoreF.timelineSemaphore = VK_TRUE;
+    timelineSemaphoreF.pNext = &descriptorIndexingF;
+
     VkPhysicalDeviceFeatures2 physicalDeviceFeatures2{};
     physicalDeviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
-    physicalDeviceFeatures2.pNext = &descriptorIndexingF;
+    physicalDeviceFeatures2.pNext = &timelineSemaphoreF;
     vkGetPhysicalDeviceFeatures2(_physicalDevice, &physicalDeviceFeatures2);
+    _accelerationStructureHostCommands = accelerationStructureF.accelerationStructureHostCommands == VK_TRUE;
 
     createInfo.pNext = &physicalDeviceFeatures2;
     createInfo.pEnabledFeatures = nullptr;
@@ -144,6 +171,23 @@ void VulkanDevice::CreateLogicalDevice() {
     }
 
     vkGetDeviceQueue(_device, _queueFamilyIndices.graphics, 0, &_queue);
+    vkGetDeviceQueue(_device, _queueFamilyIndices.transfer, 0, &_transferQueue);
+    _allocator.Connect(_physicalDevice, _device, memoryBudget);
+}
+
+bool VulkanDevice::IsExtensionAvailable(VkPhysicalDevice device, const char* extensionName) {
+    uint32_t extensionCount;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+    for (const auto& extension : availableExtensions) {
+        if (strcmp(extension.extensionName, extensionName) == 0) {
+            return true;
+        }
+    }
+    return false;
 }
 
 bool VulkanDevice::CheckDeviceExtensionSupport(VkPhysicalDevice device) {
@@ -182,9 +226,13 @@ void VulkanDevice::CreateCommandPool() {
     if (vkCreateCommandPool(_device, &poolInfo, nullptr, &_commandPool) != VK_SUCCESS) {
         throw std::runtime_error("failed to create graphics command pool!");
     }
+
+    _stagingRing.Connect(this);
+    _uploadQueue.Connect(this, &_stagingRing);
+    _scratchPool.Connect(this);
 }
 
-vk::Buffer VulkanDevice::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties) {
+vk::Buffer VulkanDevice::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, vk::MemoryCategory category) {
     
     vk::Buffer ret;
 
@@ -201,23 +249,9 @@ vk::Buffer VulkanDevice::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usag
     VkMemoryRequirements memRequirements{};
     vkGetBufferMemoryRequirements(_device, ret.buffer, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties);
-
-    if (usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
-        VkMemoryAllocateFlagsInfo memoryAllocateFlagsInfo{};
-        memoryAllocateFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
-        memoryAllocateFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
-        allocInfo.pNext = &memoryAllocateFlagsInfo;
-    }
-
-    if (vkAllocateMemory(_device, &allocInfo, nullptr, &ret.memory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate buffer memory!");
-    }
-
-    vkBindBufferMemory(_device, ret.buffer, ret.memory, 0);
+    ret.allocation = _allocator.Allocate(memRequirements, FindMemoryType(memRequirements.memoryTypeBits, properties), MemoryAllocator::ResourceType::Buffer, category);
+    ret.memory = ret.allocation.memory;
+    vkBindBufferMemory(_device, ret.buffer, ret.memory, ret.allocation.offset);
 
     if (usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
         ret.GetBufferDeviceAddress(_device);
@@ -226,6 +260,26 @@ vk::Buffer VulkanDevice::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usag
     return ret;
 }
 
+void VulkanDevice::AllocateImageMemory(vk::Image& image, VkMemoryPropertyFlags properties, vk::MemoryCategory category) {
+
+    VkImageMemoryRequirementsInfo2 requirementsInfo{};
+    requirementsInfo.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2;
+    requirementsInfo.image = image.image;
+    VkMemoryDedicatedRequirements dedicatedRequirements{};
+    dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+    VkMemoryRequirements2 memRequirements{};
+    memRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+    memRequirements.pNext = &dedicatedRequirements;
+    vkGetImageMemoryRequirements2(_device, &requirementsInfo, &memRequirements);
+
+    //render targets and other images the driver wants on their own get a dedicated allocation
+    const bool dedicated = dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation;
+    const uint32_t memoryTypeIndex = FindMemoryType(memRequirements.memoryRequirements.memoryTypeBits, properties);
+    image.allocation = _allocator.Allocate(memRequirements.memoryRequirements, memoryTypeIndex, MemoryAllocator::ResourceType::Image, category, dedicated, image.image);
+    image.memory = image.allocation.memory;
+    vkBindImageMemory(_device, image.image, image.memory, image.allocation.offset);
+}
+
 VkCommandBuffer VulkanDevice::BeginCommand() {
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -244,20 +298,31 @@ VkCommandBuffer VulkanDevice::BeginCommand() {
 }
 
 
-void VulkanDevice::FlushCommandBuffer(VkCommandBuffer& commandBuffer, VkQueue& queue, VkFenceCreateFlags flags) {
+void VulkanDevice::FlushCommandBuffer(VkCommandBuffer& commandBuffer, VkQueue& queue) {
 
     vkEndCommandBuffer(commandBuffer);
 
-    VkFenceCreateInfo fenceCI{};
-    fenceCI.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceCI.flags = flags;
-    VkFence fence;
-    vkCreateFence(_device, &fenceCI, nullptr, &fence);
+    //the command may read what the upload queue has recorded so far
+    const UploadQueue::Ticket ticket = _uploadQueue.Submit();
+    const VkSemaphore uploadSemaphore = _uploadQueue.GetSemaphore();
+    const VkPipelineStageFlags uploadWaitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = 1;
+    timelineInfo.pWaitSemaphoreValues = &ticket;
+
+    VkFence fence = _stagingRing.AcquireFence();
 
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &commandBuffer;
+    if (!_uploadQueue.IsComplete(ticket)) {
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &uploadSemaphore;
+        submitInfo.pWaitDstStageMask = &uploadWaitStage;
+    }
     VkResult result;
     result = vkQueueSubmit(_queue, 1, &submitInfo, fence);
     if (result != VK_SUCCESS) {
@@ -265,20 +330,8 @@ void VulkanDevice::FlushCommandBuffer(VkCommandBuffer& commandBuffer, VkQueue& q
     }
 
     vkWaitForFences(_device, 1, &fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT);
-    vkDestroyFence(_device, fence, nullptr);
-    vkQueueWaitIdle(queue);
     vkFreeCommandBuffers(_device, _commandPool, 1, &commandBuffer);
-}
-
-void VulkanDevice::CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-    VkCommandBuffer commandBuffer = BeginCommand();
-
-    VkBufferCopy copyRegion{};
-    copyRegion.size = size;
-    vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-    //]
-    FlushCommandBuffer(commandBuffer, _queue);
+    _uploadQueue.Reclaim();
 }
 
 VkFormat VulkanDevice::FindSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features) {
@@ -349,6 +402,10 @@ void VulkanDevice::Connect(VkPhysicalDevice physicalDevice) {
 
 void VulkanDevice::Destroy() {
 
+    _uploadQueue.Destroy();
+    _stagingRing.Destroy();
+    _scratchPool.Destroy();
+    _allocator.Destroy();
     vkDestroyCommandPool(_device, _commandPool, nullptr);
     vkDestroyDevice(_device, nullptr);
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #pragma once
 
 #define MAX_FRAMES_IN_FLIGHT 2
+//use a transfer only queue family for uploads when the device has one
+#define USE_TRANSFER_QUEUE true
 
 #include <optional>
 #include <stdexcept>
@@ -11,6 +13,10 @@
 #include <extensions_vk.hpp>
 
 #include "common.h"
+#include "memoryAllocator.h"
+#include "scratchPool.h"
+#include "stagingRing.h"
+#include "uploadQueue.h"
 
 
 struct VulkanDevice {
@@ -32,77 +38,83 @@ struct VulkanDevice {
     }_queueFamilyIndices;
 
     /**
-    * @brief    ^CvT
+    * @brief    メモリタイプを探す
     */
     uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
 
     /**
-    * @brief    L[t@~CfbNX
+    * @brief    キューファミリインデックスを見つける
     */
     uint32_t FindQueueFamilyIndex(VkQueueFlagBits queueFlags);
 
     /**
-    * @brief    _foCX擾
+    * @brief    論理デバイスを取得する
     */
     void CreateLogicalDevice();
 
     /**
-    * @brief    foCX̊g`FbN
+    * @brief    デバイスの拡張をチェックする
     */
     bool CheckDeviceExtensionSupport(VkPhysicalDevice device);
 
     /**
-    * @brief    foCXg邩mF
+    * @brief    任意の拡張が使えるか確認する
+    */
+    bool IsExtensionAvailable(VkPhysicalDevice device, const char* extensionName);
+
+    /**
+    * @brief    デバイスが使えるか確認する
     */
     bool IsDeviceSuitable(VkPhysicalDevice& device);
 
     /**
-    * @brief    R}hv[쐬
+    * @brief    コマンドプールを作成する
     */
     void CreateCommandPool();
 
     /**
-    * @brief    obt@쐬
+    * @brief    バッファを作成する（categoryはメモリの集計に使う）
     */
-    vk::Buffer CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties);
+    vk::Buffer CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, vk::MemoryCategory category);
 
     /**
-    * @brief    obt@Rs[
+    * @brief    イメージのメモリを割り当ててバインドする
     */
-    void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+    void AllocateImageMemory(vk::Image& image, VkMemoryPropertyFlags properties, vk::MemoryCategory category);
 
     /**
-    * @brief    R}hobt@̋L^Jn
+    * @brief    コマンドバッファの記録開始
     */
     VkCommandBuffer BeginCommand();
 
     /**
-    * @brief    R}hobt@̋L^Iҋ@it[Ɗ֘AtȂR}hobt@j
+    * @brief    コマンドバッファの記録終了＆待機（フレームと関連付かないコマンドバッファ）
+    *           記録中のアップロードを先に提出し、その完了を待ってから実行する
     */
-    void FlushCommandBuffer(VkCommandBuffer& commandBuffer, VkQueue& queue, VkFenceCreateFlags flags = 0);
+    void FlushCommandBuffer(VkCommandBuffer& commandBuffer, VkQueue& queue);
 
     /**
-    * @brief    T|[gĂtH[}bg
+    * @brief    サポートしているフォーマットを見つける
     */
     VkFormat FindSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
 
     /**
-    * @brief    [xtH[}bg
+    * @brief    深度フォーマットを見つける
     */
     VkFormat FindDepthFormat();
 
     /**
-    * @brief    Tv[쐬
+    * @brief    サンプラーを作成する
     */
     VkSampler CreateSampler();
 
     /**
-    * @brief    
+    * @brief    初期化
     */
     void Connect(VkPhysicalDevice physicalDevice);
 
     /**
-    * @brief    j
+    * @brief    破棄
     */
     void Destroy();
 
@@ -112,6 +124,14 @@ struct VulkanDevice {
     std::vector<VkQueueFamilyProperties> _queueFamilyProperties;
     VkCommandPool _commandPool;
     VkQueue _queue;
+    //same as _queue when there is no dedicated transfer queue
+    VkQueue _transferQueue;
+    MemoryAllocator _allocator;
+    StagingRing _stagingRing;
+    UploadQueue _uploadQueue;
+    ScratchPool _scratchPool;
+    //accelerationStructureHostCommands, enabled when the device supports it
+    bool _accelerationStructureHostCommands = false;
 
     float _angle = 0.f;
     float _cmeraPosX = 2.0f;
@@ -0,0 +1,105 @@
+#include "mappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+bool MappedFile::Open(const std::string& filename) {
+
+    Close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    _file = file;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) {
+        Close();
+        return false;
+    }
+    _size = static_cast<size_t>(fileSize.QuadPart);
+    if (_size == 0) {
+        //an empty file cannot be mapped, but it is still a valid file
+        return true;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        Close();
+        return false;
+    }
+    _mapping = mapping;
+
+    _data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (_data == nullptr) {
+        Close();
+        return false;
+    }
+#else
+    _fd = open(filename.c_str(), O_RDONLY);
+    if (_fd < 0) {
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(_fd, &fileStat) != 0) {
+        Close();
+        return false;
+    }
+    _size = static_cast<size_t>(fileStat.st_size);
+    if (_size == 0) {
+        return true;
+    }
+
+    void* data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+    if (data == MAP_FAILED) {
+        Close();
+        return false;
+    }
+    madvise(data, _size, MADV_SEQUENTIAL);
+    _data = static_cast<const unsigned char*>(data);
+#endif
+
+    return true;
+}
+
+void MappedFile::Close() {
+
+#ifdef _WIN32
+    if (_data) {
+        UnmapViewOfFile(_data);
+    }
+    if (_mapping) {
+        CloseHandle(_mapping);
+    }
+    if (_file) {
+        CloseHandle(_file);
+    }
+    _mapping = nullptr;
+    _file = nullptr;
+#else
+    if (_data) {
+        munmap(const_cast<unsigned char*>(_data), _size);
+    }
+    if (_fd >= 0) {
+        close(_fd);
+    }
+    _fd = -1;
+#endif
+    _data = nullptr;
+    _size = 0;
+}
\ No newline at end of file
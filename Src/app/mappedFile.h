@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+class MappedFile {
+
+public:
+
+    MappedFile() = default;
+    ~MappedFile();
+
+    /**
+    * @brief    コピーコンストラクタの禁止
+    */
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+    * @brief    ファイルを読み取り専用でメモリマップする
+    */
+    bool Open(const std::string& filename);
+
+    /**
+    * @brief    マップを解除する
+    */
+    void Close();
+
+    /**
+    * @brief    マップされた先頭アドレスを取得する
+    */
+    const unsigned char* GetData() const { return _data; }
+
+    /**
+    * @brief    ファイルサイズを取得する
+    */
+    size_t GetSize() const { return _size; }
+
+private:
+
+    const unsigned char* _data = nullptr;
+    size_t _size = 0;
+
+#ifdef _WIN32
+    void* _file = nullptr;
+    void* _mapping = nullptr;
+#else
+    int _fd = -1;
+#endif
+};
\ No newline at end of file
@@ -0,0 +1,334 @@
+#include "memoryAllocator.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+MemoryAllocator::~MemoryAllocator() {
+    Destroy();
+}
+
+void MemoryAllocator::Connect(VkPhysicalDevice physicalDevice, VkDevice device, bool memoryBudget, VkDeviceSize blockSize) {
+
+    _physicalDevice = physicalDevice;
+    _device = device;
+    _memoryBudget = memoryBudget;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &_memProperties);
+
+    //one buffer pool and one image pool per memory type
+    _pools.resize(size_t(_memProperties.memoryTypeCount) * 2);
+    for (uint32_t i = 0; i < _memProperties.memoryTypeCount; i++) {
+        //small heaps (e.g. the 256MB host visible device local heap) get smaller blocks
+        const VkDeviceSize heapSize = _memProperties.memoryHeaps[_memProperties.memoryTypes[i].heapIndex].size;
+        const VkDeviceSize poolBlockSize = std::min(blockSize, heapSize / 8);
+        for (ResourceType type : { ResourceType::Buffer, ResourceType::Image }) {
+            Pool& pool = GetPool(i, type);
+            pool.memoryTypeIndex = i;
+            pool.type = type;
+            pool.blockSize = poolBlockSize;
+        }
+    }
+}
+
+MemoryAllocator::Pool& MemoryAllocator::GetPool(uint32_t memoryTypeIndex, ResourceType type) {
+    return _pools[size_t(memoryTypeIndex) * 2 + (type == ResourceType::Image ? 1 : 0)];
+}
+
+VkDeviceMemory MemoryAllocator::AllocateMemory(VkDeviceSize size, uint32_t memoryTypeIndex, ResourceType type, VkImage dedicatedImage, void** mapped) {
+
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+    //every buffer may ask for its device address
+    VkMemoryAllocateFlagsInfo memoryAllocateFlagsInfo{};
+    memoryAllocateFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+    memoryAllocateFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
+    VkMemoryDedicatedAllocateInfo dedicatedAllocateInfo{};
+    dedicatedAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    dedicatedAllocateInfo.image = dedicatedImage;
+    if (type == ResourceType::Buffer) {
+        allocInfo.pNext = &memoryAllocateFlagsInfo;
+    }
+    else if (dedicatedImage != VK_NULL_HANDLE) {
+        allocInfo.pNext = &dedicatedAllocateInfo;
+    }
+
+    //going over the budget does not fail right away but makes the driver page memory out
+    const uint32_t heapIndex = _memProperties.memoryTypes[memoryTypeIndex].heapIndex;
+    const HeapBudget heapBudget = QueryHeapBudgets()[heapIndex];
+    if (heapBudget.usage + size > heapBudget.budget) {
+        std::cerr << "device memory budget exceeded on heap " << heapIndex << " ("
+            << (heapBudget.usage + size) / (1024 * 1024) << " / " << heapBudget.budget / (1024 * 1024) << " MB)" << std::endl;
+    }
+
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(_device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate device memory!");
+    }
+    _heapBytes[heapIndex] += size;
+
+    //host visible memory stays mapped for its whole lifetime
+    *mapped = nullptr;
+    if (_memProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        if (vkMapMemory(_device, memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS) {
+            FreeMemory(memory, size, memoryTypeIndex, nullptr);
+            throw std::runtime_error("failed to map device memory!");
+        }
+    }
+    return memory;
+}
+
+void MemoryAllocator::FreeMemory(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryTypeIndex, void* mapped) {
+    if (mapped) {
+        vkUnmapMemory(_device, memory);
+    }
+    vkFreeMemory(_device, memory, nullptr);
+    _heapBytes[_memProperties.memoryTypes[memoryTypeIndex].heapIndex] -= size;
+}
+
+vk::Allocation MemoryAllocator::Allocate(const VkMemoryRequirements& requirements, uint32_t memoryTypeIndex, ResourceType type, vk::MemoryCategory category, bool dedicated, VkImage dedicatedImage) {
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    vk::Allocation allocation;
+    allocation.allocator = this;
+    allocation.memoryTypeIndex = memoryTypeIndex;
+    allocation.type = static_cast<uint32_t>(type);
+    allocation.category = category;
+    allocation.size = requirements.size;
+
+    Pool& pool = GetPool(memoryTypeIndex, type);
+
+    //large resources would waste most of a block
+    if (dedicated || requirements.size > pool.blockSize / 2) {
+        allocation.block = DEDICATED_BLOCK;
+        allocation.memory = AllocateMemory(requirements.size, memoryTypeIndex, type, dedicatedImage, &allocation.mapped);
+        _dedicatedCount++;
+        _dedicatedBytes += requirements.size;
+        _categories[size_t(category)].count++;
+        _categories[size_t(category)].bytes += requirements.size;
+        return allocation;
+    }
+
+    VkDeviceSize alignment = requirements.alignment;
+    if (type == ResourceType::Buffer) {
+        alignment = std::max(alignment, DEVICE_ADDRESS_ALIGNMENT);
+    }
+
+    auto suballocate = [&](uint32_t blockIndex) {
+        Block& block = pool.blocks[blockIndex];
+        uint64_t offset = block.ranges->Allocate(requirements.size, alignment);
+        if (offset == TlsfAllocator::INVALID_OFFSET) {
+            return false;
+        }
+        allocation.block = blockIndex;
+        allocation.memory = block.memory;
+        allocation.offset = offset;
+        allocation.mapped = block.mapped ? static_cast<char*>(block.mapped) + offset : nullptr;
+        return true;
+    };
+
+    uint32_t emptyIndex = DEDICATED_BLOCK;
+    for (uint32_t i = 0; i < uint32_t(pool.blocks.size()); i++) {
+        if (pool.blocks[i].memory == VK_NULL_HANDLE) {
+            emptyIndex = std::min(emptyIndex, i);
+            continue;
+        }
+        if (suballocate(i)) {
+            _categories[size_t(category)].count++;
+            _categories[size_t(category)].bytes += requirements.size;
+            return allocation;
+        }
+    }
+
+    //no room left, add a block
+    if (emptyIndex == DEDICATED_BLOCK) {
+        emptyIndex = uint32_t(pool.blocks.size());
+        pool.blocks.emplace_back();
+    }
+    Block& block = pool.blocks[emptyIndex];
+    block.memory = AllocateMemory(pool.blockSize, memoryTypeIndex, type, VK_NULL_HANDLE, &block.mapped);
+    block.ranges = std::make_unique<TlsfAllocator>(pool.blockSize);
+    if (!suballocate(emptyIndex)) {
+        throw std::runtime_error("failed to sub-allocate device memory!");
+    }
+    _categories[size_t(category)].count++;
+    _categories[size_t(category)].bytes += requirements.size;
+    return allocation;
+}
+
+void MemoryAllocator::Free(vk::Allocation& allocation) {
+
+    if (allocation.memory == VK_NULL_HANDLE) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _categories[size_t(allocation.category)].count--;
+    _categories[size_t(allocation.category)].bytes -= allocation.size;
+
+    if (allocation.block == DEDICATED_BLOCK) {
+        FreeMemory(allocation.memory, allocation.size, allocation.memoryTypeIndex, allocation.mapped);
+        _dedicatedCount--;
+        _dedicatedBytes -= allocation.size;
+    }
+    else {
+        Pool& pool = GetPool(allocation.memoryTypeIndex, static_cast<ResourceType>(allocation.type));
+        Block& block = pool.blocks[allocation.block];
+        block.ranges->Free(allocation.offset);
+
+        //keep one block per pool to avoid reallocating it for every new resource
+        if (block.ranges->IsEmpty()) {
+            uint32_t liveBlocks = 0;
+            for (const Block& b : pool.blocks) {
+                liveBlocks += b.memory != VK_NULL_HANDLE ? 1 : 0;
+            }
+            if (liveBlocks > 1) {
+                FreeMemory(block.memory, pool.blockSize, pool.memoryTypeIndex, block.mapped);
+                block = Block();
+            }
+        }
+    }
+    allocation = vk::Allocation();
+}
+
+void MemoryAllocator::RecordCompaction(uint32_t structureCount, VkDeviceSize originalBytes, VkDeviceSize compactedBytes) {
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _compaction.structureCount += structureCount;
+    _compaction.originalBytes += originalBytes;
+    _compaction.compactedBytes += compactedBytes;
+}
+
+MemoryAllocator::Statistics MemoryAllocator::GetStatistics() const {
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    Statistics statistics;
+    statistics.dedicatedCount = _dedicatedCount;
+    statistics.dedicatedBytes = _dedicatedBytes;
+    statistics.allocationCount = _dedicatedCount;
+    VkDeviceSize freeBytes = 0;
+    for (const Pool& pool : _pools) {
+        for (const Block& block : pool.blocks) {
+            if (block.memory == VK_NULL_HANDLE) {
+                continue;
+            }
+            statistics.blockCount++;
+            statistics.blockBytes += block.ranges->GetSize();
+            statistics.usedBytes += block.ranges->GetUsedSize();
+            statistics.allocationCount += block.ranges->GetAllocationCount();
+            statistics.largestFreeRange = std::max<VkDeviceSize>(statistics.largestFreeRange, block.ranges->GetLargestFreeSize());
+            freeBytes += block.ranges->GetSize() - block.ranges->GetUsedSize();
+        }
+    }
+    if (freeBytes > 0) {
+        statistics.fragmentation = 1.0f - float(double(statistics.largestFreeRange) / double(freeBytes));
+    }
+    std::copy(std::begin(_categories), std::end(_categories), std::begin(statistics.categories));
+    statistics.compaction = _compaction;
+    return statistics;
+}
+
+std::vector<MemoryAllocator::HeapBudget> MemoryAllocator::GetHeapBudgets() const {
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    return QueryHeapBudgets();
+}
+
+std::vector<MemoryAllocator::HeapBudget> MemoryAllocator::QueryHeapBudgets() const {
+
+    std::vector<HeapBudget> heapBudgets(_memProperties.memoryHeapCount);
+    for (uint32_t i = 0; i < _memProperties.memoryHeapCount; i++) {
+        heapBudgets[i].size = _memProperties.memoryHeaps[i].size;
+        heapBudgets[i].deviceLocal = (_memProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+        heapBudgets[i].allocatedBytes = _heapBytes[i];
+        heapBudgets[i].budget = heapBudgets[i].size / 10 * 8;
+        heapBudgets[i].usage = _heapBytes[i];
+    }
+
+    //the budget and usage of the whole process, other applications taken into account
+    if (_memoryBudget) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+        budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+        VkPhysicalDeviceMemoryProperties2 memProperties2{};
+        memProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        memProperties2.pNext = &budgetProperties;
+        vkGetPhysicalDeviceMemoryProperties2(_physicalDevice, &memProperties2);
+        for (uint32_t i = 0; i < _memProperties.memoryHeapCount; i++) {
+            heapBudgets[i].budget = budgetProperties.heapBudget[i];
+            heapBudgets[i].usage = budgetProperties.heapUsage[i];
+        }
+    }
+    return heapBudgets;
+}
+
+void MemoryAllocator::WriteReport(const std::string& path) const {
+
+    const Statistics statistics = GetStatistics();
+    const std::vector<HeapBudget> heapBudgets = GetHeapBudgets();
+
+    std::ofstream file(path);
+    if (!file) {
+        throw std::runtime_error("failed to open " + path);
+    }
+
+    file << "{\n";
+    file << "  \"memoryBudget\": " << (_memoryBudget ? "true" : "false") << ",\n";
+    file << "  \"blockCount\": " << statistics.blockCount << ",\n";
+    file << "  \"blockBytes\": " << statistics.blockBytes << ",\n";
+    file << "  \"dedicatedCount\": " << statistics.dedicatedCount << ",\n";
+    file << "  \"dedicatedBytes\": " << statistics.dedicatedBytes << ",\n";
+    file << "  \"allocationCount\": " << statistics.allocationCount << ",\n";
+    file << "  \"usedBytes\": " << statistics.usedBytes << ",\n";
+    file << "  \"largestFreeRange\": " << statistics.largestFreeRange << ",\n";
+    file << "  \"fragmentation\": " << statistics.fragmentation << ",\n";
+
+    file << "  \"categories\": {\n";
+    for (size_t i = 0; i < size_t(vk::MemoryCategory::Count); i++) {
+        file << "    \"" << GetCategoryName(vk::MemoryCategory(i)) << "\": { \"count\": " << statistics.categories[i].count
+            << ", \"bytes\": " << statistics.categories[i].bytes << " }" << (i + 1 < size_t(vk::MemoryCategory::Count) ? "," : "") << "\n";
+    }
+    file << "  },\n";
+
+    file << "  \"compaction\": { \"structureCount\": " << statistics.compaction.structureCount
+        << ", \"originalBytes\": " << statistics.compaction.originalBytes
+        << ", \"compactedBytes\": " << statistics.compaction.compactedBytes << " },\n";
+
+    file << "  \"heaps\": [\n";
+    for (size_t i = 0; i < heapBudgets.size(); i++) {
+        const HeapBudget& heap = heapBudgets[i];
+        file << "    { \"size\": " << heap.size << ", \"deviceLocal\": " << (heap.deviceLocal ? "true" : "false")
+            << ", \"budget\": " << heap.budget << ", \"usage\": " << heap.usage
+            << ", \"allocatedBytes\": " << heap.allocatedBytes << " }" << (i + 1 < heapBudgets.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n";
+    file << "}\n";
+}
+
+const char* MemoryAllocator::GetCategoryName(vk::MemoryCategory category) {
+
+    static const char* names[] = {
+        "geometry", "texture", "blas", "tlas", "scratch", "sbt", "uniform", "staging", "render target", "other"
+    };
+    static_assert(sizeof(names) / sizeof(names[0]) == size_t(vk::MemoryCategory::Count), "missing category name");
+    return names[size_t(category)];
+}
+
+void MemoryAllocator::Destroy() {
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for (Pool& pool : _pools) {
+        for (Block& block : pool.blocks) {
+            if (block.memory != VK_NULL_HANDLE) {
+                FreeMemory(block.memory, pool.blockSize, pool.memoryTypeIndex, block.mapped);
+            }
+        }
+        pool.blocks.clear();
+    }
+}
\ No newline at end of file
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "common.h"
+#include "tlsf.h"
+
+/**
+* @brief    メモリタイプごとにブロックを確保し、TLSFでサブアロケーションするデバイスメモリアロケータ
+*/
+class MemoryAllocator {
+
+public:
+
+    //buffers and optimal images live in different blocks, so bufferImageGranularity never applies
+    enum class ResourceType {
+        Buffer, Image
+    };
+
+    struct Statistics {
+        uint32_t blockCount = 0;
+        uint32_t dedicatedCount = 0;
+        uint32_t allocationCount = 0;
+        VkDeviceSize blockBytes = 0;
+        VkDeviceSize dedicatedBytes = 0;
+        //bytes handed out from the blocks, alignment padding included
+        VkDeviceSize usedBytes = 0;
+        VkDeviceSize largestFreeRange = 0;
+        //1 - largest free range / free bytes of the blocks
+        float fragmentation = 0.0f;
+        //resources per vk::MemoryCategory, alignment padding excluded
+        struct Category {
+            uint32_t count = 0;
+            VkDeviceSize bytes = 0;
+        } categories[size_t(vk::MemoryCategory::Count)];
+        //acceleration structure storage before and after compaction, summed over all compactions
+        struct Compaction {
+            uint32_t structureCount = 0;
+            VkDeviceSize originalBytes = 0;
+            VkDeviceSize compactedBytes = 0;
+        } compaction;
+    };
+
+    struct HeapBudget {
+        VkDeviceSize size = 0;
+        bool deviceLocal = false;
+        //from VK_EXT_memory_budget, otherwise 80% of the heap and our own allocations
+        VkDeviceSize budget = 0;
+        VkDeviceSize usage = 0;
+        //VkDeviceMemory allocated by this allocator
+        VkDeviceSize allocatedBytes = 0;
+    };
+
+    static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+    //device address buffers may be used as acceleration structure scratch or storage
+    static constexpr VkDeviceSize DEVICE_ADDRESS_ALIGNMENT = 256;
+
+    MemoryAllocator() = default;
+    ~MemoryAllocator();
+
+    /**
+    * @brief    コピーコンストラクタの禁止
+    */
+    MemoryAllocator(const MemoryAllocator&) = delete;
+    MemoryAllocator& operator=(const MemoryAllocator&) = delete;
+
+    /**
+    * @brief    初期化
+    *           memoryBudgetはVK_EXT_memory_budgetが有効になっているか
+    */
+    void Connect(VkPhysicalDevice physicalDevice, VkDevice device, bool memoryBudget, VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE);
+
+    /**
+    * @brief    メモリを割り当てる（大きいリソースとdedicatedImageは専用のVkDeviceMemoryを持つ）
+    */
+    vk::Allocation Allocate(const VkMemoryRequirements& requirements, uint32_t memoryTypeIndex, ResourceType type, vk::MemoryCategory category, bool dedicated = false, VkImage dedicatedImage = VK_NULL_HANDLE);
+
+    /**
+    * @brief    メモリを解放する
+    */
+    void Free(vk::Allocation& allocation);
+
+    /**
+    * @brief    アクセラレーション構造のコンパクション前後のサイズを記録する（レポート用）
+    */
+    void RecordCompaction(uint32_t structureCount, VkDeviceSize originalBytes, VkDeviceSize compactedBytes);
+
+    /**
+    * @brief    統計情報を取得する
+    */
+    Statistics GetStatistics() const;
+
+    /**
+    * @brief    ヒープごとの予算と使用量を取得する
+    */
+    std::vector<HeapBudget> GetHeapBudgets() const;
+
+    /**
+    * @brief    統計情報とヒープの予算をJSONで書き出す
+    */
+    void WriteReport(const std::string& path) const;
+
+    /**
+    * @brief    カテゴリ名の取得
+    */
+    static const char* GetCategoryName(vk::MemoryCategory category);
+
+    /**
+    * @brief    全ブロックの破棄
+    */
+    void Destroy();
+
+private:
+
+    static constexpr uint32_t DEDICATED_BLOCK = ~0u;
+
+    struct Block {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        void* mapped = nullptr;
+        std::unique_ptr<TlsfAllocator> ranges;
+    };
+
+    struct Pool {
+        uint32_t memoryTypeIndex = 0;
+        ResourceType type = ResourceType::Buffer;
+        VkDeviceSize blockSize = 0;
+        //released blocks are left empty so that the indices stay valid
+        std::vector<Block> blocks;
+    };
+
+    VkDeviceMemory AllocateMemory(VkDeviceSize size, uint32_t memoryTypeIndex, ResourceType type, VkImage dedicatedImage, void** mapped);
+    void FreeMemory(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryTypeIndex, void* mapped);
+    Pool& GetPool(uint32_t memoryTypeIndex, ResourceType type);
+    //called with the mutex held
+    std::vector<HeapBudget> QueryHeapBudgets() const;
+
+    VkPhysicalDevice _physicalDevice = VK_NULL_HANDLE;
+    VkDevice _device = VK_NULL_HANDLE;
+    bool _memoryBudget = false;
+    VkPhysicalDeviceMemoryProperties _memProperties{};
+    std::vector<Pool> _pools;
+    uint32_t _dedicatedCount = 0;
+    VkDeviceSize _dedicatedBytes = 0;
+    VkDeviceSize _heapBytes[VK_MAX_MEMORY_HEAPS] = {};
+    Statistics::Category _categories[size_t(vk::MemoryCategory::Count)];
+    Statistics::Compaction _compaction;
+    mutable std::mutex _mutex;
+};
\ No newline at end of file
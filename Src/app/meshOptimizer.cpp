@@ -0,0 +1,229 @@
+#include "meshOptimizer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+namespace meshOptimizer
+{
+    namespace {
+
+        constexpr uint32_t INVALID_INDEX = ~0u;
+
+        uint64_t HashVertex(const unsigned char* vertex, size_t vertexStride) {
+            uint64_t hash = 0xcbf29ce484222325ull;
+            for (size_t i = 0; i < vertexStride; i++) {
+                hash = (hash ^ vertex[i]) * 0x100000001b3ull;
+            }
+            return hash;
+        }
+    }
+
+    MeshStats AnalyzeMesh(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t vertexStride, uint32_t cacheSize) {
+
+        MeshStats stats;
+        stats.vertexCount = vertexCount;
+        stats.indexCount = indexCount;
+        stats.vertexBytes = vertexCount * vertexStride;
+        if (indexCount < 3) {
+            return stats;
+        }
+
+        //FIFO cache simulation
+        //only cache misses fetch from memory, the stride is measured between consecutive misses
+        std::vector<size_t> cacheTime(vertexCount, 0);
+        size_t time = cacheSize + 1;
+        size_t misses = 0;
+        int64_t lastFetch = -1;
+        double strideSum = 0.0;
+        for (size_t i = 0; i < indexCount; i++) {
+            uint32_t index = indices[i];
+            if (time - cacheTime[index] > cacheSize) {
+                cacheTime[index] = time++;
+                misses++;
+                if (lastFetch >= 0) {
+                    int64_t distance = int64_t(index) - lastFetch;
+                    strideSum += static_cast<double>(distance < 0 ? -distance : distance) * static_cast<double>(vertexStride);
+                }
+                lastFetch = index;
+            }
+        }
+        stats.acmr = static_cast<double>(misses) / static_cast<double>(indexCount / 3);
+        stats.averageFetchStride = misses > 1 ? strideSum / static_cast<double>(misses - 1) : 0.0;
+        return stats;
+    }
+
+    void AccumulateMeshStats(MeshStats& total, const MeshStats& stats) {
+
+        const double totalTriangles = static_cast<double>(total.indexCount / 3);
+        const double triangles = static_cast<double>(stats.indexCount / 3);
+        const double totalMisses = total.acmr * totalTriangles;
+        const double misses = stats.acmr * triangles;
+
+        total.vertexCount += stats.vertexCount;
+        total.indexCount += stats.indexCount;
+        total.vertexBytes += stats.vertexBytes;
+        if (totalTriangles + triangles > 0.0) {
+            total.acmr = (totalMisses + misses) / (totalTriangles + triangles);
+        }
+        if (totalMisses + misses > 0.0) {
+            total.averageFetchStride = (total.averageFetchStride * totalMisses + stats.averageFetchStride * misses) / (totalMisses + misses);
+        }
+    }
+
+    size_t WeldVertices(const void* vertices, size_t vertexCount, size_t vertexStride, std::vector<uint32_t>& remap) {
+
+        const unsigned char* bytes = static_cast<const unsigned char*>(vertices);
+        remap.assign(vertexCount, INVALID_INDEX);
+
+        //hash -> first vertex with that hash, collisions are resolved by a linear probe over the chain
+        std::unordered_multimap<uint64_t, uint32_t> table;
+        table.reserve(vertexCount);
+
+        size_t uniqueCount = 0;
+        for (size_t v = 0; v < vertexCount; v++) {
+            const unsigned char* vertex = bytes + v * vertexStride;
+            uint64_t hash = HashVertex(vertex, vertexStride);
+
+            auto range = table.equal_range(hash);
+            for (auto it = range.first; it != range.second; ++it) {
+                if (memcmp(bytes + size_t(it->second) * vertexStride, vertex, vertexStride) == 0) {
+                    remap[v] = remap[it->second];
+                    break;
+                }
+            }
+            if (remap[v] == INVALID_INDEX) {
+                remap[v] = static_cast<uint32_t>(uniqueCount++);
+                table.emplace(hash, static_cast<uint32_t>(v));
+            }
+        }
+        return uniqueCount;
+    }
+
+    void OptimizeTriangleOrder(uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize) {
+
+        const size_t triangleCount = indexCount / 3;
+        if (triangleCount == 0) {
+            return;
+        }
+
+        //vertex -> triangle adjacency
+        std::vector<uint32_t> liveTriangles(vertexCount, 0);
+        for (size_t i = 0; i < triangleCount * 3; i++) {
+            liveTriangles[indices[i]]++;
+        }
+        std::vector<uint32_t> adjacencyOffset(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; v++) {
+            adjacencyOffset[v + 1] = adjacencyOffset[v] + liveTriangles[v];
+        }
+        std::vector<uint32_t> adjacency(triangleCount * 3);
+        {
+            std::vector<uint32_t> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+            for (size_t t = 0; t < triangleCount; t++) {
+                for (size_t k = 0; k < 3; k++) {
+                    adjacency[fill[indices[t * 3 + k]]++] = static_cast<uint32_t>(t);
+                }
+            }
+        }
+
+        std::vector<uint32_t> cacheTime(vertexCount, 0);
+        std::vector<bool> emitted(triangleCount, false);
+        std::vector<uint32_t> deadEnd;
+        std::vector<uint32_t> result;
+        result.reserve(triangleCount * 3);
+
+        uint32_t time = cacheSize + 1;
+        uint32_t cursor = 0;
+        int64_t fanning = indices[0];
+
+        while (fanning >= 0) {
+            std::vector<uint32_t> candidates;
+
+            //emit all remaining triangles around the fanning vertex
+            for (uint32_t a = adjacencyOffset[fanning]; a < adjacencyOffset[fanning + 1]; a++) {
+                uint32_t t = adjacency[a];
+                if (emitted[t]) {
+                    continue;
+                }
+                emitted[t] = true;
+                for (size_t k = 0; k < 3; k++) {
+                    uint32_t v = indices[t * 3 + k];
+                    result.push_back(v);
+                    deadEnd.push_back(v);
+                    candidates.push_back(v);
+                    liveTriangles[v]--;
+                    if (time - cacheTime[v] > cacheSize) {
+                        cacheTime[v] = time++;
+                    }
+                }
+            }
+
+            //next fanning vertex: the candidate that stays in the cache longest after its fan is emitted
+            fanning = -1;
+            int64_t bestPriority = -1;
+            for (uint32_t v : candidates) {
+                if (liveTriangles[v] == 0) {
+                    continue;
+                }
+                int64_t priority = 0;
+                if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize) {
+                    priority = time - cacheTime[v];
+                }
+                if (priority > bestPriority) {
+                    bestPriority = priority;
+                    fanning = v;
+                }
+            }
+
+            if (fanning < 0) {
+                //dead end: recently used vertices first, then scan the input
+                while (!deadEnd.empty()) {
+                    uint32_t v = deadEnd.back();
+                    deadEnd.pop_back();
+                    if (liveTriangles[v] > 0) {
+                        fanning = v;
+                        break;
+                    }
+                }
+                while (fanning < 0 && cursor < vertexCount) {
+                    if (liveTriangles[cursor] > 0) {
+                        fanning = cursor;
+                    }
+                    cursor++;
+                }
+            }
+        }
+
+        std::copy(result.begin(), result.end(), indices);
+    }
+
+    size_t BuildFetchRemap(const uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<uint32_t>& remap) {
+
+        remap.assign(vertexCount, INVALID_INDEX);
+        uint32_t next = 0;
+        for (size_t i = 0; i < indexCount; i++) {
+            if (remap[indices[i]] == INVALID_INDEX) {
+                remap[indices[i]] = next++;
+            }
+        }
+        return next;
+    }
+
+    void RemapVertices(void* dst, const void* src, size_t vertexCount, size_t vertexStride, const std::vector<uint32_t>& remap) {
+
+        unsigned char* dstBytes = static_cast<unsigned char*>(dst);
+        const unsigned char* srcBytes = static_cast<const unsigned char*>(src);
+        for (size_t v = 0; v < vertexCount; v++) {
+            if (remap[v] != INVALID_INDEX) {
+                memcpy(dstBytes + size_t(remap[v]) * vertexStride, srcBytes + v * vertexStride, vertexStride);
+            }
+        }
+    }
+
+    void RemapIndices(uint32_t* indices, size_t indexCount, const std::vector<uint32_t>& remap) {
+
+        for (size_t i = 0; i < indexCount; i++) {
+            indices[i] = remap[indices[i]];
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace meshOptimizer
+{
+    /**
+    * @brief    メッシュの統計情報
+    */
+    struct MeshStats {
+        size_t vertexCount = 0;
+        size_t indexCount = 0;
+        size_t vertexBytes = 0;
+        //average cache miss ratio (transformed vertices per triangle) with a FIFO cache
+        double acmr = 0.0;
+        //average distance in bytes between consecutive vertex fetches that miss the cache
+        double averageFetchStride = 0.0;
+    };
+
+    /**
+    * @brief    統計情報を計算する（インデックスは0始まり）
+    */
+    MeshStats AnalyzeMesh(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t vertexStride, uint32_t cacheSize = 16);
+
+    /**
+    * @brief    統計情報を合算する（ACMRは三角形数、ストライドはキャッシュミス数で重み付けする）
+    */
+    void AccumulateMeshStats(MeshStats& total, const MeshStats& stats);
+
+    /**
+    * @brief    ビット単位で同じ頂点をまとめる（remapに新しい頂点番号を書き込み、頂点数を返す）
+    */
+    size_t WeldVertices(const void* vertices, size_t vertexCount, size_t vertexStride, std::vector<uint32_t>& remap);
+
+    /**
+    * @brief    頂点キャッシュの局所性が高くなるように三角形を並べ替える（Tipsify）
+    */
+    void OptimizeTriangleOrder(uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = 16);
+
+    /**
+    * @brief    インデックスの参照順に頂点を並べるremapを作成する（使われない頂点は除く）
+    */
+    size_t BuildFetchRemap(const uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<uint32_t>& remap);
+
+    /**
+    * @brief    remapに従って頂点を並べ替える（dstはremap後の頂点数分必要）
+    */
+    void RemapVertices(void* dst, const void* src, size_t vertexCount, size_t vertexStride, const std::vector<uint32_t>& remap);
+
+    /**
+    * @brief    remapに従ってインデックスを書き換える
+    */
+    void RemapIndices(uint32_t* indices, size_t indexCount, const std::vector<uint32_t>& remap);
+}
\ No newline at end of file
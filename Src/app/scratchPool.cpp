@@ -0,0 +1,149 @@
+#include "scratchPool.h"
+#include "device.h"
+
+namespace {
+
+    VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+void ScratchPool::Connect(VulkanDevice* device, VkDeviceSize chunkSize) {
+
+    _vulkanDevice = device;
+    _chunkSize = chunkSize;
+
+    VkPhysicalDeviceAccelerationStructurePropertiesKHR accelerationStructureProperties{};
+    accelerationStructureProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
+    VkPhysicalDeviceProperties2 deviceProperties{};
+    deviceProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    deviceProperties.pNext = &accelerationStructureProperties;
+    vkGetPhysicalDeviceProperties2(_vulkanDevice->_physicalDevice, &deviceProperties);
+    _alignment = std::max<VkDeviceSize>(accelerationStructureProperties.minAccelerationStructureScratchOffsetAlignment, 1);
+}
+
+uint32_t ScratchPool::CreateChunk(VkDeviceSize size, bool shared) {
+
+    uint32_t index = uint32_t(_chunks.size());
+    for (uint32_t i = 0; i < uint32_t(_chunks.size()); i++) {
+        if (_chunks[i].buffer.buffer == VK_NULL_HANDLE) {
+            index = i;
+            break;
+        }
+    }
+    if (index == _chunks.size()) {
+        _chunks.emplace_back();
+    }
+
+    Chunk& chunk = _chunks[index];
+    chunk.buffer = _vulkanDevice->CreateBuffer(
+        size + _alignment - 1,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        vk::MemoryCategory::Scratch
+    );
+    chunk.skew = AlignUp(chunk.buffer.address, _alignment) - chunk.buffer.address;
+    chunk.size = size;
+    if (shared) {
+        chunk.ranges = std::make_unique<TlsfAllocator>(size);
+    }
+    _size += size;
+    _peakSize = std::max(_peakSize, _size);
+    return index;
+}
+
+ScratchPool::Allocation ScratchPool::Allocate(VkDeviceSize size) {
+
+    Allocation allocation;
+    if (size == 0) {
+        return allocation;
+    }
+
+    auto fill = [&](uint32_t chunkIndex, VkDeviceSize offset) {
+        const Chunk& chunk = _chunks[chunkIndex];
+        allocation.buffer = chunk.buffer.buffer;
+        allocation.offset = chunk.skew + offset;
+        allocation.size = size;
+        allocation.address = chunk.buffer.address + allocation.offset;
+        allocation.chunk = chunkIndex;
+        return allocation;
+    };
+
+    //large builds, reuse the smallest idle chunk that fits
+    if (size > _chunkSize / 2) {
+        uint32_t best = ~0u;
+        for (uint32_t i = 0; i < uint32_t(_chunks.size()); i++) {
+            const Chunk& chunk = _chunks[i];
+            if (chunk.buffer.buffer == VK_NULL_HANDLE || chunk.ranges || chunk.used || chunk.size < size) {
+                continue;
+            }
+            if (best == ~0u || chunk.size < _chunks[best].size) {
+                best = i;
+            }
+        }
+        if (best == ~0u) {
+            best = CreateChunk(AlignUp(size, _alignment), false);
+        }
+        _chunks[best].used = true;
+        return fill(best, 0);
+    }
+
+    for (uint32_t i = 0; i < uint32_t(_chunks.size()); i++) {
+        if (!_chunks[i].ranges) {
+            continue;
+        }
+        const uint64_t offset = _chunks[i].ranges->Allocate(size, _alignment);
+        if (offset != TlsfAllocator::INVALID_OFFSET) {
+            return fill(i, offset);
+        }
+    }
+
+    //no room left, add a chunk
+    const uint32_t index = CreateChunk(_chunkSize, true);
+    const uint64_t offset = _chunks[index].ranges->Allocate(size, _alignment);
+    if (offset == TlsfAllocator::INVALID_OFFSET) {
+        throw std::runtime_error("failed to allocate acceleration structure scratch!");
+    }
+    return fill(index, offset);
+}
+
+void ScratchPool::Free(Allocation& allocation) {
+
+    if (allocation.size == 0) {
+        return;
+    }
+    Chunk& chunk = _chunks[allocation.chunk];
+    if (chunk.ranges) {
+        chunk.ranges->Free(allocation.offset - chunk.skew);
+    }
+    else {
+        chunk.used = false;
+    }
+    allocation = Allocation();
+}
+
+void ScratchPool::Trim() {
+
+    for (Chunk& chunk : _chunks) {
+        if (chunk.buffer.buffer != VK_NULL_HANDLE && chunk.IsEmpty()) {
+            _size -= chunk.size;
+            chunk.buffer.Destroy(_vulkanDevice->_device);
+            chunk = Chunk();
+        }
+    }
+}
+
+void ScratchPool::Destroy() {
+
+    if (_vulkanDevice == nullptr) {
+        return;
+    }
+    for (Chunk& chunk : _chunks) {
+        if (chunk.buffer.buffer != VK_NULL_HANDLE) {
+            chunk.buffer.Destroy(_vulkanDevice->_device);
+        }
+    }
+    _chunks.clear();
+    _size = 0;
+    _vulkanDevice = nullptr;
+}
\ No newline at end of file
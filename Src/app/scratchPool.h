@@ -0,0 +1,106 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "common.h"
+#include "tlsf.h"
+
+struct VulkanDevice;
+
+/**
+* @brief    加速構造のビルドと更新で共有するスクラッチメモリのプール
+*           チャンクは同時に必要な最大量まで増え、Trimで空のチャンクを解放する
+*           スレッドセーフではないので、ビルドを記録するスレッドからだけ使う
+*/
+class ScratchPool {
+
+public:
+
+    //range of a scratch chunk, address is aligned to minAccelerationStructureScratchOffsetAlignment
+    struct Allocation {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        VkDeviceAddress address = 0;
+        uint32_t chunk = 0;
+    };
+
+    //small enough to keep resident, builds larger than half of it get a chunk of their own
+    static constexpr VkDeviceSize DEFAULT_CHUNK_SIZE = 8ull * 1024 * 1024;
+
+    ScratchPool() = default;
+
+    /**
+    * @brief    コピーコンストラクタの禁止
+    */
+    ScratchPool(const ScratchPool&) = delete;
+    ScratchPool& operator=(const ScratchPool&) = delete;
+
+    /**
+    * @brief    初期化
+    */
+    void Connect(VulkanDevice* device, VkDeviceSize chunkSize = DEFAULT_CHUNK_SIZE);
+
+    /**
+    * @brief    スクラッチ領域を割り当てる（sizeが0なら空の領域）
+    */
+    Allocation Allocate(VkDeviceSize size);
+
+    /**
+    * @brief    スクラッチ領域を解放する（使っているコマンドの完了後に呼ぶこと）
+    */
+    void Free(Allocation& allocation);
+
+    /**
+    * @brief    空のチャンクを解放する
+    */
+    void Trim();
+
+    /**
+    * @brief    スクラッチアドレスのアライメントを取得する
+    */
+    VkDeviceSize GetAlignment() const { return _alignment; }
+
+    /**
+    * @brief    チャンクの合計サイズを取得する
+    */
+    VkDeviceSize GetSize() const { return _size; }
+
+    /**
+    * @brief    これまでの最大のチャンクの合計サイズを取得する
+    */
+    VkDeviceSize GetPeakSize() const { return _peakSize; }
+
+    /**
+    * @brief    破棄
+    */
+    void Destroy();
+
+private:
+
+    struct Chunk {
+        vk::Buffer buffer;
+        //bytes skipped at the start so that the ranges are aligned in device address space
+        VkDeviceSize skew = 0;
+        VkDeviceSize size = 0;
+        //nullptr for a chunk that holds a single large build
+        std::unique_ptr<TlsfAllocator> ranges;
+        bool used = false;
+
+        bool IsEmpty() const { return ranges ? ranges->IsEmpty() : !used; }
+    };
+
+    //the index of an unused slot, or a new one
+    uint32_t CreateChunk(VkDeviceSize size, bool shared);
+
+    VulkanDevice* _vulkanDevice = nullptr;
+    VkDeviceSize _chunkSize = DEFAULT_CHUNK_SIZE;
+    VkDeviceSize _alignment = 1;
+    VkDeviceSize _size = 0;
+    VkDeviceSize _peakSize = 0;
+    //released chunks are left empty so that the indices stay valid
+    std::vector<Chunk> _chunks;
+};
\ No newline at end of file
@@ -2,7 +2,7 @@
 
 std::vector<char> Shader::ReadFile(const std::string& filename) {
 
-    //Ō̈ʒuǂݎ
+    //最後の位置を読み取る
     std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
     if (!file.is_open()) {
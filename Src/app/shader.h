@@ -13,7 +13,7 @@
 #include "device.h"
 
 
-//spirv-reflectg߂ɃNXɂĂ
+//後でspirv-reflectを使うためにクラスにしておきたい
 class Shader {
 
 public:
@@ -40,27 +40,27 @@ public:
     };
 
     /**
-    * @brief    VF[_t@Cǂݍ
+    * @brief    シェーダファイルを読み込む
     */
     static std::vector<char> ReadFile(const std::string& filename);
 
     /**
-    * @brief    jtH[ϐ̏擾
+    * @brief    ユニフォーム変数の情報を取得する
     */
     std::vector<std::vector<UniformBinding>> GetUniformDescriptions(SpvReflectShaderModule* module);
     
     /**
-    * @brief    VF[_W[쐬
+    * @brief    シェーダモジュールを作成する
     */
     VkShaderModule CreateShaderModule(const std::vector<char>& code);
     
     /**
-    * @brief    VF[_[ǂݍ
+    * @brief    シェーダーを読み込む
     */
     VkPipelineShaderStageCreateInfo LoadShaderProgram(std::string shaderFileName, VkShaderStageFlagBits stage);
 
     /**
-    * @brief    
+    * @brief    初期化
     */
     void Connect(VulkanDevice* device);
 
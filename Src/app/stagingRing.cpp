@@ -0,0 +1,162 @@
+#include "stagingRing.h"
+#include "device.h"
+
+namespace {
+
+    VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+void StagingRing::Connect(VulkanDevice* device, VkDeviceSize size) {
+
+    _vulkanDevice = device;
+    _size = size;
+    _buffer = _vulkanDevice->CreateBuffer(
+        _size,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        vk::MemoryCategory::Staging
+    );
+    _mapped = static_cast<char*>(_buffer.Map(_vulkanDevice->_device));
+    _head = 0;
+    _used = 0;
+    _pendingBytes = 0;
+}
+
+StagingRing::Region StagingRing::Allocate(VkDeviceSize size, VkDeviceSize alignment) {
+
+    alignment = std::max<VkDeviceSize>(alignment, 1);
+
+    //a single upload larger than the ring, grow once everything in flight has finished
+    if (size + alignment - 1 > _size) {
+        if (_pendingBytes > 0) {
+            throw std::runtime_error("staging ring is too small, submit the pending uploads first");
+        }
+        Reclaim(true);
+        _buffer.Unmap(_vulkanDevice->_device);
+        _buffer.Destroy(_vulkanDevice->_device);
+        VkDeviceSize newSize = _size;
+        while (newSize < size + alignment - 1) {
+            newSize *= 2;
+        }
+        Connect(_vulkanDevice, newSize);
+    }
+
+    VkDeviceSize offset = 0;
+    VkDeviceSize consumed = 0;
+    while (true) {
+        //nothing in flight, start over from the beginning
+        if (_used == 0) {
+            _head = 0;
+        }
+        offset = AlignUp(_head, alignment);
+        if (offset + size > _size) {
+            //the tail of the ring is skipped and belongs to this allocation
+            offset = 0;
+            consumed = (_size - _head) + size;
+        }
+        else {
+            consumed = (offset - _head) + size;
+        }
+        if (_used + consumed <= _size) {
+            break;
+        }
+        if (!ReclaimOldest()) {
+            throw std::runtime_error("staging ring is full, submit the pending uploads first");
+        }
+    }
+
+    _head = offset + size;
+    _used += consumed;
+    _pendingBytes += consumed;
+
+    Region region;
+    region.data = _mapped + offset;
+    region.buffer = _buffer.buffer;
+    region.offset = offset;
+    region.size = size;
+    return region;
+}
+
+bool StagingRing::Fits(VkDeviceSize size, VkDeviceSize alignment) const {
+
+    alignment = std::max<VkDeviceSize>(alignment, 1);
+    if (_pendingBytes == 0) {
+        //Allocate grows the ring if needed
+        return true;
+    }
+    if (_pendingBytes + size + alignment - 1 > _size) {
+        return false;
+    }
+
+    //only the unsubmitted range [start, _head) would be left
+    const VkDeviceSize start = _head >= _pendingBytes ? _head - _pendingBytes : _head + _size - _pendingBytes;
+    if (start <= _head) {
+        return AlignUp(_head, alignment) + size <= _size || size <= start;
+    }
+    return AlignUp(_head, alignment) + size <= start;
+}
+
+VkFence StagingRing::AcquireFence() {
+
+    VkFence fence;
+    if (!_freeFences.empty()) {
+        fence = _freeFences.back();
+        _freeFences.pop_back();
+    }
+    else {
+        VkFenceCreateInfo fenceCI{};
+        fenceCI.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        if (vkCreateFence(_vulkanDevice->_device, &fenceCI, nullptr, &fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create staging fence!");
+        }
+    }
+
+    Submission submission;
+    submission.fence = fence;
+    submission.bytes = _pendingBytes;
+    _submissions.push_back(submission);
+    _pendingBytes = 0;
+    return fence;
+}
+
+bool StagingRing::ReclaimOldest() {
+
+    if (_submissions.empty()) {
+        return false;
+    }
+    Submission& submission = _submissions.front();
+    vkWaitForFences(_vulkanDevice->_device, 1, &submission.fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT);
+    vkResetFences(_vulkanDevice->_device, 1, &submission.fence);
+    _freeFences.push_back(submission.fence);
+    _used -= submission.bytes;
+    _submissions.pop_front();
+    return true;
+}
+
+void StagingRing::Reclaim(bool wait) {
+
+    while (!_submissions.empty()) {
+        if (!wait && vkGetFenceStatus(_vulkanDevice->_device, _submissions.front().fence) != VK_SUCCESS) {
+            break;
+        }
+        ReclaimOldest();
+    }
+}
+
+void StagingRing::Destroy() {
+
+    if (_vulkanDevice == nullptr) {
+        return;
+    }
+    Reclaim(true);
+    for (VkFence fence : _freeFences) {
+        vkDestroyFence(_vulkanDevice->_device, fence, nullptr);
+    }
+    _freeFences.clear();
+    _buffer.Unmap(_vulkanDevice->_device);
+    _buffer.Destroy(_vulkanDevice->_device);
+    _mapped = nullptr;
+    _vulkanDevice = nullptr;
+}
\ No newline at end of file
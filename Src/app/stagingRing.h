@@ -0,0 +1,97 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "common.h"
+
+struct VulkanDevice;
+
+/**
+* @brief    永続的にマップされたステージング用のリングバッファ
+*           割り当てた範囲はフェンスごとにまとめて、フェンスが通知されたら再利用する
+*           スレッドセーフではないので、転送コマンドを記録するスレッドからだけ使う
+*/
+class StagingRing {
+
+public:
+
+    //write pointer and the range of the ring buffer to copy from
+    struct Region {
+        void* data = nullptr;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+    };
+
+    static constexpr VkDeviceSize DEFAULT_SIZE = 64ull * 1024 * 1024;
+    //covers the texel size of every format and optimalBufferCopyOffsetAlignment in practice
+    static constexpr VkDeviceSize DEFAULT_ALIGNMENT = 16;
+
+    StagingRing() = default;
+
+    /**
+    * @brief    コピーコンストラクタの禁止
+    */
+    StagingRing(const StagingRing&) = delete;
+    StagingRing& operator=(const StagingRing&) = delete;
+
+    /**
+    * @brief    初期化
+    */
+    void Connect(VulkanDevice* device, VkDeviceSize size = DEFAULT_SIZE);
+
+    /**
+    * @brief    書き込み先を割り当てる（空きがなければ古いフェンスを待つ）
+    */
+    Region Allocate(VkDeviceSize size, VkDeviceSize alignment = DEFAULT_ALIGNMENT);
+
+    /**
+    * @brief    提出済みの範囲がすべて解放されれば割り当てられるか（falseなら先に提出が必要）
+    */
+    bool Fits(VkDeviceSize size, VkDeviceSize alignment = DEFAULT_ALIGNMENT) const;
+
+    /**
+    * @brief    前回から割り当てた範囲を読むコマンドの提出に使うフェンスを取得する
+    */
+    VkFence AcquireFence();
+
+    /**
+    * @brief    通知済みのフェンスの範囲を解放する
+    */
+    void Reclaim(bool wait = false);
+
+    /**
+    * @brief    容量の取得
+    */
+    VkDeviceSize GetSize() const { return _size; }
+
+    /**
+    * @brief    破棄
+    */
+    void Destroy();
+
+private:
+
+    struct Submission {
+        VkFence fence = VK_NULL_HANDLE;
+        VkDeviceSize bytes = 0;
+    };
+
+    //waits for the oldest submission
+    bool ReclaimOldest();
+
+    VulkanDevice* _vulkanDevice = nullptr;
+    vk::Buffer _buffer;
+    char* _mapped = nullptr;
+    VkDeviceSize _size = 0;
+    VkDeviceSize _head = 0;
+    //bytes between the oldest submission and the head, wrap padding included
+    VkDeviceSize _used = 0;
+    //bytes allocated since the last AcquireFence
+    VkDeviceSize _pendingBytes = 0;
+    std::deque<Submission> _submissions;
+    std::vector<VkFence> _freeFences;
+};
\ No newline at end of file
@@ -46,7 +46,7 @@ VkSurfaceFormatKHR Swapchain::ChooseSwapSurfaceFormat(const std::vector<VkSurfac
             return availableFormat;
         }
     }
-    //ΉĂȂŏ̃tH[}bgɂ
+    //対応してなかったら最初のフォーマットにする
     return availableFormats[0];
 }
 
@@ -74,7 +74,7 @@ VkExtent2D Swapchain::ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilit
             static_cast<uint32_t>(height)
         };
 
-        //RetinafBXvC
+        //Retinaディスプレイ等
         actualExtent.width = std::clamp(actualExtent.width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
         actualExtent.height = std::clamp(actualExtent.height, capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
 
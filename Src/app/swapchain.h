@@ -14,61 +14,61 @@ class Swapchain {
 public:
 
     struct SwapChainSupportDetails {
-        //{Iȕ\ʋ@\iXbv`F[̉摜̍ŏő吔A摜̍ŏő啝ƍj
+        //基本的な表面機能（スワップチェーン内の画像の最小最大数、画像の最小最大幅と高さ）
         VkSurfaceCapabilitiesKHR capabilities = {};
-        //\ʃtH[}bgisNZtH[}bgAFԁj
+        //表面フォーマット（ピクセルフォーマット、色空間）
         std::vector<VkSurfaceFormatKHR> formats;
-        //p\ȃv[e[V[h
+        //利用可能なプレゼンテーションモード
         std::vector<VkPresentModeKHR> presentModes;
     };
 
     /**
-    * @brief    
+    * @brief    初期化
     */
     void Connect(GLFWwindow* _window, VkInstance& instance, VkPhysicalDevice& physicalDevice, VkDevice& device);
 
     /**
-    * @brief    T[tFX
+    * @brief    サーフェスを作る
     */
     void CreateSurface();
 
     /**
-    * @brief    Xbv`F[̃T|[gmF
+    * @brief    スワップチェーンのサポートを確認する
     */
     SwapChainSupportDetails QuerySwapChainSupport(VkPhysicalDevice device, uint32_t queueFalimyIndex);
 
     /**
-    * @brief    Xbv`F[̃T[tFXtH[}bgI
+    * @brief    スワップチェーンのサーフェスフォーマットを選択する
     */
     VkSurfaceFormatKHR ChooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
 
     /**
-    * @brief    Xbv`F[̕\[hI
+    * @brief    スワップチェーンの表示モードを選択する
     */
     VkPresentModeKHR ChooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes);
 
     /**
-    * @brief    Xbv`F[͈̔͂I
+    * @brief    スワップチェーンの範囲を選択する
     */
     VkExtent2D ChooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities);
 
     /**
-    * @brief    Xbv`F[쐬
+    * @brief    スワップチェーンを作成する
     */
     void CreateSwapChain(uint32_t queueFamilyIndex);
 
     /**
-    * @brief    \p
+    * @brief    表示用
     */
     VkResult QueuePresent(VkQueue& queue, uint32_t imageIndex, VkSemaphore& waitSemaphore);
 
     /**
-    * @brief    Xbv`F[č쐬̂ƂɃN[
+    * @brief    スワップチェーン再作成のときにクリーンする
     */
     void Cleanup();
 
     /**
-    * @brief    I
+    * @brief    終了時
     */
     void Destroy();
 
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class ThreadPool {
+
+public:
+
+    /**
+    * @brief    コンストラクタ（threadCountが0のときはハードウェアスレッド数）
+    */
+    explicit ThreadPool(uint32_t threadCount = 0) {
+        if (threadCount == 0) {
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (uint32_t i = 0; i < threadCount; i++) {
+            _workers.emplace_back([this] { WorkerLoop(); });
+        }
+    }
+
+    /**
+    * @brief    デストラクタ（残りのタスクを処理してから終了する）
+    */
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _condition.notify_all();
+        for (auto& worker : _workers) {
+            worker.join();
+        }
+    }
+
+    /**
+    * @brief    コピーコンストラクタの禁止
+    */
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+    * @brief    タスクを追加する
+    */
+    template<class F>
+    std::future<std::invoke_result_t<F>> Submit(F&& func) {
+        using ReturnType = std::invoke_result_t<F>;
+        auto task = std::make_shared<std::packaged_task<ReturnType()>>(std::forward<F>(func));
+        std::future<ReturnType> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _tasks.emplace([task]() { (*task)(); });
+        }
+        _condition.notify_one();
+        return result;
+    }
+
+    /**
+    * @brief    ワーカースレッド数の取得
+    */
+    uint32_t GetThreadCount() const {
+        return static_cast<uint32_t>(_workers.size());
+    }
+
+private:
+
+    void WorkerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _condition.wait(lock, [this] { return _stop || !_tasks.empty(); });
+                if (_stop && _tasks.empty()) {
+                    return;
+                }
+                task = std::move(_tasks.front());
+                _tasks.pop();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> _workers;
+    std::queue<std::function<void()>> _tasks;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    bool _stop = false;
+};
\ No newline at end of file
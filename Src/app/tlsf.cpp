@@ -0,0 +1,260 @@
+#include "tlsf.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+
+    uint32_t LowestBit(uint64_t value) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward64(&index, value);
+        return static_cast<uint32_t>(index);
+#else
+        return static_cast<uint32_t>(__builtin_ctzll(value));
+#endif
+    }
+
+    uint32_t HighestBit(uint64_t value) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return static_cast<uint32_t>(index);
+#else
+        return static_cast<uint32_t>(63 - __builtin_clzll(value));
+#endif
+    }
+
+    uint64_t AlignUp(uint64_t value, uint64_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+TlsfAllocator::TlsfAllocator(uint64_t size) {
+
+    if (size == 0) {
+        throw std::runtime_error("TlsfAllocator: size must not be 0");
+    }
+    _size = size;
+    for (auto& lists : _freeLists) {
+        std::fill(std::begin(lists), std::end(lists), NONE);
+    }
+
+    uint32_t block = CreateBlock();
+    _blocks[block].size = size;
+    InsertFree(block);
+}
+
+void TlsfAllocator::Mapping(uint64_t size, uint32_t& fl, uint32_t& sl) {
+
+    //sizes below SL_COUNT get one list each
+    if (size < SL_COUNT) {
+        fl = 0;
+        sl = static_cast<uint32_t>(size);
+        return;
+    }
+    uint32_t bit = HighestBit(size);
+    fl = bit - SL_BITS + 1;
+    sl = static_cast<uint32_t>(size >> (bit - SL_BITS)) ^ SL_COUNT;
+}
+
+uint32_t TlsfAllocator::CreateBlock() {
+    if (!_unusedBlocks.empty()) {
+        uint32_t index = _unusedBlocks.back();
+        _unusedBlocks.pop_back();
+        _blocks[index] = Block();
+        return index;
+    }
+    _blocks.emplace_back();
+    return static_cast<uint32_t>(_blocks.size() - 1);
+}
+
+void TlsfAllocator::ReleaseBlock(uint32_t index) {
+    _unusedBlocks.push_back(index);
+}
+
+void TlsfAllocator::InsertFree(uint32_t index) {
+
+    uint32_t fl, sl;
+    Mapping(_blocks[index].size, fl, sl);
+
+    Block& block = _blocks[index];
+    block.isFree = true;
+    block.prevFree = NONE;
+    block.nextFree = _freeLists[fl][sl];
+    if (block.nextFree != NONE) {
+        _blocks[block.nextFree].prevFree = index;
+    }
+    _freeLists[fl][sl] = index;
+    _flBitmap |= 1ull << fl;
+    _slBitmap[fl] |= 1u << sl;
+    _freeCount++;
+}
+
+void TlsfAllocator::RemoveFree(uint32_t index) {
+
+    uint32_t fl, sl;
+    Mapping(_blocks[index].size, fl, sl);
+
+    Block& block = _blocks[index];
+    if (block.prevFree != NONE) {
+        _blocks[block.prevFree].nextFree = block.nextFree;
+    }
+    else {
+        _freeLists[fl][sl] = block.nextFree;
+    }
+    if (block.nextFree != NONE) {
+        _blocks[block.nextFree].prevFree = block.prevFree;
+    }
+    if (_freeLists[fl][sl] == NONE) {
+        _slBitmap[fl] &= ~(1u << sl);
+        if (_slBitmap[fl] == 0) {
+            _flBitmap &= ~(1ull << fl);
+        }
+    }
+    block.isFree = false;
+    block.prevFree = NONE;
+    block.nextFree = NONE;
+    _freeCount--;
+}
+
+uint32_t TlsfAllocator::FindFree(uint64_t size) const {
+
+    //round up to the next list so that every block of the found list is large enough
+    if (size >= SL_COUNT) {
+        uint64_t round = (1ull << (HighestBit(size) - SL_BITS)) - 1;
+        if (size > ~0ull - round) {
+            return NONE;
+        }
+        size += round;
+    }
+
+    uint32_t fl, sl;
+    Mapping(size, fl, sl);
+    if (fl >= FL_COUNT) {
+        return NONE;
+    }
+
+    uint32_t slMap = _slBitmap[fl] & (~0u << sl);
+    if (slMap == 0) {
+        uint64_t flMap = fl + 1 < 64 ? _flBitmap & (~0ull << (fl + 1)) : 0;
+        if (flMap == 0) {
+            return NONE;
+        }
+        fl = LowestBit(flMap);
+        slMap = _slBitmap[fl];
+    }
+    return _freeLists[fl][LowestBit(slMap)];
+}
+
+uint32_t TlsfAllocator::Split(uint32_t index, uint64_t size) {
+
+    uint32_t rest = CreateBlock();
+    Block& block = _blocks[index];
+    Block& restBlock = _blocks[rest];
+    restBlock.offset = block.offset + size;
+    restBlock.size = block.size - size;
+    restBlock.prevPhysical = index;
+    restBlock.nextPhysical = block.nextPhysical;
+    if (block.nextPhysical != NONE) {
+        _blocks[block.nextPhysical].prevPhysical = rest;
+    }
+    block.nextPhysical = rest;
+    block.size = size;
+    return rest;
+}
+
+uint32_t TlsfAllocator::Merge(uint32_t index) {
+
+    //absorb the free neighbours, the block itself is not in a free list
+    uint32_t next = _blocks[index].nextPhysical;
+    if (next != NONE && _blocks[next].isFree) {
+        RemoveFree(next);
+        _blocks[index].size += _blocks[next].size;
+        _blocks[index].nextPhysical = _blocks[next].nextPhysical;
+        if (_blocks[next].nextPhysical != NONE) {
+            _blocks[_blocks[next].nextPhysical].prevPhysical = index;
+        }
+        ReleaseBlock(next);
+    }
+
+    uint32_t prev = _blocks[index].prevPhysical;
+    if (prev != NONE && _blocks[prev].isFree) {
+        RemoveFree(prev);
+        _blocks[prev].size += _blocks[index].size;
+        _blocks[prev].nextPhysical = _blocks[index].nextPhysical;
+        if (_blocks[index].nextPhysical != NONE) {
+            _blocks[_blocks[index].nextPhysical].prevPhysical = prev;
+        }
+        ReleaseBlock(index);
+        index = prev;
+    }
+    return index;
+}
+
+uint64_t TlsfAllocator::Allocate(uint64_t size, uint64_t alignment) {
+
+    if (size == 0) {
+        return INVALID_OFFSET;
+    }
+    alignment = std::max<uint64_t>(alignment, 1);
+
+    //worst case padding, the blocks keep the alignment of the previous allocations in practice
+    uint64_t searchSize = size + alignment - 1;
+    if (searchSize < size) {
+        return INVALID_OFFSET;
+    }
+    uint32_t index = FindFree(searchSize);
+    if (index == NONE) {
+        return INVALID_OFFSET;
+    }
+    RemoveFree(index);
+
+    //the padding in front of the aligned offset stays free
+    uint64_t padding = AlignUp(_blocks[index].offset, alignment) - _blocks[index].offset;
+    if (padding > 0) {
+        uint32_t aligned = Split(index, padding);
+        InsertFree(index);
+        index = aligned;
+    }
+    if (_blocks[index].size > size) {
+        uint32_t rest = Split(index, size);
+        InsertFree(rest);
+    }
+
+    _usedSize += _blocks[index].size;
+    _allocated.emplace(_blocks[index].offset, index);
+    return _blocks[index].offset;
+}
+
+void TlsfAllocator::Free(uint64_t offset) {
+
+    auto it = _allocated.find(offset);
+    if (it == _allocated.end()) {
+        throw std::runtime_error("TlsfAllocator: freeing an offset that was not allocated");
+    }
+    uint32_t index = it->second;
+    _allocated.erase(it);
+    _usedSize -= _blocks[index].size;
+
+    InsertFree(Merge(index));
+}
+
+uint64_t TlsfAllocator::GetLargestFreeSize() const {
+
+    if (_flBitmap == 0) {
+        return 0;
+    }
+    //the largest blocks are in the highest first level list, its lists are not sorted
+    uint32_t fl = HighestBit(_flBitmap);
+    uint32_t sl = HighestBit(_slBitmap[fl]);
+    uint64_t largest = 0;
+    for (uint32_t index = _freeLists[fl][sl]; index != NONE; index = _blocks[index].nextFree) {
+        largest = std::max(largest, _blocks[index].size);
+    }
+    return largest;
+}
\ No newline at end of file
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/**
+* @brief    TLSF(Two-Level Segregated Fit)による範囲アロケータ
+*           [0, size) の範囲からオフセットだけを割り当てる（メモリ自体は持たない）
+*/
+class TlsfAllocator {
+
+public:
+
+    static constexpr uint64_t INVALID_OFFSET = ~0ull;
+
+    /**
+    * @brief    コンストラクタ
+    */
+    explicit TlsfAllocator(uint64_t size);
+
+    /**
+    * @brief    範囲を割り当てる（失敗したときはINVALID_OFFSET）
+    */
+    uint64_t Allocate(uint64_t size, uint64_t alignment);
+
+    /**
+    * @brief    Allocateが返したオフセットの範囲を解放する
+    */
+    void Free(uint64_t offset);
+
+    /**
+    * @brief    全体のサイズを取得する
+    */
+    uint64_t GetSize() const { return _size; }
+
+    /**
+    * @brief    割り当て済みのサイズを取得する（アライメントの余白を含む）
+    */
+    uint64_t GetUsedSize() const { return _usedSize; }
+
+    /**
+    * @brief    最大の空き範囲のサイズを取得する
+    */
+    uint64_t GetLargestFreeSize() const;
+
+    /**
+    * @brief    空き範囲の数を取得する
+    */
+    uint32_t GetFreeRangeCount() const { return _freeCount; }
+
+    /**
+    * @brief    割り当て数を取得する
+    */
+    uint32_t GetAllocationCount() const { return static_cast<uint32_t>(_allocated.size()); }
+
+    /**
+    * @brief    割り当てがないか
+    */
+    bool IsEmpty() const { return _allocated.empty(); }
+
+private:
+
+    //16 second level lists per power of two
+    static constexpr uint32_t SL_BITS = 4;
+    static constexpr uint32_t SL_COUNT = 1u << SL_BITS;
+    static constexpr uint32_t FL_COUNT = 64 - SL_BITS + 1;
+    static constexpr uint32_t NONE = ~0u;
+
+    struct Block {
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        //neighbours in address order
+        uint32_t prevPhysical = NONE;
+        uint32_t nextPhysical = NONE;
+        //neighbours in the free list of the same size class
+        uint32_t prevFree = NONE;
+        uint32_t nextFree = NONE;
+        bool isFree = false;
+    };
+
+    static void Mapping(uint64_t size, uint32_t& fl, uint32_t& sl);
+
+    uint32_t CreateBlock();
+    void ReleaseBlock(uint32_t index);
+    void InsertFree(uint32_t index);
+    void RemoveFree(uint32_t index);
+    uint32_t FindFree(uint64_t size) const;
+    //splits [offset, offset + size) of a block off into a new block placed after it
+    uint32_t Split(uint32_t index, uint64_t size);
+    uint32_t Merge(uint32_t index);
+
+    uint64_t _size = 0;
+    uint64_t _usedSize = 0;
+    uint32_t _freeCount = 0;
+
+    std::vector<Block> _blocks;
+    std::vector<uint32_t> _unusedBlocks;
+    std::unordered_map<uint64_t, uint32_t> _allocated;
+
+    uint64_t _flBitmap = 0;
+    uint32_t _slBitmap[FL_COUNT] = {};
+    uint32_t _freeLists[FL_COUNT][SL_COUNT];
+};
\ No newline at end of file
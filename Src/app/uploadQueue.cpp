@@ -0,0 +1,300 @@
+#include "uploadQueue.h"
+#include "device.h"
+
+#include <cstring>
+
+void UploadQueue::Connect(VulkanDevice* device, StagingRing* stagingRing) {
+
+    _vulkanDevice = device;
+    _stagingRing = stagingRing;
+    _dedicated = _vulkanDevice->_queueFamilyIndices.transfer != _vulkanDevice->_queueFamilyIndices.graphics;
+    _queue = _vulkanDevice->_transferQueue;
+    _commandPool = _vulkanDevice->_commandPool;
+
+    if (_dedicated) {
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = _vulkanDevice->_queueFamilyIndices.transfer;
+        if (vkCreateCommandPool(_vulkanDevice->_device, &poolInfo, nullptr, &_commandPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create transfer command pool!");
+        }
+    }
+
+    VkSemaphoreTypeCreateInfo semaphoreTypeCI{};
+    semaphoreTypeCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    semaphoreTypeCI.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    semaphoreTypeCI.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreCI{};
+    semaphoreCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreCI.pNext = &semaphoreTypeCI;
+    if (vkCreateSemaphore(_vulkanDevice->_device, &semaphoreCI, nullptr, &_semaphore) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create upload semaphore!");
+    }
+}
+
+StagingRing::Region UploadQueue::Allocate(VkDeviceSize size, VkDeviceSize alignment) {
+
+    //the ranges of the open batch can only be reclaimed after it has been submitted
+    if (!_stagingRing->Fits(size, alignment)) {
+        Submit();
+    }
+    return _stagingRing->Allocate(size, alignment);
+}
+
+VkCommandBuffer UploadQueue::GetCommandBuffer() {
+
+    if (_recording == VK_NULL_HANDLE) {
+        Reclaim();
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = _commandPool;
+        allocInfo.commandBufferCount = 1;
+        vkAllocateCommandBuffers(_vulkanDevice->_device, &allocInfo, &_recording);
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(_recording, &beginInfo);
+    }
+    return _recording;
+}
+
+void UploadQueue::CopyBuffer(VkBuffer dstBuffer, const void* data, VkDeviceSize size, VkDeviceSize dstOffset) {
+
+    const char* src = static_cast<const char*>(data);
+    WriteBuffer(dstBuffer, size, [src](void* dst, VkDeviceSize offset, VkDeviceSize chunkSize) {
+        memcpy(dst, src + offset, static_cast<size_t>(chunkSize));
+    }, dstOffset);
+}
+
+void UploadQueue::ReleaseBuffer(VkBuffer buffer) {
+
+    //on a single queue the semaphore wait of the consumer is enough
+    if (!_dedicated) {
+        return;
+    }
+    for (const VkBufferMemoryBarrier& barrier : _bufferBarriers) {
+        if (barrier.buffer == buffer) {
+            return;
+        }
+    }
+
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    barrier.srcQueueFamilyIndex = _vulkanDevice->_queueFamilyIndices.transfer;
+    barrier.dstQueueFamilyIndex = _vulkanDevice->_queueFamilyIndices.graphics;
+    barrier.buffer = buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    _bufferBarriers.push_back(barrier);
+}
+
+void UploadQueue::ReleaseImage(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, const VkImageSubresourceRange& range) {
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = range;
+
+    if (!_dedicated) {
+        vkCmdPipelineBarrier(
+            GetCommandBuffer(),
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &barrier
+        );
+        return;
+    }
+
+    //the layout transition happens once, as part of the ownership transfer
+    barrier.srcQueueFamilyIndex = _vulkanDevice->_queueFamilyIndices.transfer;
+    barrier.dstQueueFamilyIndex = _vulkanDevice->_queueFamilyIndices.graphics;
+    _imageBarriers.push_back(barrier);
+}
+
+void UploadQueue::ReleaseImage(vk::Image& image, VkImageLayout newLayout, uint32_t mipLevels) {
+
+    VkImageSubresourceRange range{};
+    range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    range.baseMipLevel = 0;
+    range.levelCount = mipLevels;
+    range.baseArrayLayer = 0;
+    range.layerCount = image.layerCount;
+    ReleaseImage(image.image, image.currentLayout, newLayout, range);
+    image.currentLayout = newLayout;
+}
+
+UploadQueue::Ticket UploadQueue::Submit() {
+
+    if (_recording == VK_NULL_HANDLE) {
+        return _lastTicket;
+    }
+
+    const bool transferOwnership = !_bufferBarriers.empty() || !_imageBarriers.empty();
+    if (transferOwnership) {
+        //release half, the destination access is ignored
+        std::vector<VkBufferMemoryBarrier> bufferReleases = _bufferBarriers;
+        for (VkBufferMemoryBarrier& barrier : bufferReleases) {
+            barrier.dstAccessMask = 0;
+        }
+        std::vector<VkImageMemoryBarrier> imageReleases = _imageBarriers;
+        for (VkImageMemoryBarrier& barrier : imageReleases) {
+            barrier.dstAccessMask = 0;
+        }
+        vkCmdPipelineBarrier(
+            _recording,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0,
+            0, nullptr,
+            uint32_t(bufferReleases.size()), bufferReleases.data(),
+            uint32_t(imageReleases.size()), imageReleases.data()
+        );
+    }
+    vkEndCommandBuffer(_recording);
+
+    Batch batch;
+    batch.commandBuffer = _recording;
+
+    const uint64_t transferValue = _lastTicket + 1;
+    {
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues = &transferValue;
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &_recording;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &_semaphore;
+
+        //the fence releases the staging ranges of this batch
+        VkFence fence = _stagingRing->AcquireFence();
+        if (vkQueueSubmit(_queue, 1, &submitInfo, fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit upload command!");
+        }
+    }
+    Ticket ticket = transferValue;
+
+    if (transferOwnership) {
+        //acquire half on the graphics queue, after the transfer queue has finished
+        batch.acquireCommandBuffer = _vulkanDevice->BeginCommand();
+        std::vector<VkBufferMemoryBarrier> bufferAcquires = _bufferBarriers;
+        for (VkBufferMemoryBarrier& barrier : bufferAcquires) {
+            barrier.srcAccessMask = 0;
+        }
+        std::vector<VkImageMemoryBarrier> imageAcquires = _imageBarriers;
+        for (VkImageMemoryBarrier& barrier : imageAcquires) {
+            barrier.srcAccessMask = 0;
+        }
+        vkCmdPipelineBarrier(
+            batch.acquireCommandBuffer,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+            0,
+            0, nullptr,
+            uint32_t(bufferAcquires.size()), bufferAcquires.data(),
+            uint32_t(imageAcquires.size()), imageAcquires.data()
+        );
+        vkEndCommandBuffer(batch.acquireCommandBuffer);
+
+        ticket = transferValue + 1;
+        const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.waitSemaphoreValueCount = 1;
+        timelineInfo.pWaitSemaphoreValues = &transferValue;
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues = &ticket;
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &_semaphore;
+        submitInfo.pWaitDstStageMask = &waitStage;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &batch.acquireCommandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &_semaphore;
+        if (vkQueueSubmit(_vulkanDevice->_queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit ownership acquire command!");
+        }
+        _bufferBarriers.clear();
+        _imageBarriers.clear();
+    }
+
+    batch.ticket = ticket;
+    _inFlight.push_back(batch);
+    _recording = VK_NULL_HANDLE;
+    _lastTicket = ticket;
+    return ticket;
+}
+
+bool UploadQueue::IsComplete(Ticket ticket) {
+
+    if (ticket <= _completedTicket) {
+        return true;
+    }
+    vkGetSemaphoreCounterValue(_vulkanDevice->_device, _semaphore, &_completedTicket);
+    return ticket <= _completedTicket;
+}
+
+void UploadQueue::Wait(Ticket ticket) {
+
+    if (IsComplete(ticket)) {
+        return;
+    }
+
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &_semaphore;
+    waitInfo.pValues = &ticket;
+    vkWaitSemaphores(_vulkanDevice->_device, &waitInfo, DEFAULT_FENCE_TIMEOUT);
+    _completedTicket = std::max(_completedTicket, ticket);
+    Reclaim();
+}
+
+void UploadQueue::Reclaim() {
+
+    while (!_inFlight.empty() && IsComplete(_inFlight.front().ticket)) {
+        Batch& batch = _inFlight.front();
+        vkFreeCommandBuffers(_vulkanDevice->_device, _commandPool, 1, &batch.commandBuffer);
+        if (batch.acquireCommandBuffer != VK_NULL_HANDLE) {
+            vkFreeCommandBuffers(_vulkanDevice->_device, _vulkanDevice->_commandPool, 1, &batch.acquireCommandBuffer);
+        }
+        _inFlight.pop_front();
+    }
+    _stagingRing->Reclaim();
+}
+
+void UploadQueue::Destroy() {
+
+    if (_vulkanDevice == nullptr) {
+        return;
+    }
+    Wait(Submit());
+    vkDestroySemaphore(_vulkanDevice->_device, _semaphore, nullptr);
+    if (_dedicated) {
+        vkDestroyCommandPool(_vulkanDevice->_device, _commandPool, nullptr);
+    }
+    _semaphore = VK_NULL_HANDLE;
+    _commandPool = VK_NULL_HANDLE;
+    _vulkanDevice = nullptr;
+}
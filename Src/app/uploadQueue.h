@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "common.h"
+#include "stagingRing.h"
+
+struct VulkanDevice;
+
+/**
+* @brief    転送コマンドを1つのコマンドバッファにまとめて記録し、まとめて提出するキュー
+*           提出ごとにタイムラインセマフォの値（チケット）が進む
+*           専用の転送キューがあればそちらで実行し、グラフィックスキューへ所有権を移す
+*/
+class UploadQueue {
+
+public:
+
+    //timeline semaphore value signalled when the batch has finished
+    using Ticket = uint64_t;
+
+    UploadQueue() = default;
+
+    /**
+    * @brief    コピーコンストラクタの禁止
+    */
+    UploadQueue(const UploadQueue&) = delete;
+    UploadQueue& operator=(const UploadQueue&) = delete;
+
+    /**
+    * @brief    初期化
+    */
+    void Connect(VulkanDevice* device, StagingRing* stagingRing);
+
+    /**
+    * @brief    ステージング領域を割り当てる（リングに収まらなければ記録中のバッチを先に提出する）
+    *           GetCommandBufferより先に呼ぶこと
+    */
+    StagingRing::Region Allocate(VkDeviceSize size, VkDeviceSize alignment = StagingRing::DEFAULT_ALIGNMENT);
+
+    /**
+    * @brief    記録中のコマンドバッファを取得する（なければ記録を開始する）
+    */
+    VkCommandBuffer GetCommandBuffer();
+
+    /**
+    * @brief    バッファへのアップロードを記録する
+    */
+    void CopyBuffer(VkBuffer dstBuffer, const void* data, VkDeviceSize size, VkDeviceSize dstOffset = 0);
+
+    /**
+    * @brief    ステージング領域へ直接書き込み、バッファへのアップロードを記録する
+    *           writer(void* dst, VkDeviceSize offset, VkDeviceSize size)がチャンクごとに呼ばれる（チャンクの境界は4byte単位）
+    */
+    template<class Writer>
+    void WriteBuffer(VkBuffer dstBuffer, VkDeviceSize size, Writer&& writer, VkDeviceSize dstOffset = 0);
+
+    /**
+    * @brief    書き込んだバッファをグラフィックスキューで使えるようにする
+    */
+    void ReleaseBuffer(VkBuffer buffer);
+
+    /**
+    * @brief    書き込んだイメージのレイアウトを変更し、グラフィックスキューで使えるようにする
+    */
+    void ReleaseImage(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout, const VkImageSubresourceRange& range);
+    void ReleaseImage(vk::Image& image, VkImageLayout newLayout, uint32_t mipLevels);
+
+    /**
+    * @brief    専用の転送キューを使っているか
+    */
+    bool IsDedicated() const { return _dedicated; }
+
+    /**
+    * @brief    記録中のバッチを提出する（記録がなければ最後のチケットを返す）
+    */
+    Ticket Submit();
+
+    /**
+    * @brief    チケットの転送が完了しているか
+    */
+    bool IsComplete(Ticket ticket);
+
+    /**
+    * @brief    チケットの転送完了を待つ
+    */
+    void Wait(Ticket ticket);
+
+    /**
+    * @brief    最後に提出したチケットを取得する
+    */
+    Ticket GetLastTicket() const { return _lastTicket; }
+
+    /**
+    * @brief    タイムラインセマフォの取得（他の提出で待つため）
+    */
+    VkSemaphore GetSemaphore() const { return _semaphore; }
+
+    /**
+    * @brief    完了したコマンドバッファとステージング領域を解放する
+    */
+    void Reclaim();
+
+    /**
+    * @brief    破棄
+    */
+    void Destroy();
+
+private:
+
+    struct Batch {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        //acquires the ownership on the graphics queue
+        VkCommandBuffer acquireCommandBuffer = VK_NULL_HANDLE;
+        Ticket ticket = 0;
+    };
+
+    VulkanDevice* _vulkanDevice = nullptr;
+    StagingRing* _stagingRing = nullptr;
+    bool _dedicated = false;
+    VkQueue _queue = VK_NULL_HANDLE;
+    VkCommandPool _commandPool = VK_NULL_HANDLE;
+    VkSemaphore _semaphore = VK_NULL_HANDLE;
+    VkCommandBuffer _recording = VK_NULL_HANDLE;
+    Ticket _lastTicket = 0;
+    Ticket _completedTicket = 0;
+    std::deque<Batch> _inFlight;
+    //ownership transfers of the open batch, recorded as release on submit and as acquire on the graphics queue
+    std::vector<VkBufferMemoryBarrier> _bufferBarriers;
+    std::vector<VkImageMemoryBarrier> _imageBarriers;
+};
+
+template<class Writer>
+void UploadQueue::WriteBuffer(VkBuffer dstBuffer, VkDeviceSize size, Writer&& writer, VkDeviceSize dstOffset) {
+
+    //uploads larger than the ring are split into chunks
+    VkDeviceSize uploaded = 0;
+    while (uploaded < size) {
+        const VkDeviceSize chunkSize = std::min(size - uploaded, _stagingRing->GetSize() / 2);
+        StagingRing::Region region = Allocate(chunkSize);
+        writer(region.data, uploaded, chunkSize);
+
+        VkBufferCopy copyRegion{};
+        copyRegion.srcOffset = region.offset;
+        copyRegion.dstOffset = dstOffset + uploaded;
+        copyRegion.size = chunkSize;
+        vkCmdCopyBuffer(GetCommandBuffer(), region.buffer, dstBuffer, 1, &copyRegion);
+        ReleaseBuffer(dstBuffer);
+
+        uploaded += chunkSize;
+    }
+}
\ No newline at end of file
@@ -15,4 +15,25 @@ namespace utils
 		memcpy(&mtx.matrix[2], &mT[2], sizeof(float) * 4);
 		return mtx;
 	}
+
+	uint64_t HashBytes(const void* data, size_t size, uint64_t seed)
+	{
+		//64bit multiply-xorshift over 8 byte words, not cryptographic
+		const uint64_t prime = 0x9E3779B97F4A7C15ull;
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		uint64_t hash = seed ^ (size * prime);
+
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8) {
+			uint64_t word;
+			memcpy(&word, bytes + i, sizeof(word));
+			hash = (hash ^ word) * prime;
+			hash ^= hash >> 29;
+		}
+		uint64_t tail = 0;
+		memcpy(&tail, bytes + i, size - i);
+		hash = (hash ^ tail) * prime;
+		hash ^= hash >> 32;
+		return hash;
+	}
 }
\ No newline at end of file
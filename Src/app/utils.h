@@ -8,4 +8,6 @@ namespace utils
 	uint32_t GetAlinedSize(uint32_t value, uint32_t alignment);
 
 	VkTransformMatrixKHR ConvertFrom4x4To3x4(const glm::mat4x3& m);
+
+	uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0);
 }
\ No newline at end of file
@@ -0,0 +1,413 @@
+#include "vertexConverter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define VERTEX_CONVERTER_SSE
+#include <emmintrin.h>
+#endif
+
+namespace vertexConverter
+{
+    namespace {
+
+        //vertices converted per attribute before moving on to the next one
+        constexpr size_t BLOCK_SIZE = 512;
+
+        template<class T>
+        constexpr bool IsNormalizable() {
+            return std::is_integral<T>::value && sizeof(T) <= 2;
+        }
+
+        template<class T>
+        inline int32_t LoadComponent(const unsigned char* element, uint32_t index) {
+            T component;
+            memcpy(&component, element + index * sizeof(T), sizeof(T));
+            return static_cast<int32_t>(component);
+        }
+
+        //N source components are converted, the remaining of the D destination components are filled
+        template<class T, uint32_t N, uint32_t D>
+        void ConvertBlock(const unsigned char* src, size_t srcByteStride, bool normalized, size_t count, unsigned char* dst, size_t dstByteStride, const float* fillValue) {
+
+            const float scale = (normalized && IsNormalizable<T>()) ? 1.0f / static_cast<float>(std::numeric_limits<T>::max()) : 1.0f;
+            const bool clampSigned = normalized && IsNormalizable<T>() && std::is_signed<T>::value;
+
+            for (size_t v = 0; v < count; v++) {
+                const unsigned char* element = src + v * srcByteStride;
+                float out[4];
+
+                if (std::is_same<T, float>::value) {
+                    memcpy(out, element, sizeof(float) * N);
+                }
+                else {
+#ifdef VERTEX_CONVERTER_SSE
+                    if (IsNormalizable<T>()) {
+                        //convert and scale all components in one register
+                        __m128i value = _mm_setr_epi32(
+                            LoadComponent<T>(element, 0),
+                            N > 1 ? LoadComponent<T>(element, 1) : 0,
+                            N > 2 ? LoadComponent<T>(element, 2) : 0,
+                            N > 3 ? LoadComponent<T>(element, 3) : 0);
+                        __m128 result = _mm_mul_ps(_mm_cvtepi32_ps(value), _mm_set1_ps(scale));
+                        if (clampSigned) {
+                            result = _mm_max_ps(result, _mm_set1_ps(-1.0f));
+                        }
+                        _mm_storeu_ps(out, result);
+                    }
+                    else
+#endif
+                    {
+                        for (uint32_t c = 0; c < N; c++) {
+                            T component;
+                            memcpy(&component, element + c * sizeof(T), sizeof(T));
+                            out[c] = clampSigned ? std::max(static_cast<float>(component) * scale, -1.0f) : static_cast<float>(component) * scale;
+                        }
+                    }
+                }
+                for (uint32_t c = N; c < D; c++) {
+                    out[c] = fillValue[c];
+                }
+                memcpy(dst + v * dstByteStride, out, sizeof(float) * D);
+            }
+        }
+
+        using ConvertFunction = void(*)(const unsigned char*, size_t, bool, size_t, unsigned char*, size_t, const float*);
+
+        template<class T, uint32_t N>
+        ConvertFunction SelectDst(uint32_t dstComponentCount) {
+            switch (dstComponentCount) {
+            case 1: return &ConvertBlock<T, std::min(N, 1u), 1>;
+            case 2: return &ConvertBlock<T, std::min(N, 2u), 2>;
+            case 3: return &ConvertBlock<T, std::min(N, 3u), 3>;
+            case 4: return &ConvertBlock<T, N, 4>;
+            }
+            return nullptr;
+        }
+
+        template<class T>
+        ConvertFunction SelectSrc(uint32_t componentCount, uint32_t dstComponentCount) {
+            switch (componentCount) {
+            case 1: return SelectDst<T, 1>(dstComponentCount);
+            case 2: return SelectDst<T, 2>(dstComponentCount);
+            case 3: return SelectDst<T, 3>(dstComponentCount);
+            case 4: return SelectDst<T, 4>(dstComponentCount);
+            }
+            return nullptr;
+        }
+
+        ConvertFunction Select(const AttributeStream& src, uint32_t dstComponentCount) {
+            ConvertFunction function = nullptr;
+            switch (src.componentType) {
+            case ComponentType::Byte:
+                function = SelectSrc<int8_t>(src.componentCount, dstComponentCount);
+                break;
+            case ComponentType::UnsignedByte:
+                function = SelectSrc<uint8_t>(src.componentCount, dstComponentCount);
+                break;
+            case ComponentType::Short:
+                function = SelectSrc<int16_t>(src.componentCount, dstComponentCount);
+                break;
+            case ComponentType::UnsignedShort:
+                function = SelectSrc<uint16_t>(src.componentCount, dstComponentCount);
+                break;
+            case ComponentType::UnsignedInt:
+                function = SelectSrc<uint32_t>(src.componentCount, dstComponentCount);
+                break;
+            case ComponentType::Float:
+                function = SelectSrc<float>(src.componentCount, dstComponentCount);
+                break;
+            }
+            if (function == nullptr) {
+                throw std::runtime_error("unsupported vertex attribute format!");
+            }
+            return function;
+        }
+
+        void Fill(unsigned char* dst, size_t dstByteStride, size_t count, const float* value, uint32_t componentCount) {
+            for (size_t v = 0; v < count; v++) {
+                memcpy(dst + v * dstByteStride, value, sizeof(float) * componentCount);
+            }
+        }
+    }
+
+    void Convert(const AttributeStream& src, size_t count, float* dst, size_t dstByteStride, uint32_t dstComponentCount, const float* fillValue) {
+
+        const float defaultFill[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        ConvertFunction function = Select(src, dstComponentCount);
+        function(src.data, src.byteStride, src.normalized, count, reinterpret_cast<unsigned char*>(dst), dstByteStride, fillValue ? fillValue : defaultFill);
+    }
+
+    void NormalizeVec3(float* dst, size_t dstByteStride, size_t count) {
+
+        unsigned char* dstBytes = reinterpret_cast<unsigned char*>(dst);
+        size_t v = 0;
+
+#ifdef VERTEX_CONVERTER_SSE
+        //4 vectors per iteration in SoA form
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        for (; v + 4 <= count; v += 4) {
+            float* p[4];
+            for (int i = 0; i < 4; i++) {
+                p[i] = reinterpret_cast<float*>(dstBytes + (v + i) * dstByteStride);
+            }
+
+            __m128 x = _mm_setr_ps(p[0][0], p[1][0], p[2][0], p[3][0]);
+            __m128 y = _mm_setr_ps(p[0][1], p[1][1], p[2][1], p[3][1]);
+            __m128 z = _mm_setr_ps(p[0][2], p[1][2], p[2][2], p[3][2]);
+
+            __m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+            __m128 valid = _mm_cmpgt_ps(lengthSq, zero);
+            __m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_or_ps(_mm_and_ps(valid, lengthSq), _mm_andnot_ps(valid, one))));
+
+            float out[3][4];
+            _mm_storeu_ps(out[0], _mm_mul_ps(x, invLength));
+            _mm_storeu_ps(out[1], _mm_mul_ps(y, invLength));
+            _mm_storeu_ps(out[2], _mm_mul_ps(z, invLength));
+            for (int i = 0; i < 4; i++) {
+                p[i][0] = out[0][i];
+                p[i][1] = out[1][i];
+                p[i][2] = out[2][i];
+            }
+        }
+#endif
+
+        for (; v < count; v++) {
+            float* p = reinterpret_cast<float*>(dstBytes + v * dstByteStride);
+            float lengthSq = p[0] * p[0] + p[1] * p[1] + p[2] * p[2];
+            if (lengthSq > 0.0f) {
+                float invLength = 1.0f / std::sqrt(lengthSq);
+                p[0] *= invLength;
+                p[1] *= invLength;
+                p[2] *= invLength;
+            }
+        }
+    }
+
+    void ConvertVertices(const AttributeBinding* bindings, uint32_t bindingCount, size_t count, void* dst, size_t dstByteStride) {
+
+        std::vector<ConvertFunction> functions(bindingCount, nullptr);
+        for (uint32_t i = 0; i < bindingCount; i++) {
+            if (bindings[i].stream.data) {
+                functions[i] = Select(bindings[i].stream, bindings[i].dstComponentCount);
+            }
+        }
+
+        unsigned char* dstBytes = static_cast<unsigned char*>(dst);
+        for (size_t first = 0; first < count; first += BLOCK_SIZE) {
+            const size_t blockCount = std::min(BLOCK_SIZE, count - first);
+            unsigned char* block = dstBytes + first * dstByteStride;
+
+            for (uint32_t i = 0; i < bindingCount; i++) {
+                const AttributeBinding& binding = bindings[i];
+                unsigned char* blockDst = block + binding.dstOffset;
+                if (functions[i]) {
+                    const AttributeStream& stream = binding.stream;
+                    functions[i](stream.data + first * stream.byteStride, stream.byteStride, stream.normalized, blockCount, blockDst, dstByteStride, binding.fillValue);
+                    if (binding.normalizeVec3) {
+                        NormalizeVec3(reinterpret_cast<float*>(blockDst), dstByteStride, blockCount);
+                    }
+                }
+                else {
+                    Fill(blockDst, dstByteStride, blockCount, binding.fillValue, binding.dstComponentCount);
+                }
+            }
+        }
+    }
+
+    void ConvertIndices(const unsigned char* src, int componentType, size_t count, uint32_t baseVertex, uint32_t* dst) {
+
+        size_t i = 0;
+#ifdef VERTEX_CONVERTER_SSE
+        const __m128i base = _mm_set1_epi32(static_cast<int>(baseVertex));
+        const __m128i zero = _mm_setzero_si128();
+#endif
+
+        switch (componentType) {
+        case ComponentType::UnsignedInt:
+#ifdef VERTEX_CONVERTER_SSE
+            for (; i + 4 <= count; i += 4) {
+                __m128i index = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * sizeof(uint32_t)));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_add_epi32(index, base));
+            }
+#endif
+            for (; i < count; i++) {
+                uint32_t index;
+                memcpy(&index, src + i * sizeof(uint32_t), sizeof(uint32_t));
+                dst[i] = index + baseVertex;
+            }
+            break;
+        case ComponentType::UnsignedShort:
+#ifdef VERTEX_CONVERTER_SSE
+            for (; i + 8 <= count; i += 8) {
+                __m128i index = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * sizeof(uint16_t)));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_add_epi32(_mm_unpacklo_epi16(index, zero), base));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4), _mm_add_epi32(_mm_unpackhi_epi16(index, zero), base));
+            }
+#endif
+            for (; i < count; i++) {
+                uint16_t index;
+                memcpy(&index, src + i * sizeof(uint16_t), sizeof(uint16_t));
+                dst[i] = index + baseVertex;
+            }
+            break;
+        case ComponentType::UnsignedByte:
+#ifdef VERTEX_CONVERTER_SSE
+            for (; i + 8 <= count; i += 8) {
+                __m128i index = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i)), zero);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_add_epi32(_mm_unpacklo_epi16(index, zero), base));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4), _mm_add_epi32(_mm_unpackhi_epi16(index, zero), base));
+            }
+#endif
+            for (; i < count; i++) {
+                dst[i] = src[i] + baseVertex;
+            }
+            break;
+        default:
+            throw std::runtime_error("unsupported index component type!");
+        }
+    }
+
+    void NarrowIndices(const uint32_t* src, size_t count, uint32_t baseVertex, uint16_t* dst) {
+
+        size_t i = 0;
+#ifdef VERTEX_CONVERTER_SSE
+        //sign-extend the low 16 bits so that the signed saturating pack keeps them unchanged
+        const __m128i base = _mm_set1_epi32(static_cast<int>(baseVertex));
+        for (; i + 8 <= count; i += 8) {
+            __m128i low = _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), base);
+            __m128i high = _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 4)), base);
+            low = _mm_srai_epi32(_mm_slli_epi32(low, 16), 16);
+            high = _mm_srai_epi32(_mm_slli_epi32(high, 16), 16);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packs_epi32(low, high));
+        }
+#endif
+        for (; i < count; i++) {
+            dst[i] = static_cast<uint16_t>(src[i] - baseVertex);
+        }
+    }
+
+    namespace {
+
+        inline int16_t ToSnorm16(float value) {
+            return static_cast<int16_t>(std::lround(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f));
+        }
+
+        inline uint8_t ToUnorm8(float value) {
+            return static_cast<uint8_t>(std::lround(std::min(std::max(value, 0.0f), 1.0f) * 255.0f));
+        }
+
+        //round to nearest even, out of range values become infinity
+        uint16_t ToHalf(float value) {
+            uint32_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            const uint32_t sign = (bits >> 16) & 0x8000;
+            const uint32_t absBits = bits & 0x7FFFFFFF;
+            if (absBits >= 0x47800000) {
+                return static_cast<uint16_t>(sign | (absBits > 0x7F800000 ? 0x7E00 : 0x7C00));
+            }
+            if (absBits < 0x38800000) {
+                //subnormal, in units of 2^-24
+                return static_cast<uint16_t>(sign | static_cast<uint32_t>(std::nearbyint(std::fabs(value) * 16777216.0f)));
+            }
+            const uint32_t rounded = absBits + 0x0FFF + ((absBits >> 13) & 1);
+            return static_cast<uint16_t>(sign | ((rounded - 0x38000000) >> 13));
+        }
+
+        //octahedral encoding, a zero vector decodes to +Z
+        void OctEncode(const float* normal, int16_t* dst) {
+            float x = normal[0];
+            float y = normal[1];
+            const float z = normal[2];
+            const float length = std::fabs(x) + std::fabs(y) + std::fabs(z);
+            if (length == 0.0f) {
+                dst[0] = 0;
+                dst[1] = 0;
+                return;
+            }
+            x /= length;
+            y /= length;
+            if (z < 0.0f) {
+                const float foldedX = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+                const float foldedY = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+                x = foldedX;
+                y = foldedY;
+            }
+            dst[0] = ToSnorm16(x);
+            dst[1] = ToSnorm16(y);
+        }
+    }
+
+    PositionQuantization ComputePositionQuantization(const void* positions, size_t count, size_t byteStride) {
+
+        PositionQuantization quantization;
+        if (count == 0) {
+            return quantization;
+        }
+
+        float minimum[3];
+        float maximum[3];
+        memcpy(minimum, positions, sizeof(minimum));
+        memcpy(maximum, positions, sizeof(maximum));
+        const unsigned char* src = static_cast<const unsigned char*>(positions);
+        for (size_t i = 1; i < count; i++) {
+            float pos[3];
+            memcpy(pos, src + i * byteStride, sizeof(pos));
+            for (uint32_t c = 0; c < 3; c++) {
+                minimum[c] = std::min(minimum[c], pos[c]);
+                maximum[c] = std::max(maximum[c], pos[c]);
+            }
+        }
+
+        //the box is mapped to [-1, 1], flat axes keep a unit scale
+        for (uint32_t c = 0; c < 3; c++) {
+            const float halfExtent = 0.5f * (maximum[c] - minimum[c]);
+            quantization.offset[c] = 0.5f * (maximum[c] + minimum[c]);
+            quantization.scale[c] = halfExtent > 0.0f ? halfExtent : 1.0f;
+        }
+        return quantization;
+    }
+
+    void QuantizeVertices(const void* src, size_t count, size_t srcByteStride, const PositionQuantization& quantization, QuantizedVertex* dst) {
+
+        const float invScale[3] = { 1.0f / quantization.scale[0], 1.0f / quantization.scale[1], 1.0f / quantization.scale[2] };
+        const unsigned char* vertices = static_cast<const unsigned char*>(src);
+
+        for (size_t i = 0; i < count; i++) {
+            //pos(3), normal(3), uv(2), color(4)
+            float vertex[12];
+            memcpy(vertex, vertices + i * srcByteStride, sizeof(vertex));
+
+            QuantizedVertex& quantized = dst[i];
+            for (uint32_t c = 0; c < 3; c++) {
+                quantized.pos[c] = ToSnorm16((vertex[c] - quantization.offset[c]) * invScale[c]);
+            }
+            quantized.pos[3] = 0;
+            OctEncode(vertex + 3, quantized.normal);
+            quantized.uv[0] = ToHalf(vertex[6]);
+            quantized.uv[1] = ToHalf(vertex[7]);
+            for (uint32_t c = 0; c < 4; c++) {
+                quantized.color[c] = ToUnorm8(vertex[8 + c]);
+            }
+        }
+    }
+
+    void SplitVertices(const void* src, size_t count, size_t srcByteStride, size_t positionSize, void* positions, void* attributes) {
+
+        const size_t attributeSize = srcByteStride - positionSize;
+        const unsigned char* vertices = static_cast<const unsigned char*>(src);
+        unsigned char* positionDst = static_cast<unsigned char*>(positions);
+        unsigned char* attributeDst = static_cast<unsigned char*>(attributes);
+        for (size_t i = 0; i < count; i++) {
+            memcpy(positionDst + i * positionSize, vertices + i * srcByteStride, positionSize);
+            memcpy(attributeDst + i * attributeSize, vertices + i * srcByteStride + positionSize, attributeSize);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vertexConverter
+{
+    /**
+    * @brief    glTFのコンポーネントタイプ
+    */
+    enum ComponentType {
+        Byte = 5120,
+        UnsignedByte = 5121,
+        Short = 5122,
+        UnsignedShort = 5123,
+        UnsignedInt = 5125,
+        Float = 5126
+    };
+
+    /**
+    * @brief    ストライド付きの入力アトリビュート
+    */
+    struct AttributeStream {
+        const unsigned char* data = nullptr;
+        size_t byteStride = 0;
+        int componentType = ComponentType::Float;
+        uint32_t componentCount = 0;
+        bool normalized = false;
+    };
+
+    /**
+    * @brief    出力頂点への書き込み先（dataがnullのときはfillValueで埋める）
+    */
+    struct AttributeBinding {
+        AttributeStream stream;
+        size_t dstOffset = 0;
+        uint32_t dstComponentCount = 0;
+        float fillValue[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        bool normalizeVec3 = false;
+    };
+
+    /**
+    * @brief    量子化された頂点（20byte）
+    * @note     pos : snorm16（wは未使用）, normal : 八面体エンコードのsnorm16, uv : half, color : unorm8
+    */
+    struct QuantizedVertex {
+        int16_t pos[4];
+        int16_t normal[2];
+        uint16_t uv[2];
+        uint8_t color[4];
+    };
+
+    /**
+    * @brief    量子化した座標の復元パラメータ（pos = snorm * scale + offset）
+    */
+    struct PositionQuantization {
+        float scale[3] = { 1.0f, 1.0f, 1.0f };
+        float offset[3] = { 0.0f, 0.0f, 0.0f };
+    };
+
+    /**
+    * @brief    アトリビュートをfloatに変換して書き込む（足りない成分はfillValueで埋める）
+    */
+    void Convert(const AttributeStream& src, size_t count, float* dst, size_t dstByteStride, uint32_t dstComponentCount, const float* fillValue = nullptr);
+
+    /**
+    * @brief    3成分ベクトルを正規化する（長さ0のベクトルはそのまま）
+    */
+    void NormalizeVec3(float* dst, size_t dstByteStride, size_t count);
+
+    /**
+    * @brief    インターリーブされた頂点を一度に組み立てる（キャッシュに収まるブロック単位で変換する）
+    */
+    void ConvertVertices(const AttributeBinding* bindings, uint32_t bindingCount, size_t count, void* dst, size_t dstByteStride);
+
+    /**
+    * @brief    インデックスを32bitに変換してbaseVertexを足す
+    */
+    void ConvertIndices(const unsigned char* src, int componentType, size_t count, uint32_t baseVertex, uint32_t* dst);
+
+    /**
+    * @brief    32bitインデックスからbaseVertexを引いて16bitに詰める（引いた値がすべて65536未満であること）
+    */
+    void NarrowIndices(const uint32_t* src, size_t count, uint32_t baseVertex, uint16_t* dst);
+
+    /**
+    * @brief    座標のバウンディングボックスから量子化パラメータを求める
+    */
+    PositionQuantization ComputePositionQuantization(const void* positions, size_t count, size_t byteStride);
+
+    /**
+    * @brief    float頂点（pos, normal, uv, colorの順に48byte）を量子化する
+    */
+    void QuantizeVertices(const void* src, size_t count, size_t srcByteStride, const PositionQuantization& quantization, QuantizedVertex* dst);
+
+    /**
+    * @brief    インターリーブされた頂点を先頭positionSizeバイトの座標と残りのアトリビュートに分ける
+    */
+    void SplitVertices(const void* src, size_t count, size_t srcByteStride, size_t positionSize, void* positions, void* attributes);
+}
\ No newline at end of file
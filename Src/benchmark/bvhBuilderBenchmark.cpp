@@ -0,0 +1,165 @@
+/*
+* bvhBuilderのビルド速度とBVHの品質を計測するベンチマーク
+*
+* Vulkan/GPUに依存しないので、以下のように単体でビルドして実行できる
+*   cl /O2 /EHsc /std:c++17 /I..\app bvhBuilderBenchmark.cpp ..\app\bvhBuilder.cpp
+*   g++ -O2 -std=c++17 -pthread -I../app bvhBuilderBenchmark.cpp ../app/bvhBuilder.cpp
+*
+* 引数: [三角形数(既定 1000000)] [スレッド数(既定 ハードウェアスレッド数)] [繰り返し回数(既定 3)]
+*/
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "bvhBuilder.h"
+#include "threadPool.h"
+
+namespace {
+
+    //a displaced sphere for the large coherent surfaces and scattered small triangles for clutter
+    void CreateScene(size_t triangleCount, std::vector<float>& vertices, std::vector<uint32_t>& indices) {
+
+        const size_t clutterCount = triangleCount / 8;
+        const uint32_t rings = std::max<uint32_t>(2, static_cast<uint32_t>(std::sqrt((triangleCount - clutterCount) / 4.0)));
+        const uint32_t segments = 2 * rings;
+        const float pi = 3.14159265f;
+
+        for (uint32_t r = 0; r <= rings; r++) {
+            const float theta = pi * r / rings;
+            for (uint32_t s = 0; s <= segments; s++) {
+                const float phi = 2.0f * pi * s / segments;
+                const float radius = 10.0f + 0.5f * std::sin(7.0f * theta) * std::cos(5.0f * phi);
+                vertices.push_back(radius * std::sin(theta) * std::cos(phi));
+                vertices.push_back(radius * std::cos(theta));
+                vertices.push_back(radius * std::sin(theta) * std::sin(phi));
+            }
+        }
+        for (uint32_t r = 0; r < rings; r++) {
+            for (uint32_t s = 0; s < segments; s++) {
+                const uint32_t i0 = r * (segments + 1) + s;
+                const uint32_t i1 = i0 + segments + 1;
+                indices.insert(indices.end(), { i0, i1, i0 + 1, i0 + 1, i1, i1 + 1 });
+            }
+        }
+
+        std::mt19937 random(1234);
+        std::uniform_real_distribution<float> position(-30.0f, 30.0f);
+        std::uniform_real_distribution<float> offset(-0.2f, 0.2f);
+        while (indices.size() / 3 < triangleCount) {
+            const float center[3] = { position(random), position(random), position(random) };
+            const uint32_t first = static_cast<uint32_t>(vertices.size() / 3);
+            for (int v = 0; v < 3; v++) {
+                for (int c = 0; c < 3; c++) {
+                    vertices.push_back(center[c] + offset(random));
+                }
+            }
+            indices.insert(indices.end(), { first, first + 1, first + 2 });
+        }
+    }
+
+    //every triangle is in exactly one leaf and every node contains what is below it
+    bool Validate(const bvhBuilder::Bvh& bvh, const std::vector<float>& positions) {
+
+        const size_t triangleCount = positions.size() / 9;
+        std::vector<uint32_t> referenced(triangleCount, 0);
+        auto contains = [](const bvhBuilder::Node& outer, const float* min, const float* max) {
+            for (int c = 0; c < 3; c++) {
+                if (min[c] < outer.min[c] || max[c] > outer.max[c]) {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        std::vector<uint32_t> stack = { 0 };
+        while (!stack.empty()) {
+            const bvhBuilder::Node& node = bvh.nodes[stack.back()];
+            stack.pop_back();
+            if (node.IsLeaf()) {
+                for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+                    const uint32_t triangle = bvh.primitiveIndices[i];
+                    referenced[triangle]++;
+                    for (int v = 0; v < 3; v++) {
+                        const float* p = &positions[9 * triangle + 3 * v];
+                        if (!contains(node, p, p)) {
+                            return false;
+                        }
+                    }
+                }
+                continue;
+            }
+            for (uint32_t child = node.leftFirst; child < node.leftFirst + 2; child++) {
+                if (child >= bvh.nodes.size() || !contains(node, bvh.nodes[child].min, bvh.nodes[child].max)) {
+                    return false;
+                }
+                stack.push_back(child);
+            }
+        }
+        return std::all_of(referenced.begin(), referenced.end(), [](uint32_t count) { return count == 1; });
+    }
+
+    template<class F>
+    bvhBuilder::Bvh Measure(uint32_t repeat, F&& func) {
+        bvhBuilder::Bvh best;
+        for (uint32_t i = 0; i < repeat; i++) {
+            bvhBuilder::Bvh bvh = func();
+            if (i == 0 || bvh.stats.buildTime < best.stats.buildTime) {
+                best = std::move(bvh);
+            }
+        }
+        return best;
+    }
+
+    void Print(const char* name, const bvhBuilder::Bvh& bvh, size_t triangleCount) {
+        std::cout << name << ": " << bvh.stats.buildTime << " ms (" << triangleCount / bvh.stats.buildTime / 1e3 << " Mtriangles/s)"
+            << ", SAH " << bvh.stats.sahCost
+            << ", nodes " << bvh.stats.nodeCount
+            << ", leaves " << bvh.stats.leafCount
+            << ", depth " << bvh.stats.maxDepth
+            << ", leaf size " << bvh.stats.averageLeafSize << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+
+    const size_t triangleCount = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    const uint32_t threadCount = argc > 2 ? static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10)) : 0;
+    const uint32_t repeat = std::max(1u, argc > 3 ? static_cast<uint32_t>(std::strtoul(argv[3], nullptr, 10)) : 3u);
+
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+    CreateScene(triangleCount, vertices, indices);
+
+    bvhBuilder::TriangleInput input;
+    input.vertices = vertices.data();
+    input.vertexStride = 3 * sizeof(float);
+    input.indices = indices.data();
+    input.indexCount = indices.size();
+
+    std::vector<float> positions;
+    bvhBuilder::GatherTriangles(&input, 1, positions);
+
+    ThreadPool threadPool(threadCount);
+    bvhBuilder::BuildSettings settings;
+    bvhBuilder::Bvh serial = Measure(repeat, [&]() { return bvhBuilder::BuildTriangles(&input, 1, settings); });
+    bvhBuilder::Bvh parallel = Measure(repeat, [&]() { return bvhBuilder::BuildTriangles(&input, 1, settings, &threadPool); });
+
+    std::cout << "triangles : " << indices.size() / 3 << std::endl;
+    std::cout << "threads   : " << threadPool.GetThreadCount() << std::endl;
+    Print("serial    ", serial, indices.size() / 3);
+    Print("parallel  ", parallel, indices.size() / 3);
+    std::cout << "speedup   : " << serial.stats.buildTime / parallel.stats.buildTime << std::endl;
+
+    //the parallel build makes the same splits, only the node order differs
+    const bool valid = Validate(serial, positions) && Validate(parallel, positions);
+    const bool same = serial.stats.nodeCount == parallel.stats.nodeCount &&
+        std::fabs(serial.stats.sahCost - parallel.stats.sahCost) <= 1e-4 * serial.stats.sahCost;
+    std::cout << "valid     : " << (valid ? "yes" : "no") << std::endl;
+    std::cout << "identical : " << (same ? "yes" : "no") << std::endl;
+
+    return valid && same ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,298 @@
+/*
+* cpuRayTracerで基準画像を描画し、スレッド数ごとのレイの処理速度を計測するベンチマーク
+*
+* Vulkan/GPUに依存しないので、以下のように単体でビルドして実行できる
+*   cl /O2 /EHsc /std:c++17 /I..\app /I..\..\Externals cpuRayTracerBenchmark.cpp ..\app\cpuRayTracer.cpp ..\app\bvhBuilder.cpp ..\app\vertexConverter.cpp
+*   g++ -O2 -std=c++17 -pthread -I../app -I../../Externals cpuRayTracerBenchmark.cpp ../app/cpuRayTracer.cpp ../app/bvhBuilder.cpp ../app/vertexConverter.cpp
+*
+* 引数: [幅(既定 1280)] [高さ(既定 720)] [最大スレッド数(既定 ハードウェアスレッド数)] [光源 directional|point(既定 directional)]
+*       [出力ファイル(既定 cpuRayTracer.bmp)] [モデルの三角形数(既定 200000)]
+*/
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "camera.h"
+#include "cpuRayTracer.h"
+#include "threadPool.h"
+#include "vertexConverter.h"
+
+namespace {
+
+    //same layout as glTF::Vertex and PrimitiveMesh::Vertex
+    struct Vertex {
+        float pos[3];
+        float normal[3];
+        float uv[2];
+        float color[4];
+    };
+
+    //streams of a mesh, cpuRayTracer::Mesh points into them
+    struct MeshStorage {
+        std::vector<unsigned char> positions;
+        std::vector<unsigned char> attributes;
+        std::vector<unsigned char> indices;
+    };
+
+    void AddVertex(std::vector<Vertex>& vertices, float x, float y, float z, float nx, float ny, float nz, float u, float v) {
+        vertices.push_back({ { x, y, z }, { nx, ny, nz }, { u, v }, { 1.0f, 1.0f, 1.0f, 1.0f } });
+    }
+
+    //PrimitiveMesh::GetSphere
+    void CreateSphere(uint32_t slices, uint32_t stacks, float radius, float displacement, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+        const float pi = 3.14159265f;
+        for (uint32_t stack = 0; stack <= stacks; stack++) {
+            for (uint32_t slice = 0; slice <= slices; slice++) {
+                const float y = 2.0f * stack / stacks - 1.0f;
+                const float r = std::sqrt(std::max(0.0f, 1.0f - y * y));
+                const float theta = 2.0f * pi * slice / slices;
+                const float nx = r * std::sin(theta);
+                const float nz = r * std::cos(theta);
+                const float scale = radius * (1.0f + displacement * std::sin(9.0f * theta) * std::cos(7.0f * y));
+                AddVertex(vertices, nx * scale, y * scale, nz * scale, nx, y, nz, float(slice) / slices, 1.0f - float(stack) / stacks);
+            }
+        }
+        for (uint32_t stack = 0; stack < stacks; stack++) {
+            for (uint32_t slice = 0; slice < slices; slice++) {
+                const uint32_t i0 = stack * (slices + 1) + slice;
+                const uint32_t i1 = i0 + 1;
+                const uint32_t i2 = i0 + slices + 1;
+                const uint32_t i3 = i1 + slices + 1;
+                indices.insert(indices.end(), { i0, i1, i2, i2, i1, i3 });
+            }
+        }
+    }
+
+    //float positions and attributes in separate streams like the primitive meshes of AppBase
+    cpuRayTracer::Mesh CreateFloatMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, MeshStorage& storage) {
+        const size_t positionSize = sizeof(Vertex::pos);
+        storage.positions.resize(vertices.size() * positionSize);
+        storage.attributes.resize(vertices.size() * (sizeof(Vertex) - positionSize));
+        vertexConverter::SplitVertices(vertices.data(), vertices.size(), sizeof(Vertex), positionSize, storage.positions.data(), storage.attributes.data());
+        storage.indices.resize(indices.size() * sizeof(uint32_t));
+        memcpy(storage.indices.data(), indices.data(), storage.indices.size());
+
+        cpuRayTracer::Mesh mesh;
+        mesh.vertices = storage.positions.data();
+        mesh.positionStride = uint32_t(positionSize);
+        mesh.attributes = storage.attributes.data();
+        mesh.attributeStride = uint32_t(sizeof(Vertex) - positionSize);
+        mesh.indices = storage.indices.data();
+        mesh.geometries.push_back({ 0, uint32_t(indices.size()), cpuRayTracer::OBJECT_MATERIAL });
+        return mesh;
+    }
+
+    //quantized split streams and 16bit indices like a glTF model loaded with QuantizeVertices | SplitPositionStream
+    cpuRayTracer::Mesh CreateQuantizedMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, MeshStorage& storage) {
+        const vertexConverter::PositionQuantization quantization = vertexConverter::ComputePositionQuantization(vertices.data(), vertices.size(), sizeof(Vertex));
+        std::vector<vertexConverter::QuantizedVertex> quantized(vertices.size());
+        vertexConverter::QuantizeVertices(vertices.data(), vertices.size(), sizeof(Vertex), quantization, quantized.data());
+
+        const size_t positionSize = sizeof(vertexConverter::QuantizedVertex::pos);
+        const size_t attributeSize = sizeof(vertexConverter::QuantizedVertex) - positionSize;
+        storage.positions.resize(vertices.size() * positionSize);
+        storage.attributes.resize(vertices.size() * attributeSize);
+        vertexConverter::SplitVertices(quantized.data(), quantized.size(), sizeof(vertexConverter::QuantizedVertex), positionSize, storage.positions.data(), storage.attributes.data());
+
+        const bool shortIndices = vertices.size() < 65536;
+        if (shortIndices) {
+            storage.indices.resize(indices.size() * sizeof(uint16_t));
+            vertexConverter::NarrowIndices(indices.data(), indices.size(), 0, reinterpret_cast<uint16_t*>(storage.indices.data()));
+        }
+        else {
+            storage.indices.resize(indices.size() * sizeof(uint32_t));
+            memcpy(storage.indices.data(), indices.data(), storage.indices.size());
+        }
+
+        cpuRayTracer::Mesh mesh;
+        mesh.vertices = storage.positions.data();
+        mesh.positionStride = uint32_t(positionSize);
+        mesh.quantized = true;
+        mesh.positionScale = glm::vec3(quantization.scale[0], quantization.scale[1], quantization.scale[2]);
+        mesh.positionOffset = glm::vec3(quantization.offset[0], quantization.offset[1], quantization.offset[2]);
+        mesh.attributes = storage.attributes.data();
+        mesh.attributeStride = uint32_t(attributeSize);
+        mesh.indices = storage.indices.data();
+
+        //two primitives, the first with a glTF material and the second with the material of the object
+        const uint32_t half = uint32_t(indices.size() / 6 * 3);
+        mesh.geometries.push_back({ 0, half, 0, 0, shortIndices });
+        mesh.geometries.push_back({ half, uint32_t(indices.size()) - half, cpuRayTracer::OBJECT_MATERIAL, 0, shortIndices });
+        return mesh;
+    }
+
+    cpuRayTracer::Image CreateCheckerTexture(uint32_t size) {
+        cpuRayTracer::Image image;
+        image.width = size;
+        image.height = size;
+        image.srgb = true;
+        image.pixels.resize(size_t(size) * size * 4);
+        for (uint32_t y = 0; y < size; y++) {
+            for (uint32_t x = 0; x < size; x++) {
+                const bool dark = ((x / (size / 8)) + (y / (size / 8))) & 1;
+                uint8_t* texel = &image.pixels[(size_t(y) * size + x) * 4];
+                texel[0] = dark ? 60 : 220;
+                texel[1] = dark ? 70 : 210;
+                texel[2] = dark ? 90 : 190;
+                texel[3] = 255;
+            }
+        }
+        return image;
+    }
+
+    //a sky gradient on the faces of the cube map
+    void CreateSky(uint32_t size, cpuRayTracer::Image faces[6]) {
+        for (int face = 0; face < 6; face++) {
+            cpuRayTracer::Image& image = faces[face];
+            image.width = size;
+            image.height = size;
+            image.pixels.resize(size_t(size) * size * 4);
+            for (uint32_t y = 0; y < size; y++) {
+                for (uint32_t x = 0; x < size; x++) {
+                    //inverse of the face selection, tc runs downwards on the side faces
+                    const float sc = 2.0f * (x + 0.5f) / size - 1.0f;
+                    const float tc = 2.0f * (y + 0.5f) / size - 1.0f;
+                    const glm::vec3 directions[6] = {
+                        { 1.0f, -tc, -sc }, { -1.0f, -tc, sc },
+                        { sc, 1.0f, tc }, { sc, -1.0f, -tc },
+                        { sc, -tc, 1.0f }, { -sc, -tc, -1.0f }
+                    };
+                    const float height = glm::normalize(directions[face]).y;
+                    const glm::vec3 color = height > 0.0f
+                        ? glm::mix(glm::vec3(0.85f, 0.9f, 1.0f), glm::vec3(0.25f, 0.45f, 0.85f), height)
+                        : glm::mix(glm::vec3(0.85f, 0.9f, 1.0f), glm::vec3(0.3f, 0.28f, 0.25f), -height);
+                    uint8_t* texel = &image.pixels[(size_t(y) * size + x) * 4];
+                    for (int c = 0; c < 3; c++) {
+                        texel[c] = uint8_t(color[c] * 255.0f + 0.5f);
+                    }
+                    texel[3] = 255;
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+
+    const uint32_t width = argc > 1 ? uint32_t(std::strtoul(argv[1], nullptr, 10)) : 1280;
+    const uint32_t height = argc > 2 ? uint32_t(std::strtoul(argv[2], nullptr, 10)) : 720;
+    const uint32_t maxThreadCount = argc > 3 && std::strtoul(argv[3], nullptr, 10) > 0 ? uint32_t(std::strtoul(argv[3], nullptr, 10)) : std::max(1u, std::thread::hardware_concurrency());
+    const bool pointLight = argc > 4 && std::string(argv[4]) == "point";
+    const std::string output = argc > 5 ? argv[5] : "cpuRayTracer.bmp";
+    const uint32_t modelTriangles = argc > 6 ? uint32_t(std::strtoul(argv[6], nullptr, 10)) : 200000;
+    if (width == 0 || height == 0) {
+        std::cerr << "invalid image size" << std::endl;
+        return 1;
+    }
+
+    //the scene of AppBase::CreateSceneObject with a generated mesh in place of the glTF model
+    cpuRayTracer::Scene scene;
+    std::vector<MeshStorage> storage(3);
+    {
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+        const uint32_t stacks = std::max(4u, uint32_t(std::sqrt(modelTriangles / 4.0)));
+        CreateSphere(2 * stacks, stacks, 2.0f, 0.08f, vertices, indices);
+        scene.meshes.push_back(CreateQuantizedMesh(vertices, indices, storage[0]));
+    }
+    {
+        std::vector<Vertex> vertices;
+        AddVertex(vertices, -10.0f, -1.0f, -10.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f);
+        AddVertex(vertices, -10.0f, -1.0f, 10.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f);
+        AddVertex(vertices, 10.0f, -1.0f, -10.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f);
+        AddVertex(vertices, 10.0f, -1.0f, 10.0f, 0.0f, 1.0f, 0.0f, 1.0f, 1.0f);
+        scene.meshes.push_back(CreateFloatMesh(vertices, { 0, 1, 2, 2, 1, 3 }, storage[1]));
+    }
+    {
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+        CreateSphere(32, 32, 1.0f, 0.0f, vertices, indices);
+        scene.meshes.push_back(CreateFloatMesh(vertices, indices, storage[2]));
+    }
+
+    //glTF materials first, then one material per object, the model is glass so that every material type is traced
+    cpuRayTracer::Material gltfMaterial;
+    gltfMaterial.diffuse = glm::vec4(0.8f, 0.55f, 0.3f, 1.0f);
+    gltfMaterial.materialType = cpuRayTracer::GLASS;
+    scene.materials.push_back(gltfMaterial);
+
+    cpuRayTracer::Material modelMaterial;
+    modelMaterial.materialType = cpuRayTracer::GLASS;
+    cpuRayTracer::Material ceilingMaterial;
+    ceilingMaterial.textureIndex = 0;
+    cpuRayTracer::Material sphereMaterial;
+    sphereMaterial.materialType = cpuRayTracer::METAL;
+    const uint32_t gltfMaterialCount = uint32_t(scene.materials.size());
+    scene.materials.push_back(modelMaterial);
+    scene.materials.push_back(ceilingMaterial);
+    scene.materials.push_back(sphereMaterial);
+
+    scene.instances.push_back({ 0, glm::translate(glm::mat4(1.0f), glm::vec3(-5.0f, 1.0f, 0.0f)), gltfMaterialCount + 0, false });
+    scene.instances.push_back({ 1, glm::mat4(1.0f), gltfMaterialCount + 1, true });
+    scene.instances.push_back({ 2, glm::translate(glm::mat4(1.0f), glm::vec3(5.0f, 0.0f, 0.0f)), gltfMaterialCount + 2, false });
+
+    scene.textures.push_back(CreateCheckerTexture(256));
+    CreateSky(128, scene.background);
+
+    //AppBase::Initialize and UpdateUniformBuffer, placed so that the objects are in view
+    Camera camera;
+    camera.type = Camera::CameraType::firstperson;
+    camera.setRotation(glm::vec3(0.0f, 0.0f, 0.0f));
+    camera.setPerspective(60.0f, float(width) / float(height), 0.1f, 512.0f);
+    camera.setTranslation(glm::vec3(0.0f, -1.0f, -12.0f));
+
+    cpuRayTracer::Uniforms uniforms;
+    uniforms.projInverse = glm::inverse(camera.matrix.perspective);
+    uniforms.viewInverse = glm::inverse(camera.matrix.view);
+    uniforms.cameraPosition = glm::vec4(camera.position, 1.0f);
+    uniforms.shaderFlags = pointLight ? 1 : 0;
+
+    cpuRayTracer::RenderSettings settings;
+    settings.width = width;
+    settings.height = height;
+
+    ThreadPool buildPool(maxThreadCount);
+    cpuRayTracer::Renderer renderer(scene, &buildPool);
+
+    std::cout << "image     : " << width << "x" << height << (pointLight ? ", point light" : ", directional light") << std::endl;
+    std::cout << "triangles : " << storage[0].indices.size() / (scene.meshes[0].geometries[0].shortIndices ? 6 : 12) << " (model)" << std::endl;
+    std::cout << "BVH build : " << renderer.GetBuildTime() << " ms" << std::endl;
+
+    //1, 2, 4, ... threads up to maxThreadCount, every run has to produce the same image
+    std::vector<uint32_t> threadCounts;
+    for (uint32_t count = 1; count < maxThreadCount; count *= 2) {
+        threadCounts.push_back(count);
+    }
+    threadCounts.push_back(maxThreadCount);
+
+    std::vector<uint8_t> reference;
+    double baseRaysPerSecond = 0.0;
+    bool identical = true;
+    for (uint32_t threadCount : threadCounts) {
+        ThreadPool threadPool(threadCount);
+        std::vector<uint8_t> pixels;
+        const cpuRayTracer::RenderStats stats = renderer.Render(uniforms, settings, pixels, &threadPool);
+        if (reference.empty()) {
+            reference = pixels;
+            baseRaysPerSecond = stats.GetRaysPerSecond();
+            std::cout << "rays      : " << stats.primaryRays << " primary, " << stats.secondaryRays << " secondary, " << stats.shadowRays << " shadow" << std::endl;
+        }
+        identical = identical && pixels == reference;
+
+        const double speedup = baseRaysPerSecond > 0.0 ? stats.GetRaysPerSecond() / baseRaysPerSecond : 0.0;
+        std::cout << "threads " << threadCount << " : " << stats.renderTime << " ms, " << stats.GetRaysPerSecond() / 1e6 << " Mrays/s"
+            << ", speedup " << speedup << ", efficiency " << speedup / threadCount
+            << ", " << stats.stolenTiles << "/" << stats.tileCount << " tiles stolen" << std::endl;
+    }
+
+    const bool written = cpuRayTracer::WriteBmp(output, width, height, reference.data());
+    std::cout << "identical : " << (identical ? "yes" : "no") << std::endl;
+    std::cout << "image     : " << (written ? output : "failed to write " + output) << std::endl;
+
+    return identical && written ? 0 : 1;
+}
\ No newline at end of file
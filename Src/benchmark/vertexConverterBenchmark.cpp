@@ -0,0 +1,221 @@
+/*
+* vertexConverterの変換速度と、meshOptimizerによるキャッシュ効率の変化を計測するベンチマーク
+*
+* Vulkan/GPUに依存しないので、以下のように単体でビルドして実行できる
+*   cl /O2 /EHsc /std:c++17 /I..\app vertexConverterBenchmark.cpp ..\app\vertexConverter.cpp ..\app\meshOptimizer.cpp
+*   g++ -O2 -std=c++17 -I../app vertexConverterBenchmark.cpp ../app/vertexConverter.cpp ../app/meshOptimizer.cpp
+*
+* 引数: [頂点数(既定 10000000)] [繰り返し回数(既定 5)]
+*/
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "vertexConverter.h"
+#include "meshOptimizer.h"
+
+namespace {
+
+    //same layout as glTF::Vertex
+    struct Vertex {
+        float pos[3];
+        float normal[3];
+        float uv[2];
+        float color[4];
+    };
+
+    //interleaved source: float position, short normalized normal, ushort normalized uv, ubyte normalized color
+    struct SourceVertex {
+        float pos[3];
+        int16_t normal[4];
+        uint16_t uv[2];
+        uint8_t color[4];
+    };
+
+    //one element per iteration, the way LoadNode used to do it
+    void ConvertReference(const std::vector<SourceVertex>& src, std::vector<Vertex>& dst) {
+        dst.clear();
+        for (const SourceVertex& s : src) {
+            Vertex v{};
+            for (int c = 0; c < 3; c++) {
+                v.pos[c] = s.pos[c];
+                v.normal[c] = std::max(s.normal[c] / 32767.0f, -1.0f);
+            }
+            float length = std::sqrt(v.normal[0] * v.normal[0] + v.normal[1] * v.normal[1] + v.normal[2] * v.normal[2]);
+            if (length > 0.0f) {
+                for (int c = 0; c < 3; c++) {
+                    v.normal[c] /= length;
+                }
+            }
+            for (int c = 0; c < 2; c++) {
+                v.uv[c] = s.uv[c] / 65535.0f;
+            }
+            for (int c = 0; c < 4; c++) {
+                v.color[c] = s.color[c] / 255.0f;
+            }
+            dst.push_back(v);
+        }
+    }
+
+    void ConvertBulk(const std::vector<SourceVertex>& src, std::vector<Vertex>& dst) {
+        dst.resize(src.size());
+        const unsigned char* base = reinterpret_cast<const unsigned char*>(src.data());
+
+        vertexConverter::AttributeBinding bindings[4];
+        for (vertexConverter::AttributeBinding& binding : bindings) {
+            binding.stream.byteStride = sizeof(SourceVertex);
+        }
+
+        bindings[0].stream.data = base + offsetof(SourceVertex, pos);
+        bindings[0].stream.componentType = vertexConverter::ComponentType::Float;
+        bindings[0].stream.componentCount = 3;
+        bindings[0].dstOffset = offsetof(Vertex, pos);
+        bindings[0].dstComponentCount = 3;
+
+        bindings[1].stream.data = base + offsetof(SourceVertex, normal);
+        bindings[1].stream.componentType = vertexConverter::ComponentType::Short;
+        bindings[1].stream.componentCount = 3;
+        bindings[1].stream.normalized = true;
+        bindings[1].dstOffset = offsetof(Vertex, normal);
+        bindings[1].dstComponentCount = 3;
+        bindings[1].normalizeVec3 = true;
+
+        bindings[2].stream.data = base + offsetof(SourceVertex, uv);
+        bindings[2].stream.componentType = vertexConverter::ComponentType::UnsignedShort;
+        bindings[2].stream.componentCount = 2;
+        bindings[2].stream.normalized = true;
+        bindings[2].dstOffset = offsetof(Vertex, uv);
+        bindings[2].dstComponentCount = 2;
+
+        bindings[3].stream.data = base + offsetof(SourceVertex, color);
+        bindings[3].stream.componentType = vertexConverter::ComponentType::UnsignedByte;
+        bindings[3].stream.componentCount = 4;
+        bindings[3].stream.normalized = true;
+        bindings[3].dstOffset = offsetof(Vertex, color);
+        bindings[3].dstComponentCount = 4;
+
+        vertexConverter::ConvertVertices(bindings, 4, src.size(), dst.data(), sizeof(Vertex));
+    }
+
+    //grid of unwelded quads in random triangle order, the worst case OptimizeMeshes sees in exported scenes
+    void BuildShuffledGrid(uint32_t gridSize, std::mt19937& random, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+        vertices.clear();
+        std::vector<uint32_t> quads;
+        for (uint32_t y = 0; y < gridSize; y++) {
+            for (uint32_t x = 0; x < gridSize; x++) {
+                const uint32_t corners[4][2] = { { x, y }, { x + 1, y }, { x, y + 1 }, { x + 1, y + 1 } };
+                const uint32_t first = static_cast<uint32_t>(vertices.size());
+                for (const auto& corner : corners) {
+                    Vertex v{};
+                    v.pos[0] = static_cast<float>(corner[0]);
+                    v.pos[1] = static_cast<float>(corner[1]);
+                    v.normal[2] = 1.0f;
+                    v.uv[0] = corner[0] / static_cast<float>(gridSize);
+                    v.uv[1] = corner[1] / static_cast<float>(gridSize);
+                    vertices.push_back(v);
+                }
+                quads.push_back(first);
+            }
+        }
+        std::shuffle(quads.begin(), quads.end(), random);
+        indices.clear();
+        for (uint32_t first : quads) {
+            const uint32_t quad[6] = { first, first + 1, first + 2, first + 2, first + 1, first + 3 };
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+
+    //same steps as glTF::Model::OptimizeMeshes for a single primitive
+    void OptimizeMesh(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices) {
+        std::vector<uint32_t> remap;
+        size_t uniqueCount = meshOptimizer::WeldVertices(vertices.data(), vertices.size(), sizeof(Vertex), remap);
+        std::vector<Vertex> welded(uniqueCount);
+        meshOptimizer::RemapVertices(welded.data(), vertices.data(), vertices.size(), sizeof(Vertex), remap);
+        meshOptimizer::RemapIndices(indices.data(), indices.size(), remap);
+
+        meshOptimizer::OptimizeTriangleOrder(indices.data(), indices.size(), uniqueCount);
+        size_t usedCount = meshOptimizer::BuildFetchRemap(indices.data(), indices.size(), uniqueCount, remap);
+        vertices.resize(usedCount);
+        meshOptimizer::RemapVertices(vertices.data(), welded.data(), uniqueCount, sizeof(Vertex), remap);
+        meshOptimizer::RemapIndices(indices.data(), indices.size(), remap);
+    }
+
+    template<class F>
+    double Measure(uint32_t repeat, F&& func) {
+        double best = 1e30;
+        for (uint32_t i = 0; i < repeat; i++) {
+            auto tStart = std::chrono::high_resolution_clock::now();
+            func();
+            auto tEnd = std::chrono::high_resolution_clock::now();
+            best = std::min(best, std::chrono::duration<double>(tEnd - tStart).count());
+        }
+        return best;
+    }
+}
+
+int main(int argc, char** argv) {
+
+    const size_t vertexCount = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+    const uint32_t repeat = argc > 2 ? static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10)) : 5;
+
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+    std::uniform_int_distribution<int> component(-32767, 32767);
+
+    std::vector<SourceVertex> source(vertexCount);
+    for (SourceVertex& v : source) {
+        for (int c = 0; c < 3; c++) {
+            v.pos[c] = position(random);
+            v.normal[c] = static_cast<int16_t>(component(random));
+        }
+        v.normal[3] = 0;
+        v.uv[0] = static_cast<uint16_t>(component(random) + 32767);
+        v.uv[1] = static_cast<uint16_t>(component(random) + 32767);
+        for (int c = 0; c < 4; c++) {
+            v.color[c] = static_cast<uint8_t>(component(random) & 0xff);
+        }
+    }
+
+    std::vector<Vertex> reference, bulk;
+    reference.reserve(vertexCount);
+    double referenceTime = Measure(repeat, [&]() { ConvertReference(source, reference); });
+    double bulkTime = Measure(repeat, [&]() { ConvertBulk(source, bulk); });
+
+    double maxError = 0.0;
+    for (size_t i = 0; i < vertexCount; i++) {
+        const float* a = reinterpret_cast<const float*>(&reference[i]);
+        const float* b = reinterpret_cast<const float*>(&bulk[i]);
+        for (size_t c = 0; c < sizeof(Vertex) / sizeof(float); c++) {
+            maxError = std::max(maxError, static_cast<double>(std::fabs(a[c] - b[c])));
+        }
+    }
+
+    std::cout << "vertices      : " << vertexCount << std::endl;
+    std::cout << "reference     : " << vertexCount / referenceTime / 1e6 << " Mvertices/s" << std::endl;
+    std::cout << "vertexConverter: " << vertexCount / bulkTime / 1e6 << " Mvertices/s" << std::endl;
+    std::cout << "max error     : " << maxError << std::endl;
+
+    std::vector<Vertex> meshVertices;
+    std::vector<uint32_t> meshIndices;
+    BuildShuffledGrid(512, random, meshVertices, meshIndices);
+    const size_t meshIndexCount = meshIndices.size();
+    const meshOptimizer::MeshStats before = meshOptimizer::AnalyzeMesh(meshIndices.data(), meshIndices.size(), meshVertices.size(), sizeof(Vertex));
+    auto tStart = std::chrono::high_resolution_clock::now();
+    OptimizeMesh(meshVertices, meshIndices);
+    auto tEnd = std::chrono::high_resolution_clock::now();
+    const meshOptimizer::MeshStats after = meshOptimizer::AnalyzeMesh(meshIndices.data(), meshIndices.size(), meshVertices.size(), sizeof(Vertex));
+
+    std::cout << "mesh optimization: " << meshIndexCount / 3 << " triangles in " << std::chrono::duration<double, std::milli>(tEnd - tStart).count() << "ms" << std::endl;
+    std::cout << "  vertices " << before.vertexCount << " -> " << after.vertexCount
+        << " (" << before.vertexBytes / 1024 << "KB -> " << after.vertexBytes / 1024 << "KB)" << std::endl;
+    std::cout << "  ACMR " << before.acmr << " -> " << after.acmr
+        << ", average fetch stride " << before.averageFetchStride << " -> " << after.averageFetchStride << " bytes" << std::endl;
+
+    return maxError < 1e-5 && meshIndices.size() == meshIndexCount ? 0 : 1;
+}
\ No newline at end of file
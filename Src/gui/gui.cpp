@@ -1,6 +1,6 @@
 #include "gui.h"
 
-void Gui::CreateImage(uint32_t width, uint32_t height, VkImage& image, VkDeviceMemory& imageMemory) {
+void Gui::CreateImage(uint32_t width, uint32_t height, vk::Image& image) {
     VkImageCreateInfo imageInfo{};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
     imageInfo.imageType = VK_IMAGE_TYPE_2D;
@@ -16,27 +16,15 @@ void Gui::CreateImage(uint32_t width, uint32_t height, VkImage& image, VkDeviceM
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-    if (vkCreateImage(_vulkanDevice->_device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
+    if (vkCreateImage(_vulkanDevice->_device, &imageInfo, nullptr, &image.image) != VK_SUCCESS) {
         throw std::runtime_error("failed to create image!");
     }
 
-    VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(_vulkanDevice->_device, image, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = _vulkanDevice->FindMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-    if (vkAllocateMemory(_vulkanDevice->_device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate image memory!");
-    }
-
-    vkBindImageMemory(_vulkanDevice->_device, image, imageMemory, 0);
+    _vulkanDevice->AllocateImageMemory(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vk::MemoryCategory::Texture);
 }
 
 void Gui::TransitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout) {
-    VkCommandBuffer commandBuffer = _vulkanDevice->BeginCommand();
+    VkCommandBuffer commandBuffer = _vulkanDevice->_uploadQueue.GetCommandBuffer();
 
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -79,15 +67,13 @@ void Gui::TransitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageL
         0, nullptr,
         1, &barrier
     );
-
-    _vulkanDevice->FlushCommandBuffer(commandBuffer, _queue);
 }
 
-void Gui::CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
-    VkCommandBuffer commandBuffer = _vulkanDevice->BeginCommand();
+void Gui::CopyBufferToImage(VkBuffer buffer, VkDeviceSize bufferOffset, VkImage image, uint32_t width, uint32_t height) {
+    VkCommandBuffer commandBuffer = _vulkanDevice->_uploadQueue.GetCommandBuffer();
 
     VkBufferImageCopy region{};
-    region.bufferOffset = 0;
+    region.bufferOffset = bufferOffset;
     region.bufferRowLength = 0;
     region.bufferImageHeight = 0;
     region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -101,9 +87,6 @@ void Gui::CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint
     };
 
     vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-
-    _vulkanDevice->FlushCommandBuffer(commandBuffer, _queue);
 }
 
 void Gui::PrepareImage() {
@@ -118,28 +101,21 @@ void Gui::PrepareImage() {
     io.Fonts->GetTexDataAsRGBA32(&fontData, &texWidth, &texHeight);
     VkDeviceSize uploadSize = texWidth * texHeight * 4 * sizeof(char);
 
-    vk::Buffer stagingBuffer = _vulkanDevice->CreateBuffer(
-        uploadSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
-    );
-
-    void* data;
-    vkMapMemory(_vulkanDevice->_device, stagingBuffer.memory, 0, uploadSize, 0, &data);
-    memcpy(data, fontData, uploadSize);
-    stagingBuffer.Flush(_vulkanDevice->_device, uploadSize);
-    vkUnmapMemory(_vulkanDevice->_device, stagingBuffer.memory);
+    StagingRing::Region staging = _vulkanDevice->_uploadQueue.Allocate(uploadSize);
+    memcpy(staging.data, fontData, uploadSize);
 
-    CreateImage(texWidth, texHeight, _fontImage.image, _fontImage.memory);
+    CreateImage(texWidth, texHeight, _fontImage);
 
+    //recorded into the upload batch
     TransitionImageLayout(_fontImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    CopyBufferToImage(stagingBuffer.buffer, _fontImage.image, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-    TransitionImageLayout(_fontImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    CopyBufferToImage(staging.buffer, staging.offset, _fontImage.image, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+    VkImageSubresourceRange range{};
+    range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    range.levelCount = 1;
+    range.layerCount = 1;
+    _vulkanDevice->_uploadQueue.ReleaseImage(_fontImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, range);
     
     io.Fonts->SetTexID((ImTextureID)(intptr_t)_fontImage.image);
-
-    vkDestroyBuffer(_vulkanDevice->_device, stagingBuffer.buffer, nullptr);
-    vkFreeMemory(_vulkanDevice->_device, stagingBuffer.memory, nullptr);
 }
 
 void Gui::CreateImageView() {
@@ -402,11 +378,12 @@ bool Gui::UpdateBuffers() {
         _vertexBuffer = _vulkanDevice->CreateBuffer(
             vertexBufferSize,
             VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+            vk::MemoryCategory::Other
         );
         _vertexBuffer.count = imDrawData->TotalVtxCount;
         
-        vkMapMemory(_vulkanDevice->_device, _vertexBuffer.memory, 0, vertexBufferSize, 0, &_vertexBuffer.mapped);
+        _vertexBuffer.mapped = _vertexBuffer.Map(_vulkanDevice->_device);
         IsUpdateCmdBuffers = true;
     }
 
@@ -416,11 +393,12 @@ bool Gui::UpdateBuffers() {
         _indexBuffer = _vulkanDevice->CreateBuffer(
             indexBufferSize,
             VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+            vk::MemoryCategory::Other
         );
         _indexBuffer.count= imDrawData->TotalIdxCount;
 
-        vkMapMemory(_vulkanDevice->_device, _indexBuffer.memory, 0, indexBufferSize, 0, &_indexBuffer.mapped);
+        _indexBuffer.mapped = _indexBuffer.Map(_vulkanDevice->_device);
         IsUpdateCmdBuffers = true;
     }
 
@@ -439,8 +417,8 @@ bool Gui::UpdateBuffers() {
     _vertexBuffer.Flush(_vulkanDevice->_device, VK_WHOLE_SIZE);
     _indexBuffer.Flush(_vulkanDevice->_device, VK_WHOLE_SIZE);
 
-    vkUnmapMemory(_vulkanDevice->_device, _vertexBuffer.memory);
-    vkUnmapMemory(_vulkanDevice->_device, _indexBuffer.memory);
+    _vertexBuffer.Unmap(_vulkanDevice->_device);
+    _indexBuffer.Unmap(_vulkanDevice->_device);
     return IsUpdateCmdBuffers;
 }
 
@@ -541,16 +519,10 @@ void Gui::Recreate() {
 
 void Gui::Destroy() {
     
-    vkDestroyBuffer(_vulkanDevice->_device, _vertexBuffer.buffer, nullptr);
-    vkFreeMemory(_vulkanDevice->_device, _vertexBuffer.memory, nullptr);
-
-    vkDestroyBuffer(_vulkanDevice->_device, _indexBuffer.buffer, nullptr);
-    vkFreeMemory(_vulkanDevice->_device, _indexBuffer.memory, nullptr);
+    _vertexBuffer.Destroy(_vulkanDevice->_device);
+    _indexBuffer.Destroy(_vulkanDevice->_device);
 
-    vkDestroySampler(_vulkanDevice->_device, _fontImage.sampler, nullptr);
-    vkDestroyImageView(_vulkanDevice->_device, _fontImage.view, nullptr);
-    vkDestroyImage(_vulkanDevice->_device, _fontImage.image, nullptr);
-    vkFreeMemory(_vulkanDevice->_device, _fontImage.memory, nullptr);
+    _fontImage.Destroy(_vulkanDevice->_device);
     
     vkDestroyDescriptorSetLayout(_vulkanDevice->_device, _descriptorSetLayout, nullptr);
     vkDestroyDescriptorPool(_vulkanDevice->_device, _descriptorPool, nullptr);
@@ -59,62 +59,62 @@ public:
 
 
     /**
-    * @brief    C[W쐬
+    * @brief    イメージを作成する
     */
-    void CreateImage(uint32_t width, uint32_t height, VkImage& image, VkDeviceMemory& imageMemory);
+    void CreateImage(uint32_t width, uint32_t height, vk::Image& image);
 
     /**
-    * @brief    C[WCAEg̎w
+    * @brief    イメージレイアウトの指定
     */
     void TransitionImageLayout(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout);
     
     /**
-    * @brief    obt@C[WɃRs[
+    * @brief    バッファをイメージにコピーする
     */
-    void CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
+    void CopyBufferToImage(VkBuffer buffer, VkDeviceSize bufferOffset, VkImage image, uint32_t width, uint32_t height);
 
     /**
-    * @brief    C[W̏
+    * @brief    イメージの準備
     */
     void PrepareImage();
 
     /**
-    * @brief    C[Wr[쐬
+    * @brief    イメージビューを作成する
     */
     void CreateImageView();
     
     /**
-    * @brief    Tv[쐬
+    * @brief    サンプラーを作成する
     */
     void CreateSampler();
 
     /**
-    * @brief    fBXNv^Zbg̍쐬
+    * @brief    ディスクリプタセットの作成
     */
     void CreateDescriptorSet();
 
     /**
-    * @brief    pCvC̍쐬
+    * @brief    パイプラインの作成
     */
     void CreateGraphicsPipeline(VkRenderPass& renderPass);
 
     /**
-    * @brief    UȈ
+    * @brief    UIの準備
     */
     void PrepareUI(VkInstance& instance, VkCommandPool& commandBuffers, VkRenderPass& renderPass);
 
     /**
-    * @brief    eobt@̍XV
+    * @brief    各バッファの更新
     */
     bool UpdateBuffers();
 
     /**
-    * @brief    UI̍XV
+    * @brief    UIの更新
     */
     void UpdateUI(float frameTimer, vk::MouseButtons mouseButtons, glm::vec2 mousePos);
 
     /**
-    * @brief    `
+    * @brief    描画
     */
     void DrawUI(VkCommandBuffer commandBuffer);
 
@@ -122,7 +122,7 @@ public:
     void Recreate();
 
     /**
-    * @brief    j
+    * @brief    破棄
     */
     void Destroy();
     void Connect(VulkanDevice* device, VkQueue& queue);